@@ -29,6 +29,16 @@
 
 #include "SKIRTypes.h"
 
+//
+// skir.work.info - named metadata describing work functions with one
+// input and one output stream, written by frontends that know more than
+// SKIRKernelInfo can find out from the code.  Each operand is
+//   !{ work, i32 pop, i32 peek, i32 push, i32 stateful }
+// A rate of -1 is dynamic and stateful is -1 if unknown.  The runtime
+// trusts it.
+//
+#define SKIR_WORK_INFO "skir.work.info"
+
 namespace llvm {
 
 class SKIRBuilder 
@@ -50,7 +60,7 @@ public:
 	SKIR_STATE
     };
 
-    Value *CreateStream(Module *mod);
+    Value *CreateStream(Module *mod, Value *elem_size);
 
     Value *CreateKernel(Module *mod, Value *work, Value *params);
     Value *CreateKernel(Module *mod, Value *init, Value *work, Value *params);
@@ -65,7 +75,21 @@ public:
 
     Value *CreatePeek(Module *mod, Value *stream, Value *elm_ptr, Value *offset);
 
+    // zero-copy access to n elements, see __SKIR_push_reserve
+    Value *CreatePushReserve(Module *mod, Value *stream, Value *n);
+    Value *CreatePushCommit(Module *mod, Value *stream, Value *n);
+    Value *CreatePopReserve(Module *mod, Value *stream, Value *n);
+    Value *CreatePopCommit(Module *mod, Value *stream, Value *n);
+
     Value *CreateMalloc(const Type *AllocTy, Value *ArraySize, const Twine &NameStr);
+
+    // add work to SKIR_WORK_INFO
+    void CreateWorkInfo(Module *mod, Function *work, int pop, int peek, int push,
+			int stateful);
+
+private:
+    Value *CreateZeroCopyOp(Module *mod, const char *name, const Type *retTy,
+			    Value *stream, Value *n);
 };
 
 }
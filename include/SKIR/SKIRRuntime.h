@@ -31,6 +31,7 @@
 #include <sstream>
 
 #include <llvm/Module.h>
+#include <llvm/LLVMContext.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/PassManager.h>
 #include <llvm/Target/TargetData.h>
@@ -43,6 +44,7 @@
 #if USE_TBB
 #include <tbb/atomic.h>
 #endif
+#include <tbb/tbb_thread.h>
 
 namespace llvm {
 
@@ -50,10 +52,51 @@ class SKIRRuntimeGraph;
 class SKIRRuntimeStream;
 class SKIRRuntimeKernel;
 class SKIRScheduler;
+class SKIREventQueue;
+
+//
+// SKIRRuntimeOptions - scheduler and graph options of one runtime instance
+//
+// The default constructor copies the command line options, so construct
+// it after cl::ParseCommandLineOptions.
+//
+struct SKIRRuntimeOptions {
+    bool force_single;		// -force-single
+    bool force_tpk;		// -force-tpk
+    bool enable_dp;		// -enable-dp
+    int dp_width;		// -dp-width
+    bool enable_opencl;		// -enable-opencl
+    int opencl_mult;		// -opencl-mult
+    bool enable_merge;		// -enable-merge
+    bool disable_koro_steal;	// -disable-coro-steal
+    int koro_threads;		// -koro-threads, 0 for the thread count
+    int tbb_retries;		// -tbb-retries, -1 picks from the thread count
+    bool tbb_monitor;		// -tbb-monitor
+    bool tbb_d4r;		// -tbb-d4r
+    bool steal_sched;		// -steal-sched
+    bool steal_affinity;	// -steal-affinity
+    bool numa;			// -numa
+    bool numa_producer;		// -numa-producer
+    bool priority_sched;	// -priority-sched
+    bool latency_mode;		// -latency-mode
+    int quantum_iters;		// -quantum-iters
+    int quantum_cycles;		// -quantum-cycles
+    int latency_depth;		// -latency-depth
+    bool kernel_modules;	// -kernel-modules
+
+    SKIRRuntimeOptions();
+};
  
 class SKIRRuntime {
 
 public:    
+    // create/destroy a started runtime instance.  Instances share nothing
+    // but the process: each has its own LLVM context, JIT, stream graph,
+    // schedulers (with their own worker threads) and control thread.
+    static SKIRRuntime *create(int nthreads,
+			       const SKIRRuntimeOptions &opts = SKIRRuntimeOptions());
+    static void destroy(SKIRRuntime *rt);
+
     // program entry point
     bool run(std::string InputFile, std::vector<std::string> InputArgv,
 	     std::string FakeArgv0, std::string EntryFunc,
@@ -70,18 +113,27 @@ public:
     void *handleKernelInst(void *work, void *args);
     void *handleKernelInst(Function *work, void *args);
     void handleCallInst(void *kernel, void *ins, void *outs);
-    void handleUncallInst(void *kernel);
+    // uncall and reconfigure are false if they refused
+    bool handleUncallInst(void *kernel);
     void handleWaitInst(void *kernel);
     void handleBecomeInst(void *kernel, void *ins, void *outs);
+    bool handleReconfigureInst(void *kernel, void *kernels);
     void *handleStreamInst(unsigned elem_size);
     void *handleArrayInst(void *begin, void *end, unsigned elem_size, unsigned stride);
 
     // event handlers
+    // onEvent runs a request on the calling thread, postEvent is safe to
+    // call from any number of threads: read-only requests and waits run in
+    // place, everything else is serialized through the runtime control thread
     bool onEvent(std::stringstream *event);
+    bool postEvent(std::stringstream *event);
+    void runEvents(void);
 
-    SKIRRuntime();
+    SKIRRuntime(const SKIRRuntimeOptions &opts = SKIRRuntimeOptions());
     ~SKIRRuntime();
 
+    const SKIRRuntimeOptions &getOptions() { return options; }
+
     void setVerbose(bool v);
     bool getVerbose(void) { return verbose; }
 
@@ -94,6 +146,9 @@ public:
  
     unsigned getNumThreads() { return num_threads; }
 
+    // bytes of machine code the JIT holds for F, or in all if F is 0
+    size_t getCodeSize(const Function *F=0);
+
     // skir program and kernel transformation passes
     static void runSKIRLoweringPasses(SKIRRuntime *p, Module *m);
     static void runSKIRCloneWorkPass(SKIRRuntimeKernel *k, Module *dstMod=0);
@@ -107,6 +162,11 @@ public:
     static void runSKIRBlockingOpsPass(SKIRRuntimeKernel *k);
     static void runSKIRStreamOptsPass(SKIRRuntimeKernel *k);
     static void runSKIRKoroPass(SKIRRuntimeKernel *k);
+    // true if k is a splitter or joiner and got a generated work function
+    static bool runSKIRSplitJoinPass(SKIRRuntimeKernel *k);
+    // compile a whole program ahead of time for the static runtime in
+    // lib/AOTRuntime, false if the program isn't a static graph
+    static bool runSKIRAOTPasses(Module *m, const char *entry="main");
 
     static void addSKIRAddReentriesPass(SKIRRuntimeKernel *k);
     static void addSKIROuterLoopPass(SKIRRuntimeKernel *k, const char *, const char *);
@@ -115,6 +175,7 @@ public:
     static void addSKIRKernelInfoPass(SKIRRuntimeKernel *K);
     static void addSKIRStreamsToArraysPass(SKIRRuntimeKernel *K);
     static void addLLVMOpts(SKIRRuntimeKernel *k);
+    static void addLLVMOpts(FunctionPassManager &PM);
     static void addSKIRBlockingOpsPass(SKIRRuntimeKernel *k);
     static void addSKIRStreamOptsPass(SKIRRuntimeKernel *k);
     static void addSKIRKoroPass(SKIRRuntimeKernel *k);
@@ -141,13 +202,20 @@ public:
     // add bitcode to host_mod
     void includeModule(Module *mod);
 
+    // addr_map under addr_lock, 0 if id is unknown
+    void *getAddr(unsigned int id);
+    void setAddr(unsigned int id, void *addr);
+
     // private data
     bool initialized;
 
-    unsigned next_stream_id;
-    unsigned next_kernel_id;
+    tbb::atomic<unsigned> next_stream_id;
+    tbb::atomic<unsigned> next_kernel_id;
+
+    SKIRRuntimeOptions options;
 
     // default architecture, code generator, module, and scheduler
+    LLVMContext *host_ctx;
     Module *host_mod;
     ExecutionEngine *host_cg;
     SKIRRuntimeGraph *host_sg;
@@ -155,12 +223,24 @@ public:
 
     int num_threads;
 
-    // map of generated code to llvm code
+    // map of generated code to llvm code, and machine code sizes, kept
+    // by the JIT listener under the JIT lock
     std::map<void*, Function*> fn_map;
+    std::map<const Function*, size_t> code_size;
+    size_t code_bytes;
 
     // map a id/hash to an address
     // used by event handler: void* addr == addr_map[unsigned int request_id]
+    // written by the control thread, read by waits on the clients' threads
     std::map<unsigned int, void*> addr_map;
+    sys::Mutex addr_lock;
+
+    // sizes of the state buffers registered by StateRequest and ShmRequest
+    std::map<void*, size_t> addr_size;
+
+    // graph-mutating events are queued for the control thread
+    SKIREventQueue *event_queue;
+    tbb::tbb_thread *event_thread;
 
     bool verbose;
 };
@@ -51,9 +51,28 @@ typedef struct {
 #define CACHE_LINE_SIZE 64
 #define NUM_STREAM_HEADERS 0
 #define STREAM_BUFFER_SIZE (1024*32)
+// address space reserved for a stream that may be grown to break an
+// artificial deadlock (-tbb-d4r), only touched pages are ever backed
+#define STREAM_MAX_BUFFER_SIZE (STREAM_BUFFER_SIZE*64)
+// fewest elements a ring buffer holds, for elements too large for the above
+#define STREAM_MIN_ELEMENTS 4
+
+// ring buffer size for elements of elem_size bytes, at most size unless
+// that's less than STREAM_MIN_ELEMENTS.  it holds whole elements only, so
+// no element wraps around the end, and with the buffer cache line aligned
+// every element stays aligned to the largest power of two dividing elem_size
+static inline size_t
+skir_stream_buffer_size(size_t elem_size, size_t size)
+{
+    size_t n = size / elem_size;
+    if (n < STREAM_MIN_ELEMENTS)
+	n = STREAM_MIN_ELEMENTS;
+    return n * elem_size;
+}
 
 // STREAM
-typedef struct {
+// (tagged, so passes can find the type by name, see SKIRStreamOpts)
+typedef struct skir_stream_t {
     // state
     unsigned id;
     unsigned elem_size;
@@ -72,20 +91,37 @@ typedef struct {
     void *dst;        // SKIRRuntimeKernel*
     void *rs;         // SKIRRuntimeStream*
 
-    char _pad0[CACHE_LINE_SIZE-5*sizeof(unsigned)-3*sizeof(int)-3*sizeof(void*)];
+    // ring buffer size in bytes, a whole number of elements.  the generic
+    // (_E_B_<0,0>) ops use this, the specialized ones assume
+    // STREAM_BUFFER_SIZE or have it folded in by SKIRStreamOpts
+    size_t size;
+
+    char _pad0[CACHE_LINE_SIZE-5*sizeof(unsigned)-3*sizeof(int)-3*sizeof(void*)-sizeof(size_t)];
 
     // cache line 1
     /*volatile*/ size_t head;
     char *outp;
     unsigned long long num_push;
     size_t next_tail;
-    char _pad1[CACHE_LINE_SIZE-3*sizeof(size_t)-sizeof(unsigned long long)];
+    // a push reservation that wraps is made here and copied into the
+    // ring buffer on commit.  push_reserved is the size of the one
+    // outstanding, wrapped or not.  neither reservation outlives the
+    // work call that made it
+    char *push_bounce;
+    size_t push_bounce_size;
+    size_t push_reserved;
+    char _pad1[CACHE_LINE_SIZE-5*sizeof(size_t)-sizeof(unsigned long long)-sizeof(char*)];
 
     // cache line 2
     /*volatile*/ size_t tail;
     char *inp;
     size_t next_head;
-    char _pad2[CACHE_LINE_SIZE-3*sizeof(size_t)];
+    // a pop reservation that wraps is copied here.  pop_reserved is
+    // the size of the one outstanding, wrapped or not
+    char *pop_bounce;
+    size_t pop_bounce_size;
+    size_t pop_reserved;
+    char _pad2[CACHE_LINE_SIZE-5*sizeof(size_t)-sizeof(char*)];
 
     // buffer
     //char *buf;
@@ -97,6 +133,25 @@ typedef struct {
 // ARRAY
 typedef skir_stream_t skir_array_stream_t;
 
+// SPLITTERS AND JOINERS
+// the state of a kernel whose work function is named SKIR_SPLITJOIN_WORK.
+// the runtime replaces the work function with one generated for the
+// weights, which moves blocks of elements between the ring buffers.
+#define SKIR_SPLITJOIN_WORK "__SKIR_splitjoin_work"
+
+enum {
+    SKIR_SPLIT_DUP,   // every input element to all outputs
+    SKIR_SPLIT_RR,    // weights[i] input elements to output i in turn
+    SKIR_JOIN_RR      // weights[i] elements from input i in turn
+};
+
+typedef struct {
+    int kind;
+    int n;            // number of outputs, or of inputs for joiners
+    int elem_size;    // of every stream
+    int weights[0];   // n of them, unused for SKIR_SPLIT_DUP
+} skir_splitjoin_t;
+
 #ifdef __cplusplus 
 }
 #endif
@@ -0,0 +1,251 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+//
+// Runtime for programs compiled ahead of time by skir-aot.
+//
+// There is no JIT and no stream graph here.  Every kernel called runs its
+// compiled work function on a thread of its own until it returns 1, the
+// stream ops in it block in place (see SKIRBlockingOpsPass).  Hierarchical
+// kernels run on the caller's thread and wait for the kernels they call.
+//
+
+#include <SKIR/SKIRStream.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <vector>
+
+typedef void *(*aot_work_t)(skir_rt_state_t *, void *, skir_stream_t **, skir_stream_t **);
+
+// written by SKIRRuntime::runSKIRAOTPasses, null terminated
+typedef struct {
+    void *work;
+    int is_hier;
+} aot_kernel_entry_t;
+
+extern "C" aot_kernel_entry_t __SKIRAOT_kernels[];
+
+struct aot_kernel {
+    aot_work_t work;
+    void *state;
+    bool is_hier;
+    skir_rt_state_t rt_state;
+
+    // copies, the program reuses its arrays between calls
+    std::vector<skir_stream_t*> ins;
+    std::vector<skir_stream_t*> outs;
+
+    pthread_t thread;
+    bool called;
+    bool joined;
+
+    std::vector<aot_kernel*> children;
+};
+
+static pthread_mutex_t aot_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned next_stream_id = 0;
+
+// the hierarchical kernel whose work function is running on this thread
+static __thread aot_kernel *hier_parent = 0;
+
+static void
+aot_error(const char *what)
+{
+    fprintf(stderr, "skir-aot runtime: %s\n", what);
+    abort();
+}
+
+static void
+copy_streams(void *streams, std::vector<skir_stream_t*> &v)
+{
+    skir_stream_t **s = (skir_stream_t **)streams;
+    v.clear();
+    for (int i = 0; s && s[i]; i++)
+	v.push_back(s[i]);
+    v.push_back(0);
+}
+
+static void *
+aot_run_kernel(void *arg)
+{
+    aot_kernel *k = (aot_kernel *)arg;
+
+    while (1) {
+	void *ret = k->work(&k->rt_state, k->state, &k->ins[0], &k->outs[0]);
+	k->rt_state.niter++;
+	if (ret == (void *)1)
+	    break;
+	// only reached by work functions that return early
+	if (ret)
+	    sched_yield();
+    }
+
+    for (unsigned i = 0; k->outs[i]; i++)
+	k->outs[i]->src_dead = 1;
+    for (unsigned i = 0; k->ins[i]; i++)
+	k->ins[i]->dst_dead = 1;
+
+    return 0;
+}
+
+extern "C" {
+
+void *
+__SKIRRT_kernel(void *me, void *work, void *args)
+{
+    aot_kernel_entry_t *e = __SKIRAOT_kernels;
+    while (e->work && e->work != work)
+	e++;
+    if (!e->work)
+	aot_error("kernel wasn't compiled ahead of time");
+
+    aot_kernel *k = new aot_kernel;
+    k->work = (aot_work_t)work;
+    k->state = args;
+    k->is_hier = e->is_hier;
+    memset(&k->rt_state, 0, sizeof(skir_rt_state_t));
+    k->called = false;
+    k->joined = false;
+    return k;
+}
+
+void
+__SKIRRT_call(void *me, void *kernel, void *in_streams, void *out_streams)
+{
+    aot_kernel *k = (aot_kernel *)kernel;
+
+    if (k->called)
+	aot_error("a kernel can only be called once");
+    k->called = true;
+
+    copy_streams(in_streams, k->ins);
+    copy_streams(out_streams, k->outs);
+
+    if (hier_parent) {
+	pthread_mutex_lock(&aot_lock);
+	hier_parent->children.push_back(k);
+	pthread_mutex_unlock(&aot_lock);
+    }
+
+    if (k->is_hier) {
+	// run the work function now
+	aot_kernel *pop = hier_parent;
+	hier_parent = k;
+	k->work(&k->rt_state, k->state, &k->ins[0], &k->outs[0]);
+	hier_parent = pop;
+	return;
+    }
+
+    for (unsigned i = 0; k->outs[i]; i++)
+	k->outs[i]->src = k;
+    for (unsigned i = 0; k->ins[i]; i++)
+	k->ins[i]->dst = k;
+
+    if (pthread_create(&k->thread, 0, aot_run_kernel, k))
+	aot_error("can't start a kernel thread");
+}
+
+void
+__SKIRRT_wait(void *me, void *kernel)
+{
+    aot_kernel *k = (aot_kernel *)kernel;
+
+    if (!k->called)
+	return;
+
+    if (k->is_hier) {
+	std::vector<aot_kernel*> children;
+	pthread_mutex_lock(&aot_lock);
+	children = k->children;
+	pthread_mutex_unlock(&aot_lock);
+	for (unsigned i = 0; i < children.size(); i++)
+	    __SKIRRT_wait(me, children[i]);
+    }
+    else {
+	pthread_mutex_lock(&aot_lock);
+	bool join = !k->joined;
+	k->joined = true;
+	pthread_mutex_unlock(&aot_lock);
+	if (join)
+	    pthread_join(k->thread, 0);
+    }
+}
+
+void *
+__SKIRRT_stream(void *me, unsigned int elem_size)
+{
+    size_t size = skir_stream_buffer_size(elem_size, STREAM_BUFFER_SIZE);
+
+    void *p;
+    if (posix_memalign(&p, CACHE_LINE_SIZE, sizeof(skir_stream_t) + size))
+	aot_error("can't allocate a stream");
+
+    skir_stream_t *s = (skir_stream_t *)p;
+    memset(s, 0, sizeof(skir_stream_t));
+
+    pthread_mutex_lock(&aot_lock);
+    s->id = ++next_stream_id;
+    pthread_mutex_unlock(&aot_lock);
+
+    s->elem_size = elem_size;
+    s->size = size;
+    s->src = s->dst = (void *)(-1);
+    s->outp = s->buf;
+    s->inp = s->buf;
+
+    return s;
+}
+
+// the graph is fixed when compiled ahead of time, runSKIRAOTPasses
+// refuses programs that call these; they stay for bitcode linked without it
+void
+__SKIRRT_become(void *me, void *k, void *ins, void *outs)
+{
+    aot_error("become isn't supported ahead of time");
+}
+
+void
+__SKIRRT_uncall(void *me, void *k)
+{
+    aot_error("uncall isn't supported ahead of time");
+}
+
+void
+__SKIRRT_reconfigure(void *me, void *k, void *kernels)
+{
+    aot_error("reconfigure isn't supported ahead of time");
+}
+
+// the non-blocking stream ops spin on this
+void
+__SKIRRT_would_block(void *, void *)
+{
+    sched_yield();
+}
+
+}
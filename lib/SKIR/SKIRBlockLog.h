@@ -0,0 +1,135 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#ifndef _SKIR_BLOCK_LOG_H_
+#define _SKIR_BLOCK_LOG_H_
+
+#include <tbb/atomic.h>
+#include <tbb/enumerable_thread_specific.h>
+
+//
+// SKIRBlockLog - per worker logs of blocking events
+//
+// A work call that returns a blocking kernel records (me, blocker) in the
+// log of the worker that ran it.  Each log is a single-producer/single-
+// consumer ring: the worker is the only producer and the monitor thread,
+// which runs D4R and the merge heuristics, the only consumer.  A push is a
+// few stores and never waits; when the ring is full the event is dropped.
+//
+namespace llvm {
+
+struct SKIRRuntimeKernel;
+
+#define BLOCK_LOG_SIZE    1024     // events per worker, a power of 2
+#define BLOCK_LOG_WORKERS 64
+
+struct block_event_t {
+    SKIRRuntimeKernel *me;
+    SKIRRuntimeKernel *blocker;
+    // me->total_niter when it blocked
+    unsigned long long niter;
+};
+
+struct block_log_t {
+    block_log_t() { head = 0; tail = 0; dropped = 0; }
+
+    // producer
+    void push(SKIRRuntimeKernel *me, SKIRRuntimeKernel *blocker, unsigned long long niter) {
+	unsigned h = head;
+	if (h - tail == BLOCK_LOG_SIZE) {
+	    dropped++;
+	    return;
+	}
+	block_event_t &e = ring[h & (BLOCK_LOG_SIZE-1)];
+	e.me = me;
+	e.blocker = blocker;
+	e.niter = niter;
+	// release, the event is written before head moves
+	head = h + 1;
+    }
+
+    // consumer
+    bool pop(block_event_t &e) {
+	unsigned t = tail;
+	if (t == head)
+	    return false;
+	e = ring[t & (BLOCK_LOG_SIZE-1)];
+	tail = t + 1;
+	return true;
+    }
+
+    tbb::atomic<unsigned> head;
+    char pad[64 - sizeof(unsigned)];
+    tbb::atomic<unsigned> tail;
+    tbb::atomic<unsigned long long> dropped;
+    block_event_t ring[BLOCK_LOG_SIZE];
+};
+
+class SKIRBlockLog {
+public:
+    SKIRBlockLog() : slot(-1) { nlogs = 0; overflow = 0; }
+
+    // the calling worker's log
+    void record(SKIRRuntimeKernel *me, SKIRRuntimeKernel *blocker, unsigned long long niter) {
+	int &i = slot.local();
+	if (i < 0)
+	    i = nlogs.fetch_and_increment();
+	if (i >= BLOCK_LOG_WORKERS) {
+	    overflow++;
+	    return;
+	}
+	logs[i].push(me, blocker, niter);
+    }
+
+    // monitor thread only, visits every pending event
+    template <class F> unsigned drain(F &f) {
+	unsigned n = 0;
+	int nl = nlogs;
+	if (nl > BLOCK_LOG_WORKERS) nl = BLOCK_LOG_WORKERS;
+	block_event_t e;
+	for (int i=0; i<nl; i++) {
+	    while (logs[i].pop(e)) {
+		f(e);
+		n++;
+	    }
+	}
+	return n;
+    }
+
+    unsigned long long dropped(void) {
+	unsigned long long d = overflow;
+	int nl = nlogs;
+	if (nl > BLOCK_LOG_WORKERS) nl = BLOCK_LOG_WORKERS;
+	for (int i=0; i<nl; i++)
+	    d += logs[i].dropped;
+	return d;
+    }
+
+private:
+    tbb::enumerable_thread_specific<int> slot;
+    tbb::atomic<int> nlogs;
+    tbb::atomic<unsigned long long> overflow;
+    block_log_t logs[BLOCK_LOG_WORKERS];
+};
+
+}
+#endif
@@ -23,6 +23,7 @@
 #include <SKIR/SKIRBuilder.h>
 
 #include <llvm/Module.h>
+#include <llvm/Metadata.h>
 #include <llvm/Support/IRBuilder.h>
 #include <llvm/Intrinsics.h>
 #include <llvm/Target/TargetData.h>
@@ -35,9 +36,9 @@
 using namespace llvm;
 
 Value *
-SKIRBuilder::CreateStream(Module *mod) {
+SKIRBuilder::CreateStream(Module *mod, Value *elem_size) {
     Value *int_skir_stream = Intrinsic::getDeclaration(mod, Intrinsic::skir_stream);
-    return CreateCall(int_skir_stream);
+    return CreateCall(int_skir_stream, elem_size);
 }
 
 Value *
@@ -105,6 +106,46 @@ SKIRBuilder::CreatePeek(Module *mod, Value *stream, Value *elm, Value *offset)
     return CreateCall3(int_skir_peek, stream, elm, offset);
 }
 
+// the zero-copy ops have no intrinsic, the runtime lowers these calls
+Value *
+SKIRBuilder::CreateZeroCopyOp(Module *mod, const char *name, const Type *retTy,
+			      Value *stream, Value *n)
+{
+    const Type *i32 = Type::getInt32Ty(mod->getContext());
+    Constant *F = mod->getOrInsertFunction(name, retTy, i32, i32, NULL);
+    if (n->getType() != i32)
+	n = CreateIntCast(n, i32, false);
+    return CreateCall2(F, stream, n);
+}
+
+Value *
+SKIRBuilder::CreatePushReserve(Module *mod, Value *stream, Value *n)
+{
+    return CreateZeroCopyOp(mod, "__SKIR_push_reserve", GetVoidPtrType(mod->getContext()),
+			    stream, n);
+}
+
+Value *
+SKIRBuilder::CreatePushCommit(Module *mod, Value *stream, Value *n)
+{
+    return CreateZeroCopyOp(mod, "__SKIR_push_commit", Type::getVoidTy(mod->getContext()),
+			    stream, n);
+}
+
+Value *
+SKIRBuilder::CreatePopReserve(Module *mod, Value *stream, Value *n)
+{
+    return CreateZeroCopyOp(mod, "__SKIR_pop_reserve", GetVoidPtrType(mod->getContext()),
+			    stream, n);
+}
+
+Value *
+SKIRBuilder::CreatePopCommit(Module *mod, Value *stream, Value *n)
+{
+    return CreateZeroCopyOp(mod, "__SKIR_pop_commit", Type::getVoidTy(mod->getContext()),
+			    stream, n);
+}
+
 Value *
 SKIRBuilder::CreateWait(Module *mod, Value *kernel)
 {
@@ -127,3 +168,20 @@ SKIRBuilder::CreateMalloc(const Type *allocTy, Value *arraySize, const Twine &na
     BB->getInstList().push_back(result);
     return result;
 }
+
+void
+SKIRBuilder::CreateWorkInfo(Module *mod, Function *work, int pop, int peek, int push,
+			    int stateful)
+{
+    LLVMContext &C = mod->getContext();
+    const Type *i32 = Type::getInt32Ty(C);
+
+    Value *info[5] = {
+	work,
+	ConstantInt::get(i32, pop, true),
+	ConstantInt::get(i32, peek, true),
+	ConstantInt::get(i32, push, true),
+	ConstantInt::get(i32, stateful, true)
+    };
+    mod->getOrInsertNamedMetadata(SKIR_WORK_INFO)->addOperand(MDNode::get(C, info, 5));
+}
@@ -0,0 +1,700 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <SKIR/SKIRRuntime.h>
+#include "SKIRRuntimeGraph.h"
+#include "SKIRTiming.h"
+
+#include <set>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace llvm;
+using namespace std;
+
+//
+// Checkpoint file layout
+//
+//   header
+//   record (kernel state or stream contents) followed by its data
+//   ...
+//
+// the readers of one ring buffer (see new_skir_stream_readers) share a
+// record: each reader's tail as an offset into the data, then the data
+// from the oldest tail to their common head.
+//
+// every stream record reserves the stream's current buffer (skir_stream_t::size)
+// so the layout only changes when the graph does or a stream grows.  that
+// lets a checkpoint reuse the mapping of the previous one and only dirty
+// the chunks that changed.
+//
+
+#define CKPT_MAGIC   "SKIRCKPT"
+#define CKPT_VERSION 2
+#define CKPT_CHUNK   ((size_t)4096)
+
+typedef struct {
+    char magic[8];
+    unsigned version;
+    unsigned nrecords;
+    unsigned long long seq;
+    size_t length;
+} skir_ckpt_header_t;
+
+enum { CKPT_KERNEL = 1, CKPT_STREAM = 2, CKPT_READERS = 3 };
+
+typedef struct {
+    unsigned type;
+    unsigned id;      // of the first reader for CKPT_READERS
+    unsigned elem_size;
+    unsigned count;   // readers in a CKPT_READERS record
+    size_t length;    // bytes of valid data
+    size_t reserved;  // bytes of data in the file
+} skir_ckpt_record_t;
+
+static size_t
+align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+// copy n bytes, skipping chunks that are already the same in dst.
+// returns the number of bytes written.
+static size_t
+copyChanged(char *dst, const char *src, size_t n)
+{
+    size_t dirty = 0;
+    for (size_t off = 0; off < n; off += CKPT_CHUNK) {
+	size_t len = std::min(CKPT_CHUNK, n - off);
+	if (memcmp(dst + off, src + off, len)) {
+	    memcpy(dst + off, src + off, len);
+	    dirty += len;
+	}
+    }
+    return dirty;
+}
+
+// copy n bytes of s's ring buffer from offset from on, unwrapped
+static size_t
+copyRing(char *dst, skir_stream_t *s, size_t from, size_t n)
+{
+    size_t n0 = std::min(n, s->size - from);
+    size_t dirty = copyChanged(dst, &s->buf[from], n0);
+    return dirty + copyChanged(dst + n0, &s->buf[0], n - n0);
+}
+
+// bytes in front of the data of a CKPT_READERS record
+static size_t
+readersOffsetSize(unsigned count)
+{
+    return align8(count * sizeof(size_t));
+}
+
+// set the ring of s to tail..head with no reservation outstanding, the
+// kernel that held one may have been rebuilt since
+static void
+resetRing(skir_stream_t *s, size_t tail, size_t head)
+{
+    s->tail = tail;
+    s->head = head;
+    s->next_tail = 0;
+    s->next_head = 0;
+    s->push_reserved = 0;
+    s->pop_reserved = 0;
+    free(s->push_bounce);
+    free(s->pop_bounce);
+    s->push_bounce = 0;
+    s->pop_bounce = 0;
+    s->push_bounce_size = 0;
+    s->pop_bounce_size = 0;
+}
+
+typedef std::vector<SKIRRuntimeStream*> reader_group_t;
+
+// streams in use by kernels in the graph, including streams internal to
+// fused kernels.  the outputs of a kernel that are readers of one ring
+// buffer go to groups instead
+static void
+collectStreams(std::vector<SKIRRuntimeKernel*> &kernels,
+	       std::vector<SKIRRuntimeStream*> &streams,
+	       std::vector<reader_group_t> &groups)
+{
+    std::set<SKIRRuntimeStream*> seen;
+    for (unsigned i=0; i<kernels.size(); i++) {
+	SKIRRuntimeKernel *k = kernels[i];
+	if (!k->rt_outs || k->nouts < 1 || !k->rt_outs[0]->map)
+	    continue;
+	reader_group_t g;
+	for (int j=0; j<k->nouts; j++)
+	    if (k->rt_outs[j]->si && seen.insert(k->rt_outs[j]).second)
+		g.push_back(k->rt_outs[j]);
+	if (!g.empty())
+	    groups.push_back(g);
+    }
+    for (unsigned i=0; i<kernels.size(); i++) {
+	SKIRRuntimeKernel *k = kernels[i];
+	for (int j=0; k->rt_ins && j<k->nins; j++)
+	    if (k->rt_ins[j]->si && seen.insert(k->rt_ins[j]).second)
+		streams.push_back(k->rt_ins[j]);
+	for (int j=0; k->rt_outs && j<k->nouts; j++)
+	    if (k->rt_outs[j]->si && seen.insert(k->rt_outs[j]).second)
+		streams.push_back(k->rt_outs[j]);
+	for (int j=0; k->rt_ints && j<k->nints; j++)
+	    if (k->rt_ints[j]->si && seen.insert(k->rt_ints[j]).second)
+		streams.push_back(k->rt_ints[j]);
+    }
+}
+
+// kernels that are scheduled (i.e. not hierarchical) 
+void
+SKIRRuntimeGraph::getScheduledKernels(std::vector<SKIRRuntimeKernel*> &kernels)
+{
+    MutexGuard locked(graph_lock);
+    std::map< unsigned, SKIRRuntimeKernel* >::iterator I,E;
+    for (I = id2kernel.begin(), E = id2kernel.end(); I!=E; ++I) {
+	SKIRRuntimeKernel *k = (*I).second;
+	if (k && !k->is_hier && k->sched)
+	    kernels.push_back(k);
+    }
+}
+
+// a fused kernel's state is its parts' states and how far they are into
+// their iterations (see SKIRFusion), which no state record holds
+static SKIRRuntimeKernel *
+findFusedKernel(std::vector<SKIRRuntimeKernel*> &kernels)
+{
+    for (unsigned i=0; i<kernels.size(); i++)
+	if (kernels[i]->nints > 0)
+	    return kernels[i];
+    return 0;
+}
+
+// the records of a checkpoint of length bytes, false if one of them
+// isn't within it
+static bool
+readRecords(skir_ckpt_header_t *h, size_t length,
+	    std::vector<skir_ckpt_record_t*> &records)
+{
+    char *p = (char *)h + sizeof(skir_ckpt_header_t);
+    char *end = (char *)h + length;
+    for (unsigned i=0; i<h->nrecords; i++) {
+	if ((size_t)(end - p) < sizeof(skir_ckpt_record_t))
+	    return false;
+	skir_ckpt_record_t *r = (skir_ckpt_record_t *)p;
+	p += sizeof(skir_ckpt_record_t);
+	if (r->type != CKPT_KERNEL && r->type != CKPT_STREAM && r->type != CKPT_READERS)
+	    return false;
+	size_t data = r->length;
+	if (r->type == CKPT_READERS) {
+	    if (r->count < 1 || r->count > r->reserved / sizeof(size_t))
+		return false;
+	    data += readersOffsetSize(r->count);
+	}
+	if (r->reserved > (size_t)(end - p) || r->length > r->reserved ||
+	    data > r->reserved)
+	    return false;
+	records.push_back(r);
+	p += r->reserved;
+    }
+    return p == end;
+}
+
+// pause every kernel.  each pause returns at the end of the kernel's
+// current work call, so once all return no kernel or stream is changing.
+static void
+quiesce(std::vector<SKIRRuntimeKernel*> &kernels)
+{
+    for (unsigned i=0; i<kernels.size(); i++)
+	kernels[i]->sched->pauseKernel(kernels[i]);
+}
+
+static void
+resume(std::vector<SKIRRuntimeKernel*> &kernels)
+{
+    for (unsigned i=0; i<kernels.size(); i++)
+	kernels[i]->sched->unPauseKernel(kernels[i]);
+}
+
+// a stream record (one stream) or readers record (a reader group) of a
+// checkpoint, with the kernels at its ends
+struct ckpt_streams_t {
+    unsigned type;
+    reader_group_t streams;
+    int producer;                // index into the kernels, -1 if none
+    std::vector<int> consumers;
+    size_t offset;               // of its record in the file
+    size_t size;                 // of the ring buffer it was laid out for
+    bool saved;
+};
+
+// the records of the streams and reader groups, and who is at their ends
+static void
+collectEnds(std::vector<SKIRRuntimeKernel*> &kernels,
+	    std::vector<SKIRRuntimeStream*> &streams,
+	    std::vector<reader_group_t> &groups,
+	    std::vector<ckpt_streams_t> &records)
+{
+    std::map<SKIRRuntimeStream*, unsigned> rec;
+    for (unsigned i=0; i<streams.size() + groups.size(); i++) {
+	ckpt_streams_t r;
+	if (i < streams.size()) {
+	    r.type = CKPT_STREAM;
+	    r.streams.push_back(streams[i]);
+	} else {
+	    r.type = CKPT_READERS;
+	    r.streams = groups[i - streams.size()];
+	}
+	r.producer = -1;
+	r.offset = 0;
+	r.size = r.streams[0]->si->size;
+	r.saved = false;
+	for (unsigned j=0; j<r.streams.size(); j++)
+	    rec[r.streams[j]] = records.size();
+	records.push_back(r);
+    }
+
+    for (unsigned i=0; i<kernels.size(); i++) {
+	SKIRRuntimeKernel *k = kernels[i];
+	for (int j=0; k->rt_outs && j<k->nouts; j++)
+	    if (rec.count(k->rt_outs[j]))
+		records[rec[k->rt_outs[j]]].producer = i;
+	for (int j=0; k->rt_ins && j<k->nins; j++)
+	    if (rec.count(k->rt_ins[j])) {
+		std::vector<int> &c = records[rec[k->rt_ins[j]]].consumers;
+		if (std::find(c.begin(), c.end(), (int)i) == c.end())
+		    c.push_back(i);
+	    }
+    }
+}
+
+// kernel i after every kernel downstream of it, a consumer before its
+// producers as far as the graph has no cycles
+static void
+consumersFirst(unsigned i, std::vector<std::vector<int> > &downstream,
+	       std::vector<bool> &seen, std::vector<int> &order)
+{
+    seen[i] = true;
+    for (unsigned j=0; j<downstream[i].size(); j++)
+	if (!seen[downstream[i][j]])
+	    consumersFirst(downstream[i][j], downstream, seen, order);
+    order.push_back(i);
+}
+
+// copy the live data of a stream into its record, unwrapped so the data
+// starts at offset 0
+static size_t
+saveStream(skir_ckpt_record_t *r, SKIRRuntimeStream *rs)
+{
+    skir_stream_t *s = rs->si;
+    assert(!s->push_reserved && !s->pop_reserved && "reservation outlived its work call");
+    size_t head = s->head;
+    size_t tail = s->tail;
+    size_t size = s->size;
+    size_t n = (head + size - tail) % size;
+
+    r->type = CKPT_STREAM;
+    r->id = rs->id;
+    r->elem_size = s->elem_size;
+    r->count = 0;
+    r->length = n;
+    r->reserved = align8(size);
+    return copyRing((char *)(r + 1), s, tail, n);
+}
+
+// the readers' tails as offsets, then the data from the oldest tail to
+// the head
+static size_t
+saveReaders(skir_ckpt_record_t *r, reader_group_t &g)
+{
+    // the writer moves every head at once, so one head for all
+    skir_stream_t *s0 = g[0]->si;
+    size_t head = s0->head;
+    size_t size = s0->size;
+    size_t n = 0;
+    size_t dirty = 0;
+    for (unsigned j=0; j<g.size(); j++) {
+	assert(!g[j]->si->push_reserved && !g[j]->si->pop_reserved &&
+	       "reservation outlived its work call");
+	n = std::max(n, (head + size - g[j]->si->tail) % size);
+    }
+
+    r->type = CKPT_READERS;
+    r->id = g[0]->id;
+    r->elem_size = s0->elem_size;
+    r->count = g.size();
+    r->length = n;
+    r->reserved = readersOffsetSize(g.size()) + align8(size);
+
+    char *p = (char *)(r + 1);
+    size_t *offsets = (size_t *)p;
+    for (unsigned j=0; j<g.size(); j++) {
+	size_t off = n - (head + size - g[j]->si->tail) % size;
+	if (offsets[j] != off) {
+	    offsets[j] = off;
+	    dirty += sizeof(size_t);
+	}
+    }
+    return dirty + copyRing(p + readersOffsetSize(g.size()), s0, (head + size - n) % size, n);
+}
+
+// times the layout may be redone because a stream grew meanwhile
+#define CKPT_TRIES 3
+
+//
+// SKIRRuntimeGraph::checkpoint - write kernel state and stream contents to file.
+//  the graph is never paused as a whole.  kernels are paused one at a
+//  time, consumers before producers: a kernel's state is copied while it
+//  is paused, a stream once its producer and its consumers are paused and
+//  copied, and a kernel resumes once all its streams are copied.  so in a
+//  pipeline at most a kernel and its consumer are paused at once, for as
+//  long as it takes to copy their state and the streams between them.
+//  a cycle in the graph keeps its kernels paused until the whole cycle is
+//  copied.  the mapping is flushed after the kernels are resumed.
+//  kernels without a known state size are skipped, graphs with fused
+//  kernels can't be checkpointed.
+bool
+SKIRRuntimeGraph::checkpoint(const char *file)
+{
+    std::vector<SKIRRuntimeKernel*> kernels;
+    std::vector<SKIRRuntimeStream*> streams;
+    std::vector<reader_group_t> groups;
+    getScheduledKernels(kernels);
+    collectStreams(kernels, streams, groups);
+
+    if (SKIRRuntimeKernel *k = findFusedKernel(kernels)) {
+	errs() << "checkpoint: can't save the state of fused kernel " 
+	       << k->work->getName() << "\n";
+	return false;
+    }
+
+    std::vector<ckpt_streams_t> records;
+    collectEnds(kernels, streams, groups, records);
+
+    // which kernels each kernel feeds, and which records touch it
+    unsigned nk = kernels.size();
+    std::vector<std::vector<int> > downstream(nk), touching(nk);
+    for (unsigned i=0; i<records.size(); i++) {
+	ckpt_streams_t &r = records[i];
+	if (r.producer >= 0) {
+	    touching[r.producer].push_back(i);
+	    for (unsigned j=0; j<r.consumers.size(); j++)
+		downstream[r.producer].push_back(r.consumers[j]);
+	}
+	for (unsigned j=0; j<r.consumers.size(); j++)
+	    touching[r.consumers[j]].push_back(i);
+    }
+    std::vector<int> order;
+    std::vector<bool> seen(nk, false);
+    for (unsigned i=0; i<nk; i++)
+	if (!seen[i])
+	    consumersFirst(i, downstream, seen, order);
+
+    size_t dirty = 0;
+    size_t length = 0;
+    unsigned nrecords = 0;
+    unsigned long long longest = 0;
+    bool grown = true;
+
+    for (int tries = 0; grown; tries++) {
+	if (tries == CKPT_TRIES) {
+	    errs() << "checkpoint: streams keep growing, giving up\n";
+	    return false;
+	}
+	grown = false;
+	dirty = 0;
+
+	// compute the layout from the current buffer sizes, a stream that
+	// grows before it is copied makes us start over
+	nrecords = 0;
+	length = sizeof(skir_ckpt_header_t);
+	std::vector<size_t> state_offset(nk, 0);
+	for (unsigned i=0; i<nk; i++) {
+	    SKIRRuntimeKernel *k = kernels[i];
+	    if (!k->state || !k->state_size) {
+		if (verbose && k->state)
+		    errs() << "checkpoint: state size of " << k->work->getName() 
+			   << " unknown, skipping\n";
+		continue;
+	    }
+	    state_offset[i] = length;
+	    length += sizeof(skir_ckpt_record_t) + align8(k->state_size);
+	    nrecords++;
+	}
+	for (unsigned i=0; i<records.size(); i++) {
+	    ckpt_streams_t &r = records[i];
+	    r.size = r.streams[0]->si->size;
+	    r.saved = false;
+	    r.offset = length;
+	    length += sizeof(skir_ckpt_record_t) + align8(r.size);
+	    if (r.type == CKPT_READERS)
+		length += readersOffsetSize(r.streams.size());
+	    nrecords++;
+	}
+
+	// map the file, reuse the last mapping if nothing moved
+	if (!ckpt_map || ckpt_len != length || ckpt_file.compare(file)) {
+	    if (ckpt_map) munmap(ckpt_map, ckpt_len);
+	    ckpt_map = 0;
+
+	    int fd = open(file, O_CREAT | O_RDWR, S_IREAD | S_IWRITE);
+	    if (fd < 0 || ftruncate(fd, length) != 0) {
+		errs() << "checkpoint: can't open '" << file << "': " << strerror(errno) << "\n";
+		if (fd >= 0) close(fd);
+		return false;
+	    }
+	    void *p = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	    close(fd);
+	    if (p == MAP_FAILED) {
+		errs() << "checkpoint: can't map '" << file << "': " << strerror(errno) << "\n";
+		return false;
+	    }
+	    ckpt_map = p;
+	    ckpt_len = length;
+	    ckpt_file = file;
+	}
+	char *map = (char *)ckpt_map;
+
+	std::vector<bool> copied(nk, false), running(nk, true);
+	std::vector<unsigned long long> paused_at(nk, 0);
+
+	for (unsigned o=0; o<order.size(); o++) {
+	    int i = order[o];
+	    SKIRRuntimeKernel *k = kernels[i];
+	    k->sched->pauseKernel(k);
+	    running[i] = false;
+	    rdtscll(paused_at[i]);
+
+	    if (k->state && k->state_size) {
+		skir_ckpt_record_t *r = (skir_ckpt_record_t *)(map + state_offset[i]);
+		r->type = CKPT_KERNEL;
+		r->id = k->id;
+		r->elem_size = 0;
+		r->count = 0;
+		r->length = k->state_size;
+		r->reserved = align8(k->state_size);
+		dirty += copyChanged((char *)(r + 1), (char *)k->state, k->state_size);
+	    }
+	    copied[i] = true;
+
+	    // the streams whose ends are all copied and still paused
+	    for (unsigned j=0; j<touching[i].size(); j++) {
+		ckpt_streams_t &r = records[touching[i][j]];
+		if (r.saved || (r.producer >= 0 && !copied[r.producer]))
+		    continue;
+		bool ready = true;
+		for (unsigned c=0; ready && c<r.consumers.size(); c++)
+		    ready = copied[r.consumers[c]];
+		if (!ready)
+		    continue;
+
+		skir_ckpt_record_t *rec = (skir_ckpt_record_t *)(map + r.offset);
+		if (r.streams[0]->si->size != r.size)
+		    grown = true;
+		else if (r.type == CKPT_STREAM)
+		    dirty += saveStream(rec, r.streams[0]);
+		else
+		    dirty += saveReaders(rec, r.streams);
+		r.saved = true;
+	    }
+
+	    // resume the kernels whose streams are all copied
+	    for (unsigned j=0; j<=o; j++) {
+		int m = order[j];
+		if (running[m])
+		    continue;
+		bool done = true;
+		for (unsigned t=0; done && t<touching[m].size(); t++)
+		    done = records[touching[m][t]].saved;
+		if (!done)
+		    continue;
+		kernels[m]->sched->unPauseKernel(kernels[m]);
+		running[m] = true;
+		unsigned long long now;
+		rdtscll(now);
+		longest = std::max(longest, now - paused_at[m]);
+	    }
+	}
+
+	// every record has both ends copied by now, so all are resumed
+	for (unsigned i=0; i<nk; i++)
+	    assert(running[i] && "checkpoint: kernel left paused");
+
+	if (grown && verbose)
+	    errs() << "checkpoint: a stream grew while it was saved, starting over\n";
+    }
+
+    skir_ckpt_header_t *h = (skir_ckpt_header_t *)ckpt_map;
+    memcpy(h->magic, CKPT_MAGIC, sizeof(h->magic));
+    h->version = CKPT_VERSION;
+    h->nrecords = nrecords;
+    h->length = length;
+    h->seq = ++ckpt_seq;
+
+    msync(ckpt_map, ckpt_len, MS_SYNC);
+
+    if (verbose)
+	errs() << "checkpoint: " << file << " #" << ckpt_seq << " "
+	       << nrecords << " records, " << dirty << "/" << length 
+	       << " bytes changed, longest pause " << longest << " cycles\n";
+
+    return true;
+}
+
+// grow the buffer of rs until length bytes fit, as far as max_size allows.
+// the buffer of a reader group is never grown, see new_skir_stream_readers
+static bool
+growToFit(SKIRRuntimeStream *rs, size_t length)
+{
+    if (!rs || !rs->si)
+	return false;
+    size_t size = rs->si->size;
+    while (size <= length && size * 2 <= rs->max_size)
+	size *= 2;
+    if (size != rs->si->size)
+	skir_stream_grow(rs, size);
+    return length < rs->si->size;
+}
+
+//
+// SKIRRuntimeGraph::restore - load kernel state and stream contents from
+//  a checkpoint.  the graph must have been rebuilt the same way as the one
+//  that was checkpointed, records are matched to kernels and streams by id.
+bool
+SKIRRuntimeGraph::restore(const char *file)
+{
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+	errs() << "restore: can't open '" << file << "': " << strerror(errno) << "\n";
+	if (fd >= 0) close(fd);
+	return false;
+    }
+    size_t length = st.st_size;
+    void *map = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	errs() << "restore: can't map '" << file << "': " << strerror(errno) << "\n";
+	return false;
+    }
+
+    skir_ckpt_header_t *h = (skir_ckpt_header_t *)map;
+    if (length < sizeof(skir_ckpt_header_t) || memcmp(h->magic, CKPT_MAGIC, sizeof(h->magic)) ||
+	h->version != CKPT_VERSION || h->length != length) {
+	errs() << "restore: '" << file << "' is not a checkpoint\n";
+	munmap(map, length);
+	return false;
+    }
+
+    // check every record before anything is overwritten
+    std::vector<skir_ckpt_record_t*> records;
+    if (!readRecords(h, length, records)) {
+	errs() << "restore: '" << file << "' is corrupt\n";
+	munmap(map, length);
+	return false;
+    }
+
+    std::vector<SKIRRuntimeKernel*> kernels;
+    std::vector<SKIRRuntimeStream*> streams;
+    std::vector<reader_group_t> groups;
+    getScheduledKernels(kernels);
+    collectStreams(kernels, streams, groups);
+
+    if (SKIRRuntimeKernel *k = findFusedKernel(kernels)) {
+	errs() << "restore: can't restore the state of fused kernel " 
+	       << k->work->getName() << "\n";
+	munmap(map, length);
+	return false;
+    }
+
+    std::map<unsigned, SKIRRuntimeStream*> id2stream;
+    for (unsigned i=0; i<streams.size(); i++)
+	id2stream[streams[i]->id] = streams[i];
+    std::map<unsigned, reader_group_t*> id2group;
+    for (unsigned i=0; i<groups.size(); i++)
+	id2group[groups[i][0]->id] = &groups[i];
+
+    bool ok = true;
+
+    quiesce(kernels);
+
+    for (unsigned i=0; i<records.size(); i++) {
+	skir_ckpt_record_t *r = records[i];
+	char *p = (char *)(r + 1);
+
+	if (r->type == CKPT_KERNEL) {
+	    SKIRRuntimeKernel *k = id2kernel.count(r->id) ? id2kernel[r->id] : 0;
+	    if (k && k->state && k->state_size == r->length)
+		memcpy(k->state, p, r->length);
+	    else {
+		errs() << "restore: no kernel matching state record " << r->id << "\n";
+		ok = false;
+	    }
+	}
+	else if (r->type == CKPT_STREAM) {
+	    SKIRRuntimeStream *rs = id2stream.count(r->id) ? id2stream[r->id] : 0;
+	    // a stream grown before the checkpoint is grown again
+	    if (rs && growToFit(rs, r->length) && rs->si->elem_size == r->elem_size) {
+		skir_stream_t *s = rs->si;
+		memcpy(&s->buf[0], p, r->length);
+		resetRing(s, 0, r->length);
+	    } else {
+		errs() << "restore: no stream matching record " << r->id << "\n";
+		ok = false;
+	    }
+	}
+	else if (r->type == CKPT_READERS) {
+	    reader_group_t *g = id2group.count(r->id) ? id2group[r->id] : 0;
+	    size_t *offsets = (size_t *)p;
+	    bool match = g && g->size() == r->count;
+	    for (unsigned j=0; match && j<g->size(); j++) {
+		skir_stream_t *s = (*g)[j]->si;
+		match = growToFit((*g)[j], r->length) && s->elem_size == r->elem_size &&
+		    offsets[j] <= r->length;
+	    }
+	    if (match) {
+		// one buffer, one head; only the tails are per reader
+		memcpy(&(*g)[0]->si->buf[0], p + readersOffsetSize(r->count), r->length);
+		for (unsigned j=0; j<g->size(); j++)
+		    resetRing((*g)[j]->si, offsets[j], r->length);
+	    } else {
+		errs() << "restore: no reader group matching record " << r->id << "\n";
+		ok = false;
+	    }
+	}
+    }
+
+    resume(kernels);
+
+    if (verbose)
+	errs() << "restore: " << file << " #" << h->seq << " " << h->nrecords << " records\n";
+
+    munmap(map, length);
+
+    return ok;
+}
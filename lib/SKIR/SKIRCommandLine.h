@@ -26,12 +26,42 @@
 ///
 /// SKIR global command line options
 ///
+/// These are only the process wide defaults, a runtime instance copies
+/// them into its SKIRRuntimeOptions when it is created.
+///
 
 namespace llvm {
 
 extern bool DisableKoroSteal;
+extern int KoroThreads;
 extern bool EnableMergeSched;
 
+extern bool EnableOpenCLSched;
+extern int OpenCLMultiplier;
+extern bool ForceSingleSched;
+extern bool ForceTPK;
+extern bool EnableDPSched;
+extern int DPWidth;
+
+extern int TbbRetries;
+extern bool TbbMonitor;
+extern bool EnableD4R;
+
+extern bool EnableStealSched;
+extern bool EnableStealAffinity;
+
+extern bool EnableNuma;
+extern bool NumaProducer;
+
+extern bool EnablePrioritySched;
+
+extern bool LatencyMode;
+extern int QuantumIters;
+extern int QuantumCycles;
+extern int LatencyDepth;
+
+extern bool KernelModules;
+
 }
 
 #endif
@@ -45,7 +45,7 @@ SKIRDPSched::runCodeGen(SKIRRuntimeKernel *rtk)
     rtk->fpm->add(new TargetData(rtk->work->getParent()));
 
     SKIRRuntime::addSKIRInlineStreamsPass(rtk);
-    SKIRRuntime::addLLVMOpts(rtk);
+    sg->addFinalOpts(rtk);
 
     sg->codeGenKernel(rtk);
     assert(rtk->workfn);
@@ -87,17 +87,15 @@ SKIRDPSched::callKernel(SKIRRuntimeKernel *rtk)
 	    return;
 	}
 
-	assert(rtk->is_fixed_rate && !rtk->is_stateful && !rtk->has_peek);
+	assert(rtk->is_fixed_rate && !rtk->is_stateful && !rtk->has_peek && !rtk->no_dp);
 
 	my_kernel = rtk;
 
 	// XXX - remove after fixing below and the inline bc
 	assert((rtk->nins == 1) && (rtk->nouts == 1));
 	
-	extern int DPWidth;
-	extern bool EnableOpenCLSched;
-	extern int OpenCLMultiplier;
-	width = DPWidth;
+	const SKIRRuntimeOptions &opts = sg->getRuntime().getOptions();
+	width = opts.dp_width;
 
 	// create split
 	// 
@@ -109,8 +107,8 @@ SKIRDPSched::callKernel(SKIRRuntimeKernel *rtk)
 	int pop_rate = 0;
 	for (int i=0; i<width; i++) {
 	    state->rate[i] = rtk->rt_ins[0]->getPopRate();
-	    if (i==0 && EnableOpenCLSched) {
-		state->rate[0] *= OpenCLMultiplier;
+	    if (i==0 && opts.enable_opencl) {
+		state->rate[0] *= opts.opencl_mult;
 	    }
 	    pop_rate += state->rate[i];
 	}
@@ -148,8 +146,8 @@ SKIRDPSched::callKernel(SKIRRuntimeKernel *rtk)
 	state->rate = new int[width];
 	for (int i=0; i<width; i++)
 	    state->rate[i] = rtk->rt_outs[0]->getPushRate();
-	if (EnableOpenCLSched) {
-	    state->rate[0] *= OpenCLMultiplier;
+	if (opts.enable_opencl) {
+	    state->rate[0] *= opts.opencl_mult;
 	}
 	state->niter = 1;
 	state->num_streams = width;
@@ -189,8 +187,7 @@ SKIRDPSched::callKernel(SKIRRuntimeKernel *rtk)
 	    SKIRRuntimeKernel *k = (SKIRRuntimeKernel*)
 		sg->getRuntime().handleKernelInst(rtk->base_work, rtk->state);
 
-	    extern bool EnableOpenCLSched;
-	    if (strm == 0 && EnableOpenCLSched) {
+	    if (strm == 0 && opts.enable_opencl) {
 		sg->selectScheduler(k, sg->getOpenCLSched());
 		sg->getOpenCLSched()->start();
 	    }
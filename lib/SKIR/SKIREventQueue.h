@@ -0,0 +1,121 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#ifndef _SKIR_EVENT_QUEUE_H_
+#define _SKIR_EVENT_QUEUE_H_
+
+#include <sstream>
+#include <semaphore.h>
+#include <tbb/atomic.h>
+#include <tbb/tbb_thread.h>
+
+//
+// SKIREventQueue - multi-producer/single-consumer queue of runtime events
+//
+// Event server sessions push graph-mutating requests here and block on the
+// event's done semaphore.  The runtime control thread is the only consumer.
+// push() is a single atomic exchange; pop() only spins while a producer is
+// between the exchange and linking its node.
+//
+namespace llvm {
+
+struct skir_event_t {
+    std::stringstream *event;
+    tbb::atomic<skir_event_t*> next;
+    sem_t done;
+    bool die;
+
+    skir_event_t(std::stringstream *e) : event(e), die(false) {
+	next = NULL;
+	sem_init(&done, 0, 0);
+    }
+    ~skir_event_t() { sem_destroy(&done); }
+};
+
+class SKIREventQueue {
+public:
+    SKIREventQueue() : stub(NULL) {
+	head = &stub;
+	tail = &stub;
+	sem_init(&avail, 0, 0);
+    }
+    ~SKIREventQueue() { sem_destroy(&avail); }
+
+    // any thread
+    void push(skir_event_t *e) {
+	link(e);
+	sem_post(&avail);
+    }
+
+    // control thread only, blocks until an event is available
+    skir_event_t *pop(void) {
+	while (sem_wait(&avail) != 0)
+	    ;
+
+	while (1) {
+	    skir_event_t *t = tail;
+	    skir_event_t *n = t->next;
+
+	    if (t == &stub) {
+		// a producer swapped head but hasn't linked yet
+		if (!n) {
+		    tbb::this_tbb_thread::yield();
+		    continue;
+		}
+		tail = t = n;
+		n = n->next;
+	    }
+
+	    if (n) {
+		tail = n;
+		return t;
+	    }
+
+	    if (t != (skir_event_t*)head) {
+		tbb::this_tbb_thread::yield();
+		continue;
+	    }
+
+	    // t is the last event, put the stub back behind it
+	    link(&stub);
+	    while (!(n = t->next))
+		tbb::this_tbb_thread::yield();
+	    tail = n;
+	    return t;
+	}
+    }
+
+private:
+    void link(skir_event_t *e) {
+	e->next = NULL;
+	skir_event_t *prev = head.fetch_and_store(e);
+	prev->next = e;
+    }
+
+    tbb::atomic<skir_event_t*> head;
+    skir_event_t *tail;
+    skir_event_t stub;
+    sem_t avail;
+};
+
+}
+#endif
@@ -111,9 +111,7 @@ void SKIRFusion::replaceStreamOps(std::set<SKIRRuntimeStream*> &common, SKIRRunt
 		    Value *ops[3] = { vouts,
 				      CI->getOperand(1),   /* stream */
 				      CI->getOperand(2) }; /* elm */
-		    static Constant *pushFCache = 0;
-		    if (!pushFCache) 
-			pushFCache = getInlineCode(mod, "__SKIRRT_inline_push_nocheck");
+		    Constant *pushFCache = getInlineCode(mod, "__SKIRRT_inline_push_nocheck");
 		    newCI = ReplaceCallWith("__SKIRRT_inline_push_nocheck", 
 					    CI, ops, ops+3, Type::getVoidTy(CTX),
 					    pushFCache);
@@ -122,17 +120,13 @@ void SKIRFusion::replaceStreamOps(std::set<SKIRRuntimeStream*> &common, SKIRRunt
 		    Value *ops[3] = { vins,
 				      CI->getOperand(1),   /* stream */
 				      CI->getOperand(2) }; /* elmptr */
-		    static Constant *popFCache;
-		    if (!popFCache) 
-			popFCache = getInlineCode(mod, "__SKIRRT_inline_pop_nocheck");
+		    Constant *popFCache = getInlineCode(mod, "__SKIRRT_inline_pop_nocheck");
 		    newCI = ReplaceCallWith("__SKIRRT_inline_pop_nocheck",
 					    CI, ops, ops+3, Type::getVoidTy(CTX),
 					    popFCache);
 		}
 		else if (isa<SKIRPeekInst>(inst)) {
-		    static Constant *peekFCache;
-		    if (!peekFCache) 
-			peekFCache = getInlineCode(mod, "__SKIRRT_inline_peek_nocheck");
+		    Constant *peekFCache = getInlineCode(mod, "__SKIRRT_inline_peek_nocheck");
 		    Value *ops[4] = { vins,
 				      CI->getOperand(1),   /* stream */
 				      CI->getOperand(2),   /* elmptr */
@@ -176,9 +170,7 @@ void SKIRFusion::replaceRenumberedOps(SKIRRuntimeKernel &k,
 		Value *ops[3] = { bufs[idx],
 				  idxs[idx*2],
 				  CI->getOperand(2) }; /* elm */
-		static Constant *pushFCache = 0;
-		if (!pushFCache) 
-		    pushFCache = getInlineCode(mod, "__SKIRRT_inline_push_fuse_4");
+		Constant *pushFCache = getInlineCode(mod, "__SKIRRT_inline_push_fuse_4");
 		newCI = ReplaceCallWith("__SKIRRT_inline_push_fuse_4",
 					CI, ops, ops+3, Type::getVoidTy(CTX),
 					pushFCache);
@@ -190,9 +182,7 @@ void SKIRFusion::replaceRenumberedOps(SKIRRuntimeKernel &k,
 		Value *ops[3] = { bufs[idx],
 				  idxs[(idx*2)+1],
 				  CI->getOperand(2) }; /* elmptr */
-		static Constant *popFCache = 0;
-		if (!popFCache) 
-		    popFCache = getInlineCode(mod, "__SKIRRT_inline_pop_fuse_4");
+		Constant *popFCache = getInlineCode(mod, "__SKIRRT_inline_pop_fuse_4");
 		newCI = ReplaceCallWith("__SKIRRT_inline_pop_fuse_4",
 					CI, ops, ops+3, Type::getVoidTy(CTX),
 					popFCache);
@@ -307,25 +297,25 @@ SKIRRuntimeKernel *SKIRFusion::runOnKernels(SKIRRuntimeKernel &K0, SKIRRuntimeKe
 	    niter1 = n1;
 	}
     }
-    // check rates
+    // check rates, a fused iteration has to fit in each stream's buffer
     for (i=0; i<K0.nins; i++) {
 	SKIRRuntimeStream *s = K0.rt_ins[i];
-	if ((s->si->pop_rate * s->elem_size * niter0) > STREAM_BUFFER_SIZE)
+	if ((s->si->pop_rate * s->elem_size * niter0) > s->si->size)
 	    return 0;
     }
     for (i=0; i<K0.nouts; i++) {
 	SKIRRuntimeStream *s = K0.rt_outs[i];
-	if ((s->si->push_rate * s->elem_size * niter0) > STREAM_BUFFER_SIZE)
+	if ((s->si->push_rate * s->elem_size * niter0) > s->si->size)
 	    return 0;
     }
     for (i=0; i<K1.nins; i++) {
 	SKIRRuntimeStream *s = K1.rt_ins[i];
-	if ((s->si->pop_rate * s->elem_size * niter1) > STREAM_BUFFER_SIZE)
+	if ((s->si->pop_rate * s->elem_size * niter1) > s->si->size)
 	    return 0;
     }
     for (i=0; i<K1.nouts; i++) {
 	SKIRRuntimeStream *s = K1.rt_outs[i];
-	if ((s->si->push_rate * s->elem_size * niter1) > STREAM_BUFFER_SIZE)
+	if ((s->si->push_rate * s->elem_size * niter1) > s->si->size)
 	    return 0;
     }
 
@@ -390,22 +380,22 @@ SKIRRuntimeKernel *SKIRFusion::runOnKernels(SKIRRuntimeKernel &K0, SKIRRuntimeKe
     for (int i=0; i<K0.nins; i++) {
 	SKIRRuntimeStream *s = K0.rt_ins[i];
 	s->si->pop_rate *= niter0;
-	assert((s->si->pop_rate * K0.rt_ins[i]->elem_size) <= STREAM_BUFFER_SIZE);
+	assert((s->si->pop_rate * K0.rt_ins[i]->elem_size) <= s->si->size);
     }
     for (int i=0; i<K0.nouts; i++) {
 	SKIRRuntimeStream *s = K0.rt_outs[i];
 	s->si->push_rate *= niter0;
-	assert((s->si->push_rate * K0.rt_outs[i]->elem_size) <= STREAM_BUFFER_SIZE);
+	assert((s->si->push_rate * K0.rt_outs[i]->elem_size) <= s->si->size);
     }
     for (int i=0; i<K1.nins; i++) {
 	SKIRRuntimeStream *s = K1.rt_ins[i];
 	s->si->pop_rate *= niter1;
-	assert((s->si->pop_rate * K1.rt_ins[i]->elem_size) <= STREAM_BUFFER_SIZE);
+	assert((s->si->pop_rate * K1.rt_ins[i]->elem_size) <= s->si->size);
     }
     for (int i=0; i<K1.nouts; i++) {
 	SKIRRuntimeStream *s = K1.rt_outs[i];
 	s->si->push_rate *= niter1;
-	assert((s->si->push_rate * K1.rt_outs[i]->elem_size) <= STREAM_BUFFER_SIZE);
+	assert((s->si->push_rate * K1.rt_outs[i]->elem_size) <= s->si->size);
     }
 
     // new kernel work function
@@ -454,6 +444,10 @@ SKIRRuntimeKernel *SKIRFusion::runOnKernels(SKIRRuntimeKernel &K0, SKIRRuntimeKe
     newKernel->base_work = newKernel->work = makeWorkFromSkel(&K1, tmpF->getName().str().c_str());
     newKernel->work->setName(K0.work->getName() + K1.work->getName());
     mod->getFunctionList().push_back(newKernel->work);
+    newKernel->code.push_back(newKernel->work);
+
+    // only the skeleton K1 was inlined into
+    tmpF->eraseFromParent();
 
     //newKernel->opt_only = true;
     newKernel->is_hier = false;
@@ -463,6 +457,7 @@ SKIRRuntimeKernel *SKIRFusion::runOnKernels(SKIRRuntimeKernel &K0, SKIRRuntimeKe
     newKernel->has_push = (newKernel->nouts > 0);
     newKernel->has_pop = (newKernel->nouts > 0);
     newKernel->has_peek = K0.has_peek || K1.has_peek;
+    newKernel->no_dp = K0.no_dp || K1.no_dp;
 
     assert(!newKernel->has_peek && newKernel->is_fixed_rate);// && !newKernel->is_stateful);
 
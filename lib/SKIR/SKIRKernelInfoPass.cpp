@@ -21,6 +21,7 @@
 //===----------------------------------------------------------------------===//
 
 #include <llvm/Pass.h>
+#include <llvm/Metadata.h>
 #include <llvm/IntrinsicInst.h>
 #include <llvm/Support/InstIterator.h>
 #include <llvm/Support/raw_ostream.h>
@@ -32,8 +33,10 @@
 #include "llvm/Analysis/ScalarEvolutionExpressions.h"
 
 #include <SKIR/SKIRRuntime.h>
+#include <SKIR/SKIRBuilder.h>
 #include "SKIRRuntimeKernel.h"
 #include "SKIRKernelInfoPass.h"
+#include "SKIRUtil.h"
 
 #include <string.h>
 #include <string>
@@ -115,70 +118,45 @@ SKIRKernelInfo::findByIdx(unsigned idx, inst_list_t &input_list, inst_list_t &ou
 }
 #endif
 
+// use the rates and state use a frontend declared in SKIR_WORK_INFO.
+// returns true if the rates were set.
 bool
-SKIRKernelInfo::tryKnownRates(Function &work)
+SKIRKernelInfo::tryDeclaredInfo(void)
 {
-    size_t pos;
-
-    if (!kernel)
+    Function *work = kernel->base_work;
+    NamedMDNode *info = work->getParent()->getNamedMetadata(SKIR_WORK_INFO);
+    if (!info)
 	return false;
 
-    const std::string name(kernel->base_work->getNameStr());
-
-    pos = name.find("split_rr_work_N_A_ILi");
-    if (pos != std::string::npos) {
-	pos += strlen("split_rr_work_N_A_ILi");
-	std::string nout_str(name.substr(pos, name.find("ELi", pos)-pos));
-	int nout = atoi(nout_str.c_str());
-	pos += nout_str.length()+3;
-	std::string arg_str(name.substr(pos, name.find("E",pos)-pos));
-	int arg = atoi(arg_str.c_str());
-	if (!nout || !arg) return false;
-
-	for (int i=0; i<nout; i++)
-	    kernel->rt_outs[i]->setPushRate(arg);
-	kernel->rt_ins[0]->setPopRate(arg*nout);
-	kernel->is_fixed_rate = true;
-	kernel->has_push = kernel->has_pop = true;
-	//errs() << name << " " << arg << " " << nout << "\n";
-	return true;
-    }
+    for (unsigned i=0; i<info->getNumOperands(); i++) {
+	MDNode *N = info->getOperand(i);
+	if (N->getNumOperands() < 5 || N->getOperand(0) != work)
+	    continue;
 
-    pos = name.find("join_rr_work_N_A_ILi");
-    if (pos != std::string::npos) {
-	pos += strlen("join_rr_work_N_A_ILi");
-	std::string nin_str(name.substr(pos, name.find("ELi", pos)-pos));
-	int nin = atoi(nin_str.c_str());
-	pos += nin_str.length()+3;
-	std::string arg_str(name.substr(pos, name.find("E",pos)-pos));
-	int arg = atoi(arg_str.c_str());
-	if (!arg) return false;
-	
-	for (int i=0; i<nin; i++)
-	    kernel->rt_ins[i]->setPopRate(arg);
-	kernel->rt_outs[0]->setPushRate(arg*nin);
-	kernel->is_fixed_rate = true;
-	kernel->has_push = kernel->has_pop = true;
-	//errs() << name << " " << arg << " " << nin << "\n";
-	return true;
-    }
+	int pop = cast<ConstantInt>(N->getOperand(1))->getSExtValue();
+	int peek = cast<ConstantInt>(N->getOperand(2))->getSExtValue();
+	int push = cast<ConstantInt>(N->getOperand(3))->getSExtValue();
+	int stateful = cast<ConstantInt>(N->getOperand(4))->getSExtValue();
+
+	if (stateful >= 0)
+	    kernel->is_stateful = stateful;
 
-    pos = name.find("split_dup_work_N_ILi");
-    if (pos != std::string::npos) {
-	pos += strlen("split_dup_work_N_ILi");
-	std::string nout_str(name.substr(pos, name.find("E", pos)-pos));
-	int nout = atoi(nout_str.c_str());
-        if (!nout) return false;
+	// only filters, with at most one stream each way
+	if (pop < 0 || push < 0 || peek < 0)
+	    return false;
+	if (kernel->nins > 1 || kernel->nouts > 1)
+	    return false;
 
-	for (int i=0; i<nout; i++)
-	    kernel->rt_outs[i]->setPushRate(1);
-	kernel->rt_ins[0]->setPopRate(nout);
+	if (kernel->nins) {
+	    kernel->rt_ins[0]->setPopRate(pop);
+	    kernel->rt_ins[0]->setPeekRate(kernel->has_peek ? peek : 0);
+	}
+	if (kernel->nouts)
+	    kernel->rt_outs[0]->setPushRate(push);
 	kernel->is_fixed_rate = true;
-	kernel->has_push = kernel->has_pop = true;
-	//errs() << name << " " << nout << "\n";
+	kernel->is_const_idx = true;
 	return true;
     }
-
     return false;
 }
 
@@ -244,6 +222,8 @@ SKIRKernelInfo::runOnFunction(Function &work)
     if (kernel->opt_only) return false;
 
     bool is_stateful = false;
+    bool zc_push = false;
+    bool zc_pop = false;
 
     // - build lists of all the pop, peek and push instructions
     // - a kernel is hierarchical if it contains call, kernel, or stream intrinsics
@@ -258,7 +238,13 @@ SKIRKernelInfo::runOnFunction(Function &work)
 	    else if (isa<SKIRStreamInst>(inst)) kernel->is_hier = true;
 	}
 	else if (CallInst *CI = dyn_cast<CallInst>(inst)) {
-	    if (dyn_cast<Function>(CI->getCalledFunction())) {
+	    if (const char *op = getZeroCopyOp(CI)) {
+		if (!strncmp(op, "__SKIR_push", strlen("__SKIR_push")))
+		    zc_push = true;
+		else
+		    zc_pop = true;
+	    }
+	    else if (dyn_cast<Function>(CI->getCalledFunction())) {
 		std::string name(CI->getCalledFunction()->getName());
 		if (!name.find("__SKIRRT_call") ||
 		    !name.find("__SKIRRT_kernel") ||
@@ -274,13 +260,25 @@ SKIRKernelInfo::runOnFunction(Function &work)
     }
 
     kernel->is_stateful = is_stateful;
-    kernel->has_push = (push_list.size() > 0);
-    kernel->has_pop = (pop_list.size() > 0);
+    kernel->has_push = (push_list.size() > 0) || zc_push;
+    kernel->has_pop = (pop_list.size() > 0) || zc_pop;
     kernel->has_peek = (peek_list.size() > 0);
     kernel->is_hier = kernel->is_hier && !(kernel->has_push || kernel->has_pop || kernel->has_peek);
 
+    // reserve/commit move any number of elements at a time, and in place,
+    // which fusion and the nocheck work functions can't follow
+    if (zc_push || zc_pop) {
+	kernel->is_fixed_rate = false;
+	kernel->is_const_idx = false;
+	return false;
+    }
+
     //std::cout << kernel->work->getName().str() << " stateful: " << is_stateful << "\n";
 
+    // declared rates are trusted over what we can find below
+    if (tryDeclaredInfo())
+	return false;
+
     // find static input/output rates if possible,
     is_fixed_rate = true;
 
@@ -322,7 +320,6 @@ SKIRKernelInfo::runOnFunction(Function &work)
 
     kernel->is_fixed_rate = is_fixed_rate;
     kernel->is_const_idx = is_fixed_rate;
-    if (!is_fixed_rate) tryKnownRates(work);
 
     return false;
 }
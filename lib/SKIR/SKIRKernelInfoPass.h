@@ -66,7 +66,7 @@ private:
     //void findByIdx(unsigned idx, inst_list_t &input_list, inst_list_t &output_list);
 
     bool computed_rates;
-    bool tryKnownRates(Function &work);
+    bool tryDeclaredInfo(void);
 
     inst_list_t pop_list;
     inst_list_t push_list;
@@ -0,0 +1,232 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/ExecutionEngine/JIT.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/MutexGuard.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetData.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <SKIR/SKIRRuntime.h>
+#include "SKIRKernelModule.h"
+
+#include <set>
+#include <sstream>
+#include <vector>
+
+using namespace llvm;
+
+// the globals V refers to, directly or through constant expressions
+static void
+findGlobals(Value *V, std::vector<GlobalValue*> &globals, std::set<Value*> &visited)
+{
+    if (!isa<Constant>(V) || !visited.insert(V).second)
+	return;
+
+    if (GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
+	globals.push_back(GV);
+	return;
+    }
+
+    Constant *C = cast<Constant>(V);
+    for (User::op_iterator I = C->op_begin(), E = C->op_end(); I != E; ++I)
+	findGlobals(*I, globals, visited);
+}
+
+SKIRKernelModule::SKIRKernelModule()
+    : ctx(0), mod(0), cg(0), workfn(0), code_bytes(0)
+{
+}
+
+SKIRKernelModule::~SKIRKernelModule()
+{
+    // the engine owns mod and frees the machine code
+    if (cg) {
+	cg->UnregisterJITEventListener(this);
+	delete cg;
+    }
+    else
+	delete mod;
+    delete ctx;
+}
+
+SKIRKernelModule *
+SKIRKernelModule::create(ExecutionEngine *host_cg, Function *work,
+			 bool run_opts, std::string *err)
+{
+    std::string bitcode;
+    std::vector< std::pair<std::string, void*> > mappings;
+    std::string work_name = work->getName().str();
+
+    //
+    // copy work into a module of its own, under the host lock
+    //
+    {
+	MutexGuard locked(host_cg->lock);
+
+	Module *host_mod = work->getParent();
+	std::vector<GlobalValue*> globals;
+	std::set<Value*> visited;
+	for (inst_iterator I = inst_begin(work), E = inst_end(work); I != E; ++I)
+	    for (User::op_iterator OI = I->op_begin(), OE = I->op_end(); OI != OE; ++OI)
+		findGlobals(*OI, globals, visited);
+
+	Module *M = new Module(work_name, work->getContext());
+	M->setDataLayout(host_mod->getDataLayout());
+	M->setTargetTriple(host_mod->getTargetTriple());
+
+	DenseMap<const Value*, Value*> value_map;
+	for (unsigned i=0; i<globals.size(); i++) {
+	    GlobalValue *GV = globals[i];
+	    if (GV == work)
+		continue;
+
+	    std::string name = GV->getName().str();
+	    if (name.empty()) {
+		std::stringstream ss;
+		ss << "__SKIR_kernel_module_gv" << i;
+		name = ss.str();
+	    }
+
+	    GlobalValue *NGV;
+	    if (Function *F = dyn_cast<Function>(GV)) {
+		Function *NF = Function::Create(F->getFunctionType(),
+						GlobalValue::ExternalLinkage, name, M);
+		NF->copyAttributesFrom(F);
+		NF->setLinkage(GlobalValue::ExternalLinkage);
+		NGV = NF;
+		// the kernel's engine lowers these itself
+		if (F->isIntrinsic()) {
+		    value_map[GV] = NGV;
+		    continue;
+		}
+	    }
+	    else if (GlobalVariable *G = dyn_cast<GlobalVariable>(GV)) {
+		if (G->isThreadLocal()) {
+		    delete M;
+		    *err = "thread local global " + name;
+		    return 0;
+		}
+		NGV = new GlobalVariable(*M, G->getType()->getElementType(), G->isConstant(),
+					 GlobalValue::ExternalLinkage, 0, name, 0, false,
+					 G->getType()->getAddressSpace());
+	    }
+	    else {
+		NGV = new GlobalVariable(*M, GV->getType()->getElementType(), false,
+					 GlobalValue::ExternalLinkage, 0, name);
+	    }
+	    value_map[GV] = NGV;
+
+	    // host functions the kernel calls are compiled in the host
+	    void *addr = host_cg->getPointerToGlobal(GV);
+	    if (!addr) {
+		delete M;
+		*err = "no address for " + name;
+		return 0;
+	    }
+	    mappings.push_back(std::make_pair(name, addr));
+	}
+
+	Function *new_work = Function::Create(work->getFunctionType(),
+					      GlobalValue::ExternalLinkage, work_name, M);
+	new_work->copyAttributesFrom(work);
+	new_work->setLinkage(GlobalValue::ExternalLinkage);
+	value_map[work] = new_work;
+
+	Function::arg_iterator new_arg = new_work->arg_begin();
+	for (Function::const_arg_iterator I = work->arg_begin(), E = work->arg_end();
+	     I != E; ++I, ++new_arg) {
+	    new_arg->setName(I->getName());
+	    value_map[I] = new_arg;
+	}
+
+	SmallVector<ReturnInst*, 8> rets;
+	CloneFunctionInto(new_work, work, value_map, rets, "", 0);
+
+	raw_string_ostream os(bitcode);
+	WriteBitcodeToFile(M, os);
+	os.flush();
+
+	// its types and constants are the host context's
+	delete M;
+    }
+
+    //
+    // compile it without the host lock
+    //
+    SKIRKernelModule *km = new SKIRKernelModule();
+    km->ctx = new LLVMContext();
+
+    MemoryBuffer *buffer = MemoryBuffer::getMemBufferCopy(StringRef(bitcode), work_name);
+    km->mod = ParseBitcodeFile(buffer, *km->ctx, err);
+    delete buffer;
+    if (!km->mod) {
+	delete km;
+	return 0;
+    }
+
+    Function *new_work = km->mod->getFunction(work_name);
+    assert(new_work);
+
+    if (run_opts) {
+	FunctionPassManager PM(km->mod);
+	PM.add(new TargetData(km->mod));
+
+	SKIRRuntime::addLLVMOpts(PM);
+	PM.doInitialization();
+	PM.run(*new_work);
+	PM.doFinalization();
+    }
+
+    EngineBuilder builder(km->mod);
+    builder.setErrorStr(err)
+	.setEngineKind(EngineKind::JIT)
+	.setOptLevel(CodeGenOpt::Aggressive);
+    km->cg = builder.create();
+    if (!km->cg) {
+	delete km;
+	return 0;
+    }
+    km->cg->DisableLazyCompilation();
+    km->cg->RegisterJITEventListener(km);
+
+    for (unsigned i=0; i<mappings.size(); i++) {
+	if (GlobalValue *GV = km->mod->getNamedValue(mappings[i].first))
+	    km->cg->addGlobalMapping(GV, mappings[i].second);
+    }
+
+    km->workfn = km->cg->getPointerToFunction(new_work);
+    if (!km->workfn) {
+	*err = "codegen failed";
+	delete km;
+	return 0;
+    }
+
+    return km;
+}
@@ -0,0 +1,75 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#ifndef _SKIR_KERNEL_MODULE_H_
+#define _SKIR_KERNEL_MODULE_H_
+
+#include <llvm/Function.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/Module.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+
+#include <string>
+
+namespace llvm {
+
+//
+// SKIRKernelModule - a kernel's work function compiled on its own (-kernel-modules)
+//
+// The kernel's passes still run in the host module, they splice in runtime
+// code from it.  Their result is copied into a module in a context of its
+// own, with every global it references declared and mapped to the host's
+// address, and compiled by an ExecutionEngine of its own.  Only the copy
+// takes the host JIT lock: the last LLVM opts and the machine code
+// generation run concurrently with those of other kernels.
+//
+class SKIRKernelModule : public JITEventListener
+{
+public:
+    // 0 if work can't be compiled on its own, err says why
+    static SKIRKernelModule *create(ExecutionEngine *host_cg, Function *work,
+				    bool run_opts, std::string *err);
+    ~SKIRKernelModule();
+
+    void *getWorkFn() { return workfn; }
+    size_t getCodeSize() { return code_bytes; }
+
+    virtual void NotifyFunctionEmitted(const Function &F,
+				       void *FnStart, size_t FnSize,
+				       const EmittedFunctionDetails &Details) {
+	code_bytes += FnSize;
+    }
+
+private:
+    SKIRKernelModule();
+
+    LLVMContext *ctx;
+    Module *mod;
+    ExecutionEngine *cg;
+    void *workfn;
+    size_t code_bytes;
+};
+
+}
+
+#endif
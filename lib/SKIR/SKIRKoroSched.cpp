@@ -31,6 +31,8 @@
 
 #include "SKIRTiming.h"
 
+#include <tbb/tick_count.h>
+
 namespace llvm {
 
 bool DisableKoroSteal;
@@ -45,117 +47,164 @@ FakeDisableKoroElim("disable-coro-elim",
 		   cl::desc("disable coroutine elimination"),
 		   cl::location(DisableKoroElim), cl::init(false));
 
-// kernel_map[key]
-kernel_t *
-SKIRKoroSched::kernel_map_find(SKIRRuntimeKernel *key)
+int KoroThreads;
+static cl::opt<int, true>
+FakeKoroThreads("koro-threads",
+		cl::desc("coroutine scheduler worker threads (0 for the runtime's thread count)"),
+		cl::location(KoroThreads), cl::init(0));
+
+// idle sweeps before a worker starts sleeping between steal attempts
+static const int KORO_SPINS = 64;
+
+SKIRKoroSched::SKIRKoroSched(SKIRRuntimeGraph *stream_graph, int nthreads)
+    : sg(stream_graph), verbose(false), num_workers(nthreads)
 {
-    kernel_map_t::const_accessor a;
-    if (kernel_map.find(a,key))
-	return a->second;
-    return NULL;
+    int koro_threads = sg->getRuntime().getOptions().koro_threads;
+    if (koro_threads > 0)
+	num_workers = koro_threads;
+    if (num_workers < 1)
+	num_workers = 1;
+    workers = new worker_t[num_workers];
+    for (int i=0; i<num_workers; i++)
+	workers[i].seed = i * 2654435761u + 1;
+    running = 0;
+    next_worker = 0;
 }
 
-// kernel_map[key] = value
+SKIRKoroSched::~SKIRKoroSched()
+{
+    stop();
+    delete[] workers;
+}
+
+// put k on w's run queue unless it is queued already; the queue holds a
+// reference
 void
-SKIRKoroSched::kernel_map_insert(SKIRRuntimeKernel *key, kernel_t *value)
+SKIRKoroSched::enqueue(int w, kernel_t *k)
 {
-    kernel_map_t::accessor a;
-    if (!kernel_map.find(a,key))
-	kernel_map.insert(a, key);
-    a->second = value;
+    if (k->running.compare_and_swap(1, 0) != 0)
+	return;
+    k->home = w;
+    k->ref();
+    workers[w].runq.push(k);
+}
+
+// take a kernel from some other worker's queue
+kernel_t *
+SKIRKoroSched::steal(int w)
+{
+    unsigned &seed = workers[w].seed;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    int start = seed % num_workers;
+    for (int i=0; i<num_workers; i++) {
+	int v = (start + i) % num_workers;
+	if (v == w)
+	    continue;
+	kernel_t *k;
+	if (workers[v].runq.try_pop(k))
+	    return k;
+    }
+    return 0;
 }
 
 void
 SKIRKoroSched::callKernel(SKIRRuntimeKernel *rtk)
 {
-    kernel_t *k = 0;
-    k = new kernel_t(*rtk);
+    kernel_t *k = kernel_pool.alloc(*rtk);
     assert(k);
-    kernel_map_insert(rtk, k);
+
+    // replaces (and drops) the kernel_t of an earlier call
+    if (kernel_t *old = rtk->sched_kernel.fetch_and_store(k))
+	old->unref();
     k->active();
-    runq.push(rtk);
+    enqueue(next_worker++ % num_workers, k);
     start();
 }
 
 void
 SKIRKoroSched::waitKernel(SKIRRuntimeKernel *rtk)
 {
-    kernel_t *k = kernel_map_find(rtk);
+    kernel_t *k = kernel_t::get(rtk);
     assert(k);
+    kernel_ref_t ref(k);
     k->wait(DONE);
 }
 
 void
 SKIRKoroSched::pauseKernel(SKIRRuntimeKernel *rtk)
 {
-    kernel_t *k = kernel_map_find(rtk);
+    kernel_t *k = kernel_t::get(rtk);
     assert(k);
+    kernel_ref_t ref(k);
     k->pause();
 }
 
 void
 SKIRKoroSched::unPauseKernel(SKIRRuntimeKernel *rtk)
 {
-    kernel_t *k = kernel_map_find(rtk);
+    kernel_t *k = kernel_t::get(rtk);
     assert(k);
+    kernel_ref_t ref(k);
     k->unpause();
+    // paused kernels are dropped from the run queues
+    if (k->is_active())
+	enqueue(k->home, k);
 }
 
 struct skir_koro_thread {
     SKIRKoroSched &s;
-    skir_koro_thread(SKIRKoroSched &sched) : s(sched) {}
-    void operator()() { s.run(); }
+    int w;
+    skir_koro_thread(SKIRKoroSched &sched, int worker) : s(sched), w(worker) {}
+    void operator()() { s.run(w); }
 };
 
 void
 SKIRKoroSched::start(void)
 {
     if (running.compare_and_swap(1,0) == 0) {
-	main_thread = new tbb::tbb_thread(*(new skir_koro_thread(*this)));
-	assert(main_thread);
+	for (int i=0; i<num_workers; i++)
+	    threads.push_back(new tbb::tbb_thread(skir_koro_thread(*this, i)));
     }
 }
 
 void
 SKIRKoroSched::stop(void)
 {
-    if (!main_thread) return;
-
     if (running.compare_and_swap(0,1) == 1) {
-	assert(main_thread && main_thread->joinable() && "not running");
-	main_thread->join();
-	main_thread = NULL;
+	for (unsigned i=0; i<threads.size(); i++) {
+	    threads[i]->join();
+	    delete threads[i];
+	}
+	threads.clear();
     }
 
-    SKIRRuntimeKernel *k;
-    while (runq.try_pop(k))
-	removeKernel(k);
+    // drop the queues' references
+    for (int i=0; i<num_workers; i++) {
+	kernel_t *k;
+	while (workers[i].runq.try_pop(k)) {
+	    k->running = 0;
+	    k->unref();
+	}
+    }
 }
 
 // stop executing rtk, and remove internal state associated with it
 void
 SKIRKoroSched::removeKernel(SKIRRuntimeKernel *rtk)
 {
-    kernel_t *k = kernel_map_find(rtk);
+    kernel_t *k = rtk->sched_kernel.fetch_and_store(0);
     if (!k) return;
 
-    // pause (lock) the kernel so it won't get picked for execution
-    k->pause();
-
-    // remove the kernel from the internal list
-    kernel_map_insert(rtk, NULL);
-
-    // release the pause thread
+    // returns once a work call in progress is over, and none starts after
+    if (!k->is_paused())
+	k->pause();
     k->done();
-    
-    // once we can get the lock, it's safe to delete k
-    {
-	kernel_lock_t::scoped_lock lock;
-	lock.acquire(k->lock);
-	k->running = 0;
-    }
-    
-    delete k;
+
+    // workers drop the queue's reference when they see it's gone
+    k->unref();
 }
 
 //
@@ -395,7 +444,7 @@ SKIRKoroSched::genericCodeGen(SKIRRuntimeGraph *sg, SKIRRuntimeKernel *rtk)
 	    SKIRRuntime::addSKIRStreamOptsPass(rtk);
 	    SKIRRuntime::addSKIRInlineStreamsPass(rtk);
 	    SKIRRuntime::addSKIRKoroPass(rtk);
-	    SKIRRuntime::addLLVMOpts(rtk);
+	    sg->addFinalOpts(rtk);
 
 	    sg->codeGenKernel(rtk);
 	    assert(rtk->workfn);
@@ -467,7 +516,7 @@ SKIRKoroSched::genericCodeGen(SKIRRuntimeGraph *sg, SKIRRuntimeKernel *rtk)
 	    SKIRRuntime::addLLVMOpts(rtk);
 	    SKIRRuntime::addSKIRStreamOptsPass(rtk);
 	    SKIRRuntime::addSKIRInlineStreamsPass(rtk);
-	    SKIRRuntime::addLLVMOpts(rtk);
+	    sg->addFinalOpts(rtk);
 
 	    sg->codeGenKernel(rtk);
 	}
@@ -476,7 +525,7 @@ SKIRKoroSched::genericCodeGen(SKIRRuntimeGraph *sg, SKIRRuntimeKernel *rtk)
 
 	SKIRRuntime::addSKIRStreamOptsPass(rtk);
 	SKIRRuntime::addSKIRInlineStreamsPass(rtk);
-	SKIRRuntime::addLLVMOpts(rtk);
+	sg->addFinalOpts(rtk);
 	
 	sg->codeGenKernel(rtk);
     }
@@ -490,24 +539,31 @@ SKIRKoroSched::genericCodeGen(SKIRRuntimeGraph *sg, SKIRRuntimeKernel *rtk)
 
 
 void
-SKIRKoroSched::run()
+SKIRKoroSched::run(int w)
 {
-    SKIRRuntimeKernel *next_rtk = 0;
+    // the kernel to yield to next, referenced
+    kernel_t *next_k = 0;
+    int idle = 0;
     while (running == 1)
     {
-	kernel_t *k = 0;
-	SKIRRuntimeKernel *rtk = next_rtk;
-	next_rtk = 0;
-	if (!rtk) runq.try_pop(rtk);
-
-	if (rtk) {
-	    // make sure k doesn't reference garbage (e.g. removed kernel)
-	    k = kernel_map_find(rtk);
-	    if (!k) continue;
+	// every k here holds a reference: its queue's or get's
+	kernel_t *k = next_k;
+	next_k = 0;
+	if (!k) {
+	    if (workers[w].runq.try_pop(k) || (k = steal(w))) {
+		// a kernel popped from a queue isn't queued anymore
+		k->running = 0;
+	    }
+	}
 
+	if (k) {
+	    idle = 0;
 	    kernel_lock_t::scoped_lock lock;
 	    if (lock.try_acquire(k->lock)) {
-		if (k->is_active()) {
+		// stolen kernels move to this worker
+		k->home = w;
+		// removed kernels only wait for their last reference
+		if (k->rt_kernel.sched_kernel == k && k->is_active()) {
 		    // generate workfn if needed
 		    if (!k->rt_kernel.workfn) {
 			k->rt_kernel.sched->runCodeGen(&k->rt_kernel);
@@ -521,26 +577,39 @@ SKIRKoroSched::run()
 
 		    if (b == (SKIRRuntimeKernel *)1) {
 			k->done();
-			kernel_map_insert(rtk, NULL);
-		    } else {
-			next_rtk = DisableKoroSteal ? 0 : b;
+		    } else if (b && !sg->getRuntime().getOptions().disable_koro_steal) {
+			// yield directly to a blocker on this worker
+			if (kernel_t *bk = kernel_t::get(b)) {
+			    if (bk->home == w)
+				next_k = bk;
+			    else
+				bk->unref();
+			}
 		    }
 		}
-		if (!k->is_done() && (next_rtk != rtk))
-		    runq.push(rtk);
+		lock.release();
+		// paused kernels wait for unPauseKernel off the queues
+		if (k->is_active() && k->rt_kernel.sched_kernel == k)
+		    enqueue(w, k);
 	    } else {
-		// if there's only one kernel in the scheduler,
-		// we'll only not get the lock if the kernel is paused,
-		// so we should yield if this happens
-		if (runq.empty()) tbb::this_tbb_thread::yield();
-		next_rtk = rtk;
+		// running on another worker or being paused.  Keep it queued,
+		// a worker that pops it while we hold the lock does the same.
+		if (workers[w].runq.empty()) tbb::this_tbb_thread::yield();
+		if (k->rt_kernel.sched_kernel == k)
+		    enqueue(k->home, k);
 	    }
-	} else {
-	    // runq is empty, yield
+	    k->unref();
+	} else if (++idle < KORO_SPINS) {
+	    // no queued kernels anywhere, yield
 	    tbb::this_tbb_thread::yield();
+	} else {
+	    tbb::this_tbb_thread::sleep(tbb::tick_count::interval_t(0.0001));
 	}
 
     } // while (running == 1)
+
+    if (next_k)
+	next_k->unref();
 }
 
 
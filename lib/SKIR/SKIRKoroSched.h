@@ -31,15 +31,31 @@
 #include <tbb/tbb_thread.h>
 #include <tbb/concurrent_queue.h>
 
+#include <vector>
+
 namespace llvm {
 
+//
+// SKIRKoroSched - M:N scheduler for coroutine kernels
+//
+// Kernels are spread over the run queues of num_workers threads.  A worker
+// runs a kernel until it blocks and then hands control directly to the
+// blocker if the blocker lives on the same worker, otherwise it moves on
+// to its next queued kernel.  Workers with empty queues steal a (possibly
+// suspended) coroutine from another worker, which makes it theirs: each
+// coroutine has its own stack, so it resumes on whichever worker holds
+// its lock.
+//
+// A kernel is queued at most once; kernel_t::running is 1 while it is on
+// a run queue and kernel_t::home is the worker it belongs to.  The queues
+// hold references on their kernel_ts (see kernel_pool_t), so a kernel
+// removed while queued or being yielded to is freed by whoever drops the
+// last reference.
+//
 class SKIRKoroSched : public SKIRScheduler {
 public:
-    SKIRKoroSched(SKIRRuntimeGraph *stream_graph) : sg(stream_graph),
-						    verbose(false)
-    {
-	running = 0;
-    }
+    SKIRKoroSched(SKIRRuntimeGraph *stream_graph, int nthreads);
+    ~SKIRKoroSched();
 
     void callKernel(SKIRRuntimeKernel *rtk);
     void removeKernel(SKIRRuntimeKernel *rtk);
@@ -52,24 +68,35 @@ public:
 
     void start(void);
     void stop(void);
-    void run(void);
+    void run(int w);
     void empty(void);
 
     void setVerbose(bool v) { verbose = v; }
 
  private:
+
+    struct worker_t {
+	tbb::concurrent_queue<kernel_t *> runq;
+	unsigned seed;
+	// keep neighbouring workers' queues off each other's cache lines
+	char pad[64];
+    };
+
+    void enqueue(int w, kernel_t *k);
+    kernel_t *steal(int w);
     
     SKIRRuntimeGraph *sg;
     bool verbose;
 
-    // hash_map<int> kernel_map 
-    kernel_map_t kernel_map;
-    void kernel_map_insert(SKIRRuntimeKernel *key, kernel_t *value);
-    kernel_t *kernel_map_find(SKIRRuntimeKernel *key);
+    int num_workers;
+    worker_t *workers;
+    std::vector<tbb::tbb_thread *> threads;
 
-    tbb::tbb_thread *main_thread;    
     tbb::atomic<int> running;
-    tbb::concurrent_bounded_queue<SKIRRuntimeKernel *> runq;  
+    // spreads new kernels over the workers
+    tbb::atomic<unsigned> next_worker;
+
+    kernel_pool_t kernel_pool;
 };
 
 }
@@ -126,6 +126,11 @@ SKIRMergeSched::tryMerge(SKIRRuntimeKernel *rtk)
 
 	    // if merge worked, add rtk to the merge set
 	    if (new_rtk) {
+		// neither was scheduled yet, only new_rtk will run
+		sg->retireKernel(k);
+		sg->retireKernel(rtk);
+		sg->reclaimCode();
+
 		// if rtk is already in a merge set, remove it
 		if (merge_set_t *ms = kernel_map_find(rtk)) {
 		    kernel_map_erase(ms);
@@ -0,0 +1,335 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Support/raw_ostream.h>
+#include "llvm/Support/CommandLine.h"
+
+#include <SKIR/SKIRRuntime.h>
+#include "SKIRRuntimeGraph.h"
+#include "SKIRRuntimeStream.h"
+#include "SKIRCommandLine.h"
+#include "SKIRNuma.h"
+
+#include <tbb/atomic.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef USE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+namespace llvm {
+
+bool EnableNuma;
+static cl::opt<bool, true>
+FakeEnableNuma("numa",
+	       cl::desc("place stream buffers and kernel state on the NUMA node their kernel runs on"),
+	       cl::location(EnableNuma), cl::init(false));
+
+bool NumaProducer;
+static cl::opt<bool, true>
+FakeNumaProducer("numa-producer",
+		 cl::desc("with -numa, place stream buffers with their producer instead of their consumer"),
+		 cl::location(NumaProducer), cl::init(false));
+
+static int NumaFakeNodes;
+static cl::opt<int, true>
+FakeNumaFakeNodes("numa-fake-nodes",
+		  cl::desc("pretend there are this many NUMA nodes, cpu c on node c % n; memory is only accounted, not moved (for testing)"),
+		  cl::location(NumaFakeNodes), cl::init(0));
+
+// runs in a row on another node before a kernel's memory follows it
+#define NUMA_MIGRATE_RUNS 8
+
+//
+// nodes and memory
+//
+
+static int num_nodes = 0;
+// the nodes are libnuma's, not -numa-fake-nodes
+static bool real_nodes = false;
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+
+static tbb::atomic<long long> node_bytes[SKIR_MAX_NUMA_NODES];
+static tbb::atomic<long long> node_allocs[SKIR_MAX_NUMA_NODES];
+static tbb::atomic<long long> node_migrated[SKIR_MAX_NUMA_NODES];
+
+static void
+initializeNuma(void)
+{
+    num_nodes = 1;
+    if (NumaFakeNodes > 1) {
+	num_nodes = std::min(NumaFakeNodes, SKIR_MAX_NUMA_NODES);
+	return;
+    }
+#ifdef USE_NUMA
+    if (numa_available() >= 0) {
+	num_nodes = numa_max_node() + 1;
+	if (num_nodes > SKIR_MAX_NUMA_NODES)
+	    num_nodes = SKIR_MAX_NUMA_NODES;
+	real_nodes = num_nodes > 1;
+    }
+#endif
+}
+
+int
+skir_numa_nodes(void)
+{
+    pthread_once(&numa_once, initializeNuma);
+    return num_nodes;
+}
+
+int
+skir_numa_node_of_cpu(int cpu)
+{
+    if (skir_numa_nodes() == 1 || cpu < 0)
+	return 0;
+    if (!real_nodes)
+	return cpu % num_nodes;
+#ifdef USE_NUMA
+    int node = numa_node_of_cpu(cpu);
+    if (node >= 0 && node < num_nodes)
+	return node;
+#endif
+    return 0;
+}
+
+int
+skir_numa_current_node(void)
+{
+    if (skir_numa_nodes() == 1)
+	return 0;
+    return skir_numa_node_of_cpu(sched_getcpu());
+}
+
+void *
+skir_numa_alloc(size_t size, int &node)
+{
+    if (node < 0 || node >= skir_numa_nodes())
+	node = skir_numa_current_node();
+
+    void *p = 0;
+#ifdef USE_NUMA
+    if (real_nodes)
+	p = numa_alloc_onnode(size, node);
+    else
+#endif
+    {
+	// stream buffers follow a cache line aligned header, keep them aligned
+	if (posix_memalign(&p, CACHE_LINE_SIZE, size))
+	    p = 0;
+    }
+
+    if (p) {
+	node_bytes[node] += size;
+	node_allocs[node]++;
+    }
+    return p;
+}
+
+void
+skir_numa_free(void *p, size_t size, int node)
+{
+    if (!p)
+	return;
+    assert(node >= 0 && node < skir_numa_nodes() && "skir_numa_free: not the node skir_numa_alloc used");
+
+    node_bytes[node] -= size;
+    node_allocs[node]--;
+#ifdef USE_NUMA
+    if (real_nodes) {
+	numa_free(p, size);
+	return;
+    }
+#endif
+    free(p);
+}
+
+bool
+skir_numa_migrate(void *p, size_t size, int from, int to)
+{
+    if (skir_numa_nodes() == 1 || to < 0 || to >= num_nodes || from == to)
+	return false;
+
+    if (!real_nodes) {
+	// nothing to move between fake nodes, only the accounting follows
+	if (from >= 0 && from < num_nodes) {
+	    node_bytes[from] -= size;
+	    node_allocs[from]--;
+	    node_bytes[to] += size;
+	    node_allocs[to]++;
+	}
+	node_migrated[to] += size;
+	return true;
+    }
+
+#ifdef USE_NUMA
+    long page = sysconf(_SC_PAGESIZE);
+    char *begin = (char *)((size_t)p & ~(page-1));
+    char *end = (char *)p + size;
+    unsigned long count = (end - begin + page - 1) / page;
+
+    void **pages = new void*[count];
+    int *nodes = new int[count];
+    int *status = new int[count];
+    for (unsigned long i=0; i<count; i++) {
+	pages[i] = begin + i*page;
+	nodes[i] = to;
+    }
+
+    // pages stay readable and writable while they move, so the kernel at
+    // the other end of a stream doesn't have to stop
+    long err = numa_move_pages(0, count, pages, nodes, status, MPOL_MF_MOVE);
+
+    delete[] pages;
+    delete[] nodes;
+    delete[] status;
+
+    if (err < 0)
+	return false;
+
+    if (from >= 0 && from < num_nodes) {
+	node_bytes[from] -= size;
+	node_allocs[from]--;
+	node_bytes[to] += size;
+	node_allocs[to]++;
+    }
+    node_migrated[to] += size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void
+skir_numa_stats(raw_ostream &o)
+{
+    int n = skir_numa_nodes();
+    for (int i=0; i<n; i++) {
+	o << "numa node " << i << ": "
+	  << node_bytes[i] << " bytes in " << node_allocs[i] << " allocations, "
+	  << node_migrated[i] << " bytes migrated in\n";
+    }
+}
+
+//
+// runtime graph
+//
+
+// the node a kernel runs on, or will run on if it has been placed
+int
+SKIRRuntimeGraph::kernelNode(SKIRRuntimeKernel *k)
+{
+    if (!k || k == (void*)-1 || k == (void*)1 || k == (void*)2)
+	return -1;
+    if (k->numa_node >= 0)
+	return k->numa_node;
+    if (rt.getOptions().steal_affinity) {
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int w = k->affinity % rt.getNumThreads();
+	if (ncpus > 0)
+	    return skir_numa_node_of_cpu(w % ncpus);
+    }
+    return -1;
+}
+
+// the node a new buffer for a stream of kernel should go on
+int
+SKIRRuntimeGraph::streamNode(SKIRRuntimeKernel *kernel, SKIRRuntimeStream *s, bool input)
+{
+    if (!rt.getOptions().numa)
+	return -1;
+    // the kernel is the consumer of its inputs
+    if (input != rt.getOptions().numa_producer)
+	return kernelNode(kernel);
+    // the other end, if we already know it
+    if (s->si)
+	return kernelNode((SKIRRuntimeKernel *)(input ? s->si->src : s->si->dst));
+    return -1;
+}
+
+// kernel k is now running on node: move its buffers and state there
+void
+SKIRRuntimeGraph::migrateKernel(SKIRRuntimeKernel *k, int node)
+{
+    int from = k->numa_node;
+    k->numa_node = node;
+    if (from == node)
+	return;
+
+    bool producer = rt.getOptions().numa_producer;
+    int n = producer ? k->nouts : k->nins;
+    SKIRRuntimeStream **streams = producer ? k->rt_outs : k->rt_ins;
+    for (int i=0; i<n && streams; i++) {
+	SKIRRuntimeStream *s = streams[i];
+	if (!s || !s->si || s->type != SKIRRuntimeStream::NATIVE || s->map)
+	    continue;
+	if (s->node == node)
+	    continue;
+	// pages of the mapping that were never touched are skipped
+	skir_stream_t *base = s->si - NUM_STREAM_HEADERS;
+	if (skir_numa_migrate(base, skir_stream_alloc_size(s), s->node, node))
+	    s->node = node;
+    }
+
+    // the state belongs to the program and may share its first and last
+    // pages with other data, only the pages it covers completely move
+    if (k->state && k->state_size) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin = ((size_t)k->state + page - 1) & ~(page - 1);
+	size_t end = ((size_t)k->state + k->state_size) & ~(page - 1);
+	if (end > begin)
+	    skir_numa_migrate((void *)begin, end - begin, -1, node);
+    }
+
+    if (verbose)
+	errs() << "SKIRRuntimeGraph::migrateKernel: " << k->work->getName()
+	       << " " << from << " -> " << node << "\n";
+}
+
+// called by the thread about to run k.  The first run places k's memory,
+// after that it only follows k once k keeps running somewhere else, so a
+// single steal doesn't drag the buffers across the machine and back.
+void
+SKIRRuntimeGraph::checkKernelNode(SKIRRuntimeKernel *k)
+{
+    if (!rt.getOptions().numa || skir_numa_nodes() == 1)
+	return;
+
+    int node = skir_numa_current_node();
+    if (node == k->numa_node) {
+	k->numa_runs = 0;
+	return;
+    }
+    if (k->numa_node < 0 || ++k->numa_runs >= NUMA_MIGRATE_RUNS) {
+	migrateKernel(k, node);
+	k->numa_runs = 0;
+    }
+}
+
+}
@@ -0,0 +1,62 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#ifndef _SKIR_NUMA_H_
+#define _SKIR_NUMA_H_
+
+#include <llvm/Support/raw_ostream.h>
+#include <stddef.h>
+
+namespace llvm {
+
+//
+// NUMA placement of stream buffers and kernel state
+//
+// Built with -DUSE_NUMA this uses libnuma; otherwise, or when the machine
+// (or libnuma's view of it) has a single node, everything is on node 0,
+// allocation is malloc and migration does nothing.  -numa-fake-nodes
+// makes up a topology for tests: cpus are spread over the nodes and
+// placement and migration are accounted as if the memory moved.
+//
+
+#define SKIR_MAX_NUMA_NODES 64
+
+// number of nodes, 1 without NUMA support
+int skir_numa_nodes(void);
+
+// node of a cpu, and of the cpu the caller is running on
+int skir_numa_node_of_cpu(int cpu);
+int skir_numa_current_node(void);
+
+// allocate size bytes on node (-1 is the caller's node), free them, and
+// move them to another node.  node is what the memory is accounted to;
+// skir_numa_alloc sets it to the node it used, which is what to free with.
+void *skir_numa_alloc(size_t size, int &node);
+void skir_numa_free(void *p, size_t size, int node);
+bool skir_numa_migrate(void *p, size_t size, int from, int to);
+
+// per node bytes allocated, allocations and bytes migrated in
+void skir_numa_stats(raw_ostream &o);
+
+}
+
+#endif
@@ -379,7 +379,7 @@ SKIROpenCLSched::SKIROpenCLSched(SKIRRuntimeGraph *stream_graph)
 
 SKIROpenCLSched::~SKIROpenCLSched()
 {
-    delete the_single_sched;
+    // the_single_sched is the graph's tbb sched
 }
 
 Module *
@@ -387,13 +387,13 @@ SKIROpenCLSched::getCLModule()
 {
     if (!opencl_module) {
 	// load the runtime bitcode library
-	std::string skir_path(getenv("SKIR_OBJ_ROOT"));
 	std::string errormsg;
-	skir_path = skir_path + "/lib/skir_opencl_mod.bc";
-	if (MemoryBuffer *buffer = MemoryBuffer::getFileOrSTDIN(skir_path, &errormsg)) {
-	    setCLModule(ParseBitcodeFile(buffer, getCLContext(), &errormsg));
-	    delete buffer;
+	Module *M = getOpenCLRuntimeModule(getCLContext(), &errormsg);
+	if (M && M->MaterializeAll(&errormsg)) {
+	    delete M;
+	    M = 0;
 	}
+	setCLModule(M);
 	if (!opencl_module) {
 	    errs() << "bitcode didn't read correctly:";
 	    if (errormsg.size()) errs() << errormsg;
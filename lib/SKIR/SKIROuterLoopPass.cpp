@@ -98,6 +98,9 @@ public:
 						("__SKIRRT_inline_peek"+ops_suffix).c_str());
 		    CI = ReplaceCallWith(CI, F, ops, ops+4);
 		}
+		// these check for space themselves, nocheck or not
+		else
+		    lowerZeroCopyOp(CI, vins, vouts, "");
 	    }
 	}
 
@@ -116,6 +119,11 @@ public:
 	    for (int i=0; i<kernel->nouts && equal; i++)
 		if (!elem_size) elem_size = kernel->rt_outs[i]->elem_size;
 		else equal = equal && (elem_size == kernel->rt_outs[i]->elem_size);
+	    // streams that can grow need the generic ops
+	    for (int i=0; i<kernel->nins && equal; i++)
+		equal = kernel->rt_ins[i]->max_size == STREAM_BUFFER_SIZE;
+	    for (int i=0; i<kernel->nouts && equal; i++)
+		equal = kernel->rt_outs[i]->max_size == STREAM_BUFFER_SIZE;
 
 	    name << "__SKIRRT_workfn_nocheck";
 	    if ((kernel->nins == 1) && (kernel->nouts == 1)) {
@@ -0,0 +1,175 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <SKIR/SKIRRuntime.h>
+#include "SKIRRuntimeGraph.h"
+
+#include <map>
+#include <vector>
+
+using namespace llvm;
+using namespace std;
+
+//
+// Kernel placement
+//
+// Splits the graph into nparts regions, one per worker/core, and records
+// each kernel's region in SKIRRuntimeKernel::affinity.  The topological
+// order is cut into contiguous chunks of roughly equal cost, then kernels
+// on the boundaries move to the neighbouring region that carries most of
+// their stream traffic, as long as that region doesn't get more than
+// PLACE_SLACK over its share.
+//
+// Cost is measured cycles (total_runtime) and traffic is bytes pushed on
+// each stream, so placement improves as the graph runs.  Kernels and
+// streams with nothing measured yet count as the average kernel and one
+// byte.  Calling and becoming kernels doesn't place them, the scheduler
+// (SKIRStealSched with -steal-affinity) re-places the whole graph once it
+// has changed and then periodically.
+//
+
+#define PLACE_SLACK  1.10
+#define PLACE_PASSES 4
+
+static bool
+isKernel(void *p)
+{
+    return p && p != (void*)-1 && p != (void*)1 && p != (void*)2;
+}
+
+// neighbours of k and the bytes exchanged with each
+static void
+getTraffic(SKIRRuntimeKernel *k, map<SKIRRuntimeKernel*, unsigned long long> &traffic)
+{
+    for (int i=0; i<k->nins; i++) {
+	skir_stream_t *s = k->rt_ins && k->rt_ins[i] ? k->rt_ins[i]->si : 0;
+	if (s && isKernel(s->src))
+	    traffic[(SKIRRuntimeKernel*)s->src] += s->num_push * s->elem_size + 1;
+    }
+    for (int i=0; i<k->nouts; i++) {
+	skir_stream_t *s = k->rt_outs && k->rt_outs[i] ? k->rt_outs[i]->si : 0;
+	if (s && isKernel(s->dst))
+	    traffic[(SKIRRuntimeKernel*)s->dst] += s->num_push * s->elem_size + 1;
+    }
+}
+
+void
+SKIRRuntimeGraph::placeKernels(int nparts)
+{
+    if (nparts < 1)
+	return;
+
+    MutexGuard locked(graph_lock);
+    placed_version = version;
+
+    list<SKIRRuntimeKernel *> sorted;
+    topo_sort(sorted);
+
+    vector<SKIRRuntimeKernel *> kernels;
+    unsigned long long measured = 0;
+    int nmeasured = 0;
+    for (list<SKIRRuntimeKernel *>::iterator I = sorted.begin(), E = sorted.end(); I != E; ++I) {
+	SKIRRuntimeKernel *k = *I;
+	if (!k || k->is_hier)
+	    continue;
+	kernels.push_back(k);
+	if (k->total_runtime) {
+	    measured += k->total_runtime;
+	    nmeasured++;
+	}
+    }
+    if (kernels.empty())
+	return;
+
+    unsigned long long avg = nmeasured ? measured / nmeasured : 1;
+    if (!avg) avg = 1;
+
+    map<SKIRRuntimeKernel*, unsigned long long> cost;
+    unsigned long long total = 0;
+    for (unsigned i=0; i<kernels.size(); i++) {
+	unsigned long long c = kernels[i]->total_runtime ? kernels[i]->total_runtime : avg;
+	cost[kernels[i]] = c;
+	total += c;
+    }
+
+    // contiguous chunks of the topological order
+    vector<unsigned long long> load(nparts, 0);
+    map<SKIRRuntimeKernel*, int> part;
+    double share = (double)total / nparts;
+    int p = 0;
+    for (unsigned i=0; i<kernels.size(); i++) {
+	SKIRRuntimeKernel *k = kernels[i];
+	if (p < nparts-1 && load[p] && load[p] + cost[k]/2 > share)
+	    p++;
+	part[k] = p;
+	load[p] += cost[k];
+    }
+
+    // move boundary kernels toward their traffic
+    unsigned long long limit = (unsigned long long)(share * PLACE_SLACK);
+    for (int pass=0; pass<PLACE_PASSES; pass++) {
+	bool moved = false;
+	for (unsigned i=0; i<kernels.size(); i++) {
+	    SKIRRuntimeKernel *k = kernels[i];
+	    map<SKIRRuntimeKernel*, unsigned long long> traffic;
+	    getTraffic(k, traffic);
+
+	    // bytes to each region
+	    map<int, unsigned long long> to;
+	    map<SKIRRuntimeKernel*, unsigned long long>::iterator TI, TE;
+	    for (TI = traffic.begin(), TE = traffic.end(); TI != TE; ++TI)
+		if (part.count(TI->first))
+		    to[part[TI->first]] += TI->second;
+
+	    int home = part[k];
+	    int best = home;
+	    unsigned long long best_bytes = to[home];
+	    map<int, unsigned long long>::iterator PI, PE;
+	    for (PI = to.begin(), PE = to.end(); PI != PE; ++PI) {
+		if (PI->second > best_bytes && load[PI->first] + cost[k] <= limit) {
+		    best = PI->first;
+		    best_bytes = PI->second;
+		}
+	    }
+	    if (best != home) {
+		load[home] -= cost[k];
+		load[best] += cost[k];
+		part[k] = best;
+		moved = true;
+	    }
+	}
+	if (!moved)
+	    break;
+    }
+
+    for (unsigned i=0; i<kernels.size(); i++)
+	kernels[i]->affinity = part[kernels[i]];
+
+    if (verbose) {
+	errs() << "placeKernels:";
+	for (int i=0; i<nparts; i++)
+	    errs() << " " << load[i];
+	errs() << "\n";
+    }
+}
@@ -0,0 +1,180 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Support/raw_ostream.h>
+#include "llvm/Support/CommandLine.h"
+
+#include <SKIR/SKIRRuntime.h>
+#include "SKIRRuntimeGraph.h"
+#include "SKIRCommandLine.h"
+
+#include <map>
+#include <vector>
+
+namespace llvm {
+
+bool EnablePrioritySched;
+static cl::opt<bool, true>
+FakeEnablePrioritySched("priority-sched",
+			cl::desc("dispatch kernels on the critical path and with nearly full inputs first"),
+			cl::location(EnablePrioritySched), cl::init(false));
+
+// static priorities, getPriority adds up to +-4 per stream on top
+#define PRIO_CRITICAL      4
+#define PRIO_FEEDS_LIMITER 2
+#define PRIO_LIMITER       8
+
+// measured cycles per iteration, 0 until there are enough samples
+unsigned long long
+SKIRRuntimeGraph::iterationCost(SKIRRuntimeKernel *k)
+{
+    if (!k || k->total_niter < 16)
+	return 0;
+    return k->total_runtime / k->total_niter;
+}
+
+static bool
+isKernel(void *p)
+{
+    return p && p != (void*)-1 && p != (void*)1 && p != (void*)2;
+}
+
+// the kernel at the other end of k's i'th output (forward) or input
+static SKIRRuntimeKernel *
+neighbour(SKIRRuntimeKernel *k, int i, bool forward)
+{
+    SKIRRuntimeStream **rs = forward ? k->rt_outs : k->rt_ins;
+    skir_stream_t *s = rs && rs[i] ? rs[i]->si : 0;
+    if (!s)
+	return 0;
+    void *n = forward ? s->dst : s->src;
+    return isKernel(n) ? (SKIRRuntimeKernel *)n : 0;
+}
+
+// cost of the most expensive path from k to a sink (forward) or from a
+// source to k, counting k.  Feedback loops are cut where they are found.
+static unsigned long long
+longestPath(SKIRRuntimeKernel *k, bool forward,
+	    std::map<SKIRRuntimeKernel*, unsigned long long> &cost,
+	    std::map<SKIRRuntimeKernel*, unsigned long long> &path,
+	    std::map<SKIRRuntimeKernel*, bool> &visiting)
+{
+    if (path.count(k))
+	return path[k];
+    if (visiting[k])
+	return 0;
+    visiting[k] = true;
+
+    unsigned long long longest = 0;
+    int n = forward ? k->nouts : k->nins;
+    for (int i=0; i<n; i++) {
+	SKIRRuntimeKernel *next = neighbour(k, i, forward);
+	if (!next || !cost.count(next)) continue;
+	unsigned long long l = longestPath(next, forward, cost, path, visiting);
+	if (l > longest) longest = l;
+    }
+
+    visiting[k] = false;
+    return path[k] = cost[k] + longest;
+}
+
+//
+// updatePriorities - set SKIRRuntimeKernel::priority for a set of kernels
+//
+// The kernel with the highest cost per iteration (the measured limiter)
+// gets the highest priority, its producers come next so it never starves,
+// then every kernel on the most expensive source to sink path.  Only
+// kernels in the set and their streams are looked at, so a scheduler can
+// call this on its own kernels from its own thread.
+//
+void
+SKIRRuntimeGraph::updatePriorities(std::vector<SKIRRuntimeKernel *> &kernels)
+{
+    std::map<SKIRRuntimeKernel*, unsigned long long> cost;
+    unsigned long long measured = 0;
+    int nmeasured = 0;
+    for (unsigned i=0; i<kernels.size(); i++) {
+	unsigned long long c = iterationCost(kernels[i]);
+	cost[kernels[i]] = c;
+	if (c) {
+	    measured += c;
+	    nmeasured++;
+	}
+    }
+    if (cost.empty())
+	return;
+
+    // unmeasured kernels count as average ones
+    unsigned long long avg = nmeasured ? measured / nmeasured : 1;
+    if (!avg) avg = 1;
+    SKIRRuntimeKernel *limiter = 0;
+    std::map<SKIRRuntimeKernel*, unsigned long long>::iterator I, E;
+    for (I = cost.begin(), E = cost.end(); I != E; ++I) {
+	if (!I->second) I->second = avg;
+	if (nmeasured && (!limiter || I->second > cost[limiter]))
+	    limiter = I->first;
+    }
+
+    // path lengths from each kernel to a sink, and from a source to it
+    std::map<SKIRRuntimeKernel*, unsigned long long> below, above;
+    std::map<SKIRRuntimeKernel*, bool> visiting;
+    unsigned long long critical = 0;
+    for (I = cost.begin(), E = cost.end(); I != E; ++I) {
+	unsigned long long l = longestPath(I->first, true, cost, below, visiting);
+	longestPath(I->first, false, cost, above, visiting);
+	if (l > critical) critical = l;
+    }
+
+    for (I = cost.begin(), E = cost.end(); I != E; ++I) {
+	SKIRRuntimeKernel *k = I->first;
+	int p = 0;
+	// on a path within 5% of the critical path
+	if ((above[k] + below[k] - cost[k]) * 20 >= critical * 19)
+	    p += PRIO_CRITICAL;
+	if (k == limiter)
+	    p += PRIO_LIMITER;
+	for (int i=0; limiter && i<k->nouts; i++) {
+	    if (neighbour(k, i, true) == limiter) {
+		p += PRIO_FEEDS_LIMITER;
+		break;
+	    }
+	}
+	k->priority = p;
+    }
+
+    if (verbose && limiter)
+	errs() << "updatePriorities: limiter " << limiter->work->getName()
+	       << " " << cost[limiter] << " cycles/iter, critical path "
+	       << critical << "\n";
+}
+
+// updatePriorities over every scheduled kernel, running or not
+void
+SKIRRuntimeGraph::updatePriorities()
+{
+    MutexGuard locked(graph_lock);
+    std::vector<SKIRRuntimeKernel *> kernels;
+    getScheduledKernels(kernels);
+    updatePriorities(kernels);
+}
+
+}
@@ -22,6 +22,8 @@
 
 #include <llvm/Module.h>
 #include <llvm/Support/InstIterator.h>
+#include <llvm/Target/TargetData.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/Intrinsics.h>
 #include <llvm/IntrinsicInst.h>
 #include <llvm/Support/MemoryBuffer.h>
@@ -47,9 +49,13 @@ using namespace llvm;
 #include "SKIRTbbSched.h"
 #include "SKIRMergeSched.h"
 #include "SKIRUtil.h"
+#include "SKIRRuntimeBitcode.h"
+#include "SKIREventQueue.h"
+#include "SKIRCommandLine.h"
 #include <SKIR/SKIRRuntime.h>
 
 #include <fstream>
+#include <algorithm>
 
 // skir/build/lib/events.pb.h
 #include "events.pb.h"
@@ -60,12 +66,15 @@ using namespace std;
 
 extern "C" {
 #include <stdio.h>
+#include <pthread.h>
 
 /* these are defined at the end of this file */
 void *__SKIRRT_kernel(void *me, void *work, void *args);
 void __SKIRRT_call(void *me, void *kernel, void *in_streams, void *out_stream);
 void __SKIRRT_wait(void *me, void *kernel);
 void __SKIRRT_become(void *me, void *k, void *in_streams, void *out_stream);
+void __SKIRRT_uncall(void *me, void *k);
+void __SKIRRT_reconfigure(void *me, void *k, void *kernels);
 void *__SKIRRT_stream(void *me, unsigned int elem_size);
 void __SKIR_push(skir_stream_idx_t p, skir_stream_element_t e);
 void __SKIR_pop(skir_stream_idx_t p, skir_stream_element_t e);
@@ -81,10 +90,51 @@ void __SKIRRT_return64(void *rt_state, int ret_val);
 //  SKIRRuntime Class
 //------------------------------------------------
 
-SKIRRuntime::SKIRRuntime()
+SKIRRuntimeOptions::SKIRRuntimeOptions()
+{
+    force_single = ForceSingleSched;
+    force_tpk = ForceTPK;
+    enable_dp = EnableDPSched;
+    dp_width = DPWidth;
+    enable_opencl = EnableOpenCLSched;
+    opencl_mult = OpenCLMultiplier;
+    enable_merge = EnableMergeSched;
+    disable_koro_steal = DisableKoroSteal;
+    koro_threads = KoroThreads;
+    tbb_retries = TbbRetries;
+    tbb_monitor = TbbMonitor;
+    tbb_d4r = EnableD4R;
+    steal_sched = EnableStealSched;
+    steal_affinity = EnableStealAffinity;
+    numa = EnableNuma;
+    numa_producer = NumaProducer;
+    priority_sched = EnablePrioritySched;
+    latency_mode = LatencyMode;
+    quantum_iters = QuantumIters;
+    quantum_cycles = QuantumCycles;
+    latency_depth = LatencyDepth;
+    kernel_modules = KernelModules;
+}
+
+SKIRRuntime *
+SKIRRuntime::create(int nthreads, const SKIRRuntimeOptions &opts)
+{
+    SKIRRuntime *rt = new SKIRRuntime(opts);
+    rt->start(nthreads);
+    return rt;
+}
+
+void
+SKIRRuntime::destroy(SKIRRuntime *rt)
+{
+    delete rt;
+}
+
+SKIRRuntime::SKIRRuntime(const SKIRRuntimeOptions &opts) : options(opts)
 {
     initialized = false;
 
+    host_ctx = 0;
     host_mod = 0;
     host_cg = 0;
     host_sg = 0;
@@ -93,6 +143,10 @@ SKIRRuntime::SKIRRuntime()
     
     next_kernel_id = 0;
     next_stream_id = 1;
+    code_bytes = 0;
+
+    event_queue = 0;
+    event_thread = 0;
 
     verbose = false;
 
@@ -100,11 +154,32 @@ SKIRRuntime::SKIRRuntime()
 
 SKIRRuntime::~SKIRRuntime()
 {
-    if (host_sched) delete host_sched;
+    // drain the control thread, an event with no stream tells it to exit
+    if (event_thread) {
+	skir_event_t e(0);
+	event_queue->push(&e);
+	event_thread->join();
+	delete event_thread;
+	event_thread = 0;
+    }
+    if (event_queue) delete event_queue;
+    event_queue = 0;
+
+    // the graph owns the schedulers
+    if (host_sched) host_sched->stop();
     host_sched = 0;
 
     if (host_sg) delete host_sg;
     host_sg = 0;
+
+    // the engine owns host_mod
+    if (host_mod) setModuleLock(host_mod, 0);
+    if (host_cg) delete host_cg;
+    host_cg = 0;
+    host_mod = 0;
+
+    if (host_ctx) delete host_ctx;
+    host_ctx = 0;
 }
 
 void
@@ -115,6 +190,58 @@ SKIRRuntime::setVerbose(bool v)
     verbose = v;
 }
 
+size_t
+SKIRRuntime::getCodeSize(const Function *F)
+{
+    MutexGuard locked(getCG()->lock);
+    if (!F)
+	return code_bytes;
+    std::map<const Function*, size_t>::iterator I = code_size.find(F);
+    return (I == code_size.end()) ? 0 : I->second;
+}
+
+// the size of what a work function takes its state (the first argument)
+// to be: the furthest byte it reaches through casts and constant offsets
+// of the pointer, e.g. the struct it casts the state to, or the fields
+// the optimizer made of it.  0 if it never does.
+static size_t
+workStateSize(Function *work)
+{
+    if (!work || work->isDeclaration() || work->arg_empty())
+	return 0;
+    TargetData TD(work->getParent());
+
+    size_t size = 0;
+    std::vector< std::pair<Value*, uint64_t> > ptrs;
+    ptrs.push_back(std::make_pair((Value*)work->arg_begin(), (uint64_t)0));
+    while (!ptrs.empty()) {
+	Value *V = ptrs.back().first;
+	uint64_t off = ptrs.back().second;
+	ptrs.pop_back();
+
+	for (Value::use_iterator U = V->use_begin(), E = V->use_end(); U != E; ++U) {
+	    Value *P = 0;
+	    uint64_t o = off;
+	    if (BitCastInst *BC = dyn_cast<BitCastInst>(*U))
+		P = BC;
+	    else if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(*U)) {
+		if (GEP->getPointerOperand() != V || !GEP->hasAllConstantIndices())
+		    continue;
+		SmallVector<Value*, 8> idx(GEP->idx_begin(), GEP->idx_end());
+		o += TD.getIndexedOffset(GEP->getPointerOperandType(), &idx[0], idx.size());
+		P = GEP;
+	    }
+	    const PointerType *PT = P ? dyn_cast<PointerType>(P->getType()) : 0;
+	    if (!PT)
+		continue;
+	    if (PT->getElementType()->isSized())
+		size = std::max(size, (size_t)(o + TD.getTypeAllocSize(PT->getElementType())));
+	    ptrs.push_back(std::make_pair(P, o));
+	}
+    }
+    return size;
+}
+
 // 
 // Implementation of the skir.kernel instruction.
 // The arguments are a pointer to the work
@@ -131,65 +258,29 @@ SKIRRuntime::handleKernelInst(Function *work, void *args)
     k->base_work = k->work = work;
     k->state = args;
 
+    // for checkpointing, a KernelRequest may know better
+    if (args) {
+	MutexGuard locked(getCG()->lock);
+	k->state_size = workStateSize(work);
+    }
+
     return (void *)k;
 }
 
 void *
 SKIRRuntime::handleKernelInst(void *work, void *args)
 {
-    Function *w = fn_map[work];
+    Function *w;
+    {
+	MutexGuard locked(getCG()->lock);
+	w = fn_map[work];
+    }
     assert(w);
 
     return handleKernelInst(w, args);
 }
 
 
-void
-SKIRRuntime::addLLVMOpts(SKIRRuntimeKernel *k)
-{
-    FunctionPassManager &PM = *k->fpm;
-    
-    createStandardFunctionPasses(&PM, 3);
-
-    // Start of function pass.
-    
-    PM.add(createScalarReplAggregatesPass());  // Break up aggregate allocas
-    //if (SimplifyLibCalls)
-    //PM.add(createSimplifyLibCallsPass());    // Library Call Optimizations
-    PM.add(createInstructionCombiningPass());  // Cleanup for scalarrepl.
-    PM.add(createJumpThreadingPass());         // Thread jumps.
-    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
-    PM.add(createInstructionCombiningPass());  // Combine silly seq's
-    
-    PM.add(createTailCallEliminationPass());   // Eliminate tail calls
-    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
-    PM.add(createReassociatePass());           // Reassociate expressions
-    PM.add(createLoopRotatePass());            // Rotate Loop
-    PM.add(createLICMPass());                  // Hoist loop invariants
-    //PM.add(createLoopUnswitchPass(OptimizeSize || OptimizationLevel < 3));
-    PM.add(createInstructionCombiningPass());  
-    PM.add(createIndVarSimplifyPass());        // Canonicalize indvars
-    PM.add(createLoopDeletionPass());          // Delete dead loops
-    //if (UnrollLoops)
-    PM.add(createLoopUnrollPass());          // Unroll small loops
-    PM.add(createInstructionCombiningPass());  // Clean up after the unroller
-    //if (OptimizationLevel > 1)
-    PM.add(createGVNPass());                 // Remove redundancies
-    PM.add(createMemCpyOptPass());             // Remove memcpy / form memset
-    PM.add(createSCCPPass());                  // Constant prop with SCCP
-
-    // Run instcombine after redundancy elimination to exploit opportunities
-    // opened up by them.
-    PM.add(createInstructionCombiningPass());
-    PM.add(createJumpThreadingPass());         // Thread jumps
-    PM.add(createDeadStoreEliminationPass());  // Delete dead stores
-    PM.add(createAggressiveDCEPass());         // Delete dead instructions
-    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
-    PM.add(createSCCVNPass());
-
-    PM.add(createVerifierPass());
-}
-
 void
 SKIRRuntime::runLLVMOpts(SKIRRuntimeKernel *k)
 {
@@ -197,46 +288,7 @@ SKIRRuntime::runLLVMOpts(SKIRRuntimeKernel *k)
     Function *F = k->work;
     FunctionPassManager PM(F->getParent());
     PM.add(new TargetData(F->getParent()));
-    
-    createStandardFunctionPasses(&PM, 3);
-
-    // Start of function pass.
-    
-    PM.add(createScalarReplAggregatesPass());  // Break up aggregate allocas
-    //if (SimplifyLibCalls)
-    //PM.add(createSimplifyLibCallsPass());    // Library Call Optimizations
-    PM.add(createInstructionCombiningPass());  // Cleanup for scalarrepl.
-    PM.add(createJumpThreadingPass());         // Thread jumps.
-    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
-    PM.add(createInstructionCombiningPass());  // Combine silly seq's
-    
-    PM.add(createTailCallEliminationPass());   // Eliminate tail calls
-    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
-    PM.add(createReassociatePass());           // Reassociate expressions
-    PM.add(createLoopRotatePass());            // Rotate Loop
-    PM.add(createLICMPass());                  // Hoist loop invariants
-    //PM.add(createLoopUnswitchPass(OptimizeSize || OptimizationLevel < 3));
-    PM.add(createInstructionCombiningPass());  
-    PM.add(createIndVarSimplifyPass());        // Canonicalize indvars
-    PM.add(createLoopDeletionPass());          // Delete dead loops
-    //if (UnrollLoops)
-    PM.add(createLoopUnrollPass());          // Unroll small loops
-    PM.add(createInstructionCombiningPass());  // Clean up after the unroller
-    //if (OptimizationLevel > 1)
-    PM.add(createGVNPass());                 // Remove redundancies
-    PM.add(createMemCpyOptPass());             // Remove memcpy / form memset
-    PM.add(createSCCPPass());                  // Constant prop with SCCP
-
-    // Run instcombine after redundancy elimination to exploit opportunities
-    // opened up by them.
-    PM.add(createInstructionCombiningPass());
-    PM.add(createJumpThreadingPass());         // Thread jumps
-    PM.add(createDeadStoreEliminationPass());  // Delete dead stores
-    PM.add(createAggressiveDCEPass());         // Delete dead instructions
-    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
-    PM.add(createSCCVNPass());
-
-    PM.add(createVerifierPass());
+    addLLVMOpts(PM);
 
     {
 	MutexGuard locked(k->cg->lock);
@@ -284,42 +336,60 @@ SKIRRuntime::handleCallInst(void *k, void *is, void *os)
     getSG()->callKernel(kernel);
 }
 
-void
+bool
 SKIRRuntime::handleUncallInst(void *k)
 {
     SKIRRuntimeKernel *rtk = (SKIRRuntimeKernel *)k;
 
-    // disconnect the kernel
-    for (skir_stream_t **sptr = (skir_stream_t **)rtk->impl_ins; sptr && *sptr; sptr++) {
-        skir_stream_t *si = *sptr;
-        assert(rtk == (SKIRRuntimeKernel*)si->dst);
-        si->dst = (void*)-1;
+    if (verbose) {
+	errs() << "handleUncall: ";
+	errs() << rtk->work->getNameStr() << "\n";
     }
-    for (skir_stream_t **sptr = (skir_stream_t **)rtk->impl_outs; sptr && *sptr; sptr++) {
-        skir_stream_t *si = *sptr;
-        assert(rtk == (SKIRRuntimeKernel*)si->src);
-        si->src = (void*)-1;
+
+    // pausing waits out the work call we are in, a kernel replaces
+    // itself with become instead
+    if (rtk == SKIRRuntimeKernel::current()) {
+	errs() << "handleUncall: " << rtk->work->getNameStr()
+	       << " can't uncall itself, use become\n";
+	return false;
     }
 
-    rtk->sched->removeKernel(rtk);
-    getSG()->removeKernel(rtk);
+    // stop and disconnect the kernel, its streams keep their data
+    getSG()->uncallKernel(rtk);
+    return true;
+}
 
-    delete[] rtk->impl_ins;
-    delete[] rtk->impl_outs;
-    rtk->impl_ins = 0;
-    rtk->impl_outs = 0;
+// 
+// SKIRRuntime::handleReconfigureInst - replace a running kernel with 
+//  the null terminated list of kernels ks, see SKIRRuntimeGraph::becomeKernel
+bool
+SKIRRuntime::handleReconfigureInst(void *k, void *ks)
+{
+    SKIRRuntimeKernel *old_rtk = (SKIRRuntimeKernel *)k;
+    std::vector<SKIRRuntimeKernel *> kernels;
 
-    delete[] rtk->rt_ins;
-    delete[] rtk->rt_outs;
-    rtk->rt_ins = 0;
-    rtk->rt_outs = 0;
+    for (SKIRRuntimeKernel **kptr = (SKIRRuntimeKernel **)ks; kptr && *kptr; kptr++)
+	kernels.push_back(*kptr);
 
     if (verbose) {
-	errs() << "handleUncall: ";
-	errs() << rtk->work->getNameStr() << "\n";
+	errs() << "handleReconfigure: ";
+	errs() << old_rtk->work->getNameStr() << "\n";
     }
+
+    // see handleUncallInst
+    if (old_rtk == SKIRRuntimeKernel::current()) {
+	errs() << "handleReconfigure: " << old_rtk->work->getNameStr()
+	       << " can't reconfigure itself, use become\n";
+	return false;
+    }
+
+    return getSG()->becomeKernel(old_rtk, kernels);
 }
 
+//
+// SKIRRuntime::handleBecomeInst - entry point for skir.become instructions
+//  the kernel that owns the streams is the caller, so it is already
+//  stopped and doesn't need to be paused
 void
 SKIRRuntime::handleBecomeInst(void *k, void *is, void *os)
 {
@@ -331,7 +401,7 @@ SKIRRuntime::handleBecomeInst(void *k, void *is, void *os)
     std::vector<SKIRRuntimeStream *> ins;
     std::vector<SKIRRuntimeStream *> outs;
 
-    // locate and disconnect old kernel
+    // locate old kernel
     // build vectors of RuntimeStream: ins, outs
     for (skir_stream_t **sptr = impl_ins; sptr && *sptr; sptr++) {
 	skir_stream_t *si = *sptr;
@@ -339,7 +409,6 @@ SKIRRuntime::handleBecomeInst(void *k, void *is, void *os)
 	ins.push_back(rs);
 	if (old_rtk) assert(old_rtk == (SKIRRuntimeKernel*)si->dst);
 	else old_rtk = (SKIRRuntimeKernel*)si->dst;
-	si->dst = (void*)-1;
     }
     
     for (skir_stream_t **sptr = impl_outs; sptr && *sptr; sptr++) {
@@ -348,25 +417,21 @@ SKIRRuntime::handleBecomeInst(void *k, void *is, void *os)
 	outs.push_back(rs);
 	if (old_rtk) assert(old_rtk == (SKIRRuntimeKernel*)si->src);
 	else old_rtk = (SKIRRuntimeKernel*)si->src;
-	si->src = (void*)-1;
     }
 
-    old_rtk->sched->removeKernel(old_rtk);
-    getSG()->removeKernel(old_rtk);
+    assert(old_rtk && "handleBecome: no kernel to become");
 
-    delete[] old_rtk->impl_ins;
-    delete[] old_rtk->impl_outs;
-    old_rtk->impl_ins = 0;
-    old_rtk->impl_outs = 0;
+    if (verbose) {
+	errs() << "handleBecome: ";
+	errs() << old_rtk->work->getNameStr() << " -> " << new_rtk->work->getNameStr() << "\n";
+    }
 
-    delete[] old_rtk->rt_ins;
-    delete[] old_rtk->rt_outs;
-    old_rtk->rt_ins = 0;
-    old_rtk->rt_outs = 0;
+    // disconnect the old kernel
+    getSG()->uncallKernel(old_rtk, false);
 
     // setup new kernel
-    new_rtk->nins = old_rtk->nins;
-    new_rtk->nouts = old_rtk->nouts;
+    new_rtk->nins = ins.size();
+    new_rtk->nouts = outs.size();
     new_rtk->rt_ins = new SKIRRuntimeStream*[new_rtk->nins+1];
     new_rtk->rt_outs = new SKIRRuntimeStream*[new_rtk->nouts+1];
     
@@ -378,11 +443,6 @@ SKIRRuntime::handleBecomeInst(void *k, void *is, void *os)
 	new_rtk->rt_outs[i] = outs[i];
     new_rtk->rt_outs[new_rtk->nouts] = 0;
 
-    if (verbose) {
-	errs() << "handleBecome: ";
-	errs() << old_rtk->work->getNameStr() << " -> " << new_rtk->work->getNameStr() << "\n";
-    }
-
     getSG()->callKernel(new_rtk);
 }
 
@@ -405,6 +465,14 @@ SKIRRuntime::handleStreamInst(unsigned elem_size)
     SKIRRuntimeStream *rs = newStream();
     rs->type = SKIRRuntimeStream::NATIVE;
     rs->elem_size = elem_size;
+    // whole elements, the specialized stream ops only know STREAM_BUFFER_SIZE
+    // and take any other size for one that can grow (see SKIRStreamOpts)
+    rs->qsize = skir_stream_buffer_size(elem_size, STREAM_BUFFER_SIZE);
+    if (rs->qsize != STREAM_BUFFER_SIZE)
+	rs->max_size = rs->qsize;
+    // D4R grows streams to break artificial deadlocks
+    if (options.tbb_d4r)
+	rs->max_size = skir_stream_buffer_size(elem_size, STREAM_MAX_BUFFER_SIZE);
     return (void *)rs;
 }
 
@@ -444,6 +512,24 @@ SKIRRuntime::addSymbol(const char *name, vfp symbol)
     sys::DynamicLibrary::AddSymbol(name, (void*)symbol);
 }
 
+// once per process, shared by all runtime instances
+static void
+initializeProcess(void)
+{
+    atexit(llvm_shutdown);  // Call llvm_shutdown() on exit.
+    InitializeNativeTarget();
+
+    // call before creating runtimegraph or schedulers
+    // because both can create threads
+    llvm_start_multithreaded();
+}
+
+struct skir_event_thread {
+    SKIRRuntime &rt;
+    skir_event_thread(SKIRRuntime &runtime) : rt(runtime) {}
+    void operator()() { rt.runEvents(); }
+};
+
 //
 //
 //
@@ -453,26 +539,25 @@ SKIRRuntime::initialize(int nthreads)
     if (initialized)
 	return;
 
-    LLVMContext &CTX = getGlobalContext();
+    // each instance compiles in its own context so instances never
+    // contend on (or corrupt) each other's types and constants
+    host_ctx = new LLVMContext();
+    LLVMContext &CTX = *host_ctx;
     string errormsg;
     
     setNumThreads(nthreads);
 
-    atexit(llvm_shutdown);  // Call llvm_shutdown() on exit.
-    InitializeNativeTarget();
+    static pthread_once_t process_init = PTHREAD_ONCE_INIT;
+    pthread_once(&process_init, initializeProcess);
 
-    // load the runtime bitcode library
-    string skir_root(getenv("SKIR_OBJ_ROOT"));
-    string filename = skir_root+"/lib/inline_stream_ops.bc";
-    if (MemoryBuffer *buffer = MemoryBuffer::getFileOrSTDIN(filename, &errormsg)) {
-	setModule(ParseBitcodeFile(buffer, CTX, &errormsg));
-	delete buffer;
-    }
+    // the runtime bitcode library is linked in; function bodies are only
+    // read when the JIT or getInlineCode asks for them
+    setModule(getRuntimeModule(CTX, &errormsg));
     if (!getModule()) {
-	errs() << "bitcode: '" << filename << "' didn't read correctly:";
+	errs() << "bitcode: 'inline_stream_ops.bc' didn't read correctly:";
 	if (errormsg.size()) errs() << errormsg;
 	errs() << "\n";
-	assert(0 && "Failed to read SKIR_OBJ_ROOT/lib/inline_stream_ops.bc");
+	assert(0 && "Failed to read embedded inline_stream_ops.bc");
     }
 
     // If we are supposed to override the target triple for the host, do so now.
@@ -495,15 +580,27 @@ SKIRRuntime::initialize(int nthreads)
 	    //return false;
 	}
     }
+
+    // getInlineCode reads function bodies the JIT may be reading too
+    setModuleLock(getModule(), &getCG()->lock);
     
+    // keeps its maps under the JIT lock, getCodeSize reads them under it
     class mylistener : public JITEventListener {
+	sys::Mutex &lock;
 	std::map<void*, Function*> &fnMap;
+	std::map<const Function*, size_t> &codeSize;
+	size_t &codeBytes;
     public:
-	mylistener(std::map<void*, Function*> &fnMap) : fnMap(fnMap) {}
+	mylistener(sys::Mutex &lock, std::map<void*, Function*> &fnMap,
+		   std::map<const Function*, size_t> &codeSize, size_t &codeBytes)
+	    : lock(lock), fnMap(fnMap), codeSize(codeSize), codeBytes(codeBytes) {}
 	virtual void NotifyFunctionEmitted(const Function &F,
 					   void *FnStart, size_t FnSize,
 					   const EmittedFunctionDetails &Details) {
+	    MutexGuard locked(lock);
 	    fnMap[FnStart] = const_cast<Function*>(&F);
+	    codeSize[&F] += FnSize;
+	    codeBytes += FnSize;
 	    if (0) {
 		//objdump -b binary -m i386-64 -D /tmp/skir_*.bin 
 		outs() << "func@" << FnStart << " " << F.getNameStr() << " " << FnSize << "\n";
@@ -516,18 +613,33 @@ SKIRRuntime::initialize(int nthreads)
 	}
 	virtual void NotifyFunctionStubEmitted(const Function &F,
 					       void *Addr, void *Stub) {
+	    MutexGuard locked(lock);
 	    fnMap[Stub] = const_cast<Function*>(&F);
 	    if (0)
 		outs() << "stub@" << Stub << " " << F.getNameStr() << "\n";
 	}
+	// SKIRRuntimeGraph::reclaimCode, the address may be reused
+	virtual void NotifyFreeingMachineCode(void *OldPtr) {
+	    MutexGuard locked(lock);
+	    std::map<void*, Function*>::iterator I = fnMap.find(OldPtr);
+	    if (I == fnMap.end())
+		return;
+	    std::map<const Function*, size_t>::iterator S = codeSize.find(I->second);
+	    if (S != codeSize.end()) {
+		codeBytes -= S->second;
+		codeSize.erase(S);
+	    }
+	    fnMap.erase(I);
+	}
     };
 
     getCG()->RegisterJITEventListener(createOProfileJITEventListener());
-    getCG()->RegisterJITEventListener(new mylistener(fn_map));
+    getCG()->RegisterJITEventListener(new mylistener(getCG()->lock, fn_map, code_size, code_bytes));
     getCG()->DisableLazyCompilation();
 
-    sys::DynamicLibrary::LoadLibraryPermanently("/lib/libc.so.6");
-    sys::DynamicLibrary::LoadLibraryPermanently("/usr/lib/libstdc++.so.6");
+    // resolve external symbols (libc, libstdc++, ...) against whatever the
+    // process was linked with rather than hard-coded library paths
+    sys::DynamicLibrary::LoadLibraryPermanently(0);
 
     // runtime entry points
     typedef void (*vfp)(void);
@@ -539,6 +651,8 @@ SKIRRuntime::initialize(int nthreads)
     addSymbol("__SKIR_push", (vfp)__SKIR_push);
     addSymbol("__SKIR_pop", (vfp)__SKIR_pop);
     addSymbol("__SKIRRT_become", (vfp)__SKIRRT_become);
+    addSymbol("__SKIRRT_uncall", (vfp)__SKIRRT_uncall);
+    addSymbol("__SKIRRT_reconfigure", (vfp)__SKIRRT_reconfigure);
 
 #if 0
     addSymbol("__SKIRRT_yield32", (vfp)__SKIRRT_yield32);
@@ -548,17 +662,16 @@ SKIRRuntime::initialize(int nthreads)
     addSymbol("__SKIRRT_return64", (vfp)__SKIRRT_return64);
 #endif
 
-    // call before creating runtimegraph or schedulers
-    // because both can create threads
-    llvm_start_multithreaded();
-
     // create a stream graph
     setSG(new SKIRRuntimeGraph(*this));
     assert(getSG() && "Error creating Runtime Stream Graph!");
     getSG()->setVerbose(verbose);
 
     // create the default host scheduler
-    setSched(getSG()->getTbbSched());
+    if (options.steal_sched)
+	setSched(getSG()->getStealSched());
+    else
+	setSched(getSG()->getTbbSched());
     //setSched(new SKIRMergeSched(getSG()));
     //setSched(new SKIRDPSched(getSG(), 2));
 
@@ -568,9 +681,80 @@ SKIRRuntime::initialize(int nthreads)
     //getCG()->runStaticConstructorsDestructors(false);
     //getSched()->start();
 
+    // start the control thread that applies graph-mutating events
+    event_queue = new SKIREventQueue();
+    event_thread = new tbb::tbb_thread(skir_event_thread(*this));
+
     initialized = true;
 }
 
+//
+// event queueing
+//
+
+// requests that only read runtime state and can be served by any thread
+static bool
+isReadOnlyEvent(const std::string &type)
+{
+    return !type.compare("EchoRequest") ||
+	!type.compare("DotRequest") ||
+	!type.compare("StatsRequest");
+}
+
+// a wait blocks its client until the kernel is done, not the control thread
+static bool
+isWaitEvent(const std::string &type)
+{
+    return !type.compare("WaitRequest");
+}
+
+void *
+SKIRRuntime::getAddr(unsigned int id)
+{
+    MutexGuard locked(addr_lock);
+    std::map<unsigned int, void*>::iterator I = addr_map.find(id);
+    return I == addr_map.end() ? 0 : I->second;
+}
+
+void
+SKIRRuntime::setAddr(unsigned int id, void *addr)
+{
+    MutexGuard locked(addr_lock);
+    addr_map[id] = addr;
+}
+
+bool
+SKIRRuntime::postEvent(std::stringstream *event)
+{
+    assert(event_queue && "runtime not started");
+
+    // peek at the type line without consuming it
+    const std::string &s = event->str();
+    std::string type = s.substr(0, s.find_first_of("\r\n"));
+
+    if (isReadOnlyEvent(type) || isWaitEvent(type))
+	return onEvent(event);
+
+    skir_event_t e(event);
+    event_queue->push(&e);
+    while (sem_wait(&e.done) != 0)
+	;
+    return e.die;
+}
+
+void
+SKIRRuntime::runEvents(void)
+{
+    while (1) {
+	skir_event_t *e = event_queue->pop();
+	// posted by the destructor, nobody waits on it
+	if (!e->event)
+	    return;
+	e->die = onEvent(e->event);
+	sem_post(&e->done);
+    }
+}
+
 //
 // event handling
 //
@@ -665,15 +849,15 @@ SKIRRuntime::onEvent(std::stringstream *event)
 	event->str(std::string(""));
 
 	// execute call instruction
-	void *kernel = (void*)addr_map[req.kernel()];
+	void *kernel = getAddr(req.kernel());
 	void **ins = new void*[req.ins_size()+1];
 	void **outs = new void*[req.outs_size()+1];
 	for (int i=0; i<req.ins_size(); i++) {
-	    ins[i] = (void*)addr_map[req.ins(i)];
+	    ins[i] = getAddr(req.ins(i));
 	    //std::cout << ins[i] << "\n";
 	}
 	for (int i=0; i<req.outs_size(); i++) {
-	    outs[i] = (void*)addr_map[req.outs(i)];
+	    outs[i] = getAddr(req.outs(i));
 	    //std::cout << outs[i] << "\n";
 	}
 	ins[req.ins_size()] = 0;
@@ -725,13 +909,19 @@ SKIRRuntime::onEvent(std::stringstream *event)
 	}
 	
 	//printf("kernel req arg id %p\n", req.args());
-	void *args = addr_map[ req.args() ];
+	void *args = getAddr(req.args());
 	//printf("kernel req args %p\n", args);
 
 	void *k = handleKernelInst(workF, args);
+
+	// record the state size for checkpointing
+	if (req.has_state_size())
+	    ((SKIRRuntimeKernel*)k)->state_size = req.state_size();
+	else if (addr_size.count(args))
+	    ((SKIRRuntimeKernel*)k)->state_size = addr_size[args];
 	
 	unsigned int id = req.request_id();
-	addr_map[id] = k;
+	setAddr(id, k);
 
 	RequestResponse ret;
 	ret.set_request_id(id);
@@ -758,7 +948,7 @@ SKIRRuntime::onEvent(std::stringstream *event)
 	}
 
 	unsigned int id = req.request_id();
-	addr_map[id] = s;
+	setAddr(id, s);
 
 	RequestResponse ret;
 	ret.set_request_id(id);
@@ -790,7 +980,8 @@ SKIRRuntime::onEvent(std::stringstream *event)
 	char *data = (char*)mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 	assert(data != MAP_FAILED);
 
-	addr_map[shm_id] = data;
+	setAddr(shm_id, data);
+	addr_size[data] = len;
 	//printf("new shm id %d = %p n=%d\n", shm_id, data, len);
 
 	RequestResponse ret;
@@ -823,7 +1014,7 @@ SKIRRuntime::onEvent(std::stringstream *event)
 	    if (req.has_data_id()) {
 		assert(!req.has_data_bytes());
 		data_id = req.data_id();
-		s = addr_map[data_id];
+		s = getAddr(data_id);
 		//printf("lookup ");
 	    } else {
 		assert(req.has_data_bytes());
@@ -840,7 +1031,8 @@ SKIRRuntime::onEvent(std::stringstream *event)
 
 		const char *c = req.mutable_data_bytes()->data();
 		memcpy(s, c, n);
-		addr_map[data_id] = s;
+		setAddr(data_id, s);
+		addr_size[s] = n;
 		//printf("setting ");
 	    }
 
@@ -859,7 +1051,7 @@ SKIRRuntime::onEvent(std::stringstream *event)
 	else if (req.has_type() && req.type() == StateRequest::GET) {
 	    assert(0);
 	    // get from here
-	    char *p = (char*)addr_map[ req.data_id() ];
+	    char *p = (char*)getAddr(req.data_id());
 	    size_t n = req.length();
 	    std::string data_bytes(p, n);
 	    
@@ -898,6 +1090,126 @@ SKIRRuntime::onEvent(std::stringstream *event)
 	    getSG()->unPauseKernel((SKIRRuntimeKernel *)req.kernel());
     }
 
+    // hot swap or splice kernels
+    else if (!type.compare("ReconfigureRequest")) {
+	ReconfigureRequest req;
+	req.ParseFromIstream(event);
+	event->str(std::string(""));
+
+	RequestResponse ret;
+	ret.set_request_id(req.request_id());
+	std::stringstream err;
+
+	SKIRRuntimeKernel *kernel = (SKIRRuntimeKernel *)getAddr(req.kernel());
+	if (!kernel || !kernel->sched)
+	    err << "ReconfigureRequest: kernel " << req.kernel() << " is not running\n";
+
+	void **kernels = new void*[req.kernels_size()+1];
+	for (int i=0; i<req.kernels_size(); i++) {
+	    kernels[i] = getAddr(req.kernels(i));
+	    if (!kernels[i])
+		err << "ReconfigureRequest: no kernel " << req.kernels(i) << "\n";
+	}
+	kernels[req.kernels_size()] = 0;
+
+	// nothing changes unless every id is good
+	if (err.str().empty()) {
+	    bool ok;
+	    if (req.kernels_size())
+		ok = handleReconfigureInst(kernel, kernels);
+	    else
+		ok = handleUncallInst(kernel);
+	    if (!ok)
+		err << "ReconfigureRequest: kernel " << req.kernel() 
+		    << " can't be reconfigured, see the runtime's log\n";
+	}
+	delete[] kernels;
+
+	if (!err.str().empty()) {
+	    if (verbose)
+		errs() << err.str();
+	    ret.set_type(RequestResponse::ERR);
+	    ret.set_data_string(err.str());
+	}
+
+	std::string response;
+	if (!ret.SerializeToString(&response))
+	    errs() << "ReconfigureRequest: failed to serialize response\n";
+	event->str(response);
+
+	return false;
+    }
+
+    // checkpoint/restore
+    else if (!type.compare("CheckpointRequest")) {
+	CheckpointRequest req;
+	req.ParseFromIstream(event);
+	event->str(std::string(""));
+
+	bool ok;
+	if (req.type() == CheckpointRequest::RESTORE)
+	    ok = getSG()->restore(req.file().c_str());
+	else
+	    ok = getSG()->checkpoint(req.file().c_str());
+
+	RequestResponse ret;
+	ret.set_request_id(req.request_id());
+	if (!ok) {
+	    ret.set_type(RequestResponse::ERR);
+	    ret.set_data_string("CheckpointRequest: failed on '" + req.file() + "'\n");
+	}
+
+	std::string response;
+	if (!ret.SerializeToString(&response))
+	    errs() << "CheckpointRequest: failed to serialize response\n";
+	event->str(response);
+	return false;
+    }
+
+    // wait for a called kernel to finish, on the client's thread
+    else if (!type.compare("WaitRequest")) {
+	WaitRequest req;
+	req.ParseFromIstream(event);
+	event->str(std::string(""));
+
+	RequestResponse ret;
+	ret.set_request_id(req.request_id());
+	void *kernel = getAddr(req.kernel());
+	if (kernel)
+	    handleWaitInst(kernel);
+	else {
+	    std::stringstream ss;
+	    ss << "WaitRequest: no kernel " << req.kernel();
+	    ret.set_type(RequestResponse::ERR);
+	    ret.set_data_string(ss.str());
+	}
+
+	std::string response;
+	ret.SerializeToString(&response);
+	event->str(response);
+	return false;
+    }
+
+    // per kernel counters
+    else if (!type.compare("StatsRequest")) {
+	StatsRequest req;
+	req.ParseFromIstream(event);
+	event->str(std::string(""));
+
+	std::stringstream stats;
+	getSG()->stats(stats);
+
+	RequestResponse ret;
+	ret.set_request_id(req.request_id());
+	ret.set_type(RequestResponse::STRING);
+	ret.set_data_string(stats.str());
+
+	std::string response;
+	ret.SerializeToString(&response);
+	event->str(response);
+	return false;
+    }
+
     // .
     else if (!type.compare("DotRequest")) {
 	DotRequest req;
@@ -1051,6 +1363,20 @@ extern "C"
 	rt->handleBecomeInst(k, ins, outs);
     }
 
+    void
+    __SKIRRT_uncall(void *me, void *k)
+    {
+	SKIRRuntime *rt = (SKIRRuntime *)me;
+	rt->handleUncallInst(k);
+    }
+
+    void
+    __SKIRRT_reconfigure(void *me, void *k, void *kernels)
+    {
+	SKIRRuntime *rt = (SKIRRuntime *)me;
+	rt->handleReconfigureInst(k, kernels);
+    }
+
     void
     __SKIRRT_would_block(void *, void*)
     {
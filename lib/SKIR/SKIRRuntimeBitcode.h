@@ -0,0 +1,56 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#ifndef _SKIR_RUNTIME_BITCODE_H_
+#define _SKIR_RUNTIME_BITCODE_H_
+
+#include <llvm/Module.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/System/Mutex.h>
+#include <string>
+
+//
+// Runtime bitcode libraries linked into libLLVMSKIRPasses at build time.
+//
+// The modules are returned with their function bodies left in the bitcode;
+// bodies are read in on first Materialize() (the JIT does this itself in
+// getPointerToFunction, getInlineCode does it for anything it hands out).
+//
+namespace llvm {
+
+// inline_stream_ops.bc - stream op templates and runtime skeletons
+Module *getRuntimeModule(LLVMContext &CTX, std::string *errormsg=0);
+
+// skir_opencl_mod.bc - OpenCL builtin declarations
+Module *getOpenCLRuntimeModule(LLVMContext &CTX, std::string *errormsg=0);
+
+// read in F and everything it (transitively) references, under the lock
+// set for its module if there is one
+bool materializeFunction(Function *F, std::string *errormsg=0);
+
+// the lock whoever else reads M's bodies holds, e.g. the JIT lock of the
+// runtime whose module it is.  0 removes it
+void setModuleLock(Module *M, sys::Mutex *lock);
+
+}
+
+#endif
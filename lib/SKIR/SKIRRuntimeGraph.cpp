@@ -25,10 +25,14 @@
 #include "llvm/Support/CommandLine.h"
 #include <llvm/Intrinsics.h>
 #include <llvm/IntrinsicInst.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Target/TargetData.h>
 
 #include <vector>
+#include <algorithm>
 #include <assert.h>
 #include <fstream>
+#include <sstream>
 
 #include <SKIR/SKIRRuntime.h>
 #include "SKIRRuntimeGraph.h"
@@ -42,6 +46,10 @@
 #include "SKIRMergeSched.h"
 #include "SKIRSingleThreadSched.h"
 #include "SKIRKoroSched.h"
+#include "SKIRKernelModule.h"
+#include "SKIRStealSched.h"
+#include "SKIRNuma.h"
+#include "SKIR_kernel_t.h"
 
 #ifdef USE_OPENCL
 #include "SKIROpenCLSched.h"
@@ -53,37 +61,37 @@ using namespace std;
 //
 // command line options are here
 //
-bool EnableOpenCLSched;
+bool llvm::EnableOpenCLSched;
 static llvm::cl::opt<bool, true>
 FakeEnableOpenCL("enable-opencl",
 		 llvm::cl::desc("enable opencl scheduler"),
 		 llvm::cl::location(EnableOpenCLSched), llvm::cl::init(false));
 
-int OpenCLMultiplier;
+int llvm::OpenCLMultiplier;
 static llvm::cl::opt<int, true>
 FakeOpenCLMultiplier("opencl-mult",
 		     llvm::cl::desc(""),
 		     llvm::cl::location(OpenCLMultiplier), llvm::cl::init(1));
 
-bool ForceSingleSched;
+bool llvm::ForceSingleSched;
 static llvm::cl::opt<bool, true>
 FakeForceSingle("force-single",
 		 llvm::cl::desc("only use the single threaded scheduler"),
 		 llvm::cl::location(ForceSingleSched), llvm::cl::init(false));
 
-bool ForceTPK;
+bool llvm::ForceTPK;
 static llvm::cl::opt<bool, true>
 FakeForceTPK("force-tpk",
 	     llvm::cl::desc("use a single thread for each kernel"),
 	     llvm::cl::location(ForceTPK), llvm::cl::init(false));
 
-bool EnableDPSched;
+bool llvm::EnableDPSched;
 static llvm::cl::opt<bool, true>
 FakeEnableDP("enable-dp",
 	     llvm::cl::desc("enable data parallel scheduler"),
 	     llvm::cl::location(EnableDPSched), llvm::cl::init(false));
 
-int DPWidth;
+int llvm::DPWidth;
 static llvm::cl::opt<int, true>
 FakeDPWidth("dp-width",
 	     llvm::cl::desc("width of data parallel scheduler"),
@@ -101,6 +109,36 @@ FakeMergeThresh("merge-thresh",
 		llvm::cl::desc("merge threshold in cycles"),
 		llvm::cl::location(MergeThresh), llvm::cl::init(100));
 
+bool llvm::LatencyMode;
+static llvm::cl::opt<bool, true>
+FakeLatencyMode("latency-mode",
+		llvm::cl::desc("bound each kernel dispatch for low latency instead of batching"),
+		llvm::cl::location(LatencyMode), llvm::cl::init(false));
+
+int llvm::QuantumIters;
+static llvm::cl::opt<int, true>
+FakeQuantumIters("quantum-iters",
+		 llvm::cl::desc("latency mode: iterations per dispatch, 0 for no limit"),
+		 llvm::cl::location(QuantumIters), llvm::cl::init(64));
+
+int llvm::QuantumCycles;
+static llvm::cl::opt<int, true>
+FakeQuantumCycles("quantum-cycles",
+		  llvm::cl::desc("latency mode: cycles per dispatch, 0 for no limit"),
+		  llvm::cl::location(QuantumCycles), llvm::cl::init(0));
+
+int llvm::LatencyDepth;
+static llvm::cl::opt<int, true>
+FakeLatencyDepth("latency-depth",
+		 llvm::cl::desc("latency mode: end a dispatch once an output holds this many bytes"),
+		 llvm::cl::location(LatencyDepth), llvm::cl::init(4096));
+
+bool llvm::KernelModules;
+static llvm::cl::opt<bool, true>
+FakeKernelModules("kernel-modules",
+		  llvm::cl::desc("compile each kernel in its own module and JIT"),
+		  llvm::cl::location(KernelModules), llvm::cl::init(false));
+
 // float ParallelThresh;
 // static llvm::cl::opt<float, true>
 // FakeParallelThresh("parallel-thresh",
@@ -116,12 +154,30 @@ SKIRRuntimeGraph::SKIRRuntimeGraph(SKIRRuntime &runtime)
     : rt(runtime), verbose(false)
 {
     adj.reserve(10240);
+    version = 0;
+    placed_version = 0;
+
+    const SKIRRuntimeOptions &opts = rt.getOptions();
+
+    latency_mode = opts.latency_mode;
+    quantum_iters = opts.quantum_iters;
+    quantum_cycles = opts.quantum_cycles;
+    latency_depth = opts.latency_depth;
+    kernel_modules = opts.kernel_modules;
+
+    the_dp_sched = 0;
+    the_opencl_sched = 0;
+    the_merge_sched = 0;
+    the_steal_sched = 0;
 
     the_tbb_sched = new SKIRTbbSched(this, rt.getNumThreads());
 
-    the_koro_sched = new SKIRKoroSched(this);
+    if (opts.steal_sched)
+	the_steal_sched = new SKIRStealSched(this, rt.getNumThreads());
+
+    the_koro_sched = new SKIRKoroSched(this, rt.getNumThreads());
 
-    if (EnableOpenCLSched) {
+    if (opts.enable_opencl) {
 #ifdef USE_OPENCL	
 	the_opencl_sched = new SKIROpenCLSched(this);
 	the_opencl_sched->setVerbose(false);
@@ -130,7 +186,7 @@ SKIRRuntimeGraph::SKIRRuntimeGraph(SKIRRuntime &runtime)
 #endif
     }
 
-    if (EnableDPSched) {
+    if (opts.enable_dp) {
 	the_dp_sched= new SKIRDPSched(this, rt.getNumThreads());
     }
     
@@ -140,10 +196,22 @@ SKIRRuntimeGraph::SKIRRuntimeGraph(SKIRRuntime &runtime)
 
     logfile_id = 0;
     hier_parent = 0;
+
+    ckpt_map = 0;
+    ckpt_len = 0;
+    ckpt_seq = 0;
 }
 
 SKIRRuntimeGraph::~SKIRRuntimeGraph()
 {
+    // before the schedulers drop the kernels' counters
+    if (verbose) {
+	std::stringstream ss;
+	stats(ss);
+	errs() << "------ kernel stats --------\n" << ss.str()
+	       << "----- end kernel stats -----\n";
+    }
+
 #ifdef USE_OPENCL
     if (the_opencl_sched) {
 	the_opencl_sched->stop();
@@ -161,6 +229,24 @@ SKIRRuntimeGraph::~SKIRRuntimeGraph()
 	delete the_dp_sched;
 	the_dp_sched = 0;
     }
+    if (the_koro_sched) {
+	the_koro_sched->stop();
+	delete the_koro_sched;
+	the_koro_sched = 0;
+    }
+    if (the_steal_sched) {
+	the_steal_sched->stop();
+	delete the_steal_sched;
+	the_steal_sched = 0;
+    }
+    if (the_tbb_sched) {
+	the_tbb_sched->stop();
+	delete the_tbb_sched;
+	the_tbb_sched = 0;
+    }
+
+    if (verbose && rt.getOptions().numa)
+	skir_numa_stats(errs());
 }
 
 void
@@ -168,6 +254,7 @@ SKIRRuntimeGraph::setVerbose(bool v)
 { 
     verbose = v;
     if (the_tbb_sched) the_tbb_sched->setVerbose(v);
+    if (the_steal_sched) the_steal_sched->setVerbose(v);
 #ifdef USE_OPENCL
     if (the_opencl_sched) the_opencl_sched->setVerbose(v);
 #endif
@@ -192,33 +279,7 @@ SKIRRuntimeGraph::callKernel(SKIRRuntimeKernel *kernel)
     //
     // setup the kernel if it hasn't been called before
     //
-    if (kernel->base_work == kernel->work) {  // XXX: this if statement sucks
-	
-	// - set the backend to use
-	kernel->cg = rt.getCG();
-	
-	// make runtime copies of work function and adjust prototypes
-	SKIRRuntime::runSKIRCloneWorkPass(kernel);
-
-	// run kernel analysis if required
-	if (!kernel->opt_only)
-	    SKIRRuntime::runSKIRKernelInfoPass(kernel);
-
-	// - add the kernel and new edges to the stream graph
-	addKernel(kernel);
-
-	if (kernel->is_hier) {
-	    codeGenKernel(kernel);
-	} 
-	else {
-	    // - set the scheduler to use
-	    selectScheduler(kernel);
-	}
-	
-	if (hier_parent) {
-	    hier_parent->children.push_back(kernel);
-	}
-    }
+    setupKernel(kernel);
 
     // 
     // do the call
@@ -247,6 +308,55 @@ SKIRRuntimeGraph::callKernel(SKIRRuntimeKernel *kernel)
     kernel->total_jit_time += (t_end - t_begin);
 }
 
+// setup a kernel the first time it is called
+//  - clone and analyze the work function
+//  - add the kernel to the stream graph
+//  - pick a scheduler, or codegen now if hierarchical
+void
+SKIRRuntimeGraph::setupKernel(SKIRRuntimeKernel *kernel)
+{
+    if (kernel->base_work != kernel->work) {  // XXX: this if statement sucks
+	// a kernel called again after uncallKernel, set up from scratch
+	// if its code was reclaimed in the meantime
+	if (unretireKernel(kernel)) {
+	    addKernel(kernel);
+	    return;
+	}
+	kernel->work = kernel->base_work;
+    }
+	
+    // - set the backend to use
+    kernel->cg = rt.getCG();
+	
+    // make runtime copies of work function and adjust prototypes
+    SKIRRuntime::runSKIRCloneWorkPass(kernel);
+
+    // splitters and joiners get a work function made for their weights,
+    // except where the scheduler runs work functions as they are
+    const SKIRRuntimeOptions &opts = rt.getOptions();
+    if (!kernel->opt_only && !opts.force_single && !opts.force_tpk)
+	SKIRRuntime::runSKIRSplitJoinPass(kernel);
+
+    // run kernel analysis if required
+    if (!kernel->opt_only)
+	SKIRRuntime::runSKIRKernelInfoPass(kernel);
+
+    // - add the kernel and new edges to the stream graph
+    addKernel(kernel);
+
+    if (kernel->is_hier) {
+	codeGenKernel(kernel);
+    } 
+    else {
+	// - set the scheduler to use
+	selectScheduler(kernel);
+    }
+	
+    if (hier_parent) {
+	hier_parent->children.push_back(kernel);
+    }
+}
+
 // add kernel to the wait list, put the thread to sleep
 void
 SKIRRuntimeGraph::waitKernel(SKIRRuntimeKernel *kernel)
@@ -299,10 +409,204 @@ SKIRRuntimeGraph::waitKernel(SKIRRuntimeKernel *kernel)
 #endif
 }
 
+// set the streams a kernel will be called with
+static void
+setKernelStreams(SKIRRuntimeKernel *kernel,
+		 std::vector<SKIRRuntimeStream*> &ins,
+		 std::vector<SKIRRuntimeStream*> &outs)
+{
+    kernel->nins = ins.size();
+    kernel->nouts = outs.size();
+    kernel->rt_ins = new SKIRRuntimeStream*[kernel->nins+1];
+    kernel->rt_outs = new SKIRRuntimeStream*[kernel->nouts+1];
+
+    for (int i=0; i<kernel->nins; i++)
+	kernel->rt_ins[i] = ins[i];
+    kernel->rt_ins[kernel->nins] = 0;
+
+    for (int i=0; i<kernel->nouts; i++)
+	kernel->rt_outs[i] = outs[i];
+    kernel->rt_outs[kernel->nouts] = 0;
+}
+
+// stop a called kernel and disconnect it from its streams.
+// the streams and any data buffered in them are left intact so that
+// another kernel can be called on them.  if quiesce is set, wait for the
+// kernel to finish its current call to work, otherwise the caller must
+// know that the kernel isn't running (e.g. it is the caller).
 void
+SKIRRuntimeGraph::uncallKernel(SKIRRuntimeKernel *kernel, bool quiesce)
+{
+    assert(kernel && kernel->sched && !kernel->is_hier);
+
+    if (quiesce)
+	kernel->sched->pauseKernel(kernel);
+
+    skir_stream_t **impl_ins = (skir_stream_t **)kernel->impl_ins;
+    skir_stream_t **impl_outs = (skir_stream_t **)kernel->impl_outs;
+
+    // the stream ends are unconnected until another kernel is called on them
+    for (skir_stream_t **sptr = impl_ins; sptr && *sptr; sptr++) {
+	skir_stream_t *si = *sptr;
+	assert(kernel == (SKIRRuntimeKernel*)si->dst || si->dst == (void*)2);
+	si->dst = (void*)-1;
+    }
+    for (skir_stream_t **sptr = impl_outs; sptr && *sptr; sptr++) {
+	skir_stream_t *si = *sptr;
+	assert(kernel == (SKIRRuntimeKernel*)si->src || si->src == (void*)2);
+	si->src = (void*)-1;
+    }
+
+    // hide the streams from the scheduler so removing the
+    // kernel doesn't free them
+    kernel->impl_ins = 0;
+    kernel->impl_outs = 0;
+
+    kernel->sched->removeKernel(kernel);
+    removeKernel(kernel);
+
+    delete[] impl_ins;
+    delete[] impl_outs;
+
+    delete[] kernel->rt_ins;
+    delete[] kernel->rt_outs;
+    kernel->rt_ins = 0;
+    kernel->rt_outs = 0;
+    kernel->nins = 0;
+    kernel->nouts = 0;
+
+    if (verbose) errs() << "SKIRRuntimeGraph::uncallKernel: "
+			<< kernel->work->getName() << "\n";
+
+    // a paused kernel's code can go, setupKernel makes new code if it is
+    // called again.  otherwise it is still returning from work (become)
+    if (quiesce) {
+	retireKernel(kernel);
+	reclaimCode();
+    }
+}
+
+// the size of the elements k pushes to its output idx, from the types
+// its pushes point to.  0 if it doesn't push there or they disagree
+static unsigned
+pushElemSize(SKIRRuntimeKernel *k, unsigned idx)
+{
+    Function *work = k->base_work ? k->base_work : k->work;
+    if (!work || work->isDeclaration())
+	return 0;
+    TargetData TD(work->getParent());
+
+    unsigned size = 0;
+    for (inst_iterator I = inst_begin(work), E = inst_end(work); I != E; ++I) {
+	CallInst *CI = dyn_cast<CallInst>(&*I);
+	if (!CI) continue;
+	Function *F = CI->getCalledFunction();
+	if (!isa<SKIRPushInst>(CI) && !(F && F->getName() == "__SKIR_push"))
+	    continue;
+	ConstantInt *s = dyn_cast<ConstantInt>(CI->getOperand(1));
+	if (!s || s->getZExtValue() != idx)
+	    continue;
+	const PointerType *PT =
+	    dyn_cast<PointerType>(CI->getOperand(2)->stripPointerCasts()->getType());
+	if (!PT)
+	    return 0;
+	unsigned n = TD.getTypeAllocSize(PT->getElementType());
+	if (size && n != size)
+	    return 0;
+	size = n;
+    }
+    return size;
+}
+
+// replace a running kernel with a pipeline of kernels.
+// the first kernel in the pipeline takes over the inputs of the
+// replaced kernel, the last takes over its outputs, and new streams with
+// the element size their producer pushes connect the kernels in between.
+// the replaced kernel may appear in the pipeline to splice kernels in
+// before or after it.
+//
+// the new kernels are analyzed and compiled before the old kernel is
+// stopped, so the pipeline only stalls for one call to the old work
+// function.
+//
+// false, with nothing changed, if a stream between the new kernels
+// can't be sized, e.g. because its producer pushes through a helper.
+bool
 SKIRRuntimeGraph::becomeKernel(SKIRRuntimeKernel *kernel, std::vector<SKIRRuntimeKernel*> &kernels)
 {
-    
+    assert(kernels.size() && "becomeKernel: no kernels to become");
+
+    int n = kernels.size();
+    std::vector<SKIRRuntimeStream*> old_ins(kernel->rt_ins, kernel->rt_ins + kernel->nins);
+    std::vector<SKIRRuntimeStream*> old_outs(kernel->rt_outs, kernel->rt_outs + kernel->nouts);
+
+    // streams between the new kernels, sized by what their producer
+    // pushes.  the replaced kernel still pushes what it always did
+    std::vector<unsigned> link_sizes;
+    for (int i=0; i<n-1; i++) {
+	unsigned elem_size;
+	if (kernels[i] == kernel && old_outs.size())
+	    elem_size = old_outs[0]->elem_size;
+	else
+	    elem_size = pushElemSize(kernels[i], 0);
+	if (!elem_size) {
+	    errs() << "SKIRRuntimeGraph::becomeKernel: can't tell what "
+		   << kernels[i]->work->getName() << " pushes, not replacing "
+		   << kernel->work->getName() << "\n";
+	    return false;
+	}
+	link_sizes.push_back(elem_size);
+    }
+    std::vector<SKIRRuntimeStream*> links;
+    for (int i=0; i<n-1; i++)
+	links.push_back((SKIRRuntimeStream*)rt.handleStreamInst(link_sizes[i]));
+
+    // prepare the new kernels while the old one keeps running
+    for (int i=0; i<n; i++) {
+	SKIRRuntimeKernel *k = kernels[i];
+	if (k == kernel) continue;
+
+	std::vector<SKIRRuntimeStream*> ins, outs;
+	if (i == 0) ins = old_ins;
+	else ins.push_back(links[i-1]);
+	if (i == n-1) outs = old_outs;
+	else outs.push_back(links[i]);
+
+	setKernelStreams(k, ins, outs);
+	setupKernel(k);
+	assert(!k->is_hier && "becomeKernel: can't become a hierarchical kernel");
+	if (!k->workfn)
+	    k->sched->runCodeGen(k);
+    }
+
+    // stop and disconnect the old kernel, its streams keep their data
+    uncallKernel(kernel, true);
+
+    // connect and start the new kernels
+    for (int i=0; i<n; i++) {
+	SKIRRuntimeKernel *k = kernels[i];
+	if (k == kernel) {
+	    std::vector<SKIRRuntimeStream*> ins, outs;
+	    if (i == 0) ins = old_ins;
+	    else ins.push_back(links[i-1]);
+	    if (i == n-1) outs = old_outs;
+	    else outs.push_back(links[i]);
+	    setKernelStreams(k, ins, outs);
+	    setupKernel(k);
+	}
+    }
+    for (int i=0; i<n; i++) {
+	allocateStreams(kernels[i]);
+	kernels[i]->sched->callKernel(kernels[i]);
+    }
+
+    if (verbose) {
+	errs() << "SKIRRuntimeGraph::becomeKernel: " << kernel->work->getName() << " ->";
+	for (int i=0; i<n; i++)
+	    errs() << " " << kernels[i]->work->getName();
+	errs() << "\n";
+    }
+    return true;
 }
 
 void
@@ -336,7 +640,9 @@ SKIRRuntimeGraph::selectScheduler(SKIRRuntimeKernel *kernel, SKIRScheduler *fix_
 
     kernel->sched = 0;
 
-    if (ForceSingleSched) {
+    const SKIRRuntimeOptions &opts = rt.getOptions();
+
+    if (opts.force_single) {
 	kernel->sched = the_koro_sched;
 	if (verbose) errs() << "KO: " << kernel->base_work->getName() << "\n";
 	kernel->sched->setVerbose(verbose);
@@ -344,7 +650,7 @@ SKIRRuntimeGraph::selectScheduler(SKIRRuntimeKernel *kernel, SKIRScheduler *fix_
 	return;
     }
 
-    if (ForceTPK) {
+    if (opts.force_tpk) {
 	kernel->opt_only = true;
 	kernel->sched = new SKIRSingleThreadSched(this);
 	if (verbose) errs() << "ST: " << kernel->base_work->getName() << "\n";
@@ -360,14 +666,14 @@ SKIRRuntimeGraph::selectScheduler(SKIRRuntimeKernel *kernel, SKIRScheduler *fix_
     //}
     
     if (kernel->is_fixed_rate) {
-	bool is_dp = !kernel->is_stateful && !kernel->has_peek;
-	if (EnableDPSched && is_dp) {
+	bool is_dp = !kernel->is_stateful && !kernel->has_peek && !kernel->no_dp;
+	if (opts.enable_dp && is_dp) {
 	    kernel->sched = the_dp_sched;
 	    if (verbose) errs() << "DP: " << kernel->base_work->getName() << "\n";
 	    return;
 	}
 #ifdef USE_OPENCL
-	else if (EnableOpenCLSched && is_dp) {
+	else if (opts.enable_opencl && is_dp) {
 	    the_opencl_sched->start();
 	    kernel->sched = the_opencl_sched;
 	    if (verbose) errs() << "CL: " << kernel->base_work->getName() << "\n";
@@ -398,13 +704,44 @@ SKIRRuntimeGraph::codeGenKernel(SKIRRuntimeKernel *kernel)
     } else {
 	 kernel->fpm = new FunctionPassManager(kernel->work->getParent());
 	 kernel->fpm->add(new TargetData(kernel->work->getParent()));
-	 SKIRRuntime::addLLVMOpts(kernel);
+	 addFinalOpts(kernel);
 	 codeGenKernel(kernel);
 	 return;
     }
+
+    if (kernel_modules) {
+	std::string err;
+	SKIRKernelModule *unit = SKIRKernelModule::create(kernel->cg, kernel->work,
+							  kernel->late_opts, &err);
+	if (unit) {
+	    kernel->late_opts = false;
+	    kernel->units.push_back(unit);
+	    void *fp = unit->getWorkFn();
+	    kernel->workfn = reinterpret_cast<work_function*>(reinterpret_cast<uintptr_t>(fp));
+	    kernel->code_bytes = unit->getCodeSize();
+	    return;
+	}
+	if (verbose) errs() << "codeGenKernel: " << kernel->work->getName()
+			    << " compiled in the host module: " << err << "\n";
+    }
+
+    if (kernel->late_opts) {
+	kernel->late_opts = false;
+	SKIRRuntime::runLLVMOpts(kernel);
+    }
     
     void *fp = kernel->cg->getPointerToFunction(kernel->work);//, host_arch);//, size);
     kernel->workfn = reinterpret_cast<work_function*>(reinterpret_cast<uintptr_t>(fp));
+    kernel->code_bytes = rt.getCodeSize(kernel->work);
+}
+
+void
+SKIRRuntimeGraph::addFinalOpts(SKIRRuntimeKernel *kernel)
+{
+    if (kernel_modules)
+	kernel->late_opts = true;
+    else
+	SKIRRuntime::addLLVMOpts(kernel);
 }
 
 // find limiter kernel
@@ -416,12 +753,14 @@ SKIRRuntimeGraph::getLimiter()
     SKIRRuntimeKernel *max = 0;
     std::map< SKIRRuntimeKernel*,unsigned > t;
 
+    MutexGuard locked(graph_lock);
+
     std::map< unsigned, SKIRRuntimeKernel* >::iterator I,E;
     for (I = id2kernel.begin(), E = id2kernel.end(); I!=E; ++I) {
 	SKIRRuntimeKernel *k = (*I).second;
-	if (!k || k->total_niter < 16)
+	t[k] = iterationCost(k);
+	if (!t[k])
 	    return 0;
-	t[k] = k->total_runtime / k->total_niter;
 	total += t[k];
 	if (!max || (t[k] > t[max])) max = k;
     }
@@ -430,6 +769,34 @@ SKIRRuntimeGraph::getLimiter()
     return max;
 }
 
+// quantumExpired - called between work calls of a dispatch of k
+//
+// In latency mode a dispatch ends after quantum_iters iterations or
+// quantum_cycles cycles, or as soon as one of k's outputs holds more than
+// latency_depth bytes, so a cheap producer can't fill its buffers ahead of
+// an expensive consumer.  The kernel is requeued, never held back, so this
+// can't deadlock where running to completion wouldn't.  niter counts the
+// dispatch's iterations and starts at 0.
+bool
+SKIRRuntimeGraph::quantumExpired(SKIRRuntimeKernel *k, size_t &niter)
+{
+    if (!latency_mode)
+	return false;
+
+    niter += k->rt_state->niter;
+    if (quantum_iters > 0 && niter >= (size_t)quantum_iters)
+	return true;
+    if (quantum_cycles > 0 && k->rt_state->cycles >= (unsigned long long)quantum_cycles)
+	return true;
+
+    for (int i=0; i<k->nouts && k->rt_outs; i++) {
+	skir_stream_t *s = k->rt_outs[i] ? k->rt_outs[i]->si : 0;
+	if (s && skir_stream_used(s) > (size_t)latency_depth)
+	    return true;
+    }
+    return false;
+}
+
 // perform kernel fission
 //
 void
@@ -479,6 +846,100 @@ SKIRRuntimeGraph::fuseKernels(SKIRRuntimeKernel *kernel0,
     return k;
 }
 
+// a kernel that will never be called again, e.g. fused into another one.
+// the scheduler must have removed it already
+//
+void
+SKIRRuntimeGraph::retireKernel(SKIRRuntimeKernel *kernel)
+{
+    MutexGuard locked(rt.getCG()->lock);
+    retired.push_back(kernel);
+}
+
+// take back a retired kernel that is called again, false if its code
+// was already reclaimed
+bool
+SKIRRuntimeGraph::unretireKernel(SKIRRuntimeKernel *kernel)
+{
+    MutexGuard locked(rt.getCG()->lock);
+    std::vector<SKIRRuntimeKernel*>::iterator I = std::find(retired.begin(), retired.end(), kernel);
+    if (I != retired.end())
+	retired.erase(I);
+    return !kernel->code.empty();
+}
+
+// drop the IR and machine code of a function the runtime generated
+static void
+releaseFunction(ExecutionEngine *cg, SKIRRuntimeKernel *k, Function *F)
+{
+    cg->freeMachineCodeForFunction(F);
+    // the kernel keeps the names of its work functions for logs and dot
+    if (F == k->work || F == k->base_work || !F->use_empty())
+	F->deleteBody();
+    else
+	F->eraseFromParent();
+}
+
+// free the code of retired kernels no scheduler can run anymore.
+// schedulers only remove a kernel while it is stopped between calls to
+// work (the TBB merge holds its lock, uncallKernel pauses it), and don't
+// call work again once sched_kernel is cleared
+//
+void
+SKIRRuntimeGraph::reclaimCode()
+{
+    ExecutionEngine *cg = rt.getCG();
+    std::vector<SKIRKernelModule*> units;
+
+    {
+	MutexGuard locked(cg->lock);
+
+	std::vector<SKIRRuntimeKernel*> busy;
+	for (unsigned i=0; i<retired.size(); i++) {
+	    SKIRRuntimeKernel *k = retired[i];
+	    if (k->sched_kernel) {
+		busy.push_back(k);
+		continue;
+	    }
+
+	    size_t bytes = 0;
+	    for (unsigned j=0; j<k->units.size(); j++) {
+		bytes += k->units[j]->getCodeSize();
+		units.push_back(k->units[j]);
+	    }
+	    k->units.clear();
+	    for (unsigned j=0; j<k->code.size(); j++) {
+		bytes += rt.getCodeSize(k->code[j]);
+		releaseFunction(cg, k, k->code[j]);
+	    }
+	    if (verbose) errs() << "reclaimCode: " << k->work->getName() << " "
+				<< k->code.size() << " functions, " << bytes << " bytes\n";
+
+	    k->code.clear();
+	    k->workfn = 0;
+	    k->code_bytes = 0;
+	}
+	retired.swap(busy);
+    }
+
+    // kernel modules have engines of their own, they don't need the host lock
+    for (unsigned i=0; i<units.size(); i++)
+	delete units[i];
+}
+
+void
+SKIRRuntimeGraph::freeCode(SKIRRuntimeKernel *kernel, Function *F)
+{
+    ExecutionEngine *cg = rt.getCG();
+    MutexGuard locked(cg->lock);
+
+    std::vector<Function*>::iterator I = std::find(kernel->code.begin(), kernel->code.end(), F);
+    if (I == kernel->code.end())
+	return;
+    kernel->code.erase(I);
+    releaseFunction(cg, kernel, F);
+}
+
 // allocate implementations details for the streams
 //
 void
@@ -497,7 +958,7 @@ SKIRRuntimeGraph::allocateStreams(SKIRRuntimeKernel *kernel)
 	SKIRRuntimeStream *s = sptr[i];
 	s->is_src = 1;
 	// already allocated when other end of stream seen first
-	if (!s->si) s->si = new_skir_stream_t(s);
+	if (!s->si) s->si = new_skir_stream_t(s, streamNode(kernel, s, true));
 	kins[i] = s->si;
 	if (s->type != SKIRRuntimeStream::SHARED)
 	    s->si->dst = kernel;
@@ -521,7 +982,7 @@ SKIRRuntimeGraph::allocateStreams(SKIRRuntimeKernel *kernel)
 	SKIRRuntimeStream *s = sptr[i];
 	s->is_dst = 1;
 	// already allocated when other end of stream seen first
-	if (!s->si) s->si = new_skir_stream_t(s);
+	if (!s->si) s->si = new_skir_stream_t(s, streamNode(kernel, s, false));
 	kouts[i] = s->si;
 	if (s->type != SKIRRuntimeStream::SHARED)
 	    s->si->src = kernel;
@@ -547,6 +1008,7 @@ SKIRRuntimeGraph::addKernel(SKIRRuntimeKernel *kernel)
 {
     assert(kernel->id < adj.capacity());
 
+    MutexGuard locked(graph_lock);
     if (id2kernel[kernel->id] == kernel)
 	return;
 
@@ -554,6 +1016,7 @@ SKIRRuntimeGraph::addKernel(SKIRRuntimeKernel *kernel)
 
     adj[kernel->id].clear();
     id2kernel[kernel->id] = kernel;
+    version++;
 
     //refreshAdjList();
 }
@@ -562,8 +1025,10 @@ SKIRRuntimeGraph::addKernel(SKIRRuntimeKernel *kernel)
 void
 SKIRRuntimeGraph::removeKernel(SKIRRuntimeKernel *kernel)
 {
+    MutexGuard locked(graph_lock);
     adj[kernel->id].clear();
     id2kernel.erase(kernel->id);
+    version++;
 }
 
 // add a directed edge to the graph
@@ -572,6 +1037,7 @@ SKIRRuntimeGraph::addEdge(SKIRRuntimeKernel *src, SKIRRuntimeKernel *dst)
 {
     if ((src == (SKIRRuntimeKernel*)-1) || (src == (SKIRRuntimeKernel*)1) || !src) return;
     if ((dst == (SKIRRuntimeKernel*)-1) || (dst == (SKIRRuntimeKernel*)1) || !dst) return;
+    MutexGuard locked(graph_lock);
     if (!id2kernel[src->id]) return;
 
     if (verbose) errs() << "addEdge: " << src->id << ", " << dst->id << "\n";
@@ -600,6 +1066,7 @@ SKIRRuntimeGraph::refreshAdjList(void)
 {
     std::set< SKIRRuntimeStream* > visited;
 
+    MutexGuard locked(graph_lock);
     for (unsigned int i=0; i<adj.capacity(); i++)
 	adj[i].clear();
 
@@ -638,9 +1105,13 @@ SKIRRuntimeGraph::dot(std::ostream &o)
     unsigned long long total_jit_time = 0;
     double min = 100000000;
     double max = 0;
+    // takes the JIT lock, which is held around calls into the graph
+    size_t code_bytes = rt.getCodeSize();
 
     //refreshAdjList();
 
+    MutexGuard locked(graph_lock);
+
     o << "digraph {\n"; //<< "rankdir=\"LR\"\n";
     std::map< unsigned, SKIRRuntimeKernel* >::iterator I,E;
     for (I = id2kernel.begin(), E = id2kernel.end(); I!=E; ++I) {
@@ -678,6 +1149,7 @@ SKIRRuntimeGraph::dot(std::ostream &o)
 	  << " [label=<" << k->work->getNameStr() \
 	  << " <BR/>\n  total_runtime = " << k->total_runtime \
 	  << " <BR/>\n  total_jit_time = " << k->total_jit_time \
+	  << " <BR/>\n  code_bytes = " << k->code_bytes \
 	  << " <BR/>\n  total_niter = "	<< k->total_niter \
 	  << " <BR/>\n  total_ncall = "	<< k->total_ncall \
 	  << " <BR/>\n  total_bytes = "	<< k->total_bytes \
@@ -697,15 +1169,53 @@ SKIRRuntimeGraph::dot(std::ostream &o)
     o << "}" << "\n";
     o << "# total cycles: " << total_runtime << "\n";
     o << "# total jit time: " << total_jit_time << "\n";
+    o << "# total code bytes: " << code_bytes << "\n";
     o << "# nkern: " << id2kernel.size() << "\n";
     o << "# min: " << min << "\n";
     o << "# max: " << max << "\n";
     o << "# aggr: " << (double)(total_bytes) / (double)(total_runtime) << "\n";
 }
 
+void
+SKIRRuntimeGraph::stats(std::ostream &o)
+{
+    MutexGuard locked(graph_lock);
+    std::map< unsigned, SKIRRuntimeKernel* >::iterator I,E;
+    for (I = id2kernel.begin(), E = id2kernel.end(); I!=E; ++I) {
+	SKIRRuntimeKernel *k = (*I).second;
+	if (!k) continue;
+	o << k->id << " " << k->work->getNameStr()
+	  << " niter=" << k->total_niter
+	  << " ncall=" << k->total_ncall
+	  << " runtime=" << k->total_runtime
+	  << " bytes=" << k->total_bytes
+	  << " jit_time=" << k->total_jit_time
+	  << " code_bytes=" << k->code_bytes;
+	// the task_stats of the current call, how often it blocked and
+	// retried under the tbb scheduler
+	if (kernel_t *kt = kernel_t::get(k)) {
+	    kernel_ref_t ref(kt);
+	    o << " tasks=" << kt->stats.num_tasks
+	      << " continues=" << kt->stats.num_continue
+	      << " steals=" << kt->stats.num_steal
+	      << " retries=" << kt->stats.num_retries;
+	}
+	if (rt.getOptions().numa)
+	    o << " node=" << k->numa_node;
+	o << "\n";
+    }
+
+    // where the stream buffers and kernel state are
+    if (rt.getOptions().numa) {
+	raw_os_ostream os(o);
+	skir_numa_stats(os);
+    }
+}
+
 void
 SKIRRuntimeGraph::topo_sort(list<SKIRRuntimeKernel *>& sorted)
 {
+    MutexGuard locked(graph_lock);
     refreshAdjList();
 
     int n = adj.capacity();
@@ -28,9 +28,12 @@
 #include "SKIRRuntimeKernel.h"
 #include "SKIRScheduler.h"
 
+#include <llvm/System/Mutex.h>
+
 #include <list>
 #include <vector>
 #include <map>
+#include <string>
 #include <iostream>
 
 namespace llvm {
@@ -51,16 +54,32 @@ public:
     void waitKernel(SKIRRuntimeKernel *kernel);
     void pauseKernel(SKIRRuntimeKernel *kernel);
     void unPauseKernel(SKIRRuntimeKernel *kernel);
-    void becomeKernel(SKIRRuntimeKernel *kernel, std::vector<SKIRRuntimeKernel*> &kernels);
+    void uncallKernel(SKIRRuntimeKernel *kernel, bool quiesce=true);
+    bool becomeKernel(SKIRRuntimeKernel *kernel, std::vector<SKIRRuntimeKernel*> &kernels);
     void codeGenKernel(SKIRRuntimeKernel *kernel);
+    // the LLVM opts that end a kernel's pipeline, deferred to the kernel's
+    // own module with -kernel-modules
+    void addFinalOpts(SKIRRuntimeKernel *kernel);
 
     unsigned getNumKernels() { return id2kernel.size(); }
 
     SKIRRuntimeKernel *getLimiter();
 
+    // bounded dispatches for latency sensitive graphs, the defaults come
+    // from -latency-mode, -quantum-iters, -quantum-cycles and -latency-depth
+    void setLatencyMode(bool on) { latency_mode = on; }
+    bool getLatencyMode() { return latency_mode; }
+    bool quantumExpired(SKIRRuntimeKernel *k, size_t &niter);
+    static unsigned long long iterationCost(SKIRRuntimeKernel *k);
+
+    // critical path priorities, see SKIRPriority.cpp
+    void updatePriorities(std::vector<SKIRRuntimeKernel *> &kernels);
+    void updatePriorities();
+
     void selectScheduler(SKIRRuntimeKernel *kernel, SKIRScheduler *sched=0);
 
     SKIRScheduler *getTbbSched() { return the_tbb_sched; }
+    SKIRScheduler *getStealSched() { return the_steal_sched; }
     SKIRScheduler *getDPSched() { return the_dp_sched; }
     SKIRScheduler *getOpenCLSched() { return the_opencl_sched; }
     
@@ -69,13 +88,41 @@ public:
 
     void removeKernel(SKIRRuntimeKernel *k);
 
+    // code of kernels that are gone (fused away, uncalled), see reclaimCode
+    void retireKernel(SKIRRuntimeKernel *k);
+    bool unretireKernel(SKIRRuntimeKernel *k);
+    void reclaimCode();
+    // free one function of k that never ran, e.g. from a failed fusion
+    void freeCode(SKIRRuntimeKernel *k, Function *F);
+
+    // checkpoint/restore kernel state and stream contents, see SKIRCheckpoint.cpp
+    bool checkpoint(const char *file);
+    bool restore(const char *file);
+
     void log();
     void dot(std::ostream &output_stream);
+    // a line of counters per kernel, and with -numa one per node, for
+    // StatsRequest
+    void stats(std::ostream &output_stream);
     void topo_sort(std::list<SKIRRuntimeKernel *> &output);
 
+    // partition the graph into per-core regions, see SKIRPlacement.cpp.
+    // the scheduler that uses the regions places the graph when
+    // placementStale says it changed, and again as measurements come in
+    void placeKernels(int nparts);
+    bool placementStale() { return placed_version != version; }
+
+    // NUMA placement and migration, see SKIRNuma.cpp
+    int kernelNode(SKIRRuntimeKernel *k);
+    void migrateKernel(SKIRRuntimeKernel *k, int node);
+    void checkKernelNode(SKIRRuntimeKernel *k);
+
 private:
 
+    void setupKernel(SKIRRuntimeKernel *kernel);
+    void getScheduledKernels(std::vector<SKIRRuntimeKernel*> &kernels);
     void allocateStreams(SKIRRuntimeKernel *kernel);
+    int streamNode(SKIRRuntimeKernel *kernel, SKIRRuntimeStream *s, bool input);
 
     void topo_sort_visit(int k, bool *c, std::list<SKIRRuntimeKernel *>& sorted);
 
@@ -89,11 +136,29 @@ private:
     // map kernel ids to kernels
     std::map< unsigned, SKIRRuntimeKernel* > id2kernel;
 
+    // guards adj and id2kernel, changed by the control thread and the
+    // schedulers, read by read-only requests on the clients' threads
+    sys::Mutex graph_lock;
+
+    // bumped by addKernel and removeKernel, see placementStale
+    tbb::atomic<unsigned> version;
+    unsigned placed_version;
+
     SKIRRuntime &rt;
     
     bool verbose;
 
+    // see quantumExpired
+    volatile bool latency_mode;
+    int quantum_iters;
+    int quantum_cycles;
+    int latency_depth;
+
+    // see SKIRKernelModule
+    bool kernel_modules;
+
     SKIRScheduler *the_tbb_sched;
+    SKIRScheduler *the_steal_sched;
     SKIRScheduler *the_koro_sched;
     SKIRScheduler *the_dp_sched;
     SKIRScheduler *the_opencl_sched;
@@ -102,6 +167,15 @@ private:
     int logfile_id;
     
     SKIRRuntimeKernel *hier_parent;
+
+    // retired kernels whose code isn't freed yet, under the JIT lock
+    std::vector<SKIRRuntimeKernel*> retired;
+
+    // the last checkpoint file stays mapped for incremental checkpoints
+    void *ckpt_map;
+    size_t ckpt_len;
+    std::string ckpt_file;
+    unsigned long long ckpt_seq;
 };
 
 }
@@ -32,7 +32,7 @@
 
 #include "D4RTag.h"
 
-//#include <tbb/atomic.h>
+#include <tbb/atomic.h>
 #include <tbb/spin_mutex.h>
 
 #include <string.h>
@@ -43,6 +43,8 @@ namespace llvm {
 typedef void* work_function(void*, void*, void *, void *);
 
 class SKIRScheduler;
+class SKIRKernelModule;
+struct kernel_t;
 
 // for D4R
 typedef tbb::spin_mutex tag_lock_t;
@@ -59,6 +61,7 @@ struct SKIRRuntimeKernel
     
     // programmer defined state
     void *state;
+    size_t state_size; // 0 if unknown
 
     // arrays of input and output streams (skir_stream_t)
     void **impl_ins;
@@ -99,6 +102,10 @@ struct SKIRRuntimeKernel
     bool has_push;
     bool has_pop;
     bool has_peek;
+
+    // never run by the data parallel or OpenCL schedulers, e.g. a
+    // generated splitter or joiner that a copy gains nothing from
+    bool no_dp;
     
     // child kernels if is_heir
     std::vector<SKIRRuntimeKernel*> children;
@@ -106,6 +113,19 @@ struct SKIRRuntimeKernel
     // passes to run on kernel before codegen
     FunctionPassManager *fpm;
 
+    // functions the runtime generated for this kernel (work clones, fused
+    // work functions), freed by SKIRRuntimeGraph::reclaimCode once retired
+    std::vector<Function*> code;
+
+    // with -kernel-modules, the modules its work was compiled in
+    std::vector<SKIRKernelModule*> units;
+
+    // the final LLVM opts are left to the kernel module, see addFinalOpts
+    bool late_opts;
+
+    // bytes of machine code the JIT emitted for work
+    size_t code_bytes;
+
     // codegen responsible for generating this kernel
     ExecutionEngine *cg;
 
@@ -113,7 +133,18 @@ struct SKIRRuntimeKernel
     SKIRScheduler *sched;
     bool fixed_sched; // if true, don't automatically assign sched
 
+    // the sched's kernel_t while the kernel is called, see kernel_t::get
+    tbb::atomic<kernel_t*> sched_kernel;
+
     int affinity;
+    // NUMA node the kernel's memory is on, -1 if it hasn't run, and how
+    // many times in a row it has run on another node since
+    int numa_node;
+    int numa_runs;
+
+    // scheduling priority from the kernel's place in the graph, see
+    // SKIRRuntimeGraph::updatePriorities; getPriority adds stream occupancy
+    int priority;
 
     // for D4R
     SKIRRuntimeKernel *last_blocker;
@@ -122,6 +153,13 @@ struct SKIRRuntimeKernel
     D4R::Tag privateTag;
     tag_lock_t taglock;
 
+    // the kernel whose work function the calling thread is in, set by
+    // kernel_t::work
+    static SKIRRuntimeKernel *&current() {
+	static __thread SKIRRuntimeKernel *k = 0;
+	return k;
+    }
+
     // stats
     unsigned long long total_runtime;
     unsigned long long total_niter;
@@ -135,6 +173,7 @@ struct SKIRRuntimeKernel
     {
 	workfn = NULL;
 	state = NULL;
+	state_size = 0;
 	impl_ins = NULL;
 	impl_outs = NULL;
 
@@ -165,14 +204,21 @@ struct SKIRRuntimeKernel
 	has_push = false;
 	has_peek = false;
 	has_pop = false;
+	no_dp = false;
 
 	sched = 0;
 	fixed_sched = false;
+	sched_kernel = 0;
 
 	fpm = 0;
+	late_opts = false;
+	code_bytes = 0;
 	cg = 0;
 	
 	affinity = 0;
+	numa_node = -1;
+	numa_runs = 0;
+	priority = 0;
 
 	// stats
 	total_runtime = 0;
@@ -238,6 +284,25 @@ struct SKIRRuntimeKernel
 	if (i_outs) delete[] i_outs;
     }
 
+    // higher runs first: nearly full inputs are worth draining, a nearly
+    // full output means the kernel would block right away
+    int getPriority()
+    {
+	int p = priority;
+	for (int i=0; i<nins && rt_ins; i++) {
+	    skir_stream_t *s = rt_ins[i] ? rt_ins[i]->si : 0;
+	    if (!s) continue;
+	    int occ = skir_stream_occupancy(s);
+	    if (occ >= 75) p += 4;
+	    else if (occ == 0) p -= 2;
+	}
+	for (int i=0; i<nouts && rt_outs; i++) {
+	    skir_stream_t *s = rt_outs[i] ? rt_outs[i]->si : 0;
+	    if (s && skir_stream_occupancy(s) >= 75) p -= 4;
+	}
+	return p;
+    }
+
 private:
     SKIRRuntimeKernel() {}
     SKIRRuntimeKernel(const SKIRRuntimeKernel &k) {}
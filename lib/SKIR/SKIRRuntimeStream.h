@@ -39,8 +39,11 @@
 
 #include <llvm/Support/raw_ostream.h>
 
+#include "SKIRNuma.h"
+
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <tbb/tbb.h>
 
 typedef tbb::spin_mutex stream_lock_t;
@@ -52,10 +55,11 @@ namespace llvm {
 struct SKIRRuntimeStream
 {
     SKIRRuntimeStream(unsigned id) :
-    si(0), id(id), type(-1),
+    si(0), id(id), type(-1), node(-1),
 	is_src(false), is_dst(false),
 	elem_size(0), stride(0), //begin(0), end(0),
         readtagchanged(false), writetagchanged(false), qsize(STREAM_BUFFER_SIZE),
+	max_size(STREAM_BUFFER_SIZE), cant_grow(false), map(0), map_size(0),
 	pop_rate(-1), push_rate(-1), peek_rate(0)
     {}
 
@@ -71,6 +75,8 @@ struct SKIRRuntimeStream
 
     unsigned id;
     int type;
+    // NUMA node of the buffer of a NATIVE stream
+    int node;
 
     bool is_src;
     bool is_dst;
@@ -84,7 +90,17 @@ struct SKIRRuntimeStream
     // for D4R
     bool readtagchanged;
     bool writetagchanged;
+    // current ring buffer size (skir_stream_t::size) and the most it can
+    // grow to, see skir_stream_grow
     int qsize;
+    size_t max_size;
+    // D4R found a deadlock it couldn't break by growing this stream, and said so
+    bool cant_grow;
+
+    // for a reader of a ring buffer shared with other streams, its own
+    // mapping of the buffer, see new_skir_stream_readers
+    void *map;
+    size_t map_size;
 
     int getPopRate() { return pop_rate; }
     int getPushRate() { return push_rate; }
@@ -106,6 +122,13 @@ private:
     SKIRRuntimeStream(const SKIRRuntimeStream &s) {}
 };
 
+// bytes mapped for a stream: headers and the largest buffer it can grow to
+inline size_t
+skir_stream_alloc_size(SKIRRuntimeStream *rs)
+{
+    return sizeof(skir_stream_t)*(NUM_STREAM_HEADERS+1) + rs->max_size;
+}
+
 inline void
 free_skir_stream_t(skir_stream_t *s)
 {
@@ -122,14 +145,21 @@ free_skir_stream_t(skir_stream_t *s)
     s->rs = 0;
     rs->si = 0;
 
-    if (rs->type == SKIRRuntimeStream::NATIVE) {
-	free(s);
+    if (rs->type != SKIRRuntimeStream::SHARED) {
+	free(s->push_bounce);
+	free(s->pop_bounce);
+    }
+
+    if (rs->type == SKIRRuntimeStream::NATIVE && rs->map) {
+	// the buffer goes with the last reader's mapping
+	munmap(rs->map, rs->map_size);
+	rs->map = 0;
+    }
+    else if (rs->type == SKIRRuntimeStream::NATIVE) {
+	skir_numa_free(s - NUM_STREAM_HEADERS, skir_stream_alloc_size(rs), rs->node);
     }
     else if (rs->type == SKIRRuntimeStream::SHARED) {
-	size_t header_size = sizeof(skir_stream_t)*(NUM_STREAM_HEADERS+1);
-	size_t buffer_size = STREAM_BUFFER_SIZE;
-	size_t alloc_size = header_size + buffer_size;
-	munmap(s, alloc_size);
+	munmap(s, skir_stream_alloc_size(rs));
 	std::stringstream file_name;
 	file_name << "/skir_stream." << rs->id;
 	shm_unlink(file_name.str().c_str());
@@ -137,20 +167,59 @@ free_skir_stream_t(skir_stream_t *s)
 
 }
 
+// set up header s of rs, whose ring buffer is buf
+inline void
+init_skir_stream_t(skir_stream_t *s, SKIRRuntimeStream *rs, char *buf, unsigned id)
+{
+    s->rs = rs;
+    s->outp = buf;
+    s->inp = buf;
+
+    if (s->id) return;
+    s->id = id;
+
+    s->elem_size = rs->elem_size;
+    s->stride = 0;
+    s->size = rs->qsize;
+
+    s->pop_rate = rs->getPopRate();
+    s->push_rate = rs->getPushRate();
+    s->peek_rate = rs->getPeekRate();
+
+    s->src = s->dst = (void *)(-1);
+
+    s->head = 0;
+    s->outp = buf;
+    s->num_push = 0;
+    s->next_tail = 0;
+    s->push_bounce = 0;
+    s->push_bounce_size = 0;
+    s->push_reserved = 0;
+
+    s->tail = 0;
+    s->inp = buf;
+    s->next_head = 0;
+    s->pop_bounce = 0;
+    s->pop_bounce_size = 0;
+    s->pop_reserved = 0;
+}
+
+// node is where a NATIVE stream's buffer goes, -1 for the caller's node
 inline skir_stream_t *
-new_skir_stream_t(SKIRRuntimeStream *rs)
+new_skir_stream_t(SKIRRuntimeStream *rs, int node=-1)
 {
     assert(rs);
     if (rs->type == SKIRRuntimeStream::ERR)
 	return 0;
 
     size_t header_size = sizeof(skir_stream_t)*(NUM_STREAM_HEADERS+1);
-    size_t buffer_size = STREAM_BUFFER_SIZE;
-    size_t alloc_size = header_size + buffer_size;
+    size_t alloc_size = skir_stream_alloc_size(rs);
 
     skir_stream_t *s;
     if (rs->type == SKIRRuntimeStream::NATIVE) {
-	s = (skir_stream_t*)malloc(alloc_size);
+	s = (skir_stream_t*)skir_numa_alloc(alloc_size, node);
+	assert(s);
+	rs->node = node;
 	s->id = 0;
     }
     else if (rs->type == SKIRRuntimeStream::SHARED) {
@@ -172,35 +241,135 @@ new_skir_stream_t(SKIRRuntimeStream *rs)
 
     char *buf = ((char*)s) + header_size;
 
-    for (int i=0; i<NUM_STREAM_HEADERS+1; i++, s++) {
-	s->rs = rs;
-	s->outp = buf;
-	s->inp = buf;
+    for (int i=0; i<NUM_STREAM_HEADERS+1; i++, s++)
+	init_skir_stream_t(s, rs, buf, i+1);
+    --s;
+    return s;
+}	
 
-	if (s->id) continue;
-	s->id = i+1;
+// n streams of equal element and buffer size that read one ring buffer.
+// Every reader gets its own header, so its own head and tail, followed
+// by its own mapping of the buffer, so the stream ops see an ordinary
+// stream.  Whoever writes the buffer pushes the same elements to all of
+// them and the slowest reader's tail limits it.  false if the streams
+// don't fit or the buffer couldn't be mapped; nothing is allocated then.
+inline bool
+new_skir_stream_readers(SKIRRuntimeStream *rs[], int n)
+{
+    if (n < 1)
+	return false;
+    for (int i=0; i<n; i++) {
+	if (rs[i]->si || rs[i]->type != SKIRRuntimeStream::NATIVE ||
+	    rs[i]->elem_size != rs[0]->elem_size || rs[i]->qsize != rs[0]->qsize)
+	    return false;
+    }
 
-	s->elem_size = rs->elem_size;
-	s->stride = 0;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t header_size = sizeof(skir_stream_t)*(NUM_STREAM_HEADERS+1);
+    size_t header_map = (header_size + page-1) & ~(page-1);
+    size_t buf_map = ((size_t)rs[0]->qsize + page-1) & ~(page-1);
+    size_t map_size = header_map + buf_map;
+
+    std::stringstream file_name;
+    file_name << "/skir_readers." << getpid() << "." << rs[0]->id;
+    int fd = shm_open(file_name.str().c_str(), O_CREAT | O_EXCL | O_RDWR, S_IREAD | S_IWRITE);
+    if (fd < 0)
+	return false;
+    shm_unlink(file_name.str().c_str());
+    if (ftruncate(fd, buf_map) != 0) {
+	close(fd);
+	return false;
+    }
 
-	s->pop_rate = rs->getPopRate();
-	s->push_rate = rs->getPushRate();
-	s->peek_rate = rs->getPeekRate();
+    // reserve the whole range first so the mappings land next to their
+    // headers
+    char *base = (char*)mmap(0, n*map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+	close(fd);
+	return false;
+    }
+    for (int i=0; i<n; i++) {
+	char *m = base + i*map_size;
+	if (mmap(m, header_map, PROT_READ | PROT_WRITE, 
+		 MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED ||
+	    mmap(m + header_map, buf_map, PROT_READ | PROT_WRITE, 
+		 MAP_FIXED | MAP_SHARED, fd, 0) == MAP_FAILED) {
+	    munmap(base, n*map_size);
+	    close(fd);
+	    return false;
+	}
+    }
+    close(fd);
+
+    for (int i=0; i<n; i++) {
+	char *buf = base + i*map_size + header_map;
+	skir_stream_t *s = (skir_stream_t*)(buf - header_size);
+	for (int j=0; j<NUM_STREAM_HEADERS+1; j++, s++)
+	    init_skir_stream_t(s, rs[i], buf, j+1);
+	rs[i]->si = s-1;
+	rs[i]->map = base + i*map_size;
+	rs[i]->map_size = map_size;
+	// the buffer can't be moved or grown under the other readers
+	rs[i]->max_size = rs[i]->qsize;
+    }
+    return true;
+}
 
-	s->src = s->dst = (void *)(-1);
+// bytes waiting in a stream
+inline size_t
+skir_stream_used(skir_stream_t *s)
+{
+    size_t head = s->head;
+    size_t tail = s->tail;
+    return (head + s->size - tail) % s->size;
+}
 
-	s->head = 0;
-	s->outp = buf;
-	s->num_push = 0;
-	s->next_tail = 0;
+// what skir_stream_grow did
+enum skir_stream_grow_t {
+    SKIR_STREAM_GROWN = 0,
+    SKIR_STREAM_BUSY,       // not now, a reservation is held, try again later
+    SKIR_STREAM_CANT_GROW   // never to size: past max_size, or not whole elements
+};
 
-	s->tail = 0;
-	s->inp = buf;
-	s->next_head = 0;
+// grow the ring buffer of a stream in place to size bytes, keeping its
+// contents.  Only the part of a wrapped ring from tail to the old end
+// moves (to the new end), head stays where it is, so a producer stopped
+// inside a push with head and next in registers can carry on.  Neither end
+// may be pushing or popping meanwhile, and both must use the generic
+// stream ops (see SKIRStreamOpts).  Data either end holds a reservation
+// on may be among what moves, so the ring isn't grown under one.  The
+// buffer of a reader group is mapped once per reader at its full size
+// (max_size == qsize), so it can't grow.
+inline skir_stream_grow_t
+skir_stream_grow(SKIRRuntimeStream *rs, size_t size)
+{
+    skir_stream_t *s = rs->si;
+    if (!s)
+	return SKIR_STREAM_CANT_GROW;
+    if (s->pop_reserved || s->push_reserved)
+	return SKIR_STREAM_BUSY;
+    if (size > rs->max_size || size <= s->size || size % s->elem_size)
+	return SKIR_STREAM_CANT_GROW;
+
+    size_t old = s->size;
+    size_t head = s->head;
+    size_t tail = s->tail;
+    if (tail > head) {
+	size_t n = old - tail;
+	memmove(&s->buf[size - n], &s->buf[tail], n);
+	s->tail = size - n;
     }
-    --s;
-    return s;
-}	
+    s->size = size;
+    rs->qsize = size;
+    return SKIR_STREAM_GROWN;
+}
+
+// how full a stream is, 0 (empty) to 100 (full)
+inline int
+skir_stream_occupancy(skir_stream_t *s)
+{
+    return (int)(skir_stream_used(s) * 100 / s->size);
+}
 
 inline skir_stream_t *
 copy_skir_stream_t(skir_stream_t *s)
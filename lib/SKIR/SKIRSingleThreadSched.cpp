@@ -84,6 +84,9 @@ SKIRSingleThreadSched::unPauseKernel(SKIRRuntimeKernel *rtk)
     kernel_t *k = kernel_map_find(rtk);
     assert(k);
     k->unpause();
+    // a parked kernel goes back on the runq
+    if (k->unpark())
+	runq.push(rtk);
 }
 
 void
@@ -97,7 +100,7 @@ SKIRSingleThreadSched::runCodeGen(SKIRRuntimeKernel *rtk)
 
     SKIRRuntime::addSKIRBlockingOpsPass(rtk);
     SKIRRuntime::addSKIRInlineStreamsPass(rtk);
-    SKIRRuntime::addLLVMOpts(rtk);
+    sg->addFinalOpts(rtk);
 
     sg->codeGenKernel(rtk);
     assert(rtk->workfn);
@@ -150,13 +153,13 @@ SKIRSingleThreadSched::removeKernel(SKIRRuntimeKernel *rtk)
     kernel_t *k = kernel_map_find(rtk);
     if (!k) return;
 
-    // pause (lock) the kernel so it won't get picked for execution
-    k->pause();
+    // pause the kernel so it won't get picked for execution
+    if (!k->is_paused())
+	k->pause();
 
     // remove the kernel from the internal list
     kernel_map_insert(rtk, NULL);
 
-    // release the pause thread
     k->done();
     
     // once we can get the lock, it's safe to delete k
@@ -181,8 +184,12 @@ SKIRSingleThreadSched::run()
 	    k = kernel_map_find(rtk);
 	    if (!k) continue;
 
+	    bool requeue = true;
 	    kernel_lock_t::scoped_lock lock;
 	    if (lock.try_acquire(k->lock)) {
+		// paused kernels wait for unPauseKernel off the runq
+		if (k->is_paused())
+		    requeue = !k->park();
 		if (k->is_active()) {
 		    // generate workfn if needed
 		    if (!k->rt_kernel.workfn) {
@@ -190,27 +197,30 @@ SKIRSingleThreadSched::run()
 			assert(k->rt_kernel.workfn);
 		    }
 		    
-		    // execute work function until it returns non-zero
+		    // execute work function until it returns non-zero,
+		    // or a latency mode quantum is used up
+		    size_t niter = 0;
+		    k->rt_kernel.rt_state->cycles = 0;
 		    SKIRRuntimeKernel *b;
 		    do {
 			b = k->work();
-		    } while (b == 0);
+		    } while (b == 0 && !sg->quantumExpired(&k->rt_kernel, niter));
 
 		    if (b == (SKIRRuntimeKernel *)1)
 			k->done();
 		}
 	    } else {
 		// if there's only one kernel in the scheduler,
-		// we'll only not get the lock if the kernel is paused,
+		// we'll only not get the lock while it's being paused,
 		// so we should yield if this happens
 		if (runq.empty()) tbb::this_tbb_thread::yield();
 	    }
 
-	    if (!k->is_done())
+	    if (requeue && !k->is_done())
 		runq.push(rtk);
 	} else {
-	    // runq is empty, yield
-	    //tbb::this_tbb_thread::yield();
+	    // runq is empty (the kernel is parked or done), yield
+	    tbb::this_tbb_thread::yield();
 	    empty();
 	    
 	}
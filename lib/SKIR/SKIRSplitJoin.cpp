@@ -0,0 +1,206 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Pass.h>
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Analysis/Verifier.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <SKIR/SKIRRuntime.h>
+#include "SKIRRuntimeKernel.h"
+#include "SKIRRuntimeStream.h"
+#include "SKIRUtil.h"
+
+// generate the work function of a splitter or joiner kernel, one whose
+// base work function is SKIR_SPLITJOIN_WORK, from a skeleton in
+// inline_stream_ops.cpp with the kernel's skir_splitjoin_t built in as a
+// constant.  the frontend's work function is only a per element
+// fallback for when this isn't done.  the outputs of a duplicate
+// splitter are made readers of one ring buffer where possible.
+
+using namespace llvm;
+
+namespace {
+
+struct SKIRSplitJoinPass : public FunctionPass {
+
+    static char ID;
+    SKIRRuntimeKernel *kernel;
+    bool done;
+
+    SKIRSplitJoinPass() 
+	: FunctionPass((intptr_t)&ID), kernel(NULL), done(false)
+    {
+    }
+
+    SKIRSplitJoinPass(SKIRRuntimeKernel *k)
+	: FunctionPass((intptr_t)&ID), kernel(k), done(false)
+    {
+    }
+
+    // the skeleton for sj, or 0 if its streams don't fit it
+    const char *getSkeleton(skir_splitjoin_t *sj)
+    {
+	bool split = (sj->kind != SKIR_JOIN_RR);
+	int nmany = split ? kernel->nouts : kernel->nins;
+	int none = split ? kernel->nins : kernel->nouts;
+	if (sj->kind < SKIR_SPLIT_DUP || sj->kind > SKIR_JOIN_RR)
+	    return 0;
+	if (sj->n < 1 || sj->n != nmany || none != 1 || sj->elem_size < 1)
+	    return 0;
+
+	// plain ring buffers of sj->elem_size elements
+	for (int i=0; i<kernel->nins; i++)
+	    if (kernel->rt_ins[i]->type != SKIRRuntimeStream::NATIVE ||
+		(int)kernel->rt_ins[i]->elem_size != sj->elem_size)
+		return 0;
+	for (int i=0; i<kernel->nouts; i++)
+	    if (kernel->rt_outs[i]->type != SKIRRuntimeStream::NATIVE ||
+		(int)kernel->rt_outs[i]->elem_size != sj->elem_size)
+		return 0;
+
+	if (sj->kind == SKIR_SPLIT_DUP)
+	    return "__SKIRRT_split_dup_work";
+
+	// a zero rate stream would never be scheduled
+	for (int i=0; i<sj->n; i++)
+	    if (sj->weights[i] < 1)
+		return 0;
+	return split ? "__SKIRRT_split_rr_work" : "__SKIRRT_join_rr_work";
+    }
+
+    void setRates(skir_splitjoin_t *sj)
+    {
+	int total = 0;
+	for (int i=0; i<sj->n; i++) {
+	    int w = (sj->kind == SKIR_SPLIT_DUP) ? 1 : sj->weights[i];
+	    if (sj->kind == SKIR_JOIN_RR)
+		kernel->rt_ins[i]->setPopRate(w);
+	    else
+		kernel->rt_outs[i]->setPushRate(w);
+	    total += w;
+	}
+	if (sj->kind == SKIR_SPLIT_DUP)
+	    kernel->rt_ins[0]->setPopRate(1);
+	else if (sj->kind == SKIR_SPLIT_RR)
+	    kernel->rt_ins[0]->setPopRate(total);
+	else
+	    kernel->rt_outs[0]->setPushRate(total);
+
+	// the generated function runs its own outer loop, see genericCodeGen
+	kernel->opt_only = true;
+	kernel->is_hier = false;
+	kernel->is_fixed_rate = true;
+	kernel->is_const_idx = true;
+	kernel->has_push = kernel->has_pop = true;
+	kernel->has_peek = false;
+	// a copy gains nothing from the data parallel scheduler
+	kernel->no_dp = true;
+    }
+
+    bool runOnFunction(Function &work)
+    {
+	if (!kernel || !kernel->state || 
+	    kernel->base_work->getName() != SKIR_SPLITJOIN_WORK)
+	    return false;
+
+	skir_splitjoin_t *sj = (skir_splitjoin_t *)kernel->state;
+	const char *skel_name = getSkeleton(sj);
+	if (!skel_name)
+	    return false;
+
+	// outputs no consumer has been called on yet can share one buffer,
+	// then the input is only copied once
+	if (sj->kind == SKIR_SPLIT_DUP && sj->n > 1 &&
+	    new_skir_stream_readers(kernel->rt_outs, sj->n))
+	    skel_name = "__SKIRRT_split_dup_readers_work";
+
+	Module *mod = work.getParent();
+	Function *skel = dyn_cast_or_null<Function>(getInlineCode(mod, skel_name));
+	assert(skel && "splitter/joiner skeleton not found");
+
+	// the state as a constant, kind, n, elem_size then the weights
+	LLVMContext &CTX = mod->getContext();
+	const Type *int32Ty = Type::getInt32Ty(CTX);
+	std::vector<Constant *> fields;
+	fields.push_back(ConstantInt::get(int32Ty, sj->kind));
+	fields.push_back(ConstantInt::get(int32Ty, sj->n));
+	fields.push_back(ConstantInt::get(int32Ty, sj->elem_size));
+	for (int i=0; sj->kind != SKIR_SPLIT_DUP && i<sj->n; i++)
+	    fields.push_back(ConstantInt::get(int32Ty, sj->weights[i]));
+	ArrayType *ty = ArrayType::get(int32Ty, fields.size());
+	GlobalVariable *gv = new GlobalVariable(*mod, ty, true, GlobalValue::InternalLinkage,
+						ConstantArray::get(ty, fields),
+						"__SKIRRT_splitjoin");
+
+	// replace the body of work with the skeleton's
+	DenseMap<const Value*, Value*> value_map;
+	Function::arg_iterator skel_arg = skel->arg_begin();
+	Function::arg_iterator work_arg = work.arg_begin();
+	value_map[skel_arg++] = work_arg++;  // rt state
+	value_map[skel_arg++] = ConstantExpr::getBitCast(gv, work_arg++->getType());
+	value_map[skel_arg++] = work_arg++;  // ins
+	value_map[skel_arg++] = work_arg++;  // outs
+
+	work.deleteBody();
+	SmallVector<ReturnInst*, 8> rets;
+	CloneFunctionInto(&work, skel, value_map, rets, "", 0);
+
+	setRates(sj);
+	done = true;
+	return true;
+    }
+};
+
+char SKIRSplitJoinPass::ID = 0;
+RegisterPass<SKIRSplitJoinPass> X("skir-splitjoin",
+				  "SKIR Runtime splitter/joiner generation", false, false);
+}
+
+namespace llvm {
+
+FunctionPass *createSKIRSplitJoinPass()
+{
+    return new SKIRSplitJoinPass;
+}
+
+}
+
+bool
+SKIRRuntime::runSKIRSplitJoinPass(SKIRRuntimeKernel *k)
+{
+    Module *mod = k->work->getParent();
+
+    SKIRSplitJoinPass *pass = new SKIRSplitJoinPass(k);
+    FunctionPassManager PM(mod);
+    PM.add(new TargetData(mod));
+    PM.add(pass);
+    PM.add(createVerifierPass());
+
+    {
+	MutexGuard locked(k->cg->lock);
+	PM.run(*k->work);
+    }
+    return pass->done;
+}
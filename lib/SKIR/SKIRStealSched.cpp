@@ -0,0 +1,467 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Support/raw_ostream.h>
+#include "llvm/Support/CommandLine.h"
+
+#include "SKIR/SKIRRuntime.h"
+#include "SKIRRuntimeGraph.h"
+#include "SKIRStealSched.h"
+#include "SKIRKoroSched.h"
+#include "SKIRCommandLine.h"
+#include "SKIR_kernel_t.h"
+
+#include <tbb/tick_count.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+namespace llvm {
+
+bool EnableStealSched;
+static cl::opt<bool, true>
+FakeEnableStealSched("steal-sched",
+		     cl::desc("use per-worker work stealing run queues instead of the tbb dispatcher"),
+		     cl::location(EnableStealSched), cl::init(false));
+
+bool EnableStealAffinity;
+static cl::opt<bool, true>
+FakeEnableStealAffinity("steal-affinity",
+			cl::desc("partition the graph over pinned steal-sched workers, only steal under imbalance"),
+			cl::location(EnableStealAffinity), cl::init(false));
+
+// idle sweeps before a worker starts sleeping between steal attempts
+static const int STEAL_SPINS = 64;
+
+// seconds a changed graph settles before it is placed, and between
+// placements of an unchanged one
+static const double PLACE_SETTLE = 0.01;
+static const double PLACE_PERIOD = 1.0;
+
+SKIRStealSched::SKIRStealSched(SKIRRuntimeGraph *stream_graph, int nthreads)
+    : sg(stream_graph), verbose(false), num_workers(nthreads)
+{
+    if (num_workers < 1)
+	num_workers = 1;
+    workers = new worker_t[num_workers];
+    for (int i=0; i<num_workers; i++)
+	workers[i].seed = i * 2654435761u + 1;
+    running = 0;
+    next_worker = 0;
+    affinity = sg->getRuntime().getOptions().steal_affinity;
+}
+
+SKIRStealSched::~SKIRStealSched()
+{
+    // workers are gone before the kernel pool
+    stop();
+    delete[] workers;
+}
+
+//
+// deques
+//
+
+void
+SKIRStealSched::pushBack(int w, kernel_t *k)
+{
+    tbb::spin_mutex::scoped_lock l(workers[w].lock);
+    workers[w].ready.push_back(k);
+}
+
+void
+SKIRStealSched::pushFront(int w, kernel_t *k)
+{
+    tbb::spin_mutex::scoped_lock l(workers[w].lock);
+    workers[w].ready.push_front(k);
+}
+
+kernel_t *
+SKIRStealSched::popBack(int w)
+{
+    tbb::spin_mutex::scoped_lock l(workers[w].lock);
+    if (workers[w].ready.empty())
+	return 0;
+    kernel_t *k = workers[w].ready.back();
+    workers[w].ready.pop_back();
+    return k;
+}
+
+// take the oldest kernel from some other worker, never waits on a lock
+kernel_t *
+SKIRStealSched::steal(int w)
+{
+    unsigned &seed = workers[w].seed;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    int start = seed % num_workers;
+    for (int i=0; i<num_workers; i++) {
+	int v = (start + i) % num_workers;
+	if (v == w)
+	    continue;
+	tbb::spin_mutex::scoped_lock l;
+	if (!l.try_acquire(workers[v].lock))
+	    continue;
+	// with placement, leave a worker its last kernel
+	if (workers[v].ready.size() > (affinity ? 1u : 0u)) {
+	    kernel_t *k = workers[v].ready.front();
+	    workers[v].ready.pop_front();
+	    return k;
+	}
+    }
+    return 0;
+}
+
+// claim k and put it on w's deque; the deque holds a reference
+bool
+SKIRStealSched::enqueue(int w, kernel_t *k)
+{
+    if (k->running.compare_and_swap(1, 0) != 0)
+	return false;
+    k->ref();
+    pushBack(w, k);
+    return true;
+}
+
+// the worker a kernel should be queued on: its placement region if we
+// have one, otherwise w
+int
+SKIRStealSched::home(int w, kernel_t *k)
+{
+    if (affinity)
+	return k->rt_kernel.affinity % num_workers;
+    return w;
+}
+
+// give up the claim on k (and the deque's reference), re-enqueueing it if
+// it was unpaused while we held the claim
+void
+SKIRStealSched::release(int w, kernel_t *k)
+{
+    k->running = 0;
+    if (k->is_active() && k->rt_kernel.sched_kernel == k)
+	enqueue(home(w, k), k);
+    k->unref();
+}
+
+//
+// parking
+//
+
+// the ends of k's streams that k doesn't move itself: the producer side
+// of its inputs and the consumer side of its outputs, including a kernel
+// finishing or being fused away.  k is claimed; whoever migrates or
+// resizes its streams holds its lock.
+static void
+otherEnds(kernel_t *k, std::vector<size_t> &ends)
+{
+    SKIRRuntimeKernel &rtk = k->rt_kernel;
+    ends.clear();
+    for (int i=0; i<rtk.nins && rtk.impl_ins; i++) {
+	skir_stream_t *s = (skir_stream_t *)rtk.impl_ins[i];
+	if (!s) continue;
+	ends.push_back(s->head);
+	ends.push_back((size_t)s->src);
+    }
+    for (int i=0; i<rtk.nouts && rtk.impl_outs; i++) {
+	skir_stream_t *s = (skir_stream_t *)rtk.impl_outs[i];
+	if (!s) continue;
+	ends.push_back(s->tail);
+	ends.push_back((size_t)s->dst);
+    }
+}
+
+// keep a blocked kernel (with its claim and the deque's reference) off
+// the deques.  workers[w].ends was taken before k's first work call, so
+// a stream that moved while k ran wakes it at once rather than never.
+void
+SKIRStealSched::park(int w, kernel_t *k)
+{
+    parked_t p;
+    p.k = k;
+    p.ends = workers[w].ends;
+    workers[w].parked.push_back(p);
+}
+
+// queue the parked kernels whose streams moved, drop the ones that were
+// paused or removed
+void
+SKIRStealSched::wake(int w)
+{
+    std::vector<parked_t> &parked = workers[w].parked;
+    for (size_t i=0; i<parked.size(); ) {
+	kernel_t *k = parked[i].k;
+	bool unparked;
+	if (k->rt_kernel.sched_kernel != k || !k->is_active()) {
+	    release(w, k);
+	    unparked = true;
+	}
+	else {
+	    kernel_lock_t::scoped_lock lock;
+	    if (!lock.try_acquire(k->lock)) {
+		i++;
+		continue;
+	    }
+	    otherEnds(k, workers[w].ends);
+	    unparked = (workers[w].ends != parked[i].ends);
+	    if (unparked)
+		pushBack(home(w, k), k);
+	}
+	if (unparked) {
+	    parked[i] = parked.back();
+	    parked.pop_back();
+	}
+	else
+	    i++;
+    }
+}
+
+//
+// workers
+//
+
+void
+SKIRStealSched::runKernel(int w, kernel_t *k)
+{
+    bool requeue = false;
+    bool blocked = false;
+    kernel_t *next = 0;
+
+    {
+	kernel_lock_t::scoped_lock lock;
+	// only pause() holds the lock of a claimed kernel, briefly
+	if (lock.try_acquire(k->lock) &&
+	    k->rt_kernel.sched_kernel == k && k->is_active()) {
+
+	    if (!k->rt_kernel.workfn) {
+		k->rt_kernel.sched->runCodeGen(&k->rt_kernel);
+		assert(k->rt_kernel.workfn);
+	    }
+
+	    sg->checkKernelNode(&k->rt_kernel);
+	    k->rt_kernel.rt_state->cycles = 0;
+	    otherEnds(k, workers[w].ends);
+
+	    // k->work returns 0 to be rescheduled, 1 if it is finished.
+	    // otherwise, it returns a pointer to a blocking kernel.
+	    size_t niter = 0;
+	    SKIRRuntimeKernel *b = k->work();
+	    while (b == 0) {
+		// stop between work calls if paused
+		if (!k->is_active()) break;
+		// or at the end of a latency mode quantum
+		if (sg->quantumExpired(&k->rt_kernel, niter)) break;
+		b = k->work();
+	    }
+
+	    if (b == 0) {
+		// quantum expired, let the rest of this deque run first
+		requeue = k->is_active();
+	    }
+	    else if (b == (SKIRRuntimeKernel *)1) {
+		k->done();
+	    }
+	    else if (b != 0) {
+		blocked = true;
+		// run the blocker next on this worker if nobody has it
+		if (kernel_t *blocker = kernel_t::get(b)) {
+		    if (blocker->running.compare_and_swap(1, 0) == 0)
+			next = blocker; // get's reference becomes the deque's
+		    else
+			blocker->unref();
+		}
+	    }
+	}
+    } // unlock
+
+    if (blocked && k->rt_kernel.sched_kernel == k)
+	park(w, k);
+    else if (requeue && k->rt_kernel.sched_kernel == k)
+	pushFront(home(w, k), k);
+    else
+	release(w, k);
+
+    if (next)
+	pushBack(home(w, next), next);
+}
+
+// with -steal-affinity worker 0 re-places the graph soon after it
+// changes, and periodically as the measured costs and traffic grow
+void
+SKIRStealSched::place(tbb::tick_count &last)
+{
+    tbb::tick_count now = tbb::tick_count::now();
+    double t = (now - last).seconds();
+    if (t < PLACE_SETTLE || (t < PLACE_PERIOD && !sg->placementStale()))
+	return;
+    sg->placeKernels(num_workers);
+    last = now;
+}
+
+void
+SKIRStealSched::run(int w)
+{
+    int idle = 0;
+    tbb::tick_count last_place = tbb::tick_count::now();
+
+    if (affinity) {
+	// worker w runs region w on core w
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > 0) {
+	    cpu_set_t set;
+	    CPU_ZERO(&set);
+	    CPU_SET(w % ncpus, &set);
+	    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) && verbose)
+		errs() << "SKIRStealSched: couldn't pin worker " << w << "\n";
+	}
+    }
+
+    while (running == 1) {
+	if (affinity && w == 0)
+	    place(last_place);
+
+	wake(w);
+	kernel_t *k = popBack(w);
+	if (!k)
+	    k = steal(w);
+
+	if (k) {
+	    idle = 0;
+	    runKernel(w, k);
+	}
+	else if (++idle < STEAL_SPINS) {
+	    tbb::this_tbb_thread::yield();
+	}
+	else {
+	    tbb::this_tbb_thread::sleep(tbb::tick_count::interval_t(0.0001));
+	}
+    }
+}
+
+struct skir_steal_thread {
+    SKIRStealSched &s;
+    int w;
+    skir_steal_thread(SKIRStealSched &sched, int worker) : s(sched), w(worker) {}
+    void operator()() { s.run(w); }
+};
+
+void
+SKIRStealSched::start(void)
+{
+    if (running.compare_and_swap(1,0) == 0) {
+	for (int i=0; i<num_workers; i++)
+	    threads.push_back(new tbb::tbb_thread(skir_steal_thread(*this, i)));
+    }
+}
+
+void
+SKIRStealSched::stop(void)
+{
+    if (running.compare_and_swap(0,1) == 1) {
+	for (unsigned i=0; i<threads.size(); i++) {
+	    threads[i]->join();
+	    delete threads[i];
+	}
+	threads.clear();
+    }
+
+    // drop the deques' and parked lists' references
+    for (int i=0; i<num_workers; i++) {
+	while (kernel_t *k = popBack(i)) {
+	    k->running = 0;
+	    k->unref();
+	}
+	std::vector<parked_t> &parked = workers[i].parked;
+	for (size_t j=0; j<parked.size(); j++) {
+	    parked[j].k->running = 0;
+	    parked[j].k->unref();
+	}
+	parked.clear();
+    }
+}
+
+//
+// scheduler interface
+//
+
+void
+SKIRStealSched::callKernel(SKIRRuntimeKernel *rtk)
+{
+    kernel_t *k = kernel_pool.alloc(*rtk);
+    assert(k);
+
+    // replaces (and drops) the kernel_t of an earlier call
+    if (kernel_t *old = rtk->sched_kernel.fetch_and_store(k))
+	old->unref();
+    k->active();
+    enqueue(home(next_worker++ % num_workers, k), k);
+}
+
+void
+SKIRStealSched::removeKernel(SKIRRuntimeKernel *rtk)
+{
+    kernel_t *k = rtk->sched_kernel.fetch_and_store(0);
+    if (k) {
+	// workers drop the deque's reference when they see it's gone
+	k->unref();
+    }
+}
+
+void
+SKIRStealSched::waitKernel(SKIRRuntimeKernel *rtk)
+{
+    kernel_t *k = kernel_t::get(rtk);
+    assert(k);
+    kernel_ref_t ref(k);
+    k->wait(DONE);
+}
+
+void
+SKIRStealSched::pauseKernel(SKIRRuntimeKernel *rtk)
+{
+    kernel_t *k = kernel_t::get(rtk);
+    assert(k);
+    kernel_ref_t ref(k);
+    k->pause();
+}
+
+void
+SKIRStealSched::unPauseKernel(SKIRRuntimeKernel *rtk)
+{
+    kernel_t *k = kernel_t::get(rtk);
+    assert(k);
+    kernel_ref_t ref(k);
+    k->unpause();
+    // paused kernels are dropped from the deques
+    enqueue(home(next_worker++ % num_workers, k), k);
+}
+
+void
+SKIRStealSched::runCodeGen(SKIRRuntimeKernel *rtk)
+{
+    SKIRKoroSched::genericCodeGen(sg, rtk);
+}
+
+}
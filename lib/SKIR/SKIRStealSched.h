@@ -0,0 +1,125 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#ifndef _SKIR_STEAL_SCHED_H_
+#define _SKIR_STEAL_SCHED_H_
+
+#include "SKIRScheduler.h"
+#include "SKIRRuntimeKernel.h"
+#include "SKIR_kernel_t.h"
+
+#include <tbb/atomic.h>
+#include <tbb/tbb_thread.h>
+#include <tbb/spin_mutex.h>
+#include <tbb/tick_count.h>
+
+#include <deque>
+#include <vector>
+
+namespace llvm {
+
+class SKIRRuntimeGraph;
+
+//
+// SKIRStealSched - work stealing scheduler without a dispatcher thread
+//
+// Every worker owns a deque of ready kernels.  A worker runs kernels from
+// the back of its own deque; when a kernel blocks, the blocking kernel is
+// pushed on the back (so it runs next, on the same core) and the blocked
+// kernel is parked on the worker until the other end of one of its streams
+// moves, then goes back on the deque.  Idle workers steal from the front
+// of a random victim.  A kernel is in at most one deque or parked list or
+// running on at most one worker at a time (kernel_t::running is the claim).
+//
+// With -steal-affinity workers are pinned to cores and kernels are always
+// queued on the worker of their placement region
+// (SKIRRuntimeKernel::affinity, see SKIRRuntimeGraph::placeKernels), which
+// worker 0 keeps up to date.  Workers then only steal from deques holding
+// more than one kernel.
+//
+class SKIRStealSched : public SKIRScheduler {
+public:
+    SKIRStealSched(SKIRRuntimeGraph *stream_graph, int nthreads);
+    ~SKIRStealSched();
+
+    void callKernel(SKIRRuntimeKernel *rtk);
+    void removeKernel(SKIRRuntimeKernel *rtk);
+    void waitKernel(SKIRRuntimeKernel *rtk);
+    void pauseKernel(SKIRRuntimeKernel *rtk);
+    void unPauseKernel(SKIRRuntimeKernel *rtk);
+
+    void runCodeGen(SKIRRuntimeKernel *rtk);
+
+    void start(void);
+    void stop(void);
+    void run(int w);
+
+    void setVerbose(bool v) { verbose = v; }
+
+ private:
+
+    // a blocked kernel and the other ends of its streams when it last ran
+    struct parked_t {
+	kernel_t *k;
+	std::vector<size_t> ends;
+    };
+
+    struct worker_t {
+	tbb::spin_mutex lock;
+	std::deque<kernel_t *> ready;
+	// only touched by the worker itself
+	std::vector<parked_t> parked;
+	std::vector<size_t> ends;
+	unsigned seed;
+	// keep neighbouring workers' locks off each other's cache lines
+	char pad[64];
+    };
+
+    bool enqueue(int w, kernel_t *k);
+    void pushBack(int w, kernel_t *k);
+    void pushFront(int w, kernel_t *k);
+    kernel_t *popBack(int w);
+    kernel_t *steal(int w);
+    void runKernel(int w, kernel_t *k);
+    void release(int w, kernel_t *k);
+    void park(int w, kernel_t *k);
+    void wake(int w);
+    int home(int w, kernel_t *k);
+    void place(tbb::tick_count &last);
+
+    SKIRRuntimeGraph *sg;
+    bool verbose;
+    bool affinity;
+
+    int num_workers;
+    worker_t *workers;
+    std::vector<tbb::tbb_thread *> threads;
+
+    tbb::atomic<int> running;
+    // spreads kernels enqueued from outside the workers
+    tbb::atomic<unsigned> next_worker;
+
+    kernel_pool_t kernel_pool;
+};
+
+}
+#endif
@@ -32,6 +32,7 @@
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Module.h>
 #include <llvm/Analysis/Verifier.h>
+#include <llvm/Target/TargetData.h>
 
 #include <SKIR/SKIRRuntime.h>
 #include "SKIRRuntimeStream.h"
@@ -40,6 +41,8 @@
 
 #include <vector>
 #include <string>
+#include <sstream>
+#include <cstddef>
 
 using namespace llvm;
 
@@ -66,6 +69,69 @@ struct SKIRStreamOptsPass : public FunctionPass {
 	kernel = k;
     }
 
+    // clone the generic stream op G with rs's element size folded in, and
+    // its buffer size if the stream can't grow.  the loads of those fields
+    // are the GEPs into a skir_stream_t at their offsets
+    Function *specializeGeneric(Function *G, SKIRRuntimeStream *rs)
+    {
+	bool fixed = rs->max_size == (size_t)rs->qsize;
+
+	// the stream header type, as the inline ops were compiled with it
+	Module *M = G->getParent();
+	const Type *streamTy = M->getTypeByName("struct.skir_stream_t");
+	if (!streamTy)
+	    return 0;
+
+	std::stringstream ss;
+	ss << std::string(G->getName()) << ".e" << rs->elem_size;
+	if (fixed) ss << ".b" << rs->qsize;
+
+	if (Function *S = M->getFunction(ss.str()))
+	    return S;
+	if (G->isDeclaration())
+	    return 0;
+
+	Function *S = CloneFunction(G);
+	S->setName(ss.str());
+	S->setLinkage(GlobalValue::InternalLinkage);
+	M->getFunctionList().push_back(S);
+
+	std::vector<GetElementPtrInst*> geps;
+	for (inst_iterator I = inst_begin(S), E = inst_end(S); I != E; ++I)
+	    if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(&*I))
+		if (GEP->hasAllConstantIndices())
+		    geps.push_back(GEP);
+
+	TargetData TD(M);
+	for (unsigned i=0; i<geps.size(); i++) {
+	    GetElementPtrInst *GEP = geps[i];
+
+	    const PointerType *PT = GEP->getPointerOperandType();
+	    if (PT->getElementType() != streamTy)
+		continue;
+
+	    std::vector<Value*> idx(GEP->idx_begin(), GEP->idx_end());
+	    if (idx.empty()) continue;
+	    uint64_t off = TD.getIndexedOffset(PT, &idx[0], idx.size());
+	    uint64_t val;
+	    if (off == offsetof(skir_stream_t, elem_size))
+		val = rs->elem_size;
+	    else if (fixed && off == offsetof(skir_stream_t, size))
+		val = rs->qsize;
+	    else
+		continue;
+
+	    for (Value::use_iterator U = GEP->use_begin(); U != GEP->use_end(); ) {
+		LoadInst *LI = dyn_cast<LoadInst>(*U); ++U;
+		if (!LI || !isa<IntegerType>(LI->getType())) continue;
+		LI->replaceAllUsesWith(ConstantInt::get(LI->getType(), val));
+		LI->eraseFromParent();
+	    }
+	}
+
+	return S;
+    }
+
     bool specializeOperSize(Function &F)
     {
 	if (!kernel) return false;
@@ -87,7 +153,9 @@ struct SKIRStreamOptsPass : public FunctionPass {
 		std::string tmplt("_E_B_ILi0ELi0");
 
 		if (name.find(prefix) == std::string::npos) continue;
-		if (name.find(tmplt) == std::string::npos) continue;
+		// the zero-copy ops are no templates, but scale by elem_size
+		bool zero_copy = isInlineZeroCopyOp(name);
+		if (name.find(tmplt) == std::string::npos && !zero_copy) continue;
 
 		// stream index
 		if (!dyn_cast<ConstantInt>(CI->getOperand(2))) continue;
@@ -95,21 +163,29 @@ struct SKIRStreamOptsPass : public FunctionPass {
 		ConstantInt *idx_oper = cast<ConstantInt>(CI->getOperand(2));
 		unsigned idx = idx_oper->getZExtValue();
 
-		size_t elem_size;
+		SKIRRuntimeStream *rs;
 		if (name.find("push") != std::string::npos)
-		    elem_size = kernel->rt_outs[idx]->elem_size;
+		    rs = kernel->rt_outs[idx];
 		else
-		    elem_size = kernel->rt_ins[idx]->elem_size;
-
-		std::stringstream ss;
-		ss << "_E_B_ILi" << elem_size << "ELi" << STREAM_BUFFER_SIZE;
-		name.replace( name.find(tmplt), tmplt.length(), ss.str() );
-
-		if (!work->getParent()->getFunction(name)) {
-		    assert(0);
+		    rs = kernel->rt_ins[idx];
+		size_t elem_size = rs->elem_size;
+
+		// the pre-instantiated ops have the buffer size built in, a
+		// stream that can grow has to stay off them
+		Constant *F = 0;
+		if (!zero_copy && rs->max_size == STREAM_BUFFER_SIZE) {
+		    std::stringstream ss;
+		    ss << "_E_B_ILi" << elem_size << "ELi" << STREAM_BUFFER_SIZE;
+		    name.replace( name.find(tmplt), tmplt.length(), ss.str() );
+
+		    if (work->getParent()->getFunction(name))
+			F = getInlineCode(work->getParent(), name.c_str());
 		}
-			
-		Constant *F = getInlineCode(work->getParent(), name.c_str());
+		// any other element size or buffer size
+		if (!F)
+		    F = specializeGeneric(CI->getCalledFunction(), rs);
+		if (!F) continue;
+
 		User::op_iterator B = CI->op_begin(); ++B;
 		CI = ReplaceCallWith(CI, F, B, CI->op_end() );
 		
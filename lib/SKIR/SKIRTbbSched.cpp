@@ -45,6 +45,8 @@
 
 #include <sys/time.h>
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <sys/syscall.h>
 
 #ifndef _GNU_SOURCE
@@ -57,18 +59,29 @@
 
 namespace llvm {
 
-static cl::opt<int>
-TbbRetries("tbb-retries",
-	   cl::desc("tbb retries"), cl::init(-1));
+int TbbRetries;
+static cl::opt<int, true>
+FakeTbbRetries("tbb-retries",
+	       cl::desc("tbb retries"),
+	       cl::location(TbbRetries), cl::init(-1));
 
+bool TbbMonitor;
+static cl::opt<bool, true>
+FakeTbbMonitor("tbb-monitor",
+	       cl::desc("tbb monitor"),
+	       cl::location(TbbMonitor), cl::init(false));
 
-static cl::opt<bool>
-TbbMonitor("tbb-monitor",
-	   cl::desc("tbb monitor"), cl::init(false));
+bool EnableD4R;
+static cl::opt<bool, true>
+FakeEnableD4R("tbb-d4r",
+	      cl::desc("enable D4R deadlock detection"),
+	      cl::location(EnableD4R), cl::init(false));
 
-static cl::opt<bool>
-EnableD4R("tbb-d4r",
-          cl::desc("enable D4R deadlock detection"), cl::init(false));
+// seconds between recomputing critical path priorities with -priority-sched
+#define PRIORITY_PERIOD 0.01
+
+// microseconds the block monitor sleeps when the logs are empty
+#define BLOCK_MON_DELAY 1000
 
 #if 0
 // < thread affinity, tbb affinity >
@@ -107,62 +120,39 @@ public:
 static MyObserver observer;
 #endif
 
-//
-// kernel_map & helpers
-//   kernel_map maps SKIRRuntimeKernels (i.e. skir intrisic operand)
-//   to a corresponding kernel_t (i.e. sched implementation details)
-//
-
-// hash_map<int> kernel_map 
-static kernel_map_t kernel_map;
-
-// kernel_map[key]
-static kernel_t*
-kernel_map_find(SKIRRuntimeKernel *key)
-{
-    kernel_map_t::const_accessor a;
-    if (kernel_map.find(a,key))
-	return a->second;
-    return NULL;
-}
-
-// kernel_map[key] = value
-static void
-kernel_map_insert(SKIRRuntimeKernel *key, kernel_t *value)
-{
-    kernel_map_t::accessor a;
-    kernel_map.insert(a, key);
-    a->second = value;
-}
-
 //
 // kernel_task
 //
 
 class kernel_task : public tbb::task
 {
+    SKIRTbbSched *s;
     kernel_t *k;
+    bool recycled;
 
 public:
 
-    kernel_task(kernel_t *kernel) : k(kernel) {
+    // the task holds a reference on kernel until it finishes
+    kernel_task(SKIRTbbSched *sched, kernel_t *kernel) : s(sched), k(kernel) {
 	kernel_lock_t::scoped_lock l;
 	assert(!l.try_acquire(k->lock) && "must hold kernel->lock in kernel_task constructor");
 	assert(k->running > 0);
+	k->ref();
 	k->stats.num_tasks++;
 	k->owning_task = this;
 	k->fail = 0;
-	k->retries = TbbRetries;
+	k->retries = s->retries;
     }
 
     static task *new_kernel_task(kernel_task *t, kernel_t *k) {
-	task *new_t = new(t->task::allocate_additional_child_of(*t->parent())) kernel_task(k);
+	task *new_t = new(t->task::allocate_additional_child_of(*t->parent())) kernel_task(t->s, k);
 	//assert(k->rt_kernel.affinity >= 0);
 	//new_t->set_affinity(k->rt_kernel.affinity);
 	return new_t;
     }
 
     void recycle(void) {
+	recycled = true;
 	k->stats.num_continue++;
 	set_ref_count(1);
 	recycle_as_safe_continuation();
@@ -179,15 +169,63 @@ public:
     }
 #endif
 
-    static SKIRRuntimeKernel* d4r_cb(void *v, SKIRRuntimeKernel *me, SKIRRuntimeKernel *r)
+    //
+    // resolve an artificial deadlock by doubling the buffer of s, the full
+    // stream from me to r.  If either kernel is running, or the reader
+    // holds a reservation, we give up for now and D4R finds the deadlock
+    // again.  A stream that can't grow any more is reported once and left
+    // deadlocked.
+    //
+    static void growStream(SKIRRuntimeKernel *me, SKIRRuntimeKernel *r, SKIRRuntimeStream *s)
     {
-//#define DEBUG(fmt, ...) fprintf(stderr, fmt, ## __VA_ARGS__)
-#define DEBUG(fmt, ...)
+        kernel_t *writer = kernel_t::get(me);
+        if (!writer)
+            return;
+        kernel_ref_t writer_ref(writer);
+        kernel_lock_t::scoped_lock wlock;
+        if (!wlock.try_acquire(writer->lock))
+            return;
+        kernel_t *reader = kernel_t::get(r);
+        if (!reader)
+            return;
+        kernel_ref_t reader_ref(reader);
+        kernel_lock_t::scoped_lock lock;
+        if (!lock.try_acquire(reader->lock))
+            return;
+
+        size_t old = s->si->size;
+        size_t size = old * 2;
+        if (size > s->max_size)
+            size = s->max_size;
+        skir_stream_grow_t grown = skir_stream_grow(s, size);
+        if (grown == SKIR_STREAM_BUSY)
+            return;
+        if (grown == SKIR_STREAM_CANT_GROW) {
+            if (!s->cant_grow)
+                errs() << "D4R: artificial deadlock, stream " << s->id << " ("
+                       << me->work->getName() << " -> " << r->work->getName()
+                       << ") can't grow past " << old << " bytes\n";
+            s->cant_grow = true;
+            return;
+        }
 
-        //SKIRRuntimeGraph *sg = (SKIRRuntimeGraph *)v;
+        errs() << "D4R: artificial deadlock, grew stream " << s->id << " ("
+               << me->work->getName() << " -> " << r->work->getName() << ") from "
+               << old << " to " << size << " bytes\n";
 
-        if (r == 0) return r;
-	if ((size_t)r & 1) return r;
+        // start over, the cycle is broken
+        me->last_blocker = 0;
+    }
+
+    //
+    // D4R, run by the block monitor for each (me, r) event.  The monitor is
+    // the only thread that touches the tags, the tag changed flags and
+    // last_blocker/last_niter, so they need no locking.
+    //
+    static void d4r(SKIRRuntimeKernel *me, SKIRRuntimeKernel *r, unsigned long long niter)
+    {
+//#define DEBUG(fmt, ...) fprintf(stderr, fmt, ## __VA_ARGS__)
+#define DEBUG(fmt, ...)
 
         SKIRRuntimeStream *s = 0;
         int qsize = 0;
@@ -208,20 +246,18 @@ public:
                 break;
             }
         }
-        if (!s) return r;
+        if (!s) return;
 
-        if ((r == me->last_blocker) && (me->total_niter == me->last_niter)) {
+        if ((r == me->last_blocker) && (niter == me->last_niter)) {
             // Transmit
             DEBUG("Transfer: %llu %p\n", me->total_niter, r);
             if (qsize > 0 && s->writetagchanged)
                 s->writetagchanged = false;
             else if (s->readtagchanged)
                 s->readtagchanged = false;
-            else return r;
+            else return;
 
             {
-                //tag_lock_t::scoped_lock lock;
-                //lock.acquire(me->taglock);
                 if (me->publicTag < r->publicTag) {
                     uint128_t priority = std::min(me->privateTag.Priority(), r->publicTag.Priority());
                     me->publicTag = r->publicTag;
@@ -245,8 +281,12 @@ public:
                           r->publicTag.Count(), r->publicTag.Key(),
                           (int)r->publicTag.QueueSize(), r->publicTag.QueueKey());
                     if (me->publicTag.Priority() == me->privateTag.Priority()) {
+                        // the event is stale, me moved on since
+                        if (me->total_niter != niter) return;
                         if (qsize == -1) assert(0 && "True deadlock detected");
-                        else assert(0 && "Artificial deadlock detected");
+                        // me is blocked writing the smallest queue in the cycle
+                        else growStream(me, r, s);
+                        return;
                     }
                 } else {
                     DEBUG("Transfer: publicTag > t NOP\n\tPrivate: (%llu, %llu, %d, %llu)\n" \
@@ -267,8 +307,6 @@ public:
         } else {
             // Block
             {
-                //tag_lock_t::scoped_lock lock;
-                //lock.acquire(me->taglock);
                 me->privateTag.QueueSize(qsize);
                 me->privateTag.Count(std::max(me->publicTag.Count(), r->publicTag.Count()) + 1);
                 me->publicTag = me->privateTag;
@@ -280,27 +318,21 @@ public:
             for (int j=0; j<me->nouts; j++)
                 me->rt_outs[j]->writetagchanged = true;
 
-            me->last_niter = me->total_niter;
+            me->last_niter = niter;
             me->last_blocker = r;
         }
-        return r;
 #undef DEBUG
     }
 
     // 
-    // try to perform dynamic kernel fusion
+    // try to perform dynamic kernel fusion, run by the block monitor.
+    // Returns the fused kernel or r.
     //
-    static SKIRRuntimeKernel* merge_cb(void *v, SKIRRuntimeKernel *me, SKIRRuntimeKernel *r)
+    static SKIRRuntimeKernel* merge(SKIRRuntimeGraph *sg, SKIRRuntimeKernel *me, SKIRRuntimeKernel *r)
     {
-	SKIRRuntimeGraph *sg = (SKIRRuntimeGraph *)v;
-
 	//SKIRRuntimeKernel *limiter = sg->getLimiter();
 	//if(limiter) errs() << "LIMITER: " << limiter->work->getName() << "\n";
 
-        // if kernel returned normally
-	if (r == 0) return r;
-	if ((size_t)r & 1) return r;
-
 	// only kernels that have run for a while
 	if (r->total_niter < 32) return r;
 	if (me->total_niter < 32) return r;
@@ -327,7 +359,15 @@ public:
 		if (r->total_runtime / r->total_niter > 256) return r;
 
 		SKIRRuntimeKernel *new_rtk = 0;
-		kernel_t *blocker = kernel_map_find(r);
+		// me isn't in a work call either, we run off the monitor
+		kernel_t *blockee = kernel_t::get(me);
+		if (!blockee) return r;
+		kernel_ref_t blockee_ref(blockee);
+		kernel_lock_t::scoped_lock ml;
+		if (!ml.try_acquire(blockee->lock)) return r;
+		kernel_t *blocker = kernel_t::get(r);
+		if (!blocker) return r;
+		kernel_ref_t blocker_ref(blocker);
 		kernel_lock_t::scoped_lock l;
 		if (l.try_acquire(blocker->lock)) {
                     // now we have a lock on both the blocker and the blockee
@@ -343,6 +383,11 @@ public:
 			    me->sched->removeKernel(me);
 			    r->sched->removeKernel(r);
 
+			    // both are stopped and unscheduled, their code can go
+			    sg->retireKernel(me);
+			    sg->retireKernel(r);
+			    sg->reclaimCode();
+
 			    SKIRRuntime::runLLVMOpts(new_rtk);
 			    SKIRRuntime::runSKIRCloneWorkPass(new_rtk);
 
@@ -359,7 +404,9 @@ public:
 			    new_rtk->sched->callKernel(new_rtk);
 			    return new_rtk;
 			}
-			// failed to merge
+			// failed to merge, drop the clones made for it
+			sg->freeCode(me, me->work);
+			sg->freeCode(r, r->work);
 			me->work = old_me_work;
 			r->work = old_r_work;
 		    }
@@ -390,7 +437,9 @@ public:
 		if (r->nouts != 1) return r;
 
 		// try to get a lock on the blocking kernel
-		kernel_t *blocker = kernel_map_find(r);
+		kernel_t *blocker = kernel_t::get(r);
+		if (!blocker) return r;
+		kernel_ref_t blocker_ref(blocker);
 		kernel_lock_t::scoped_lock l;
 		if (l.try_acquire(blocker->lock)) {
 		    //skir_stream_t *s = me->rt_outs[0]->si;
@@ -416,6 +465,17 @@ public:
     }
 
     task *execute()
+    {
+	recycled = false;
+	task *next = runKernel();
+	// k's lock is released by now; unless recycled, this task is done
+	// with k and k may be reclaimed
+	if (!recycled)
+	    k->unref();
+	return next;
+    }
+
+    task *runKernel()
     {
 	kernel_lock_t::scoped_lock lock;
 	if (lock.try_acquire(k->lock)) {
@@ -433,19 +493,27 @@ public:
 		assert(k->rt_kernel.workfn);
 	    }
 
-	    int retries = TbbRetries;
+	    s->sg->checkKernelNode(&k->rt_kernel);
+	    int retries = s->retries;
 
 	    while (1) {
-		if (!kernel_map_find(&k->rt_kernel)) break;
+		// removed from the scheduler
+		if (k->rt_kernel.sched_kernel != k) break;
 
 		k->rt_kernel.rt_state->cycles = 0;
 
 		// k->work returns 0 to be rescheduled, 1 if it is finished.
 		// otherwise, it returns a pointer to a blocking kernel.
+		size_t niter = 0;
 		SKIRRuntimeKernel *b = k->work();
 		while (b == 0) {
+		    // stop between work calls if paused
+		    if (!k->is_active()) break;
+		    // or at the end of a latency mode quantum
+		    if (s->sg->quantumExpired(&k->rt_kernel, niter)) break;
 		    b = k->work();
 		}
+		if (b == 0) break;
 
 #if 0
 		AffinityPair::reference pair = affinity_pair.local();
@@ -457,7 +525,8 @@ public:
 		if (b == (SKIRRuntimeKernel *)1) {
 		    k->done();
 		}
-		else if (kernel_t *blocker = kernel_map_find(b)) {
+		else if (kernel_t *blocker = kernel_t::get(b)) {
+		    kernel_ref_t blocker_ref(blocker);
 		    kernel_lock_t::scoped_lock l;
 		    if (l.try_acquire(blocker->lock)) {
 			if (blocker->running == 0) {
@@ -467,7 +536,7 @@ public:
 			    return t;
 			}
 			else {
-			    if (!DisableKoroSteal)
+			    if (!s->sg->getRuntime().getOptions().disable_koro_steal)
 				if (tbb::task *t = find_and_steal_task(*blocker->owning_task)) {
 				    recycle();
 				    return t;
@@ -505,18 +574,39 @@ SKIRTbbSched::SKIRTbbSched(SKIRRuntimeGraph *stream_graph, int nthreads) : sg(st
 									   num_workers(nthreads),
 									   verbose(false),
 									   root_task(NULL),
-									   main_thread(NULL)
+									   main_thread(NULL),
+									   mon_thread(NULL),
+									   block_thread(NULL),
+									   block_log(NULL),
+									   last_was_dec(false),
+									   last_was_inc(false),
+									   last_load(0.0)
 {
     running = 0;
-    if (TbbRetries == -1) {
+    priority = sg->getRuntime().getOptions().priority_sched;
+    if (sg->getRuntime().getOptions().tbb_d4r || sg->getRuntime().getOptions().enable_merge)
+	block_log = new SKIRBlockLog();
+    retries = sg->getRuntime().getOptions().tbb_retries;
+    if (retries == -1) {
 	if (num_workers > 1) {
-	    TbbRetries = 0;
+	    retries = 0;
 	} else {
-	    TbbRetries = 1;
+	    retries = 1;
 	}
     }
 }
 
+SKIRTbbSched::~SKIRTbbSched()
+{
+    // workers are gone before the kernel pool
+    stop();
+    if (block_log) {
+	if (verbose)
+	    errs() << "TBB: " << block_log->dropped() << " blocking events dropped\n";
+	delete block_log;
+    }
+}
+
 void
 SKIRTbbSched::runCodeGen(SKIRRuntimeKernel *rtk)
 {
@@ -526,8 +616,9 @@ SKIRTbbSched::runCodeGen(SKIRRuntimeKernel *rtk)
 void
 SKIRTbbSched::waitKernel(SKIRRuntimeKernel *rt_kernel)
 {
-    kernel_t *k = kernel_map_find(rt_kernel);
+    kernel_t *k = kernel_t::get(rt_kernel);
     assert(k);
+    kernel_ref_t ref(k);
     k->wait(DONE);
 }
 
@@ -563,58 +654,59 @@ void
 SKIRTbbSched::callKernel(SKIRRuntimeKernel *rt_kernel)
 {
     //    errs() << "SKIRTbbSched callKernel: " << rt_kernel->work->getName() << "\n";
-    kernel_t *k = new kernel_t(*rt_kernel);
+    // a SKIRRuntimeKernel points at its kernel_t while it is called
+    kernel_t *k = kernel_pool.alloc(*rt_kernel);
     assert(k);
 
-    if (EnableD4R) {
-        k->d4r_cb = kernel_task::d4r_cb;
-        k->d4r_cb_data = sg;
-    }
-    if (EnableMergeSched) {
-	k->niter_cb = kernel_task::merge_cb;
-	k->niter_cb_data = sg;
-    }
+    k->block_log = block_log;
     //setAffinities();
 
-    kernel_map_insert(rt_kernel, k);
+    // replaces (and drops) the kernel_t of an earlier call
+    if (kernel_t *old = rt_kernel->sched_kernel.fetch_and_store(k))
+	old->unref();
     k->active();
+    k->ref(); // runq's reference
     runq.push(k);
 }
 
 void
 SKIRTbbSched::removeKernel(SKIRRuntimeKernel *rt_kernel)
 {
-    kernel_t *k = kernel_map_find(rt_kernel);
+    kernel_t *k = rt_kernel->sched_kernel.fetch_and_store(0);
     if (k) {
 	k->owning_task = 0;
-	kernel_map_insert(rt_kernel, 0);
-	// XXX should delete k here but it's not ref counted
-	// so we can't.  instead it leaks
+	// a parked kernel's runq reference
+	if (k->unpark())
+	    k->unref();
+	// tasks and the runq drop theirs when they see it's gone
+	k->unref();
     }
 }
 
 void
 SKIRTbbSched::pauseKernel(SKIRRuntimeKernel *rt_kernel)
 {
-    kernel_t *k = kernel_map_find(rt_kernel);
+    kernel_t *k = kernel_t::get(rt_kernel);
     assert(k);
+    kernel_ref_t ref(k);
     k->pause();
 }
 
 void
 SKIRTbbSched::unPauseKernel(SKIRRuntimeKernel *rt_kernel)
 {
-    kernel_t *k = kernel_map_find(rt_kernel);
+    kernel_t *k = kernel_t::get(rt_kernel);
     assert(k);
+    kernel_ref_t ref(k);
     k->unpause();
+    // the parked runq reference goes back on the runq
+    if (k->unpark())
+	runq.push(k);
 }
 
 int
 SKIRTbbSched::loadCallback(float load)
 {
-    static bool last_was_dec = false;
-    static bool last_was_inc = false;
-    static float last_load = 0.0;
     int backoff = 0;
 
     if (!root_task)
@@ -670,7 +762,7 @@ struct skir_tbb_mon_thread {
     unsigned delay;
     skir_tbb_mon_thread(SKIRTbbSched &sched) : s(sched), delay(100000) {}
     void operator()() {
-        while (1) {
+        while (s.isRunning()) {
             usleep(delay);
 
             char cmd[1024];
@@ -700,16 +792,45 @@ struct skir_tbb_mon_thread {
     }
 };
 
+//
+// the block monitor runs D4R and the merge heuristics on the events the
+// work loops record in block_log
+//
+struct skir_tbb_block_mon_thread {
+    SKIRTbbSched &s;
+    bool d4r;
+    bool merge;
+    skir_tbb_block_mon_thread(SKIRTbbSched &sched) : s(sched) {
+	const SKIRRuntimeOptions &opts = s.sg->getRuntime().getOptions();
+	d4r = opts.tbb_d4r;
+	merge = opts.enable_merge;
+    }
+    void operator()(block_event_t &e) {
+	if (d4r)
+	    kernel_task::d4r(e.me, e.blocker, e.niter);
+	if (merge)
+	    kernel_task::merge(s.sg, e.me, e.blocker);
+    }
+    void operator()() {
+	while (s.isRunning()) {
+	    if (s.block_log->drain(*this) == 0)
+		usleep(BLOCK_MON_DELAY);
+	}
+    }
+};
+
 void
 SKIRTbbSched::start(void)
 {
     if (running.compare_and_swap(1,0) == 0) {
 	main_thread = new tbb::tbb_thread(*(new skir_tbb_thread(*this)));
-	if (TbbMonitor) {
+	if (sg->getRuntime().getOptions().tbb_monitor) {
             if (verbose)
                 errs() << "TBB: monitoring is on\n";
             mon_thread = new tbb::tbb_thread(*(new skir_tbb_mon_thread(*this)));
         }
+	if (block_log)
+	    block_thread = new tbb::tbb_thread(*(new skir_tbb_block_mon_thread(*this)));
 	assert(main_thread);
     }
 }
@@ -723,6 +844,14 @@ SKIRTbbSched::stop(void)
 	assert(main_thread && main_thread->joinable() && "not running");
 	main_thread->join();
 	main_thread = NULL;
+	if (mon_thread) {
+	    mon_thread->join();
+	    mon_thread = NULL;
+	}
+	if (block_thread) {
+	    block_thread->join();
+	    block_thread = NULL;
+	}
     }
 }
 
@@ -734,46 +863,117 @@ SKIRTbbSched::run()
     root_task = new(tbb::task::allocate_root()) tbb::empty_task;
     root_task->increment_ref_count();
 
+    std::vector<kernel_t *> batch;
+    std::vector<tbb::task *> tasks;
+    tbb::tick_count last_update = tbb::tick_count::now();
+
     while (running == 1) {
-	kernel_t *k = 0;
-	if (runq.try_pop(k)) {
-	    if (kernel_map_find(&k->rt_kernel) && k->is_active()) {
-		tbb::task *t = 0;
-		if (k->running == 0) {
-		    kernel_lock_t::scoped_lock lock;
-		    if (lock.try_acquire(k->lock)) {
+	batch.clear();
+	if (priority) {
+	    popByPriority(batch, last_update);
+	}
+	else {
+	    kernel_t *k = 0;
+	    if (runq.try_pop(k))
+		batch.push_back(k);
+	}
 
-			if (!k->rt_kernel.workfn) {
-			    k->rt_kernel.sched->runCodeGen(&k->rt_kernel);
-			    assert(k->rt_kernel.workfn);
-			}
+	if (batch.empty()) {
+	    // runq is empty, yield
+	    tbb::this_tbb_thread::yield();
+	    continue;
+	}
 
-			if (k->running == 0) {
-			    k->running++;
-			    t = new (root_task->allocate_child()) kernel_task(k);
-			    //assert(k->rt_kernel.affinity >= 0);
-			    //t->set_affinity(k->rt_kernel.affinity);
-			}
-		    }
+	tasks.clear();
+	for (unsigned i=0; i<batch.size(); i++)
+	    if (tbb::task *t = dispatch(batch[i]))
+		tasks.push_back(t);
+	if (tasks.empty())
+	    continue;
+
+	// this thread runs the tasks it spawned last in first out, so the
+	// batch, highest priority first, is spawned back to front
+	for (size_t i=tasks.size(); i>0; i--) {
+	    root_task->increment_ref_count();
+	    root_task->spawn(*tasks[i-1]);
+	}
+	if (root_task->ref_count() >= runq.size()) {
+	    root_task->wait_for_all();
+	    root_task->increment_ref_count();
+	}
+    }
+}
+
+// a task for k to spawn unless it is already running, then hand the
+// runq's reference back
+tbb::task *
+SKIRTbbSched::dispatch(kernel_t *k)
+{
+    tbb::task *t = 0;
+    // the runq's reference keeps k alive here
+    if (k->rt_kernel.sched_kernel == k && k->is_active()) {
+	if (k->running == 0) {
+	    kernel_lock_t::scoped_lock lock;
+	    if (lock.try_acquire(k->lock)) {
+
+		if (!k->rt_kernel.workfn) {
+		    k->rt_kernel.sched->runCodeGen(&k->rt_kernel);
+		    assert(k->rt_kernel.workfn);
 		}
-		if (t) {
-		    root_task->increment_ref_count();
-		    root_task->spawn(*t);
-		    if (root_task->ref_count() >= runq.size()) {
-		    	root_task->wait_for_all();
-		    	root_task->increment_ref_count();
-		    }
+
+		if (k->running == 0) {
+		    k->running++;
+		    t = new (root_task->allocate_child()) kernel_task(this, k);
+		    //assert(k->rt_kernel.affinity >= 0);
+		    //t->set_affinity(k->rt_kernel.affinity);
 		}
 	    }
-	    if (!k->is_done()) {
-		if (kernel_map_find(&(k->rt_kernel)) == k)
-		    runq.push(k);
-	    }
-	} else {
-	    // runq is empty, yield
-	    tbb::this_tbb_thread::yield();
 	}
     }
+    // hand the reference back to the runq, or drop it.  A paused kernel
+    // keeps it while parked, unPauseKernel puts it back on the runq.
+    if (!k->is_done() && k->rt_kernel.sched_kernel == k) {
+	if (!k->is_paused() || !k->park())
+	    runq.push(k);
+    }
+    else
+	k->unref();
+    return t;
+}
+
+struct kernel_priority_cmp {
+    bool operator()(const std::pair<int, kernel_t *> &a,
+		    const std::pair<int, kernel_t *> &b) const {
+	return a.first > b.first;
+    }
+};
+
+// pop everything in the runq, highest priority first.  dispatch() puts
+// every live kernel back on the runq, running or not, so the batch covers
+// the whole graph and a kernel that is still running is only skipped
+// when it is dispatched.
+void
+SKIRTbbSched::popByPriority(std::vector<kernel_t *> &batch, tbb::tick_count &last_update)
+{
+    std::vector< std::pair<int, kernel_t *> > ready;
+    kernel_t *k = 0;
+    for (size_t n = runq.size(); n > 0 && runq.try_pop(k); n--)
+	ready.push_back(std::make_pair(0, k));
+    if (ready.empty())
+	return;
+
+    tbb::tick_count now = tbb::tick_count::now();
+    if ((now - last_update).seconds() > PRIORITY_PERIOD) {
+	sg->updatePriorities();
+	last_update = now;
+    }
+
+    for (unsigned i=0; i<ready.size(); i++)
+	ready[i].first = ready[i].second->rt_kernel.getPriority();
+    std::stable_sort(ready.begin(), ready.end(), kernel_priority_cmp());
+
+    for (unsigned i=0; i<ready.size(); i++)
+	batch.push_back(ready[i].second);
 }
 
 } //namespace llvm
@@ -24,20 +24,34 @@
 #define _SKIR_TBB_SCHED_H_
 
 #include "SKIRScheduler.h"
+#include "SKIR_kernel_t.h"
 
 #include <tbb/task.h>
 #include <tbb/atomic.h>
 #include <tbb/tbb_thread.h>
 #include <tbb/concurrent_queue.h>
+#include <tbb/tick_count.h>
+
+#include <vector>
 
 namespace llvm {
 
 class SKIRRuntimeGraph;
-class kernel_t;
+class kernel_task;
 
+//
+// SKIRTbbSched - task based scheduler
+//
+// All state is per instance: run() executes on the scheduler's own thread
+// and its task_scheduler_init gives that master thread its own arena, so
+// the kernels of one runtime instance are never run by another's tasks.
+//
 class SKIRTbbSched : public SKIRScheduler {
+    friend class kernel_task;
+    friend struct skir_tbb_block_mon_thread;
 public:
     SKIRTbbSched(SKIRRuntimeGraph *stream_graph, int nthreads);
+    ~SKIRTbbSched();
 
     void callKernel(SKIRRuntimeKernel *rtk);
     void removeKernel(SKIRRuntimeKernel *rtk);
@@ -60,8 +74,12 @@ public:
     void run(void);
 
     int loadCallback(float load);
+    bool isRunning(void) { return running == 1; }
 
 private:
+    tbb::task *dispatch(kernel_t *k);
+    void popByPriority(std::vector<kernel_t *> &batch, tbb::tick_count &last_update);
+
     SKIRRuntimeGraph *sg;
 
     int cur_workers;
@@ -71,9 +89,27 @@ private:
     tbb::task *root_task;
     tbb::tbb_thread *main_thread;
     tbb::tbb_thread *mon_thread;
+    tbb::tbb_thread *block_thread;
+
+    // (me, blocker) events for D4R and merging, 0 if both are off
+    SKIRBlockLog *block_log;
 
     tbb::atomic<int> running;
 
+    // loadCallback history
+    bool last_was_dec;
+    bool last_was_inc;
+    float last_load;
+
+    // retries after failing to lock a blocking kernel
+    int retries;
+
+    // dispatch by SKIRRuntimeKernel::getPriority, -priority-sched
+    bool priority;
+
+    // kernel_t memory
+    kernel_pool_t kernel_pool;
+
     tbb::concurrent_bounded_queue<kernel_t *> runq;
 
 
@@ -37,6 +37,7 @@
 #include <string.h>
 
 #include "SKIRRuntimeKernel.h"
+#include "SKIRRuntimeBitcode.h"
 
 using namespace llvm;
 
@@ -73,6 +74,15 @@ ReplaceCallWith(const char *NewFn, CallInst *CI,
     return NewCI;
 }
 
+/// the same, always declaring NewFn in CI's module
+template <class ArgIt> static CallInst *
+ReplaceCallWith(const char *NewFn, CallInst *CI,
+		ArgIt ArgBegin, ArgIt ArgEnd, const Type *RetTy)
+{
+    Constant *F = 0;
+    return ReplaceCallWith(NewFn, CI, ArgBegin, ArgEnd, RetTy, F);
+}
+
 template <class ArgIt> static CallInst *
 ReplaceCallWith(CallInst *CI, Constant *F, ArgIt ArgBegin, ArgIt ArgEnd)
 {
@@ -102,31 +112,37 @@ template <class ArgIt> static CallInst
     return NewCI;
 }
 
-static Module *inline_module = 0;
+// named metadata marking a module the inline ops were spliced into.  the
+// ops are read once per module, so each runtime (and LLVMContext) gets
+// its own copy
+#define SKIR_INLINE_OPS "skir.inline_ops"
 
 Constant *
 getInlineCode(Module *mod, const char *Fn)
 {
     assert(mod);
      
-     if (Constant *C = mod->getFunction(Fn))
-	 return C;
-     
-     if (!inline_module) {
-	 std::string skir_root(getenv("SKIR_OBJ_ROOT"));
-	 std::string filename(skir_root+"/lib/inline_stream_ops.bc");
+     // the host module is the lazily read runtime module, so its
+     // functions may still be waiting in the bitcode
+     if (Function *F = mod->getFunction(Fn)) {
 	 std::string errormsg;
-	 if (MemoryBuffer *buffer = MemoryBuffer::getFileOrSTDIN(filename, &errormsg)) {
-	     inline_module = ParseBitcodeFile(buffer, mod->getContext(), &errormsg);
-	     delete buffer;
+	 if (materializeFunction(F, &errormsg)) {
+	     errs() << "Fn: " << Fn << " failed to materialize: " << errormsg << "\n";
+	     return 0;
 	 }
+	 return F;
+     }
+     
+     if (!mod->getNamedMetadata(SKIR_INLINE_OPS)) {
+	 std::string errormsg;
+	 Module *inline_module = getRuntimeModule(mod->getContext(), &errormsg);
 	 
-	 if (inline_module == 0) {
+	 if (inline_module == 0 || inline_module->MaterializeAll(&errormsg)) {
 	     if (errormsg.size())
 		 errs() << errormsg << "\n";
 	     else
 		 errs() << "bitcode didn't read correctly.\n";
-	     assert(0 && "Couldn't parse SKIR_OBJ_ROOT/lib/inline_stream_ops.bc");
+	     assert(0 && "Couldn't parse embedded inline_stream_ops.bc");
 	     return 0;
 	 }
 	 
@@ -135,7 +151,8 @@ getInlineCode(Module *mod, const char *Fn)
 	 
 	 mod->getGlobalList().splice( mod->getGlobalList().end(),
 				      inline_module->getGlobalList() );
-	 
+	 delete inline_module;
+	 mod->getOrInsertNamedMetadata(SKIR_INLINE_OPS);
      }
      
      if (Constant *C = mod->getFunction(Fn))
@@ -190,6 +207,65 @@ makeWorkFromSkel(SKIRRuntimeKernel *k, const char *skel_name, Module *skel_mod=0
     return skel;
 }
 
+// the zero-copy stream ops have no intrinsic, they are the library calls
+// __SKIR_{push,pop}_{reserve,commit}.  0 if CI is anything else,
+// including a function of the same name with another signature
+const char *
+getZeroCopyOp(CallInst *CI)
+{
+    static const char *names[] = { "__SKIR_push_reserve", "__SKIR_push_commit",
+				   "__SKIR_pop_reserve", "__SKIR_pop_commit", 0 };
+    Function *F = CI->getCalledFunction();
+    if (!F) return 0;
+    for (int i=0; names[i]; i++) {
+	if (F->getName() != names[i])
+	    continue;
+	// (skir_stream_idx_t s, unsigned int n), reserve returns void *
+	const FunctionType *FT = F->getFunctionType();
+	bool reserve = (i % 2) == 0;
+	if (FT->isVarArg() || FT->getNumParams() != 2 ||
+	    !FT->getParamType(0)->isIntegerTy(32) ||
+	    !FT->getParamType(1)->isIntegerTy(32))
+	    return 0;
+	if (reserve ? !FT->getReturnType()->isPointerTy() : !FT->getReturnType()->isVoidTy())
+	    return 0;
+	return names[i];
+    }
+    return 0;
+}
+
+// replace a zero-copy op with __SKIRRT_inline_OP<suffix> on the kernel's
+// ins or outs, 0 if CI isn't one
+CallInst *
+lowerZeroCopyOp(CallInst *CI, Value *vins, Value *vouts, const std::string &suffix)
+{
+    const char *name = getZeroCopyOp(CI);
+    if (!name) return 0;
+
+    // __SKIR_push_reserve -> __SKIRRT_inline_push_reserve
+    std::string rt_name = std::string("__SKIRRT_inline") + (name + strlen("__SKIR")) + suffix;
+    Value *streams = strncmp(name, "__SKIR_push", strlen("__SKIR_push")) ? vins : vouts;
+    Value *ops[3] = { streams, 
+		      CI->getOperand(1),   /* stream */
+		      CI->getOperand(2) }; /* n */
+    Module *mod = CI->getParent()->getParent()->getParent();
+    return ReplaceCallWith(CI, getInlineCode(mod, rt_name.c_str()), ops, ops+3);
+}
+
+// true if name is one of the runtime functions lowerZeroCopyOp calls
+bool
+isInlineZeroCopyOp(const std::string &name)
+{
+    static const char *ops[] = { "push_reserve", "push_commit",
+				 "pop_reserve", "pop_commit", 0 };
+    for (int i=0; ops[i]; i++) {
+	std::string op = std::string("__SKIRRT_inline_") + ops[i];
+	if (name == op || name == op + "_block")
+	    return true;
+    }
+    return false;
+}
+
 void
 CloneModuleInto(const Module *srcM, Module *dstM)
 {
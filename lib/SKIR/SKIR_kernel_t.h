@@ -25,7 +25,10 @@
 
 #include "SKIRRuntimeKernel.h"
 #include "SKIRTiming.h"
+#include "SKIRBlockLog.h"
 #include <pthread.h>
+#include <stdlib.h>
+#include <new>
 #include <tbb/tbb.h>
 
 //
@@ -46,13 +49,12 @@ typedef enum {
     DONE
 } kernel_state_t;
 
-struct pause_tbb_thread;
-
 struct kernel_t {
     kernel_t(SKIRRuntimeKernel &k) :
 	running(), owning_task(NULL), lock(), rt_kernel(k)
     {
 	running = 0;
+	parked = 0;
 	retries = 0;
 	fail = 0;
 	id = k.id;
@@ -60,8 +62,12 @@ struct kernel_t {
 	pthread_mutex_init(&wait_mutex, NULL);
 	pthread_cond_init (&wait_cond, NULL);
 	wait_state = IDLE;
-	niter_cb = 0;
-	d4r_cb = 0;
+	block_log = 0;
+	home = -1;
+	// recycled memory always has refs == 0, and a 0 is never changed by
+	// try_ref, so this store can't race with a stale reader
+	refs = 0;
+	reclaim_cb = 0;
     }
 
     ~kernel_t() {
@@ -72,6 +78,9 @@ struct kernel_t {
 
     SKIRRuntimeKernel* work() {
 	rt_kernel.rt_state->niter = 0;
+	SKIRRuntimeKernel *&current = SKIRRuntimeKernel::current();
+	SKIRRuntimeKernel *outer = current;
+	current = &rt_kernel;
 	unsigned long long tsc;
 	rdtscll(tsc);
 	SKIRRuntimeKernel *r = (SKIRRuntimeKernel *)rt_kernel.workfn((void*)rt_kernel.rt_state,
@@ -80,21 +89,16 @@ struct kernel_t {
 								     (void*)rt_kernel.impl_outs);
 	unsigned long long tsc2;
 	rdtscll(tsc2);
+	current = outer;
 	rt_kernel.rt_state->cycles += (tsc2 - tsc);
 	rt_kernel.total_runtime += (tsc2 - tsc);
 	rt_kernel.total_niter += rt_kernel.rt_state->niter;
 	rt_kernel.total_ncall++;
 
-        if (d4r_cb) {
-            if ((rt_kernel.total_ncall & 0xff) == 0) {
-                d4r_cb(d4r_cb_data, &rt_kernel, r);
-            }
-        }
-	if (niter_cb) {
-	    if ((rt_kernel.total_niter & 0x3) == 0) {
-		r = niter_cb(niter_cb_data, &rt_kernel, r);
-	    }
-	}
+	// D4R and dynamic merging run on the scheduler's monitor thread,
+	// the work loop only tells it who blocked on whom
+	if (block_log && r && !((size_t)r & 1))
+	    block_log->record(&rt_kernel, r, rt_kernel.total_niter);
 
 	return r;
     }
@@ -150,23 +154,58 @@ struct kernel_t {
 	pthread_mutex_unlock(&wait_mutex);
     }
 
-    // this simply spawns a thread that waits until the kernel is active
-    // while it waits, it holds the kernel's lock, preventing it from executing.
-    struct pause_thread {
-	kernel_t *kern;
-	pause_thread(kernel_t *kernel) : kern(kernel) { }
-	void operator()() {
-	    if (kern->is_paused()) {
-		kernel_lock_t::scoped_lock lock;
-		lock.acquire(kern->lock);
-		kern->wait(ACTIVE);
-	    }
+    //
+    // reference counting
+    //   a scheduler that sets reclaim_cb gets each kernel_t back once the
+    //   last reference is gone.  It must keep the memory type stable (reuse
+    //   it only for kernel_ts) since get() may look at a stale pointer.
+    //
+    void ref() {
+	refs.fetch_and_increment();
+    }
+
+    // take a reference unless the count already dropped to zero
+    bool try_ref() {
+	int r = refs;
+	while (r > 0) {
+	    int old = refs.compare_and_swap(r+1, r);
+	    if (old == r)
+		return true;
+	    r = old;
+	}
+	return false;
+    }
+
+    void unref() {
+	if (refs.fetch_and_decrement() == 1 && reclaim_cb)
+	    reclaim_cb(reclaim_data, this);
+    }
+
+    // a referenced kernel_t for rtk, or 0 if it isn't scheduled
+    static kernel_t *get(SKIRRuntimeKernel *rtk) {
+	kernel_t *k = rtk->sched_kernel;
+	if (!k || !k->try_ref())
+	    return 0;
+	// recycled for another kernel between the load and try_ref
+	if (rtk->sched_kernel != k) {
+	    k->unref();
+	    return 0;
 	}
-    };
+	return k;
+    }
 
+    //
+    // pausing
+    //   a paused kernel is only a state: every scheduler checks is_active()
+    //   while it holds the lock and before it calls work, and stops calling
+    //   work when it isn't.  A scheduler that drops a paused kernel from its
+    //   queues parks it, and queues it again when unPauseKernel unparks it.
+    //
     bool is_paused() {
 	return (wait_state == PAUSED);
     }
+
+    // returns once the kernel is stopped between calls to its work function
     void pause() {
 	pthread_mutex_lock(&wait_mutex);
 	if (is_done()) {
@@ -177,17 +216,43 @@ struct kernel_t {
 	pthread_cond_signal(&wait_cond);
 	pthread_mutex_unlock(&wait_mutex);
 
-	new tbb::tbb_thread(*(new pause_thread(this)));
+	// wait out a work call in progress, the next one sees PAUSED
+	kernel_lock_t::scoped_lock l(lock);
     }
 
     void unpause() {
-	active();
+	// don't revive a kernel that finished while paused
+	if (is_paused())
+	    active();
+    }
+
+    // true if the caller may drop the paused kernel from its queue; false
+    // if it was unpaused meanwhile and the caller has to keep it
+    bool park() {
+	// fetch_and_store is a full fence, wait_state is read after it
+	parked.fetch_and_store(1);
+	if (is_paused())
+	    return true;
+	return !unpark();
+    }
+
+    // true if the kernel was parked, the caller must queue it again
+    bool unpark() {
+	return parked.compare_and_swap(0, 1) == 1;
     }
 
     // these can only be written if lock is held
     tbb::atomic<int> running;
     // end locked section
 
+    // set while a paused kernel is off its scheduler's queues
+    tbb::atomic<int> parked;
+
+    // references held by the SKIRRuntimeKernel, run queues and tasks
+    tbb::atomic<int> refs;
+    void (* reclaim_cb)(void *, kernel_t *);
+    void *reclaim_data;
+
     //kernel_task *owner;
     tbb::task *owning_task;
     kernel_lock_t lock;
@@ -201,17 +266,17 @@ struct kernel_t {
 
     unsigned id;
 
+    // worker the kernel is queued on, for the M:N coroutine scheduler
+    int home;
+
     // skir.wait support
     kernel_state_t wait_state;
     pthread_mutex_t wait_mutex;
     pthread_cond_t wait_cond;
     int wait_cnt;
 
-    SKIRRuntimeKernel* (* niter_cb)(void *, SKIRRuntimeKernel *me, SKIRRuntimeKernel *ret);
-    void *niter_cb_data;
-
-    SKIRRuntimeKernel* (* d4r_cb)(void *, SKIRRuntimeKernel *me, SKIRRuntimeKernel *ret);
-    void *d4r_cb_data;
+    // blocking events for the monitor, 0 unless D4R or merging is on
+    SKIRBlockLog *block_log;
 
     struct task_stats {
 	task_stats() {
@@ -245,6 +310,60 @@ struct hash_compare {
 };
 typedef tbb::concurrent_hash_map<SKIRRuntimeKernel *, kernel_t *, hash_compare> kernel_map_t;
 
+// holds a reference on a kernel_t until the end of the scope
+struct kernel_ref_t {
+    kernel_t *k;
+    kernel_ref_t(kernel_t *kernel) : k(kernel) { }
+    ~kernel_ref_t() { if (k) k->unref(); }
+};
+
+//
+// kernel_pool_t - type stable kernel_t memory for reference counting scheds
+//   a kernel_t goes back on the free list when the last reference is
+//   dropped.  The memory is only reused for kernel_ts and freed with the
+//   pool, which is what makes kernel_t::get safe on a stale sched_kernel.
+//
+struct kernel_pool_t {
+    tbb::concurrent_queue<void *> free_kernels;
+    tbb::concurrent_vector<void *> kernel_mem;
+
+    // a kernel_t holding one reference, for rtk.sched_kernel
+    kernel_t *alloc(SKIRRuntimeKernel &rtk) {
+	void *mem = 0;
+	if (!free_kernels.try_pop(mem)) {
+	    // zeroed, so refs reads 0 until the kernel is published
+	    mem = calloc(1, sizeof(kernel_t));
+	    assert(mem);
+	    kernel_mem.push_back(mem);
+	}
+	kernel_t *k = new (mem) kernel_t(rtk);
+	k->reclaim_cb = reclaim;
+	k->reclaim_data = this;
+	k->refs = 1;
+	return k;
+    }
+
+    static void reclaim(void *pool, kernel_t *k) {
+	k->~kernel_t();
+	((kernel_pool_t *)pool)->free_kernels.push(k);
+    }
+
+    // only once nothing can run the kernels anymore
+    ~kernel_pool_t() {
+	void *mem;
+	while (free_kernels.try_pop(mem))
+	    ;
+	for (unsigned i=0; i<kernel_mem.size(); i++) {
+	    kernel_t *k = (kernel_t *)kernel_mem[i];
+	    if (k->refs > 0) {
+		k->rt_kernel.sched_kernel.compare_and_swap(0, k);
+		k->~kernel_t();
+	    }
+	    free(kernel_mem[i]);
+	}
+    }
+};
+
 }
 
 #endif
@@ -0,0 +1,257 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Pass.h>
+#include <llvm/PassManager.h>
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/IntrinsicInst.h>
+#include <llvm/Linker.h>
+#include <llvm/Analysis/Verifier.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Target/TargetData.h>
+#include <llvm/Transforms/IPO.h>
+
+#include <SKIR/SKIRRuntime.h>
+#include "SKIRRuntimeBitcode.h"
+#include "SKIRUtil.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+//
+// Ahead of time compilation of a whole SKIR program.
+//
+// Only kernels named by a constant at a skir.kernel site can be compiled,
+// which is the static graph ExtractStatic draws.  Every work function is
+// cloned and lowered the way the JIT does for -force-tpk: stream ops block
+// in place and are inlined, then the LLVM opts run.  The kernel sites are
+// pointed at the compiled work functions and the table __SKIRAOT_kernels
+// tells the runtime in lib/AOTRuntime which of them are hierarchical.
+//
+
+namespace llvm {
+    FunctionPass *createSKIRCloneWorkPass();
+    FunctionPass *createSKIRBlockingOpsPass();
+    FunctionPass *createSKIRInlineStreamsPass();
+}
+
+using namespace llvm;
+
+// same test as SKIRKernelInfoPass: a kernel is hierarchical if it builds
+// a graph and does no stream io of its own
+static bool
+isHierWork(Function *work)
+{
+    bool is_hier = false;
+    bool has_io = false;
+
+    for (inst_iterator I = inst_begin(work), E = inst_end(work); I != E; ++I) {
+	Instruction *inst = &*I;
+	if (isa<SKIRPushInst>(inst) || isa<SKIRPopInst>(inst) || isa<SKIRPeekInst>(inst))
+	    has_io = true;
+	else if (CallInst *CI = dyn_cast<CallInst>(inst)) {
+	    if (getZeroCopyOp(CI))
+		has_io = true;
+	    else if (Function *F = CI->getCalledFunction()) {
+		std::string name(F->getName());
+		if (!name.find("__SKIRRT_call") ||
+		    !name.find("__SKIRRT_kernel") ||
+		    !name.find("__SKIRRT_stream") )
+		    is_hier = true;
+	    }
+	}
+    }
+
+    return is_hier && !has_io;
+}
+
+// kernel sites in program order
+static void
+getKernelSites(Module *mod, Function *kernelF, std::vector<CallInst*> &sites)
+{
+    for (Module::iterator MI = mod->begin(), ME = mod->end(); MI != ME; ++MI) {
+	for (inst_iterator I = inst_begin(MI), E = inst_end(MI); I != E; ++I) {
+	    CallInst *CI = dyn_cast<CallInst>(&*I);
+	    if (CI && CI->getCalledFunction() == kernelF)
+		sites.push_back(CI);
+	}
+    }
+}
+
+// become, uncall and reconfigure, with an error for each.  become is
+// still the intrinsic here, it is lowered with the stream ops; uncall and
+// reconfigure are already calls into the runtime
+static bool
+hasDynamicGraphOps(Module *mod)
+{
+    bool found = false;
+    for (Module::iterator MI = mod->begin(), ME = mod->end(); MI != ME; ++MI) {
+	for (inst_iterator I = inst_begin(MI), E = inst_end(MI); I != E; ++I) {
+	    CallInst *CI = dyn_cast<CallInst>(&*I);
+	    if (!CI)
+		continue;
+	    const char *op = 0;
+	    if (isa<SKIRBecomeInst>(CI))
+		op = "become";
+	    else if (Function *F = CI->getCalledFunction()) {
+		if (F->getName() == "__SKIRRT_become")
+		    op = "become";
+		else if (F->getName() == "__SKIRRT_uncall")
+		    op = "uncall";
+		else if (F->getName() == "__SKIRRT_reconfigure")
+		    op = "reconfigure";
+	    }
+	    if (!op)
+		continue;
+	    errs() << "runSKIRAOTPasses: " << MI->getName() << " calls "
+		   << op << ", which isn't supported ahead of time\n";
+	    found = true;
+	}
+    }
+    return found;
+}
+
+bool
+SKIRRuntime::runSKIRAOTPasses(Module *mod, const char *entry)
+{
+    LLVMContext &CTX = mod->getContext();
+    std::string errormsg;
+
+    // link in the runtime bitcode, the stream ops come from here.  Linking
+    // rather than splicing merges declarations the program shares with it
+    Module *rt_mod = getRuntimeModule(CTX, &errormsg);
+    if (!rt_mod || rt_mod->MaterializeAll(&errormsg) ||
+	Linker::LinkModules(mod, rt_mod, &errormsg)) {
+	errs() << "runSKIRAOTPasses: can't link the runtime bitcode: " << errormsg << "\n";
+	return false;
+    }
+    delete rt_mod;
+
+    // graph ops become calls into the AOT runtime, there is no runtime object
+    runSKIRLoweringPasses(NULL, mod);
+
+    // the AOT runtime can't change a graph once it runs, refuse here
+    // rather than when the binary gets there
+    if (hasDynamicGraphOps(mod))
+	return false;
+
+    Function *kernelF = mod->getFunction("__SKIRRT_kernel");
+    if (!kernelF) {
+	errs() << "runSKIRAOTPasses: the program has no kernels\n";
+	return false;
+    }
+
+    // the static graph: every work function named at a kernel site
+    std::vector<CallInst*> sites;
+    std::vector<Function*> works;
+    getKernelSites(mod, kernelF, sites);
+    for (unsigned i = 0; i < sites.size(); i++) {
+	Function *work = dyn_cast<Function>(sites[i]->getOperand(2)->stripPointerCasts());
+	if (!work || work->isDeclaration()) {
+	    errs() << "runSKIRAOTPasses: kernel in "
+		   << sites[i]->getParent()->getParent()->getName()
+		   << " has no static work function\n";
+	    return false;
+	}
+	if (std::find(works.begin(), works.end(), work) == works.end())
+	    works.push_back(work);
+    }
+
+    // make runtime copies of the work functions
+    std::map<Function*, Function*> rt_works;
+    std::map<Function*, bool> hier;
+    {
+	FunctionPassManager PM(mod);
+	PM.add(new TargetData(mod));
+	PM.add(createSKIRCloneWorkPass());
+	PM.doInitialization();
+	for (unsigned i = 0; i < works.size(); i++) {
+	    Function *work = works[i];
+	    hier[work] = isHierWork(work);
+	    PM.run(*work);
+	    rt_works[work] = mod->getFunction(work->getName().str() + "_rt");
+	    assert(rt_works[work] && "runSKIRAOTPasses: work function wasn't cloned");
+	}
+	PM.doFinalization();
+    }
+
+    // block in place on stream ops and optimize, like -force-tpk
+    {
+	FunctionPassManager PM(mod);
+	PM.add(new TargetData(mod));
+	PM.add(createSKIRBlockingOpsPass());
+	PM.add(createSKIRInlineStreamsPass());
+
+	addLLVMOpts(PM);
+
+	PM.doInitialization();
+	for (unsigned i = 0; i < works.size(); i++)
+	    if (!hier[works[i]])
+		PM.run(*rt_works[works[i]]);
+	PM.doFinalization();
+    }
+
+    // point every kernel site at the compiled work, the clones of
+    // hierarchical work functions have sites of their own
+    sites.clear();
+    getKernelSites(mod, kernelF, sites);
+    for (unsigned i = 0; i < sites.size(); i++) {
+	CallInst *CI = sites[i];
+	Function *work = dyn_cast<Function>(CI->getOperand(2)->stripPointerCasts());
+	if (rt_works.count(work))
+	    CI->setOperand(2, ConstantExpr::getBitCast(rt_works[work],
+						       CI->getOperand(2)->getType()));
+    }
+
+    // the kernel table: { work, is_hier } in program order, null terminated
+    const Type *i8p = Type::getInt8PtrTy(CTX);
+    const Type *i32 = Type::getInt32Ty(CTX);
+    const StructType *entryTy = StructType::get(CTX, i8p, i32, NULL);
+    std::vector<Constant*> entries;
+    for (unsigned i = 0; i < works.size(); i++) {
+	std::vector<Constant*> fields;
+	fields.push_back(ConstantExpr::getBitCast(rt_works[works[i]], i8p));
+	fields.push_back(ConstantInt::get(i32, hier[works[i]] ? 1 : 0));
+	entries.push_back(ConstantStruct::get(entryTy, fields));
+    }
+    entries.push_back(Constant::getNullValue(entryTy));
+    const ArrayType *tableTy = ArrayType::get(entryTy, entries.size());
+    new GlobalVariable(*mod, tableTy, true, GlobalValue::ExternalLinkage,
+		       ConstantArray::get(tableTy, entries), "__SKIRAOT_kernels");
+
+    // drop the original work functions and the unused runtime code
+    std::vector<const char *> exports;
+    exports.push_back(entry);
+    exports.push_back("__SKIRAOT_kernels");
+
+    PassManager PM;
+    PM.add(createInternalizePass(exports));
+    PM.add(createGlobalDCEPass());
+    PM.add(createStripDeadPrototypesPass());
+    PM.add(createVerifierPass());
+    PM.run(*mod);
+
+    return true;
+}
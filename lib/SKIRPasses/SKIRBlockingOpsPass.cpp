@@ -46,14 +46,16 @@ private:
 public:
 
     static char ID;
-    SKIRBlockingOpsPass() : FunctionPass((intptr_t)&ID) {}
+    SKIRBlockingOpsPass() : FunctionPass((intptr_t)&ID), kernel(0) {}
     SKIRBlockingOpsPass(SKIRRuntimeKernel *k) : FunctionPass((intptr_t)&ID), kernel(k)  {}
 
     /// replace skir intrinsics with blocking runtime calls:
     ///   skir.OP -> __SKIRRT_inline_OP_block
+    ///   __SKIR_OP_reserve/commit -> __SKIRRT_inline_OP_reserve/commit_block
     bool runOnFunction(Function &work)
     {
-	assert(kernel && kernel->rt_ins && kernel->rt_outs);
+	// no kernel when compiling ahead of time, the streams come at run time
+	assert(!kernel || (kernel->rt_ins && kernel->rt_outs));
 
 	Function::arg_iterator args = work.arg_begin();
 	args++; args++;
@@ -83,6 +85,8 @@ public:
 						("__SKIRRT_inline_peek"+inline_suffix).c_str());
 		    CI = ReplaceCallWith(CI, F, ops, ops+4);
 		}
+		else
+		    lowerZeroCopyOp(CI, vins, vouts, inline_suffix);
 	    }
 	}
 
@@ -121,9 +121,7 @@ struct SKIRInlineStreamsPass : public FunctionPass {
 			    Value *ops[3] = { vouts,
 					      CI->getOperand(1),   /* stream */
 					      CI->getOperand(2) }; /* elm */
-			    static Constant *pushFCache = 0;
-			    if (!pushFCache) 
-				pushFCache = getInlineCode(mod, "__SKIRRT_inline_push");
+			    Constant *pushFCache = getInlineCode(mod, "__SKIRRT_inline_push");
 			    newCI = ReplaceCallWith("__SKIRRT_inline_push", 
 						    CI, ops, ops+3, Type::getVoidTy(CTX),
 						    pushFCache);
@@ -132,17 +130,13 @@ struct SKIRInlineStreamsPass : public FunctionPass {
 			    Value *ops[3] = { vins,
 					      CI->getOperand(1),   /* stream */
 					      CI->getOperand(2) }; /* elmptr */
-			    static Constant *popFCache;
-			    if (!popFCache) 
-				popFCache = getInlineCode(mod, "__SKIRRT_inline_pop");
+			    Constant *popFCache = getInlineCode(mod, "__SKIRRT_inline_pop");
 			    newCI = ReplaceCallWith("__SKIRRT_inline_pop",
 						    CI, ops, ops+3, Type::getVoidTy(CTX),
 						    popFCache);
 			}
 			else if (isa<SKIRPeekInst>(inst)) {
-			    static Constant *peekFCache;
-			    if (!peekFCache) 
-				peekFCache = getInlineCode(mod, "__SKIRRT_inline_peek");
+			    Constant *peekFCache = getInlineCode(mod, "__SKIRRT_inline_peek");
 			    Value *ops[4] = { vins,
 					      CI->getOperand(1),   /* stream */
 					      CI->getOperand(2),   /* elmptr */
@@ -152,8 +146,7 @@ struct SKIRInlineStreamsPass : public FunctionPass {
 						    peekFCache);
 			}
 			else if (isa<SKIRBecomeInst>(inst)) {
-			    static Constant *becomeFCache;
-			    if (!becomeFCache) becomeFCache = mod->getFunction("__SKIRRT_become");
+			    Constant *becomeFCache = mod->getFunction("__SKIRRT_become");
 			    Value *ops[4] = { CI->getOperand(1),   /* rt */
 					      CI->getOperand(2),   /* kernels */
 					      vins,
@@ -183,6 +176,10 @@ struct SKIRInlineStreamsPass : public FunctionPass {
 			assert(newCI);
 			if (do_inline) inline_sites.push_back(newCI);
 		    }
+		    else if (CallInst *newCI = lowerZeroCopyOp(CI, vins, vouts, "")) {
+			if (!NoInlineStreamOps)
+			    inline_sites.push_back(newCI);
+		    }
 		    else {
 			if (!CI->getCalledFunction()) continue;
 			std::string name(CI->getCalledFunction()->getName());
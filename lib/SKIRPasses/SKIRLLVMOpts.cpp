@@ -0,0 +1,83 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/PassManager.h>
+#include <llvm/Analysis/Verifier.h>
+#include <llvm/Support/StandardPasses.h>
+#include <llvm/Transforms/Scalar.h>
+
+#include <SKIR/SKIRRuntime.h>
+#include "SKIRRuntimeKernel.h"
+
+using namespace llvm;
+
+// the LLVM opts the runtime runs on work functions before codegen, also
+// used by skir-aot and kernel modules which have no runtime kernel
+void
+SKIRRuntime::addLLVMOpts(FunctionPassManager &PM)
+{
+    createStandardFunctionPasses(&PM, 3);
+
+    // Start of function pass.
+    
+    PM.add(createScalarReplAggregatesPass());  // Break up aggregate allocas
+    //if (SimplifyLibCalls)
+    //PM.add(createSimplifyLibCallsPass());    // Library Call Optimizations
+    PM.add(createInstructionCombiningPass());  // Cleanup for scalarrepl.
+    PM.add(createJumpThreadingPass());         // Thread jumps.
+    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
+    PM.add(createInstructionCombiningPass());  // Combine silly seq's
+    
+    PM.add(createTailCallEliminationPass());   // Eliminate tail calls
+    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
+    PM.add(createReassociatePass());           // Reassociate expressions
+    PM.add(createLoopRotatePass());            // Rotate Loop
+    PM.add(createLICMPass());                  // Hoist loop invariants
+    //PM.add(createLoopUnswitchPass(OptimizeSize || OptimizationLevel < 3));
+    PM.add(createInstructionCombiningPass());  
+    PM.add(createIndVarSimplifyPass());        // Canonicalize indvars
+    PM.add(createLoopDeletionPass());          // Delete dead loops
+    //if (UnrollLoops)
+    PM.add(createLoopUnrollPass());          // Unroll small loops
+    PM.add(createInstructionCombiningPass());  // Clean up after the unroller
+    //if (OptimizationLevel > 1)
+    PM.add(createGVNPass());                 // Remove redundancies
+    PM.add(createMemCpyOptPass());             // Remove memcpy / form memset
+    PM.add(createSCCPPass());                  // Constant prop with SCCP
+
+    // Run instcombine after redundancy elimination to exploit opportunities
+    // opened up by them.
+    PM.add(createInstructionCombiningPass());
+    PM.add(createJumpThreadingPass());         // Thread jumps
+    PM.add(createDeadStoreEliminationPass());  // Delete dead stores
+    PM.add(createAggressiveDCEPass());         // Delete dead instructions
+    PM.add(createCFGSimplificationPass());     // Merge & remove BBs
+    PM.add(createSCCVNPass());
+
+    PM.add(createVerifierPass());
+}
+
+void
+SKIRRuntime::addLLVMOpts(SKIRRuntimeKernel *k)
+{
+    addLLVMOpts(*k->fpm);
+}
@@ -0,0 +1,142 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Module.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/MutexGuard.h>
+#include "SKIRRuntimeBitcode.h"
+
+#include <map>
+
+using namespace llvm;
+
+// generated by lib/runtime/Makefile from $(LibDir)/*.bc; each array is
+// followed by a NUL which MemoryBuffer requires but which isn't bitcode
+#include "inline_stream_ops_bc.inc"
+#include "skir_opencl_mod_bc.inc"
+
+static Module *
+getLazyModule(const unsigned char *data, size_t len, const char *name,
+	      LLVMContext &CTX, std::string *errormsg)
+{
+    // no copy, the array lives as long as the library
+    MemoryBuffer *buffer = MemoryBuffer::getMemBuffer(StringRef((const char*)data, len), name);
+    if (!buffer)
+	return 0;
+
+    // takes ownership of buffer on success
+    Module *M = getLazyBitcodeModule(buffer, CTX, errormsg);
+    if (!M)
+	delete buffer;
+    return M;
+}
+
+Module *
+llvm::getRuntimeModule(LLVMContext &CTX, std::string *errormsg)
+{
+    return getLazyModule(inline_stream_ops_bc, sizeof(inline_stream_ops_bc)-1,
+			 "inline_stream_ops.bc", CTX, errormsg);
+}
+
+Module *
+llvm::getOpenCLRuntimeModule(LLVMContext &CTX, std::string *errormsg)
+{
+    return getLazyModule(skir_opencl_mod_bc, sizeof(skir_opencl_mod_bc)-1,
+			 "skir_opencl_mod.bc", CTX, errormsg);
+}
+
+static void
+addOperands(User *U, SmallVector<Value*, 16> &worklist)
+{
+    for (User::op_iterator O = U->op_begin(), E = U->op_end(); O != E; ++O)
+	worklist.push_back(*O);
+}
+
+// see setModuleLock
+static sys::Mutex module_locks_lock;
+static std::map<const Module*, sys::Mutex*> module_locks;
+
+void
+llvm::setModuleLock(Module *M, sys::Mutex *lock)
+{
+    MutexGuard locked(module_locks_lock);
+    if (lock)
+	module_locks[M] = lock;
+    else
+	module_locks.erase(M);
+}
+
+static sys::Mutex *
+getModuleLock(const Module *M)
+{
+    MutexGuard locked(module_locks_lock);
+    std::map<const Module*, sys::Mutex*>::iterator I = module_locks.find(M);
+    return I == module_locks.end() ? 0 : I->second;
+}
+
+static bool
+materialize(Function *F, std::string *errormsg)
+{
+    SmallPtrSet<Value*, 32> seen;
+    SmallVector<Value*, 16> worklist;
+    worklist.push_back(F);
+
+    while (!worklist.empty()) {
+	Value *V = worklist.pop_back_val();
+	if (!seen.insert(V))
+	    continue;
+
+	if (Function *fn = dyn_cast<Function>(V)) {
+	    if (fn->isMaterializable() && fn->Materialize(errormsg))
+		return true;
+	    for (inst_iterator I = inst_begin(fn), E = inst_end(fn); I != E; ++I)
+		addOperands(&*I, worklist);
+	}
+	else if (GlobalVariable *GV = dyn_cast<GlobalVariable>(V)) {
+	    if (GV->hasInitializer())
+		worklist.push_back(GV->getInitializer());
+	}
+	else if (isa<Constant>(V) && !isa<GlobalValue>(V)) {
+	    addOperands(cast<User>(V), worklist);
+	}
+    }
+    return false;
+}
+
+bool
+llvm::materializeFunction(Function *F, std::string *errormsg)
+{
+    // the JIT materializes the same module under its lock
+    sys::Mutex *lock = getModuleLock(F->getParent());
+    if (lock)
+	lock->acquire();
+    bool failed = materialize(F, errormsg);
+    if (lock)
+	lock->release();
+    return failed;
+}
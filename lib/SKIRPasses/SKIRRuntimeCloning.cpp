@@ -125,7 +125,10 @@ struct SKIRCloneWorkPass : public FunctionPass {
 		}
 	    }
 	}
-	if (kernel) kernel->work = new_work;
+	if (kernel) {
+	    kernel->work = new_work;
+	    kernel->code.push_back(new_work);
+	}
 	return true;
     }
 };
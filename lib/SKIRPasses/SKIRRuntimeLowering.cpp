@@ -78,7 +78,6 @@ public:
 
 	// replace these with the runtime implementation
 	if (isa<SKIRKernelInst>(&CI)) {
-	    static Constant *kernelFCache;
 	    Value *me = ConstantInt::get(intPtrType, (uintptr_t)rt);
 	    me = new IntToPtrInst(me, Type::getInt8PtrTy(CTX,0), "", &CI);
 	    Value *ops[3] = { me,                   /* SKIRRuntime* */
@@ -86,26 +85,24 @@ public:
 			      CI.getOperand(2) };   /* arguments */
 	    /* void *__SKIRRT_kernel(void *, void *) */
 	    ReplaceCallWith("__SKIRRT_kernel", &CI, ops, ops+3, 
-			    PointerType::get(Type::getInt8Ty(CTX),0), kernelFCache);
+			    PointerType::get(Type::getInt8Ty(CTX),0));
 	    ret = true;
 	}
 	else if (isa<SKIRCallInst>(&CI)) {
-	    static Constant *callFCache;
 	    Value *me = ConstantInt::get(intPtrType, (uintptr_t)rt);
 	    me = new IntToPtrInst(me, Type::getInt8PtrTy(CTX,0), "", &CI);
 	    Value *ops[4] = { me,                 /* SKIRRuntime* */
 			      CI.getOperand(1),   /* RuntimeKernel* */
 			      CI.getOperand(2),   /* ins */
 			      CI.getOperand(3) }; /* outs */
-	    ReplaceCallWith("__SKIRRT_call", &CI, ops, ops+4, Type::getVoidTy(CTX), callFCache);
+	    ReplaceCallWith("__SKIRRT_call", &CI, ops, ops+4, Type::getVoidTy(CTX));
 	    ret = true;
 	}
 	else if (isa<SKIRWaitInst>(&CI)) {
-	    static Constant *waitFCache;
 	    Value *me = ConstantInt::get(intPtrType, (uintptr_t)rt);
 	    Value *ops[2] = { me,                 /* SKIRRuntime* */
 			      CI.getOperand(1) }; /* RuntimeKernel* */
-	    ReplaceCallWith("__SKIRRT_wait", &CI, ops, ops+2, Type::getVoidTy(CTX), waitFCache);
+	    ReplaceCallWith("__SKIRRT_wait", &CI, ops, ops+2, Type::getVoidTy(CTX));
 	    ret = true;
 	}
 	else if (isa<SKIRBecomeInst>(&CI)) {
@@ -122,13 +119,30 @@ public:
 
 	    ret = true;
 	}
+	// uncall and reconfigure have no intrinsic, match the library calls
+	else if (F->getName() == "__SKIR_uncall") {
+	    Value *me = new IntToPtrInst(ConstantInt::get(intPtrType, (uintptr_t)rt), 
+					 Type::getInt8PtrTy(CTX,0), "", &CI);
+	    Value *ops[2] = { me,                 /* SKIRRuntime* */
+			      CI.getOperand(1) }; /* RuntimeKernel* */
+	    ReplaceCallWith("__SKIRRT_uncall", &CI, ops, ops+2, Type::getVoidTy(CTX));
+	    ret = true;
+	}
+	else if (F->getName() == "__SKIR_reconfigure") {
+	    Value *me = new IntToPtrInst(ConstantInt::get(intPtrType, (uintptr_t)rt), 
+					 Type::getInt8PtrTy(CTX,0), "", &CI);
+	    Value *ops[3] = { me,                 /* SKIRRuntime* */
+			      CI.getOperand(1),   /* RuntimeKernel* */
+			      CI.getOperand(2) }; /* RuntimeKernel*[] */
+	    ReplaceCallWith("__SKIRRT_reconfigure", &CI, ops, ops+3, Type::getVoidTy(CTX));
+	    ret = true;
+	}
 	else if (isa<SKIRStreamInst>(&CI)) {
-	    static Constant *streamFCache;
 	    Value *me = ConstantInt::get(intPtrType, (uintptr_t)rt);
 	    Value *ops[2] = { me,                 /* SKIRRuntime* */
 			      CI.getOperand(1) }; /* elem_size * */
 	    ReplaceCallWith("__SKIRRT_stream", &CI, ops, ops+2,
-			    PointerType::get(Type::getInt8Ty(CTX),0), streamFCache);
+			    PointerType::get(Type::getInt8Ty(CTX),0));
 	    ret = true;
 	}
     }
@@ -192,21 +206,19 @@ public:
 
 	// replace these with the runtime implementation
 	if (isa<SKIRPushInst>(&CI)) {
-	    static Constant *pushFCache;
 	    //Value *me = ConstantInt::get(intPtrType, (uintptr_t)rt);
 	    Value *ops[2] = { CI.getOperand(1),     /* stream */
 			      CI.getOperand(2) };   /* element */
 	    /* void __SKIRRT_push(skir_stream_idx_t p, skir_stream_element_t e) */
-	    ReplaceCallWith("__SKIR_push", &CI, ops, ops+2, Type::getVoidTy(CTX), pushFCache);
+	    ReplaceCallWith("__SKIR_push", &CI, ops, ops+2, Type::getVoidTy(CTX));
 	    ret = true;
 	}
 	else if (isa<SKIRPopInst>(&CI)) {
-	    static Constant *popFCache;
 	    //Value *me = ConstantInt::get(intPtrType, (uintptr_t)rt);
 	    Value *ops[2] = { CI.getOperand(1),     /* stream */
 			      CI.getOperand(2) };   /* element */
 	    /* void __SKIRRT_pop(skir_stream_idx_t p, skir_stream_element_t e) */
-	    ReplaceCallWith("__SKIR_pop", &CI, ops, ops+2, Type::getVoidTy(CTX), popFCache);
+	    ReplaceCallWith("__SKIR_pop", &CI, ops, ops+2, Type::getVoidTy(CTX));
 	    ret = true;
 	}
     }
@@ -55,21 +55,18 @@ public:
 
 typedef std::vector<StreamBase*> StreamVector;
 
+// T is any POD type, of any size.  elements are copied bytewise and each
+// sits in the ring buffer aligned as far as sizeof(T) allows
 template <class T> class Stream : public StreamBase
 {
 
 public:
-    // XXX I think these restrictions can be lifted?
-    Stream() : StreamBase(sizeof(T)) {
-	assert(sizeof(T) <= sizeof(StreamElement) && "try using pointers instead");
-    }
+    Stream() : StreamBase(sizeof(T)) {}
 
-    Stream(StreamPtr *p, int i) : StreamBase(p,i) {
-	assert(sizeof(T) <= sizeof(StreamElement) && "try using pointers instead");
-    }
+    Stream(StreamPtr *p, int i) : StreamBase(p,i) {}
 
-    inline void push(T t) {
-	void *p = &t;
+    inline void push(const T &t) {
+	void *p = (void *)&t;
 	__SKIR_push(getOffset(), p);
     }
 
@@ -79,6 +76,25 @@ public:
 	__SKIR_pop(getOffset(), p);
 	return t;
     }
+
+    // zero-copy, for large elements: fill n elements of an output in
+    // place and commit them, or read n elements of an input in place and
+    // release them.  see __SKIR_push_reserve
+    inline T *reserve(unsigned n=1) {
+	return (T*)__SKIR_push_reserve(getOffset(), n);
+    }
+
+    inline void commit(unsigned n=1) {
+	__SKIR_push_commit(getOffset(), n);
+    }
+
+    inline T *acquire(unsigned n=1) {
+	return (T*)__SKIR_pop_reserve(getOffset(), n);
+    }
+
+    inline void release(unsigned n=1) {
+	__SKIR_pop_commit(getOffset(), n);
+    }
 };
 
 template <class D> class Kernel
@@ -191,7 +191,7 @@ __SKIRRT_inline_push_E_B_< 0, 0 > (skir_stream_t *p[],skir_stream_idx_t idx,skir
     skir_stream_t *s = p[idx];
 
     size_t head = s->head;
-    size_t next = (head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (head + s->elem_size) % s->size;
     while (next == s->tail) {
 	__SKIRRT_would_block(s->src, s->dst);
     }
@@ -237,7 +237,7 @@ __SKIRRT_inline_pop_E_B_< 0, 0 > (skir_stream_t *p[],skir_stream_idx_t idx,skir_
 	__SKIRRT_would_block(s->dst, s->src);
     }
     memcpy(e, &s->buf[tail],  s->elem_size);
-    s->tail = (tail + s->elem_size) % STREAM_BUFFER_SIZE;
+    s->tail = (tail + s->elem_size) % s->size;
 }
 
 void (* __SKIRRT_inline_pop)(skir_stream_t **, skir_stream_idx_t, skir_stream_element_t) = \
@@ -285,11 +285,11 @@ __SKIRRT_inline_peek_E_B_< 0, 0 > (skir_stream_t *p[],skir_stream_idx_t idx,
     size_t offset = o;
     offset = (tail + (offset * s->elem_size));
     while (!( ((tail < head) && (offset < head)) ||
-	      ((tail > head) && (offset < (head+STREAM_BUFFER_SIZE))) )) {
+	      ((tail > head) && (offset < (head+s->size))) )) {
 	__SKIRRT_would_block(s->dst, s->src);
 	head = s->head;
     }
-    memcpy(e, &s->buf[offset%STREAM_BUFFER_SIZE], s->elem_size);
+    memcpy(e, &s->buf[offset%s->size], s->elem_size);
 }
 
 void (* __SKIRRT_inline_peek)(skir_stream_t **,skir_stream_idx_t,skir_stream_element_t,uint32_t) = \
@@ -319,7 +319,7 @@ __SKIRRT_inline_push_block(skir_stream_t *p[], skir_stream_idx_t idx, skir_strea
     skir_stream_t *s = p[idx];
 
     size_t head = s->head;
-    size_t next = (head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (head + s->elem_size) % s->size;
     size_t tail = s->tail;
     size_t retry = __SKIRRT_PASS_RETRY;
 
@@ -346,7 +346,7 @@ __SKIRRT_inline_pop_block(skir_stream_t *p[], skir_stream_idx_t idx, skir_stream
 	head = s->head;
     }
     memcpy(e, &s->buf[tail],  s->elem_size);
-    s->tail = (tail + s->elem_size) % STREAM_BUFFER_SIZE;
+    s->tail = (tail + s->elem_size) % s->size;
 }
 
 void
@@ -362,11 +362,11 @@ __SKIRRT_inline_peek_block(skir_stream_t *p[], skir_stream_idx_t idx,
 
     offset = (tail + (offset * s->elem_size));
     while ( !( ((tail < head) && (offset < head)) ||
-	       ((tail > head) && (offset < (head+STREAM_BUFFER_SIZE))) ) ) {
+	       ((tail > head) && (offset < (head+s->size))) ) ) {
 	__SKIRRT_PASS(retry);
 	head = s->head;
     }
-    memcpy(e, &s->buf[offset%STREAM_BUFFER_SIZE], s->elem_size);
+    memcpy(e, &s->buf[offset%s->size], s->elem_size);
 }
 
 //
@@ -378,17 +378,17 @@ __SKIRRT_inline_pop_space(skir_stream_t *s)
 {
     long long num = s->head - s->tail;
     if (num < 0)
-	num += STREAM_BUFFER_SIZE;
+	num += s->size;
     return num;
 }
 
 static inline size_t
 __SKIRRT_inline_push_space(skir_stream_t *s)
 {
-    long long next = (s->head + s->elem_size) % STREAM_BUFFER_SIZE;
+    long long next = (s->head + s->elem_size) % s->size;
     long long num = s->tail - next;
     if (num < 0)
-	num += STREAM_BUFFER_SIZE;
+	num += s->size;
     return num;
 }
 
@@ -429,10 +429,10 @@ __SKIRRT_inline_compute_niters_1_1(void **v,
     skir_stream_t *in = ins[0];
     skir_stream_t *out = outs[0];
 
-    long long next = (out->head + out->elem_size) % STREAM_BUFFER_SIZE;
+    long long next = (out->head + out->elem_size) % out->size;
     long long outspace = out->tail - next;
     if (outspace < 0)
-	outspace += STREAM_BUFFER_SIZE;
+	outspace += out->size;
     if (outspace <= 0) {
 	*v = out->dst;
 	return 0;
@@ -441,7 +441,7 @@ __SKIRRT_inline_compute_niters_1_1(void **v,
 
     long long inspace = in->head - in->tail;
     if (inspace < 0)
-	inspace += STREAM_BUFFER_SIZE;
+	inspace += in->size;
     if (inspace <= 0) {
 	*v = in->src;
 	return 0;
@@ -453,6 +453,153 @@ __SKIRRT_inline_compute_niters_1_1(void **v,
     *v = 0;
     return n;
 }
+
+//
+// zero-copy stream operations, see __SKIR_push_reserve
+//
+// a reservation is n elements in place in the ring buffer, unless they
+// would wrap.  those go through the stream's bounce buffer instead: push
+// commit copies it into the ring buffer, pop reserve fills it from there.
+//
+
+static inline char *
+__SKIRRT_bounce(char **bounce, size_t *bounce_size, size_t n)
+{
+    if (*bounce_size < n) {
+	free(*bounce);
+	*bounce = (char*)malloc(n);
+	*bounce_size = n;
+    }
+    return *bounce;
+}
+
+static inline void *
+__SKIRRT_push_reserve(skir_stream_t *s, size_t n)
+{
+    size_t head = s->head;
+    s->push_reserved = n;
+    if (head + n <= s->size)
+	return &s->buf[head];
+    return __SKIRRT_bounce(&s->push_bounce, &s->push_bounce_size, n);
+}
+
+static inline void
+__SKIRRT_push_commit(skir_stream_t *s, size_t n)
+{
+    size_t head = s->head;
+    assert(n <= s->push_reserved && "commit larger than the reservation");
+    if (head + s->push_reserved > s->size) {
+	size_t c = min(n, s->size - head);
+	memcpy(&s->buf[head], s->push_bounce, c);
+	memcpy(&s->buf[0], s->push_bounce + c, n - c);
+    }
+    s->push_reserved = 0;
+    s->head = (head + n) % s->size;
+}
+
+static inline void *
+__SKIRRT_pop_reserve(skir_stream_t *s, size_t n)
+{
+    size_t tail = s->tail;
+    s->pop_reserved = n;
+    if (tail + n <= s->size)
+	return &s->buf[tail];
+
+    char *b = __SKIRRT_bounce(&s->pop_bounce, &s->pop_bounce_size, n);
+    size_t c = s->size - tail;
+    memcpy(b, &s->buf[tail], c);
+    memcpy(b + c, &s->buf[0], n - c);
+    return b;
+}
+
+static inline void
+__SKIRRT_pop_commit(skir_stream_t *s, size_t n)
+{
+    assert(n <= s->pop_reserved && "commit larger than the reservation");
+    s->tail = (s->tail + n) % s->size;
+    s->pop_reserved = 0;
+}
+
+void *
+__SKIRRT_inline_push_reserve(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n)
+{
+    skir_stream_t *s = p[idx];
+    size_t bytes = n * s->elem_size;
+    assert(bytes < s->size && "reservation larger than the stream");
+    while (__SKIRRT_inline_push_space(s) < bytes) {
+	__SKIRRT_would_block(s->src, s->dst);
+    }
+    return __SKIRRT_push_reserve(s, bytes);
+}
+
+void
+__SKIRRT_inline_push_commit(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n)
+{
+    skir_stream_t *s = p[idx];
+    __SKIRRT_push_commit(s, n * s->elem_size);
+    s->num_push += n;
+}
+
+void *
+__SKIRRT_inline_pop_reserve(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n)
+{
+    skir_stream_t *s = p[idx];
+    size_t bytes = n * s->elem_size;
+    assert(bytes < s->size && "reservation larger than the stream");
+    while (__SKIRRT_inline_pop_space(s) < bytes) {
+	__SKIRRT_would_block(s->dst, s->src);
+    }
+    return __SKIRRT_pop_reserve(s, bytes);
+}
+
+void
+__SKIRRT_inline_pop_commit(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n)
+{
+    skir_stream_t *s = p[idx];
+    __SKIRRT_pop_commit(s, n * s->elem_size);
+}
+
+void *
+__SKIRRT_inline_push_reserve_block(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n)
+{
+    skir_stream_t *s = p[idx];
+    size_t bytes = n * s->elem_size;
+    size_t retry = __SKIRRT_PASS_RETRY;
+    assert(bytes < s->size && "reservation larger than the stream");
+    while (__SKIRRT_inline_push_space(s) < bytes) {
+	__SKIRRT_PASS(retry);
+    }
+    return __SKIRRT_push_reserve(s, bytes);
+}
+
+void
+__SKIRRT_inline_push_commit_block(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n)
+{
+    skir_stream_t *s = p[idx];
+    __SKIRRT_push_commit(s, n * s->elem_size);
+    s->num_push += n;
+}
+
+void *
+__SKIRRT_inline_pop_reserve_block(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n)
+{
+    skir_stream_t *s = p[idx];
+    size_t bytes = n * s->elem_size;
+    size_t retry = __SKIRRT_PASS_RETRY;
+    assert(bytes < s->size && "reservation larger than the stream");
+    while (__SKIRRT_inline_pop_space(s) < bytes) {
+	__SKIRRT_PASS(retry);
+    }
+    return __SKIRRT_pop_reserve(s, bytes);
+}
+
+void
+__SKIRRT_inline_pop_commit_block(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n)
+{
+    skir_stream_t *s = p[idx];
+    __SKIRRT_pop_commit(s, n * s->elem_size);
+}
+
 //} // extern "C"
 
 template< int ELMSZ, int BUFSZ >
@@ -605,16 +752,20 @@ __SKIRRT_workfn_nocheck_1_1(skir_rt_state_t   *rt_state,
     volatile size_t *real_head = &(outs[0]->head);
     volatile size_t *real_tail = &(ins[0]->tail);
 
-    //    i = __SKIRRT_inline_compute_niters_E_B_<4,16384>(&v, ins, 1, outs, 1);
-    i = __SKIRRT_inline_compute_niters_E_B_<4,32768>(&v, ins, 1, outs, 1);
-    //i = __SKIRRT_inline_compute_niters_E_B_<4,128>(&v, ins, 1, outs, 1);
+    // any element and buffer size, once per call
+    i = __SKIRRT_inline_compute_niters(&v, ins, 1, outs, 1);
     if (v) return v;
 
+    // the generic _p ops wrap with these, specialized ones fold them away
     in.tail = *real_tail;
     in.inp = ins[0]->inp;
+    in.elem_size = ins[0]->elem_size;
+    in.size = ins[0]->size;
 
     out.head = *real_head;
     out.outp = outs[0]->outp;
+    out.elem_size = outs[0]->elem_size;
+    out.size = outs[0]->size;
 
     ip[0] = &in;
     op[0] = &out;
@@ -741,6 +892,191 @@ __SKIRRT_dp_join_work(dp_splitter_work_t *state,
     return 0;
 }
 
+//
+// splitters and joiners, see SKIRSplitJoin.cpp.  the runtime folds the
+// skir_splitjoin_t in kernel_state into these, so the loops over the
+// streams and the copy sizes become constants.
+//
+
+// copy n bytes from src's buffer at from to dst's buffer at to, in
+// pieces where either ring buffer wraps
+static inline void
+__SKIRRT_inline_copy(skir_stream_t *dst, size_t to,
+		     skir_stream_t *src, size_t from, size_t n)
+{
+    while (n) {
+	size_t c = min(n, min(src->size - from, dst->size - to));
+	memcpy(&dst->buf[to], &src->buf[from], c);
+	from = (from + c) % src->size;
+	to = (to + c) % dst->size;
+	n -= c;
+    }
+}
+
+// iterations that fit in the streams, one iteration moves each weight
+// once.  0 with *v set to the kernel to wait for if none fit.
+static inline size_t
+__SKIRRT_inline_splitjoin_niters(void **v, skir_splitjoin_t *sj,
+				 skir_stream_t *ins[], skir_stream_t *outs[])
+{
+    int split = (sj->kind != SKIR_JOIN_RR);
+    skir_stream_t *one = split ? ins[0] : outs[0];
+    size_t n = STREAM_BUFFER_SIZE;
+    size_t total = 0;
+
+    for (int i=0; i<sj->n; i++) {
+	skir_stream_t *s = split ? outs[i] : ins[i];
+	size_t w = (sj->kind == SKIR_SPLIT_DUP) ? 1 : sj->weights[i];
+	size_t space = (split ? __SKIRRT_inline_push_space(s) :
+			__SKIRRT_inline_pop_space(s)) / sj->elem_size;
+	if (space < w) { *v = split ? s->dst : s->src; return 0; }
+	n = min(n, space / w);
+	total += w;
+    }
+    if (sj->kind == SKIR_SPLIT_DUP)
+	total = 1;
+
+    size_t space = (split ? __SKIRRT_inline_pop_space(one) :
+		    __SKIRRT_inline_push_space(one)) / sj->elem_size;
+    if (space < total) { *v = split ? one->src : one->dst; return 0; }
+    n = min(n, space / total);
+
+    *v = 0;
+    return n;
+}
+
+// the input is read once and copied to every output
+void *
+__SKIRRT_split_dup_work(skir_rt_state_t *rt_state, void *kernel_state,
+			skir_stream_t *ins[], skir_stream_t *outs[])
+{
+    skir_splitjoin_t *sj = (skir_splitjoin_t *)kernel_state;
+    void *v;
+    size_t niter = __SKIRRT_inline_splitjoin_niters(&v, sj, ins, outs);
+    if (v) return v;
+
+    START_TSC(rt_state->cycles);
+
+    skir_stream_t *in = ins[0];
+    size_t c = niter * sj->elem_size;
+    for (int i=0; i<sj->n; i++) {
+	skir_stream_t *out = outs[i];
+	__SKIRRT_inline_copy(out, out->head, in, in->tail, c);
+	out->head = (out->head + c) % out->size;
+	out->num_push += niter;
+    }
+    in->tail = (in->tail + c) % in->size;
+
+    rt_state->niter += niter;
+    GET_TSC(rt_state->cycles);
+    return 0;
+}
+
+// the outputs are readers of one ring buffer (new_skir_stream_readers),
+// so each element is copied once and only the heads are per output
+void *
+__SKIRRT_split_dup_readers_work(skir_rt_state_t *rt_state, void *kernel_state,
+				skir_stream_t *ins[], skir_stream_t *outs[])
+{
+    skir_splitjoin_t *sj = (skir_splitjoin_t *)kernel_state;
+    void *v;
+    size_t niter = __SKIRRT_inline_splitjoin_niters(&v, sj, ins, outs);
+    if (v) return v;
+
+    START_TSC(rt_state->cycles);
+
+    skir_stream_t *in = ins[0];
+    skir_stream_t *out = outs[0];
+    size_t c = niter * sj->elem_size;
+    __SKIRRT_inline_copy(out, out->head, in, in->tail, c);
+    size_t head = (out->head + c) % out->size;
+    for (int i=0; i<sj->n; i++) {
+	outs[i]->head = head;
+	outs[i]->num_push += niter;
+    }
+    in->tail = (in->tail + c) % in->size;
+
+    rt_state->niter += niter;
+    GET_TSC(rt_state->cycles);
+    return 0;
+}
+
+void *
+__SKIRRT_split_rr_work(skir_rt_state_t *rt_state, void *kernel_state,
+		       skir_stream_t *ins[], skir_stream_t *outs[])
+{
+    skir_splitjoin_t *sj = (skir_splitjoin_t *)kernel_state;
+    void *v;
+    size_t niter = __SKIRRT_inline_splitjoin_niters(&v, sj, ins, outs);
+    if (v) return v;
+
+    START_TSC(rt_state->cycles);
+
+    skir_stream_t *in = ins[0];
+    size_t stride = 0;
+    for (int i=0; i<sj->n; i++)
+	stride += sj->weights[i] * sj->elem_size;
+
+    // one output at a time, so each head is written once
+    size_t from = in->tail;
+    for (int i=0; i<sj->n; i++) {
+	skir_stream_t *out = outs[i];
+	size_t c = sj->weights[i] * sj->elem_size;
+	size_t f = from, to = out->head;
+	for (size_t j=0; j<niter; j++) {
+	    __SKIRRT_inline_copy(out, to, in, f, c);
+	    f = (f + stride) % in->size;
+	    to = (to + c) % out->size;
+	}
+	out->head = to;
+	out->num_push += niter * sj->weights[i];
+	from = (from + c) % in->size;
+    }
+    in->tail = (in->tail + niter * stride) % in->size;
+
+    rt_state->niter += niter;
+    GET_TSC(rt_state->cycles);
+    return 0;
+}
+
+void *
+__SKIRRT_join_rr_work(skir_rt_state_t *rt_state, void *kernel_state,
+		      skir_stream_t *ins[], skir_stream_t *outs[])
+{
+    skir_splitjoin_t *sj = (skir_splitjoin_t *)kernel_state;
+    void *v;
+    size_t niter = __SKIRRT_inline_splitjoin_niters(&v, sj, ins, outs);
+    if (v) return v;
+
+    START_TSC(rt_state->cycles);
+
+    skir_stream_t *out = outs[0];
+    size_t stride = 0;
+    for (int i=0; i<sj->n; i++)
+	stride += sj->weights[i] * sj->elem_size;
+
+    // one input at a time, so each tail is written once
+    size_t to = out->head;
+    for (int i=0; i<sj->n; i++) {
+	skir_stream_t *in = ins[i];
+	size_t c = sj->weights[i] * sj->elem_size;
+	size_t f = in->tail, t = to;
+	for (size_t j=0; j<niter; j++) {
+	    __SKIRRT_inline_copy(out, t, in, f, c);
+	    f = (f + c) % in->size;
+	    t = (t + stride) % out->size;
+	}
+	in->tail = f;
+	to = (to + c) % out->size;
+    }
+    out->head = (out->head + niter * stride) % out->size;
+    out->num_push += niter * stride / sj->elem_size;
+
+    rt_state->niter += niter;
+    GET_TSC(rt_state->cycles);
+    return 0;
+}
+
 } // extern "C"
 
 //
@@ -766,7 +1102,7 @@ void __SKIRRT_inline_pop_nocheck_E_B_< 0, 0 > (skir_stream_t *p[], skir_stream_i
     skir_stream_t *s = p[idx];
     size_t tail = s->tail;
     memcpy(e, &s->buf[tail],  s->elem_size);
-    s->tail = (tail + s->elem_size) % STREAM_BUFFER_SIZE;
+    s->tail = (tail + s->elem_size) % s->size;
 }
 
 void (* __SKIRRT_inline_pop_nocheck)(skir_stream_t **, skir_stream_idx_t, skir_stream_element_t) = \
@@ -791,7 +1127,7 @@ void __SKIRRT_inline_pop_nocheck_p_E_B_< 0, 0 > (skir_stream_t *p[], skir_stream
     skir_stream_t *s = p[idx];
     size_t tail = s->tail;
     memcpy(e, &s->inp[tail],  s->elem_size);
-    s->tail = (tail + s->elem_size) % STREAM_BUFFER_SIZE;
+    s->tail = (tail + s->elem_size) % s->size;
 }
 
 void (* __SKIRRT_inline_pop_nocheck_p)(skir_stream_t **,skir_stream_idx_t,skir_stream_element_t) = \
@@ -824,7 +1160,7 @@ void
 __SKIRRT_inline_pop_nocheck_s(skir_stream_t *s, skir_stream_element_t e)
 {
     memcpy(e, &s->buf[s->tail],  s->elem_size);
-    s->tail = (s->tail + s->elem_size) % STREAM_BUFFER_SIZE;
+    s->tail = (s->tail + s->elem_size) % s->size;
 }
 
 void
@@ -832,7 +1168,7 @@ __SKIRRT_inline_pop_nocheck_i(size_t i, skir_stream_element_t e)
 {
     skir_stream_t *s = (skir_stream_t *)i;
     memcpy(e, &s->buf[s->tail],  s->elem_size);
-    s->tail = (s->tail + s->elem_size) % STREAM_BUFFER_SIZE;
+    s->tail = (s->tail + s->elem_size) % s->size;
 }
 int
 __SKIRRT_inline_pop_nocheck_i_int32(size_t i)
@@ -841,7 +1177,7 @@ __SKIRRT_inline_pop_nocheck_i_int32(size_t i)
     int e;
     memcpy(&e, &s->buf[s->tail], sizeof(e));
     //size_t tail = (s->tail + 64) % STREAM_BUFFER_SIZE;
-    s->tail = (s->tail + sizeof(e)) % STREAM_BUFFER_SIZE;
+    s->tail = (s->tail + sizeof(e)) % s->size;
     //__SKIR_prefetch(&s->buf[tail], 0, 0);
     return e;
 }
@@ -853,7 +1189,7 @@ __SKIRRT_inline_pop_nocheck_int32(skir_stream_t *p)
     //assert(s->head != s->tail);
     memcpy(&e, &s->buf[s->tail], sizeof(e));
     //size_t tail = (s->tail + 64) % STREAM_BUFFER_SIZE;
-    s->tail = (s->tail + sizeof(e)) % STREAM_BUFFER_SIZE;
+    s->tail = (s->tail + sizeof(e)) % s->size;
     //__SKIR_prefetch(&s->buf[tail], 0, 0);
     return e;
 }
@@ -863,7 +1199,7 @@ __SKIRRT_inline_pop_nocheck_i_float(size_t i)
     skir_stream_t *s = (skir_stream_t *)i;
     float e;
     memcpy(&e, &s->buf[s->tail],  sizeof(e));
-    s->tail = (s->tail + sizeof(e)) % STREAM_BUFFER_SIZE;
+    s->tail = (s->tail + sizeof(e)) % s->size;
     return e;
 }
 
@@ -888,7 +1224,7 @@ void __SKIRRT_inline_peek_nocheck_E_B_< 0, 0 > (skir_stream_t *p[], skir_stream_
 
 {
     skir_stream_t *s = p[idx];
-    size_t tail = (s->tail + (offset*s->elem_size)) % STREAM_BUFFER_SIZE;
+    size_t tail = (s->tail + (offset*s->elem_size)) % s->size;
     memcpy(e, &s->buf[tail], s->elem_size);
 }
 
@@ -913,7 +1249,7 @@ void __SKIRRT_inline_peek_nocheck_p_E_B_< 0, 0 > (skir_stream_t *p[], skir_strea
 
 {
     skir_stream_t *s = p[idx];
-    size_t tail = (s->tail + (offset*s->elem_size)) % STREAM_BUFFER_SIZE;
+    size_t tail = (s->tail + (offset*s->elem_size)) % s->size;
     memcpy(e, &s->inp[tail], s->elem_size);
 }
 
@@ -950,14 +1286,14 @@ void
 __SKIRRT_inline_peek_nocheck_s(skir_stream_t *p,skir_stream_element_t e, uint32_t offset)
 {
     skir_stream_t *s = p;
-    size_t tail = (s->tail + (offset*s->elem_size)) % STREAM_BUFFER_SIZE;
+    size_t tail = (s->tail + (offset*s->elem_size)) % s->size;
     memcpy(e, &s->buf[tail],  s->elem_size);
 }
 void
 __SKIRRT_inline_peek_nocheck_i(size_t i,skir_stream_element_t e, uint32_t offset)
 {
     skir_stream_t *s = (skir_stream_t *)i;
-    size_t tail = (s->tail + (offset*s->elem_size)) % STREAM_BUFFER_SIZE;
+    size_t tail = (s->tail + (offset*s->elem_size)) % s->size;
     memcpy(e, &s->buf[tail],  s->elem_size);
 }
 int
@@ -965,7 +1301,7 @@ __SKIRRT_inline_peek_nocheck_i_int32(size_t i, uint32_t offset)
 {
     skir_stream_t *s = (skir_stream_t *)i;
     int e;
-    size_t n = (s->tail + (offset*sizeof(e))) % STREAM_BUFFER_SIZE;
+    size_t n = (s->tail + (offset*sizeof(e))) % s->size;
     memcpy(&e, &s->buf[n],  sizeof(e));
     return e;
 }
@@ -974,7 +1310,7 @@ __SKIRRT_inline_peek_nocheck_i_float(size_t i, uint32_t offset)
 {
     skir_stream_t *s = (skir_stream_t *)i;
     float e;
-    size_t n = (s->tail + (offset*sizeof(e))) % STREAM_BUFFER_SIZE;
+    size_t n = (s->tail + (offset*sizeof(e))) % s->size;
     memcpy(&e, &s->buf[n],  sizeof(e));
     return e;
 }
@@ -1001,7 +1337,7 @@ void __SKIRRT_inline_push_nocheck_E_B_< 0, 0 > (skir_stream_t *p[], skir_stream_
 {
     skir_stream_t *s = p[idx];
     size_t head = s->head;
-    size_t next = (head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (head + s->elem_size) % s->size;
     memcpy(&s->buf[head], e,  s->elem_size);
     s->head = next;
     RECORD_PUSH(s->num_push);
@@ -1027,7 +1363,7 @@ template<>
 void __SKIRRT_inline_push_nocheck_p_E_B_< 0, 0 > (skir_stream_t *p[], skir_stream_idx_t idx, skir_stream_element_t e)
 {
     skir_stream_t *s = p[idx];
-    size_t next = (s->head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (s->head + s->elem_size) % s->size;
     memcpy(&s->outp[s->head], e,  s->elem_size);
     s->head = next;
     RECORD_PUSH(s->num_push);
@@ -1066,7 +1402,7 @@ void
 __SKIRRT_inline_push_nocheck_s(skir_stream_t *p, skir_stream_element_t e)
 {
     skir_stream_t *s = p;
-    size_t next = (s->head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (s->head + s->elem_size) % s->size;
     memcpy(&s->buf[s->head], e,  s->elem_size);
     s->head = next;
     RECORD_PUSH(s->num_push);
@@ -1075,7 +1411,7 @@ void
 __SKIRRT_inline_push_nocheck_i(size_t i, skir_stream_element_t e)
 {
     skir_stream_t *s = (skir_stream_t *)i;
-    size_t next = (s->head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (s->head + s->elem_size) % s->size;
     memcpy(&s->buf[s->head], e, s->elem_size);
     s->head = next;
     RECORD_PUSH(s->num_push);
@@ -1084,7 +1420,7 @@ void
 __SKIRRT_inline_push_nocheck_i_int32(size_t i, int32_t e)
 {
     skir_stream_t *s = (skir_stream_t *)i;
-    size_t next = (s->head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (s->head + s->elem_size) % s->size;
     //assert(next != s->tail);
     //size_t head = (s->head + 64) % STREAM_BUFFER_SIZE;
     memcpy(&s->buf[s->head], &e, s->elem_size);
@@ -1096,7 +1432,7 @@ void
 __SKIRRT_inline_push_nocheck_int32(skir_stream_t *p, int32_t e)
 {
     skir_stream_t *s = p;
-    size_t next = (s->head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (s->head + s->elem_size) % s->size;
     //size_t head = (s->head + 64) % STREAM_BUFFER_SIZE;
     memcpy(&s->buf[s->head], &e, s->elem_size);
     s->head = next;
@@ -1107,7 +1443,7 @@ void
 __SKIRRT_inline_push_nocheck_i_float(size_t i, float e)
 {
     skir_stream_t *s = (skir_stream_t *)i;
-    size_t next = (s->head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (s->head + s->elem_size) % s->size;
     memcpy(&s->buf[s->head], &e, s->elem_size);
     s->head = next;
     RECORD_PUSH(s->num_push);
@@ -1118,14 +1454,14 @@ __SKIRRT_inline_poke_nocheck(skir_stream_t *p[], skir_stream_idx_t idx,
 			     skir_stream_element_t e, uint32_t offset)
 {
     skir_stream_t *s = p[idx];
-    size_t head = (s->head + (offset*s->elem_size)) % STREAM_BUFFER_SIZE;
+    size_t head = (s->head + (offset*s->elem_size)) % s->size;
     memcpy(&s->buf[head], e, s->elem_size);
 }
 void
 __SKIRRT_inline_poke_nocheck_s(skir_stream_t *p,skir_stream_element_t e, uint32_t offset)
 {
     skir_stream_t *s = p;
-    size_t head = (s->head + (offset*s->elem_size)) % STREAM_BUFFER_SIZE;
+    size_t head = (s->head + (offset*s->elem_size)) % s->size;
     memcpy(&s->buf[head], e, s->elem_size);
 }
 
@@ -1216,7 +1552,7 @@ __SKIRRT_socket_source_work(void *kernel_state,
 {
     __SKIRRT_socket_source_t *state = (__SKIRRT_socket_source_t *)kernel_state;
     skir_stream_t *s = outs[0];
-    size_t next = (s->head + s->elem_size) % STREAM_BUFFER_SIZE;
+    size_t next = (s->head + s->elem_size) % s->size;
 
     if (next == s->tail)
 	__SKIRRT_would_block(s->src, s->dst);
@@ -1244,7 +1580,7 @@ __SKIRRT_socket_source_work(void *kernel_state,
 	// connected to a client
 	int npush;
 	if (s->head >= s->tail)
-	    npush = (STREAM_BUFFER_SIZE - s->head);
+	    npush = (s->size - s->head);
 	else
 	    npush = (s->tail - s->head);
 
@@ -1255,7 +1591,7 @@ __SKIRRT_socket_source_work(void *kernel_state,
 	}
 	else {
 	    //printf("npush: %d\n",npush);
-	    next = (s->head + npush) % STREAM_BUFFER_SIZE;
+	    next = (s->head + npush) % s->size;
 	    s->head = next;
 	}
     }
@@ -1324,7 +1660,7 @@ __SKIRRT_socket_sink_work(void *kernel_state,
     if (s->head > s->tail)
 	npop = (s->head - s->tail);
     else
-	npop = (STREAM_BUFFER_SIZE - s->tail);
+	npop = (s->size - s->tail);
 
     if ((npop = send(state->sock, &(s->buf[s->tail]), npop, 0)) <= 0) {
 	if (npop < 0) perror("send() error");
@@ -1334,7 +1670,7 @@ __SKIRRT_socket_sink_work(void *kernel_state,
     }
 
     //printf("npop: %d\n",npop);
-    s->tail = (s->tail + npop) % STREAM_BUFFER_SIZE;
+    s->tail = (s->tail + npop) % s->size;
     return 0;
 }
 
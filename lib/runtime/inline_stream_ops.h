@@ -82,6 +82,21 @@ extern void __SKIRRT_inline_push_block(skir_stream_t *p[], skir_stream_idx_t idx
 extern void __SKIRRT_inline_peek_block(skir_stream_t *p[], skir_stream_idx_t idx,
 					 skir_stream_element_t e, uint32_t offset);
 
+/* zero-copy stream operations, n elements at a time */
+extern void *__SKIRRT_inline_push_reserve(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n);
+extern void __SKIRRT_inline_push_commit(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n);
+extern void *__SKIRRT_inline_pop_reserve(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n);
+extern void __SKIRRT_inline_pop_commit(skir_stream_t *p[], skir_stream_idx_t idx, uint32_t n);
+
+extern void *__SKIRRT_inline_push_reserve_block(skir_stream_t *p[], skir_stream_idx_t idx,
+						uint32_t n);
+extern void __SKIRRT_inline_push_commit_block(skir_stream_t *p[], skir_stream_idx_t idx,
+					      uint32_t n);
+extern void *__SKIRRT_inline_pop_reserve_block(skir_stream_t *p[], skir_stream_idx_t idx,
+					       uint32_t n);
+extern void __SKIRRT_inline_pop_commit_block(skir_stream_t *p[], skir_stream_idx_t idx,
+					     uint32_t n);
+
 extern size_t
 __SKIRRT_inline_compute_niters(void **v,
 			       skir_stream_t* ins[], int nins,
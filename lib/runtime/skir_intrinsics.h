@@ -44,6 +44,17 @@ extern void __SKIR_push(skir_stream_idx_t s, skir_stream_element_t e);
 extern void __SKIR_pop (skir_stream_idx_t s, skir_stream_element_t e);
 extern void __SKIR_peek(skir_stream_idx_t s, skir_stream_element_t e, unsigned int offset);
 
+/* zero-copy access: reserve returns n contiguous elements of stream s,
+   free slots of an output or the next elements of an input, to use in
+   place until the matching commit pushes or pops them.  commit at most
+   the n reserved, and at most one reservation per stream at a time.
+   commit before the work function returns: the runtime may grow,
+   checkpoint or restore the stream between work calls */
+extern void *__SKIR_push_reserve(skir_stream_idx_t s, unsigned int n);
+extern void __SKIR_push_commit(skir_stream_idx_t s, unsigned int n);
+extern void *__SKIR_pop_reserve(skir_stream_idx_t s, unsigned int n);
+extern void __SKIR_pop_commit(skir_stream_idx_t s, unsigned int n);
+
 extern void* __SKIR_kernel(void *workfn, void *args);
 
 extern unsigned long long __SKIR_rdtsc(void);
@@ -54,6 +65,10 @@ extern void __SKIR_return(void *from, int r);
 extern void __SKIR_become(skir_kernel_ptr_t k);
 extern void __SKIR_uncall(skir_kernel_ptr_t k);
 
+/* replace running kernel k with the null terminated pipeline ks,
+   k's streams and their buffered data are handed to the pipeline */
+extern void __SKIR_reconfigure(skir_kernel_ptr_t k, skir_kernel_ptr_t ks[]);
+
 #ifdef __cplusplus 
 }
 #endif
@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "skir_intrinsics.h"
+
+//
+// a kernel that replaces itself with become.  the graph isn't static,
+// so skir-aot has to refuse the program instead of building a binary
+// that aborts when it gets to the become.
+//
+
+static int next;
+
+extern "C" int ar_sink(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    printf("%d\n", e);
+    return 0;
+}
+
+extern "C" int ar_src(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    if (next >= 10) {
+	__SKIR_become(__SKIR_kernel((void*)ar_src, 0));
+	return 1;
+    }
+    __SKIR_push(0, &next);
+    next++;
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    skir_stream_ptr_t ins[2] = {0, 0};
+    skir_stream_ptr_t outs[2] = {0, 0};
+
+    skir_kernel_ptr_t src = __SKIR_kernel((void*)ar_src, 0);
+    skir_kernel_ptr_t sink = __SKIR_kernel((void*)ar_sink, 0);
+
+    outs[0] = __SKIR_stream(sizeof(int));
+    __SKIR_call(src, ins, outs);
+    ins[0] = outs[0];
+    outs[0] = 0;
+    __SKIR_call(sink, ins, outs);
+    __SKIR_wait(sink);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "skir_intrinsics.h"
+
+//
+// checkpoint a source's state and the contents of its stream in one run
+// and restore them in the next.  the requests go to the runtime's event
+// server, like they would from any other client.
+//
+//   save <file>     the source pushes 0 .. NSAMPLES-1 and finishes, then
+//                   the graph is saved
+//   restore <file>  the source is held back until its state and the
+//                   stream are restored, then continues from where the
+//                   saved one stopped up to 2*NSAMPLES-1, so the printer
+//                   prints 0 .. 2*NSAMPLES-1
+//   corrupt <file>  a record of the checkpoint claims more data than the
+//                   file holds, restore has to refuse it
+//
+
+#define NSAMPLES 10
+#define EVENT_PORT 7547
+
+// skir_ckpt_record_t::reserved of the first record, after the header
+#define FIRST_RECORD_RESERVED (32 + 24)
+
+// the runtime sizes the state from the casts in src_work
+struct src_t {
+    int next;
+};
+
+// outside the state, so a restore doesn't change them
+static int limit;
+static volatile int go;
+
+static int src_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    src_t *s = (src_t *)state;
+    if (!go)
+	return 0;
+    if (s->next >= limit)
+	return 1;
+    __SKIR_push(0, &s->next);
+    s->next++;
+    return 0;
+}
+
+static int printer_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    printf("%d\n", e);
+    fflush(stdout);
+    return 0;
+}
+
+// send a CheckpointRequest, true unless the runtime answered with an error
+static bool
+checkpoint_request(int type, const char *file)
+{
+    // "CheckpointRequest\n" and the message: request_id = 1, type, file
+    char msg[256];
+    int n = sprintf(msg, "CheckpointRequest\n");
+    size_t len = strlen(file);
+    assert(len < 128 && n + 6 + len < sizeof(msg));
+    msg[n++] = 0x08; msg[n++] = 1;
+    msg[n++] = 0x10; msg[n++] = type;
+    msg[n++] = 0x1a; msg[n++] = len;
+    memcpy(&msg[n], file, len);
+    n += len;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(EVENT_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    // the server may still be starting up
+    int fd = -1;
+    for (int i=0; i<100 && fd < 0; i++) {
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+	    close(fd);
+	    fd = -1;
+	    usleep(10000);
+	}
+    }
+    assert(fd >= 0);
+
+    int w = write(fd, msg, n);
+    assert(w == n);
+    shutdown(fd, SHUT_WR);
+
+    unsigned char r[256];
+    int m = 0, k;
+    while ((k = read(fd, r + m, sizeof(r) - m)) > 0)
+	m += k;
+    close(fd);
+
+    // RequestResponse: an error sets type (field 2) to ERR
+    for (int i=0; i+1<m; ) {
+	int tag = r[i++];
+	if ((tag & 7) == 0) {
+	    int v = r[i++];
+	    if ((tag >> 3) == 2 && v == 2)
+		return false;
+	}
+	else if ((tag & 7) == 2)
+	    i += 1 + r[i];
+	else
+	    break;
+    }
+    return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 3) {
+	printf("usage: %s save|restore|corrupt <file>\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+    const char *mode = argv[1];
+    const char *file = argv[2];
+
+    skir_stream_ptr_t ins[2] = {0, 0};
+    skir_stream_ptr_t outs[2] = {0, 0};
+
+    // the same graph every time, so the ids match
+    src_t src_state;
+    src_state.next = 0;
+    skir_kernel_ptr_t src = __SKIR_kernel((void*)src_work, &src_state);
+    skir_kernel_ptr_t printer = __SKIR_kernel((void*)printer_work, 0);
+
+    if (!strcmp(mode, "save")) {
+	limit = NSAMPLES;
+	go = 1;
+	outs[0] = __SKIR_stream(sizeof(int));
+	__SKIR_call(src, ins, outs);
+	__SKIR_wait(src);
+	printf("save: %s\n", checkpoint_request(0, file) ? "ok" : "failed");
+	fflush(stdout);
+	return EXIT_SUCCESS;
+    }
+
+    // the source runs, but holds back until the restore is done
+    limit = strcmp(mode, "restore") ? 0 : 2 * NSAMPLES;
+    outs[0] = __SKIR_stream(sizeof(int));
+    __SKIR_call(src, ins, outs);
+
+    if (!strcmp(mode, "corrupt")) {
+	FILE *f = fopen(file, "r+");
+	assert(f);
+	size_t huge = (size_t)-1;
+	fseek(f, FIRST_RECORD_RESERVED, SEEK_SET);
+	size_t w = fwrite(&huge, sizeof(huge), 1, f);
+	assert(w == 1);
+	fclose(f);
+    }
+
+    bool ok = checkpoint_request(1, file);
+    printf("restore: %s\n", ok ? "ok" : "failed");
+    fflush(stdout);
+    go = 1;
+
+    ins[0] = outs[0];
+    outs[0] = 0;
+    __SKIR_call(printer, ins, outs);
+    __SKIR_wait(printer);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "skir_intrinsics.h"
+
+//
+// stream elements whose size isn't a power of two, and elements larger
+// than the default ring buffer (STREAM_BUFFER_SIZE), through a source,
+// a copying filter and a sink.  the sink prints a checksum of elements
+// along the way.
+//
+
+// 12 bytes
+struct small_t {
+    int a, b, c;
+};
+
+// 40000 bytes
+#define BIG_INTS 10000
+struct big_t {
+    int v[BIG_INTS];
+};
+
+struct count_t {
+    int next;
+    int n;
+};
+
+static int small_src_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    count_t *s = (count_t *)state;
+    if (s->next >= s->n)
+	return 1;
+    small_t e;
+    e.a = s->next;
+    e.b = 2 * s->next;
+    e.c = 3 * s->next;
+    __SKIR_push(0, &e);
+    s->next++;
+    return 0;
+}
+
+static int small_copy_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    small_t e;
+    __SKIR_pop(0, &e);
+    __SKIR_push(0, &e);
+    return 0;
+}
+
+static int small_sink_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    count_t *s = (count_t *)state;
+    small_t e;
+    __SKIR_pop(0, &e);
+    if (s->next % 100 == 0) {
+	printf("small %d: %d %d %d\n", s->next, e.a, e.b, e.c);
+	fflush(stdout);
+    }
+    s->next++;
+    return 0;
+}
+
+static int big_src_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    count_t *s = (count_t *)state;
+    if (s->next >= s->n)
+	return 1;
+    static big_t e;
+    for (int i=0; i<BIG_INTS; i++)
+	e.v[i] = s->next + i;
+    __SKIR_push(0, &e);
+    s->next++;
+    return 0;
+}
+
+static int big_copy_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    static big_t e;
+    __SKIR_pop(0, &e);
+    __SKIR_push(0, &e);
+    return 0;
+}
+
+static int big_sink_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    count_t *s = (count_t *)state;
+    static big_t e;
+    __SKIR_pop(0, &e);
+    long long sum = 0;
+    for (int i=0; i<BIG_INTS; i++)
+	sum += e.v[i];
+    printf("big %d: %d %d %lld\n", s->next, e.v[0], e.v[BIG_INTS-1], sum);
+    fflush(stdout);
+    s->next++;
+    return 0;
+}
+
+// source -> copy -> sink, wait for the sink
+static void
+pipeline(void *src_work, void *copy_work, void *sink_work, size_t elem_size, int n)
+{
+    skir_stream_ptr_t ins[2] = {0, 0};
+    skir_stream_ptr_t outs[2] = {0, 0};
+
+    count_t src_state;
+    src_state.next = 0;
+    src_state.n = n;
+    count_t sink_state;
+    sink_state.next = 0;
+    sink_state.n = n;
+
+    skir_kernel_ptr_t src = __SKIR_kernel(src_work, &src_state);
+    skir_kernel_ptr_t copy = __SKIR_kernel(copy_work, 0);
+    skir_kernel_ptr_t sink = __SKIR_kernel(sink_work, &sink_state);
+
+    outs[0] = __SKIR_stream(elem_size);
+    __SKIR_call(src, ins, outs);
+    ins[0] = outs[0];
+    outs[0] = __SKIR_stream(elem_size);
+    __SKIR_call(copy, ins, outs);
+    ins[0] = outs[0];
+    outs[0] = 0;
+    __SKIR_call(sink, ins, outs);
+
+    __SKIR_wait(sink);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 3) {
+	printf("usage:\n%s\t<nsmall> <nbig>\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    pipeline((void*)small_src_work, (void*)small_copy_work, (void*)small_sink_work,
+	     sizeof(small_t), atoi(argv[1]));
+    pipeline((void*)big_src_work, (void*)big_copy_work, (void*)big_sink_work,
+	     sizeof(big_t), atoi(argv[2]));
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,270 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "skir_intrinsics.h"
+
+//
+// replace a running kernel through the runtime's event server.  the
+// graph src -> copy -> sink is built with requests, so every kernel has
+// an id to name it by.  the source holds back after NSAMPLES elements;
+// once the sink has them, copy is replaced by a kernel that doubles,
+// and the source goes on.  before that, two reconfigurations have to be
+// refused without touching the graph: one naming a kernel that doesn't
+// exist, one whose new pipeline pushes through a helper, so the stream
+// between its kernels can't be sized.
+//
+
+#define NSAMPLES 5
+#define EVENT_PORT 7547
+
+// request ids, the runtime names what a request made by its id
+enum { IN = 1, OUT, SRC = 10, COPY, SINK, DOUBLE, HELPER, NOP, REQ = 20 };
+
+// outside any kernel state, the kernels are made without one
+static volatile int limit = NSAMPLES;
+static int next;
+static volatile int seen;
+
+extern "C" int hr_src(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    if (next >= 2 * NSAMPLES)
+	return 1;
+    if (next >= limit)
+	return 0;
+    __SKIR_push(0, &next);
+    next++;
+    return 0;
+}
+
+extern "C" int hr_copy(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    __SKIR_push(0, &e);
+    return 0;
+}
+
+extern "C" int hr_double(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    e *= 2;
+    __SKIR_push(0, &e);
+    return 0;
+}
+
+extern "C" int hr_sink(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    printf("%d\n", e);
+    fflush(stdout);
+    seen++;
+    return 0;
+}
+
+// the push the runtime can't see from hr_helper's work function
+static __attribute__((noinline)) void
+push_through(int *e)
+{
+    __SKIR_push(0, e);
+}
+
+extern "C" int hr_helper(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    push_through(&e);
+    return 0;
+}
+
+extern "C" int hr_nop(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    __SKIR_push(0, &e);
+    return 0;
+}
+
+//
+// a request is its type on a line, then the message
+//
+
+struct msg_t {
+    char buf[256];
+    int n;
+};
+
+static void
+put_varint(msg_t &m, unsigned v)
+{
+    while (v >= 0x80) {
+	m.buf[m.n++] = (v & 0x7f) | 0x80;
+	v >>= 7;
+    }
+    m.buf[m.n++] = v;
+}
+
+static void
+put_uint(msg_t &m, int field, unsigned v)
+{
+    put_varint(m, field << 3);
+    put_varint(m, v);
+}
+
+static void
+put_string(msg_t &m, int field, const char *s)
+{
+    size_t len = strlen(s);
+    put_varint(m, (field << 3) | 2);
+    put_varint(m, len);
+    memcpy(&m.buf[m.n], s, len);
+    m.n += len;
+}
+
+static void
+start(msg_t &m, const char *type, unsigned request_id)
+{
+    m.n = sprintf(m.buf, "%s\n", type);
+    put_uint(m, 1, request_id);
+}
+
+// send a request, true unless the runtime answered with an error
+static bool
+request(msg_t &m)
+{
+    assert(m.n < (int)sizeof(m.buf));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(EVENT_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    // the server may still be starting up
+    int fd = -1;
+    for (int i=0; i<100 && fd < 0; i++) {
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+	    close(fd);
+	    fd = -1;
+	    usleep(10000);
+	}
+    }
+    assert(fd >= 0);
+
+    int w = write(fd, m.buf, m.n);
+    assert(w == m.n);
+    shutdown(fd, SHUT_WR);
+
+    unsigned char r[256];
+    int n = 0, k;
+    while ((k = read(fd, r + n, sizeof(r) - n)) > 0)
+	n += k;
+    close(fd);
+
+    // RequestResponse: an error sets type (field 2) to ERR
+    for (int i=0; i+1<n; ) {
+	int tag = r[i++];
+	if ((tag & 7) == 0) {
+	    int v = r[i++];
+	    if ((tag >> 3) == 2 && v == 2)
+		return false;
+	}
+	else if ((tag & 7) == 2)
+	    i += 1 + r[i];
+	else
+	    break;
+    }
+    return true;
+}
+
+static void
+stream(unsigned id)
+{
+    msg_t m;
+    start(m, "StreamRequest", id);
+    put_uint(m, 3, sizeof(int));
+    bool ok = request(m);
+    assert(ok);
+}
+
+static void
+kernel(unsigned id, const char *work)
+{
+    msg_t m;
+    start(m, "KernelRequest", id);
+    put_string(m, 2, work);
+    bool ok = request(m);
+    assert(ok);
+}
+
+static void
+call(unsigned id, int in, int out)
+{
+    msg_t m;
+    start(m, "CallRequest", REQ);
+    put_uint(m, 2, id);
+    if (in) put_uint(m, 3, in);
+    if (out) put_uint(m, 4, out);
+    request(m);
+}
+
+static bool
+reconfigure(unsigned id, int n, const unsigned *kernels)
+{
+    msg_t m;
+    start(m, "ReconfigureRequest", REQ);
+    put_uint(m, 2, id);
+    for (int i=0; i<n; i++)
+	put_uint(m, 3, kernels[i]);
+    return request(m);
+}
+
+int
+main(int argc, char *argv[])
+{
+    stream(IN);
+    stream(OUT);
+    kernel(SRC, "hr_src");
+    kernel(COPY, "hr_copy");
+    kernel(SINK, "hr_sink");
+    kernel(DOUBLE, "hr_double");
+    kernel(HELPER, "hr_helper");
+    kernel(NOP, "hr_nop");
+
+    call(SRC, 0, IN);
+    call(COPY, IN, OUT);
+    call(SINK, OUT, 0);
+
+    while (seen < NSAMPLES)
+	usleep(1000);
+
+    unsigned unknown[] = { DOUBLE, 99 };
+    printf("reconfigure unknown: %s\n", reconfigure(COPY, 2, unknown) ? "ok" : "failed");
+    fflush(stdout);
+
+    unsigned helper[] = { HELPER, NOP };
+    printf("reconfigure helper: %s\n", reconfigure(COPY, 2, helper) ? "ok" : "failed");
+    fflush(stdout);
+
+    unsigned twice[] = { DOUBLE };
+    printf("reconfigure: %s\n", reconfigure(COPY, 1, twice) ? "ok" : "failed");
+    fflush(stdout);
+
+    limit = 2 * NSAMPLES;
+
+    msg_t m;
+    start(m, "WaitRequest", REQ);
+    put_uint(m, 2, SINK);
+    request(m);
+
+    return EXIT_SUCCESS;
+}
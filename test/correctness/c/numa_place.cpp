@@ -0,0 +1,239 @@
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "skir_intrinsics.h"
+
+//
+// NUMA placement on a made up topology (-numa-fake-nodes=2, cpu c on
+// node c % 2) with one worker running src -> copy -> sink.  the runtime's
+// StatsRequest says which node each kernel runs on and how many bytes
+// are on each node:
+//
+//   placed  every buffer is on the node the kernels run on
+//   moved   the sink moves the worker to a cpu of the other node, the
+//           buffers follow the kernels there
+//   freed   once the kernels are done nothing is left on any node
+//
+
+#define NODES 2
+#define EVENT_PORT 7547
+#define STATS_SIZE 4096
+// polls of the stats, 10ms apart, before giving up
+#define TRIES 500
+
+static volatile int seen;
+static volatile int stop;
+static volatile int move;
+static int next;
+
+static int src_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    if (stop)
+	return 1;
+    __SKIR_push(0, &next);
+    next++;
+    return 0;
+}
+
+static int copy_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    __SKIR_push(0, &e);
+    return 0;
+}
+
+// pin the calling thread to a cpu of another node, false if there is none
+static bool
+move_to_other_node(void)
+{
+    int node = sched_getcpu() % NODES;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set))
+	return false;
+    for (int c=0; c<CPU_SETSIZE; c++) {
+	if (!CPU_ISSET(c, &set) || c % NODES == node)
+	    continue;
+	CPU_ZERO(&set);
+	CPU_SET(c, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+    return false;
+}
+
+static int sink_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    int e;
+    __SKIR_pop(0, &e);
+    if (move == 1)
+	move = move_to_other_node() ? 2 : 3;
+    seen++;
+    return 0;
+}
+
+// send a StatsRequest, the response's string into stats
+static void
+stats_request(char *stats)
+{
+    char msg[64];
+    int n = sprintf(msg, "StatsRequest\n");
+    msg[n++] = 0x08; msg[n++] = 1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(EVENT_PORT);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    // the server may still be starting up
+    int fd = -1;
+    for (int i=0; i<100 && fd < 0; i++) {
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+	    close(fd);
+	    fd = -1;
+	    usleep(10000);
+	}
+    }
+    assert(fd >= 0);
+
+    int w = write(fd, msg, n);
+    assert(w == n);
+    shutdown(fd, SHUT_WR);
+
+    static unsigned char r[STATS_SIZE];
+    int m = 0, k;
+    while ((k = read(fd, r + m, sizeof(r) - m)) > 0)
+	m += k;
+    close(fd);
+
+    // RequestResponse, the string is data_string (field 4)
+    stats[0] = 0;
+    for (int i=0; i<m; ) {
+	unsigned tag = 0, v = 0;
+	for (int s=0; i<m; s+=7) { tag |= (r[i] & 0x7f) << s; if (!(r[i++] & 0x80)) break; }
+	for (int s=0; i<m; s+=7) { v |= (r[i] & 0x7f) << s; if (!(r[i++] & 0x80)) break; }
+	if ((tag & 7) != 2)
+	    continue;
+	if ((tag >> 3) == 4 && i + (int)v <= m) {
+	    memcpy(stats, &r[i], v);
+	    stats[v] = 0;
+	}
+	i += v;
+    }
+}
+
+struct numa_t {
+    int kernel_node;   // node of every kernel, -1 if they differ
+    long long bytes[NODES];
+    long long allocs[NODES];
+    long long migrated[NODES];
+};
+
+static void
+numa_stats(numa_t &s)
+{
+    static char stats[STATS_SIZE];
+    stats_request(stats);
+
+    s.kernel_node = -2;
+    for (char *line = strtok(stats, "\n"); line; line = strtok(0, "\n")) {
+	int i;
+	long long b, a, m;
+	char *node = strstr(line, " node=");
+	if (sscanf(line, "numa node %d: %lld bytes in %lld allocations, %lld bytes migrated in",
+		   &i, &b, &a, &m) == 4) {
+	    if (i >= 0 && i < NODES) {
+		s.bytes[i] = b;
+		s.allocs[i] = a;
+		s.migrated[i] = m;
+	    }
+	}
+	else if (node) {
+	    int n = atoi(node + 6);
+	    s.kernel_node = (s.kernel_node == -2 || s.kernel_node == n) ? n : -1;
+	}
+    }
+}
+
+// every buffer on node, and the kernels too
+static bool
+all_on(numa_t &s, int node)
+{
+    if (s.kernel_node != node)
+	return false;
+    for (int i=0; i<NODES; i++)
+	if ((i == node) != (s.bytes[i] > 0))
+	    return false;
+    return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+    skir_stream_ptr_t ins[2] = {0, 0};
+    skir_stream_ptr_t outs[2] = {0, 0};
+
+    skir_kernel_ptr_t src = __SKIR_kernel((void*)src_work, 0);
+    skir_kernel_ptr_t copy = __SKIR_kernel((void*)copy_work, 0);
+    skir_kernel_ptr_t sink = __SKIR_kernel((void*)sink_work, 0);
+
+    outs[0] = __SKIR_stream(sizeof(int));
+    __SKIR_call(src, ins, outs);
+    ins[0] = outs[0];
+    outs[0] = __SKIR_stream(sizeof(int));
+    __SKIR_call(copy, ins, outs);
+    ins[0] = outs[0];
+    outs[0] = 0;
+    __SKIR_call(sink, ins, outs);
+
+    numa_t s;
+    bool ok = false;
+    int node = -1;
+    for (int i=0; i<TRIES && !ok; i++) {
+	usleep(10000);
+	numa_stats(s);
+	node = s.kernel_node;
+	ok = node >= 0 && seen > 0 && all_on(s, node);
+    }
+    printf("placed: %s\n", ok ? "yes" : "no");
+    fflush(stdout);
+
+    long long migrated = s.migrated[(node + 1) % NODES];
+    move = 1;
+    ok = false;
+    for (int i=0; i<TRIES && !ok && move != 3; i++) {
+	usleep(10000);
+	numa_stats(s);
+	int other = (node + 1) % NODES;
+	ok = move == 2 && all_on(s, other) && s.migrated[other] > migrated;
+    }
+    printf("moved: %s\n", ok ? "yes" : "no");
+    fflush(stdout);
+
+    stop = 1;
+    __SKIR_wait(sink);
+
+    ok = false;
+    for (int i=0; i<TRIES && !ok; i++) {
+	numa_stats(s);
+	ok = true;
+	for (int j=0; j<NODES; j++)
+	    ok = ok && s.bytes[j] == 0 && s.allocs[j] == 0;
+	if (!ok)
+	    usleep(10000);
+    }
+    printf("freed: %s\n", ok ? "yes" : "no");
+    fflush(stdout);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "skir_intrinsics.h"
+
+//
+// push and pop through reservations whose size doesn't divide the
+// stream's ring buffer, so every few blocks one wraps and goes through
+// the bounce buffer instead.  the sink checks every element and prints
+// a checksum of every tenth block.
+//
+
+#define BLOCK 1000
+
+struct src_t {
+    int block;
+    int nblocks;
+};
+
+struct sink_t {
+    int block;
+    int errors;
+};
+
+static int src_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    src_t *s = (src_t *)state;
+    if (s->block >= s->nblocks)
+	return 1;
+    int *p = (int *)__SKIR_push_reserve(0, BLOCK);
+    for (int i=0; i<BLOCK; i++)
+	p[i] = s->block * BLOCK + i;
+    __SKIR_push_commit(0, BLOCK);
+    s->block++;
+    return 0;
+}
+
+static int sink_work(void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+{
+    sink_t *s = (sink_t *)state;
+    int *p = (int *)__SKIR_pop_reserve(0, BLOCK);
+    long long sum = 0;
+    for (int i=0; i<BLOCK; i++) {
+	if (p[i] != s->block * BLOCK + i && s->errors++ < 10)
+	    printf("block %d: element %d is %d\n", s->block, i, p[i]);
+	sum += p[i];
+    }
+    __SKIR_pop_commit(0, BLOCK);
+    if (s->block % 10 == 0) {
+	printf("block %d: %lld\n", s->block, sum);
+	fflush(stdout);
+    }
+    s->block++;
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 2) {
+	printf("usage:\n%s\t<nblocks>\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    skir_stream_ptr_t ins[2] = {0, 0};
+    skir_stream_ptr_t outs[2] = {0, 0};
+
+    src_t src_state;
+    src_state.block = 0;
+    src_state.nblocks = atoi(argv[1]);
+    sink_t sink_state;
+    sink_state.block = 0;
+    sink_state.errors = 0;
+
+    skir_kernel_ptr_t src = __SKIR_kernel((void*)src_work, &src_state);
+    skir_kernel_ptr_t sink = __SKIR_kernel((void*)sink_work, &sink_state);
+
+    outs[0] = __SKIR_stream(sizeof(int));
+    __SKIR_call(src, ins, outs);
+    ins[0] = outs[0];
+    outs[0] = 0;
+    __SKIR_call(sink, ins, outs);
+
+    __SKIR_wait(sink);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+//
+// skir-aot: compile a SKIR program ahead of time into a standalone
+// executable that runs without the JIT.
+//
+//   skir-aot prog-skir.bc -o prog        executable
+//   skir-aot prog-skir.bc -c -o prog.o   object file only
+//   skir-aot prog-skir.bc -emit-bitcode  the compiled module, for inspection
+//
+
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/System/Host.h"
+#include "llvm/System/Path.h"
+#include "llvm/System/Program.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetRegistry.h"
+#include "llvm/Target/TargetSelect.h"
+#include "SKIR/SKIRRuntime.h"
+
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+namespace {
+    cl::opt<std::string>
+    InputFile(cl::desc("<input bitcode>"), cl::Positional, cl::init("-"));
+
+    cl::opt<std::string>
+    OutputFilename("o", cl::desc("Output filename"), cl::value_desc("filename"),
+		   cl::init("a.out"));
+
+    cl::opt<std::string>
+    EntryFunc("entry-function",
+	      cl::desc("Specify the entry function (default = 'main') "
+		       "of the executable"),
+	      cl::value_desc("function"),
+	      cl::init("main"));
+
+    cl::opt<bool>
+    CompileOnly("c", cl::desc("Write an object file, don't link"), cl::init(false));
+
+    cl::opt<bool>
+    EmitBitcode("emit-bitcode", cl::desc("Write the compiled module as bitcode"),
+		cl::init(false));
+
+    cl::opt<std::string>
+    AOTLibDir("aot-lib-dir", cl::desc("Directory of libSKIRAOT.a"),
+	      cl::value_desc("directory"), cl::init(SKIR_AOT_LIBDIR));
+
+    cl::opt<std::string>
+    LinkDriver("linker", cl::desc("Compiler driver used to link (default = 'c++')"),
+	   cl::value_desc("program"), cl::init("c++"));
+}
+
+static bool
+emitObject(Module *M, const std::string &filename)
+{
+    std::string err;
+
+    Triple TheTriple(M->getTargetTriple());
+    if (TheTriple.getTriple().empty())
+	TheTriple.setTriple(sys::getHostTriple());
+
+    const Target *TheTarget = TargetRegistry::lookupTarget(TheTriple.getTriple(), err);
+    if (!TheTarget) {
+	errs() << "skir-aot: " << err << "\n";
+	return false;
+    }
+
+    // position independent, the system linker may be making a PIE
+    TargetMachine::setRelocationModel(Reloc::PIC_);
+    std::auto_ptr<TargetMachine> TM(TheTarget->createTargetMachine(TheTriple.getTriple(), ""));
+
+    raw_fd_ostream out(filename.c_str(), err, raw_fd_ostream::F_Binary);
+    if (!err.empty()) {
+	errs() << "skir-aot: " << err << "\n";
+	return false;
+    }
+    formatted_raw_ostream fout(out);
+
+    PassManager PM;
+    PM.add(new TargetData(*TM->getTargetData()));
+    if (TM->addPassesToEmitFile(PM, fout, TargetMachine::CGFT_ObjectFile,
+				CodeGenOpt::Aggressive)) {
+	errs() << "skir-aot: " << TheTriple.getTriple() << " can't emit object files\n";
+	return false;
+    }
+    PM.run(*M);
+
+    return true;
+}
+
+static bool
+linkExecutable(const std::string &object, const std::string &filename)
+{
+    sys::Path driver = sys::Program::FindProgramByName(LinkDriver);
+    if (driver.isEmpty()) {
+	errs() << "skir-aot: can't find " << LinkDriver << "\n";
+	return false;
+    }
+
+    std::string libdir = "-L" + AOTLibDir;
+    const char *args[] = {
+	driver.c_str(), object.c_str(), "-o", filename.c_str(),
+	libdir.c_str(), "-lSKIRAOT", "-lpthread", "-lm", 0
+    };
+
+    std::string err;
+    if (sys::Program::ExecuteAndWait(driver, args, 0, 0, 0, 0, &err)) {
+	errs() << "skir-aot: link failed " << err << "\n";
+	return false;
+    }
+
+    return true;
+}
+
+int
+main(int argc, char **argv)
+{
+    llvm_shutdown_obj Y;
+    cl::ParseCommandLineOptions(argc, argv, "skir ahead of time compiler\n");
+
+    InitializeAllTargets();
+    InitializeAllAsmPrinters();
+
+    LLVMContext &Context = getGlobalContext();
+    std::string err;
+
+    MemoryBuffer *buffer = MemoryBuffer::getFileOrSTDIN(InputFile, &err);
+    Module *M = buffer ? ParseBitcodeFile(buffer, Context, &err) : 0;
+    delete buffer;
+    if (!M) {
+	errs() << "skir-aot: " << InputFile << ": " << err << "\n";
+	return 1;
+    }
+
+    if (!SKIRRuntime::runSKIRAOTPasses(M, EntryFunc.c_str()))
+	return 1;
+
+    if (EmitBitcode) {
+	raw_fd_ostream out(OutputFilename.c_str(), err, raw_fd_ostream::F_Binary);
+	if (!err.empty()) {
+	    errs() << "skir-aot: " << err << "\n";
+	    return 1;
+	}
+	WriteBitcodeToFile(M, out);
+	return 0;
+    }
+
+    if (CompileOnly)
+	return emitObject(M, OutputFilename) ? 0 : 1;
+
+    std::string object = OutputFilename + ".o";
+    bool ok = emitObject(M, object) && linkExecutable(object, OutputFilename);
+    sys::Path(object).eraseFromDisk();
+
+    return ok ? 0 : 1;
+}
@@ -34,6 +34,7 @@
 #include <string>
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 using namespace llvm;
 
@@ -92,7 +93,6 @@ namespace {
     Port("p", cl::desc("event server port"), cl::init(7547));
 }
 
-SKIRRuntime skirrt;
 bool die = false;
 
 using boost::asio::ip::tcp;
@@ -101,7 +101,7 @@ const int max_length = 4096;
 
 typedef boost::shared_ptr<tcp::socket> socket_ptr;
 
-void session(socket_ptr sock)
+void session(SKIRRuntime *skirrt, socket_ptr sock)
 {
     std::string data;
     
@@ -121,29 +121,29 @@ void session(socket_ptr sock)
 
     std::stringstream ss;
     ss.str(data);
-    skirrt.onEvent(&ss);
+    skirrt->postEvent(&ss);
 
     if (size_t n = ss.str().length())
 	boost::asio::write(*sock, boost::asio::buffer(ss.str().c_str(), n));
 }
 
-void server(boost::asio::io_service& io_service, short port)
+void server(SKIRRuntime *skirrt, boost::asio::io_service& io_service, short port)
 {
   tcp::acceptor a(io_service, tcp::endpoint(tcp::v4(), port));
   for (;;)
   {
     socket_ptr sock(new tcp::socket(io_service));
     a.accept(*sock);
-    //boost::thread t(boost::bind(session, sock));
-    session(sock);
+    // sessions run concurrently, the runtime serializes mutating requests
+    boost::thread t(boost::bind(session, skirrt, sock));
   }
 }
 
-void skirrt_event_server(void)
+void skirrt_event_server(SKIRRuntime *skirrt)
 {
     boost::asio::io_service io_service;
     
-    server(io_service, Port);
+    server(skirrt, io_service, Port);
 }
 
 int
@@ -152,9 +152,10 @@ main(int argc, char **argv, char * const *envp)
     cl::ParseCommandLineOptions(argc, argv, "skir\n");
     tbb::task_scheduler_init tbb_init(NThreads);
 
-    skirrt.setVerbose(Verbose);
-    skirrt.start(NThreads);
-    boost::thread t(skirrt_event_server);
+    // created after the command line is parsed, it copies the options
+    SKIRRuntime *skirrt = SKIRRuntime::create(NThreads);
+    skirrt->setVerbose(Verbose);
+    boost::thread t(boost::bind(skirrt_event_server, skirrt));
 
     if (!Echo.empty())
     {
@@ -163,7 +164,7 @@ main(int argc, char **argv, char * const *envp)
 	std::stringstream event;
 	event << "EchoRequest\n";
 	echo.SerializeToOstream(&event);
-	skirrt.onEvent(&event);
+	skirrt->onEvent(&event);
     }
     
     if (InputFile.compare("-")) {
@@ -179,11 +180,12 @@ main(int argc, char **argv, char * const *envp)
 	std::stringstream event;
 	event << "RunModuleRequest\n";
 	runModule.SerializeToOstream(&event);
-	skirrt.onEvent(&event);
+	skirrt->onEvent(&event);
 	//skirrt.run(InputFile, InputArgv, FakeArgv0, EntryFunc, envp, NThreads, RunMode);
     }
 
     t.join();
 
+    SKIRRuntime::destroy(skirrt);
     return 0;
 }
@@ -0,0 +1,348 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#ifndef _CONSTEVALVISITOR_HPP_
+#define _CONSTEVALVISITOR_HPP_
+
+#include "nodes/Nodes.hpp"
+#include "nodes/TypeVisitor.hpp"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <math.h>
+
+// this class evaluates int, float and boolean expressions over a
+// scoped environment of compile-time constants, e.g. stream parameters
+// and the local variables of a composite stream's init function.
+// accept() returns non-NULL and sets val if the expression is constant.
+
+namespace streamit {
+
+struct ConstVal
+{
+    enum {
+	CONST_INT,
+	CONST_FLOAT,
+	CONST_BOOL,
+	// pointer to the child count of a splitjoin (i holds the count)
+	CONST_NCHILDREN,
+	// a variable whose value is not known at compile time
+	CONST_UNKNOWN
+    };
+    int kind;
+    int i;
+    double f;
+
+    ConstVal() : kind(CONST_INT), i(0), f(0) {}
+    ConstVal(int k, int iv, double fv) : kind(k), i(iv), f(fv) {}
+
+    static ConstVal Int(int v) { return ConstVal(CONST_INT, v, v); }
+    static ConstVal Float(double v) { return ConstVal(CONST_FLOAT, (int)v, v); }
+    static ConstVal Bool(bool v) { return ConstVal(CONST_BOOL, v, v); }
+
+    bool isFloat() const { return kind == CONST_FLOAT; }
+    int asInt() const { return isFloat() ? (int)f : i; }
+    double asFloat() const { return isFloat() ? f : i; }
+
+    bool operator<(const ConstVal &o) const {
+	if (kind != o.kind) return kind < o.kind;
+	return isFloat() ? f < o.f : i < o.i;
+    }
+    bool operator==(const ConstVal &o) const {
+	return kind == o.kind && (isFloat() ? f == o.f : i == o.i);
+    }
+};
+
+typedef std::map<std::string, ConstVal> ConstEnv;
+
+class ConstEvalVisitor : public FEVisitor
+{
+protected:
+    // innermost scope last
+    std::vector<ConstEnv> scopes;
+
+    // maps primitive types to a ConstVal kind
+    struct KindVisitor : public TypeVisitor {
+	int kind;
+	void *visitTypePrimitive(TypePrimitive *t) {
+	    switch (t->getType()) {
+	    case TypePrimitive::TYPE_INT:
+	    case TypePrimitive::TYPE_CHAR:
+		kind = ConstVal::CONST_INT;
+		return (void *)1;
+	    case TypePrimitive::TYPE_FLOAT:
+	    case TypePrimitive::TYPE_DOUBLE:
+		kind = ConstVal::CONST_FLOAT;
+		return (void *)1;
+	    case TypePrimitive::TYPE_BIT:
+	    case TypePrimitive::TYPE_BOOLEAN:
+		kind = ConstVal::CONST_BOOL;
+		return (void *)1;
+	    }
+	    return NULL;
+	}
+    };
+
+    struct VarVisitor : public FEVisitor {
+	void *visitExprVar(ExprVar *exp) { return exp; }
+    };
+
+public:
+    ConstVal val;
+
+    ConstEvalVisitor() { scopes.push_back(ConstEnv()); }
+    ConstEvalVisitor(const ConstEnv &env) { scopes.push_back(env); }
+
+    void pushScope() { scopes.push_back(ConstEnv()); }
+    void popScope() { scopes.pop_back(); }
+
+    // kind of a scalar type, or false if t has no constant form
+    static bool kindOf(Type *t, int &kind) {
+	KindVisitor kv;
+	if (!t || !t->accept(&kv))
+	    return false;
+	kind = kv.kind;
+	return true;
+    }
+
+    // convert v to the kind of type t
+    static bool convert(Type *t, ConstVal &v) {
+	int kind;
+	if (!kindOf(t, kind))
+	    return false;
+	if (kind == ConstVal::CONST_FLOAT)
+	    v = ConstVal::Float(v.asFloat());
+	else if (kind == ConstVal::CONST_BOOL)
+	    v = ConstVal::Bool(v.asInt() != 0);
+	else
+	    v = ConstVal::Int(v.asInt());
+	return true;
+    }
+
+    void define(const std::string &name, const ConstVal &v) {
+	scopes.back()[name] = v;
+    }
+
+    // shadow name in the current scope with an unknown value
+    void forget(const std::string &name) {
+	scopes.back()[name] = ConstVal(ConstVal::CONST_UNKNOWN, 0, 0);
+    }
+
+    bool lookup(const std::string &name, ConstVal &v) {
+	for (size_t s = scopes.size(); s > 0; s--) {
+	    ConstEnv::iterator I = scopes[s-1].find(name);
+	    if (I != scopes[s-1].end()) {
+		v = I->second;
+		return v.kind != ConstVal::CONST_UNKNOWN;
+	    }
+	}
+	return false;
+    }
+
+    // assign to the innermost definition of name
+    bool assign(const std::string &name, const ConstVal &v) {
+	for (size_t s = scopes.size(); s > 0; s--) {
+	    ConstEnv::iterator I = scopes[s-1].find(name);
+	    if (I != scopes[s-1].end()) {
+		if (I->second.kind == ConstVal::CONST_UNKNOWN)
+		    return false;
+		ConstVal nv = v;
+		if (I->second.isFloat())
+		    nv = ConstVal::Float(v.asFloat());
+		else if (I->second.kind == ConstVal::CONST_BOOL)
+		    nv = ConstVal::Bool(v.asInt() != 0);
+		else if (I->second.kind == ConstVal::CONST_INT)
+		    nv = ConstVal::Int(v.asInt());
+		I->second = nv;
+		return true;
+	    }
+	}
+	return false;
+    }
+
+    bool eval(Expression *e, ConstVal &v) {
+	if (!e || !e->accept(this))
+	    return false;
+	v = val;
+	return true;
+    }
+
+    // val = l op r, op is one of ExprBinary::BINOP_*
+    bool binop(int op, ConstVal l, ConstVal r) {
+	if (l.kind == ConstVal::CONST_NCHILDREN || r.kind == ConstVal::CONST_NCHILDREN)
+	    return false;
+	bool fp = l.isFloat() || r.isFloat();
+	double lf = l.asFloat(), rf = r.asFloat();
+	int li = l.asInt(), ri = r.asInt();
+
+	switch (op) {
+	case ExprBinary::BINOP_ADD: val = fp ? ConstVal::Float(lf + rf) : ConstVal::Int(li + ri); break;
+	case ExprBinary::BINOP_SUB: val = fp ? ConstVal::Float(lf - rf) : ConstVal::Int(li - ri); break;
+	case ExprBinary::BINOP_MUL: val = fp ? ConstVal::Float(lf * rf) : ConstVal::Int(li * ri); break;
+	case ExprBinary::BINOP_DIV:
+	    if (fp) { val = ConstVal::Float(lf / rf); break; }
+	    if (!ri) return false;
+	    val = ConstVal::Int(li / ri);
+	    break;
+	case ExprBinary::BINOP_MOD:
+	    if (fp || !ri) return false;
+	    val = ConstVal::Int(li % ri);
+	    break;
+	case ExprBinary::BINOP_AND: val = ConstVal::Bool(li && ri); break;
+	case ExprBinary::BINOP_OR:  val = ConstVal::Bool(li || ri); break;
+	case ExprBinary::BINOP_EQ:  val = ConstVal::Bool(fp ? lf == rf : li == ri); break;
+	case ExprBinary::BINOP_NEQ: val = ConstVal::Bool(fp ? lf != rf : li != ri); break;
+	case ExprBinary::BINOP_LT:  val = ConstVal::Bool(fp ? lf <  rf : li <  ri); break;
+	case ExprBinary::BINOP_LE:  val = ConstVal::Bool(fp ? lf <= rf : li <= ri); break;
+	case ExprBinary::BINOP_GT:  val = ConstVal::Bool(fp ? lf >  rf : li >  ri); break;
+	case ExprBinary::BINOP_GE:  val = ConstVal::Bool(fp ? lf >= rf : li >= ri); break;
+	case ExprBinary::BINOP_BAND:   if (fp) return false; val = ConstVal::Int(li & ri); break;
+	case ExprBinary::BINOP_BOR:    if (fp) return false; val = ConstVal::Int(li | ri); break;
+	case ExprBinary::BINOP_BXOR:   if (fp) return false; val = ConstVal::Int(li ^ ri); break;
+	case ExprBinary::BINOP_LSHIFT: if (fp) return false; val = ConstVal::Int(li << ri); break;
+	case ExprBinary::BINOP_RSHIFT: if (fp) return false; val = ConstVal::Int(li >> ri); break;
+	default: return false;
+	}
+	if (l.kind == ConstVal::CONST_BOOL && r.kind == ConstVal::CONST_BOOL &&
+	    val.kind == ConstVal::CONST_INT)
+	    val = ConstVal::Bool(val.i != 0);
+	return true;
+    }
+
+    virtual void *visitExprConstInt(ExprConstInt *exp) {
+	val = ConstVal::Int(exp->getVal());
+	return (void *)1;
+    }
+
+    virtual void *visitExprConstFloat(ExprConstFloat *exp) {
+	val = ConstVal::Float(exp->getVal());
+	return (void *)1;
+    }
+
+    virtual void *visitExprConstBoolean(ExprConstBoolean *exp) {
+	val = ConstVal::Bool(exp->getVal());
+	return (void *)1;
+    }
+
+    virtual void *visitExprVar(ExprVar *exp) {
+	if (!lookup(exp->getName(), val))
+	    return NULL;
+	return (void *)1;
+    }
+
+    virtual void *visitExprBinary(ExprBinary *exp) {
+	ConstVal l, r;
+	if (!eval(exp->getLeft(), l) || !eval(exp->getRight(), r))
+	    return NULL;
+	return binop(exp->getOp(), l, r) ? (void *)1 : NULL;
+    }
+
+    virtual void *visitExprUnary(ExprUnary *exp) {
+	ConstVal v;
+	if (!eval(exp->getExpr(), v) || v.kind == ConstVal::CONST_NCHILDREN)
+	    return NULL;
+
+	int op = exp->getOp();
+	switch (op) {
+	case ExprUnary::UNOP_NOT: val = ConstVal::Bool(!v.asInt()); return (void *)1;
+	case ExprUnary::UNOP_NEG:
+	    val = v.isFloat() ? ConstVal::Float(-v.f) : ConstVal::Int(-v.i);
+	    return (void *)1;
+	case ExprUnary::UNOP_COMPLEMENT:
+	    if (v.isFloat()) return NULL;
+	    val = ConstVal::Int(~v.i);
+	    return (void *)1;
+	}
+
+	// ++ and -- write their operand, which must be a variable
+	VarVisitor vv;
+	ExprVar *var = (ExprVar *)exp->getExpr()->accept(&vv);
+	if (!var)
+	    return NULL;
+	int delta = (op == ExprUnary::UNOP_PREINC || op == ExprUnary::UNOP_POSTINC) ? 1 : -1;
+	ConstVal nv = v.isFloat() ? ConstVal::Float(v.f + delta) : ConstVal::Int(v.i + delta);
+	if (!assign(var->getName(), nv))
+	    return NULL;
+	val = (op == ExprUnary::UNOP_PREINC || op == ExprUnary::UNOP_PREDEC) ? nv : v;
+	return (void *)1;
+    }
+
+    virtual void *visitExprTernary(ExprTernary *exp) {
+	ConstVal c;
+	if (!eval(exp->getA(), c) || c.kind == ConstVal::CONST_NCHILDREN)
+	    return NULL;
+	return (c.asInt() ? exp->getB() : exp->getC())->accept(this);
+    }
+
+    virtual void *visitExprTypeCast(ExprTypeCast *exp) {
+	ConstVal v;
+	if (!eval(exp->getExpr(), v) || !convert(exp->getType(), v))
+	    return NULL;
+	val = v;
+	return (void *)1;
+    }
+
+    // pure math builtins with constant arguments
+    virtual void *visitExprFunCall(ExprFunCall *exp) {
+	std::vector<double> a;
+	ExpressionList *el = exp->getParams();
+	for (ExpressionList::iterator I = el->begin(), E = el->end(); I != E; ++I) {
+	    ConstVal v;
+	    if (!eval(*I, v) || v.kind == ConstVal::CONST_NCHILDREN)
+		return NULL;
+	    a.push_back(v.asFloat());
+	}
+
+	std::string n = exp->getName();
+	double r;
+	if (a.size() == 1) {
+	    if      (n == "sqrt")  r = sqrt(a[0]);
+	    else if (n == "sin")   r = sin(a[0]);
+	    else if (n == "cos")   r = cos(a[0]);
+	    else if (n == "tan")   r = tan(a[0]);
+	    else if (n == "asin")  r = asin(a[0]);
+	    else if (n == "acos")  r = acos(a[0]);
+	    else if (n == "atan")  r = atan(a[0]);
+	    else if (n == "exp")   r = ::exp(a[0]);
+	    else if (n == "log")   r = ::log(a[0]);
+	    else if (n == "floor") r = floor(a[0]);
+	    else if (n == "ceil")  r = ceil(a[0]);
+	    else if (n == "abs")   r = fabs(a[0]);
+	    else return NULL;
+	}
+	else if (a.size() == 2) {
+	    if      (n == "pow")   r = pow(a[0], a[1]);
+	    else if (n == "atan2") r = atan2(a[0], a[1]);
+	    else return NULL;
+	}
+	else
+	    return NULL;
+
+	val = ConstVal::Float(r);
+	return (void *)1;
+    }
+};
+
+}
+
+#endif
@@ -54,7 +54,7 @@ public:
 
     void *visitTypeArray(TypeArray *t) {
 	ExprEvalVisitor ev;
-	size_t length = (size_t)t->getLength()->accept(&ev);
+	size_t length = ev.evaluate(t->getLength());
 
 	ExpressionList *el = new ExpressionList;
 	for (size_t i=0; i<length; i++)
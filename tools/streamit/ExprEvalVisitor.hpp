@@ -23,22 +23,30 @@
 #ifndef _EXPREVALVISITOR_HPP_
 #define _EXPREVALVISITOR_HPP_
 
-#include "nodes/FEPrintVisitor.hpp"
+#include "ConstEvalVisitor.hpp"
 
-// this class evaluates simple integer expressions
+#include <iostream>
+#include <assert.h>
+
+// this class evaluates integer expressions, e.g. array lengths, over
+// the constants in scope
 
 namespace streamit {
 
-class ExprEvalVisitor : public FEPrintVisitor
+class ExprEvalVisitor : public ConstEvalVisitor
 {
 public:
-    void print(std::string s) { 
-	std::cout << "ExprEvalVisitor: error: cannot evaluate " << s << std::endl;
-	assert(0);
-    }
-    
-    void *visitExprConstInt(ExprConstInt *exp) {
-	return (void *)exp->getVal();
+    ExprEvalVisitor() {}
+    ExprEvalVisitor(const ConstEvalVisitor *scope)
+	: ConstEvalVisitor(scope ? *scope : ConstEvalVisitor()) {}
+
+    int evaluate(Expression *e) {
+	ConstVal v;
+	if (!eval(e, v) || v.kind == ConstVal::CONST_NCHILDREN) {
+	    std::cout << "ExprEvalVisitor: error: cannot evaluate " << e->toString() << std::endl;
+	    assert(0);
+	}
+	return v.asInt();
     }
 };
 
@@ -32,10 +32,11 @@
 #include "SKIR/SKIRTypes.h"
 #include "FEIRToSKIR.hpp"
 #include "nodes/IsZeroVisitor.hpp"
-//#include "nodes/IsConstIntVisitor.hpp"
 //#include "CreateZeroVisitor.hpp"
 
 #include <string>
+#include <sstream>
+#include <iomanip>
 #include <math.h>
 
 using namespace std;
@@ -341,6 +342,10 @@ void *FEIRToSKIR::visitExprFunCall(ExprFunCall *exp)
 	paramTypes.push_back(tConvert.convert(p->getType()));
     }
 
+    // helpers may write globals behind our back
+    if (inWork && sfunc->getCls() != sFunction::FUNC_NATIVE)
+	workStateKnown = false;
+
     const lType *retType = tConvert.convert(sfunc->getReturnType());
     FunctionType *funcType = FunctionType::get(retType, paramTypes, false);
     Value *func = getOrInsertFunction(funcName, funcType);
@@ -531,6 +536,23 @@ void *FEIRToSKIR::visitExprVar(ExprVar *exp) {
 
     if (!v) error("undefined ExprVar: "+name);
 
+    // known constants replace the load, in the variable's own type
+    ConstVal cv;
+    if (!inLHS && consts.lookup(name, cv)) {
+	const lType *ty;
+	if (v->getType()->isIntegerTy()) {
+	    const StructType *st = cast<StructType>(
+		cast<PointerType>(currentStatePtr->getType())->getElementType());
+	    ty = st->getElementType(cast<ConstantInt>(v)->getZExtValue());
+	}
+	else
+	    ty = cast<PointerType>(v->getType())->getElementType();
+	if (ty->isIntegerTy())
+	    return ConstantInt::get(ty, cv.asInt());
+	if (ty->isFloatingPointTy())
+	    return ConstantFP::get(ty, cv.asFloat());
+    }
+
     // if this thing is an integer, then it's an offset into state
     // all other values in the symbol table are pointers
     if (v->getType()->isIntegerTy()) {
@@ -578,14 +600,24 @@ void *FEIRToSKIR::visitFunction(sFunction *func) {
 
     Constant *c = mod->getOrInsertFunction(name, type);
     lFunction *f = cast<lFunction>(c);
+    // helpers are shared by the specialized copies of a filter
+    if (!f->empty())
+	return NULL;
     currentBB = BasicBlock::Create(CTX,"entry", f);
     Value *zero = ConstantInt::get(lType::getInt32Ty(CTX), 0);
     new BitCastInst(zero, zero->getType(), "alloca point", currentBB);
 
+    // helper parameters hide the stream's constants
+    consts.pushScope();
+    ParameterList *pl = func->getParams();
+    for (ParameterList::iterator I = pl->begin(); I != pl->end(); ++I)
+	consts.forget((*I)->getName());
+
     Statement *body = func->getBody();
     syms.pushScope(name);
     body->accept(this);
     syms.popScope();
+    consts.popScope();
 
     SKIRBuilder builder(currentBB);
     builder.CreateRetVoid();
@@ -732,7 +764,9 @@ void *FEIRToSKIR::visitFuncInit(Function *func) {
     if (func) {
 	Statement *body = func->getBody();
 	syms.pushScope("init");
+	consts.pushScope();
 	body->accept(this);
+	consts.popScope();
 	syms.popScope();
     }
 
@@ -956,17 +990,117 @@ void *FEIRToSKIR::visitFuncWork(FuncWork *work) {
     }
 
     Statement *body = work->getBody();
+    inWork = true;
+    workStateKnown = true;
+    workWrites.clear();
     syms.pushScope("work");
+    consts.pushScope();
     body->accept(this);
+    consts.popScope();
     syms.popScope();
+    inWork = false;
 
     SKIRBuilder builder(currentBB);
     builder.CreateRet(ConstantInt::get(lType::getInt32Ty(CTX), 0));
 
+    if (currentStreamSpec->getType() == StreamSpec::STREAM_FILTER)
+	addWorkInfo(work, f);
+
     currentBB = NULL;
     return f;
 }
 
+// finds the variable an assignment writes, through array indexing
+class LHSVarVisitor : public FEVisitor
+{
+public:
+    void *visitExprVar(ExprVar *exp) { return exp; }
+    void *visitExprArray(ExprArray *exp) { return exp->getBase()->accept(this); }
+};
+
+// collects the variables assigned anywhere under a node
+class AssignedVarsVisitor : public FEPrintVisitor
+{
+public:
+    set<string> names;
+
+    void print(std::string s) {}
+
+    void note(Expression *lhs) {
+	LHSVarVisitor v;
+	ExprVar *var = (ExprVar *)lhs->accept(&v);
+	if (var) names.insert(var->getName());
+    }
+
+    void *visitStmtAssign(StmtAssign *stmt) {
+	note(stmt->getLHS());
+	return FEPrintVisitor::visitStmtAssign(stmt);
+    }
+
+    void *visitExprUnary(ExprUnary *exp) {
+	int op = exp->getOp();
+	if (op != ExprUnary::UNOP_NOT && op != ExprUnary::UNOP_NEG &&
+	    op != ExprUnary::UNOP_COMPLEMENT)
+	    note(exp->getExpr());
+	return FEPrintVisitor::visitExprUnary(exp);
+    }
+
+    void *visitExprArray(ExprArray *exp) {
+	exp->getBase()->accept(this);
+	exp->getOffset()->accept(this);
+	return NULL;
+    }
+};
+
+// note which state field or global the lhs of an assignment in work is
+void FEIRToSKIR::recordStateWrite(Expression *lhs)
+{
+    LHSVarVisitor v;
+    ExprVar *var = (ExprVar *)lhs->accept(&v);
+    if (!var) {
+	workStateKnown = false;
+	return;
+    }
+
+    // fields are offsets into state, globals are GlobalVariables,
+    // everything else is a local
+    string name = var->getName();
+    Value *val = syms.getValue(name);
+    if (val && (val->getType()->isIntegerTy() || isa<GlobalVariable>(val)))
+	workWrites.insert(name);
+}
+
+// declared rate, -1 for dynamic rates ('*' and ranges) and rates
+// depending on parameters the filter wasn't specialized on
+static int declaredRate(ConstEvalVisitor &consts, Expression *e, int dflt)
+{
+    if (!e)
+	return dflt;
+    ConstVal v;
+    if (!consts.eval(e, v) || v.kind == ConstVal::CONST_NCHILDREN || v.asInt() < 0)
+	return -1;
+    return v.asInt();
+}
+
+// tell the runtime the declared rates of a filter and which state work
+// writes, so it doesn't have to rediscover them
+void FEIRToSKIR::addWorkInfo(FuncWork *work, lFunction *f)
+{
+    // no pop/push declaration means 0, no peek declaration means pop
+    int pop = declaredRate(consts, work->getPopRate(), 0);
+    int push = declaredRate(consts, work->getPushRate(), 0);
+    int peek = declaredRate(consts, work->getPeekRate(), pop);
+    if (peek >= 0 && pop >= 0 && peek < pop)
+	peek = pop;
+
+    int stateful = -1;
+    if (workStateKnown)
+	stateful = workWrites.empty() ? 0 : 1;
+
+    SKIRBuilder builder(CTX);
+    builder.CreateWorkInfo(mod, f, pop, peek, push, stateful);
+}
+
 // a program contains lists of streams, structs, and helper functions
 void *FEIRToSKIR::visitProgram(Program *prog) {
     debug("in visitProgram");
@@ -989,14 +1123,26 @@ void *FEIRToSKIR::visitProgram(Program *prog) {
 	StreamType *st = ss->getStreamType();
 	sType *typeIn = st->getIn();
 	sType *typeOut = st->getOut();
-	if (typeIn->isVoid() && typeOut->isVoid()) {
+	if (typeIn->isVoid() && typeOut->isVoid() && !topLevelStream)
 	    topLevelStream = ss;
-	    ss->accept(this);
-	    break;
-	}
     }
-	
-    FEPrintVisitor::visitProgram(prog);
+
+    // elaborate before generating any code: a flat graph only needs its
+    // leaves, each specialized on its constant parameters
+    StreamGraphVisitor graph(this, &syms);
+    bool flat = topLevelStream && flatten &&
+	graph.elaborate(topLevelStream) && checkFlatGraph(graph);
+
+    if (flat) {
+	TypeHelperList *thl = prog->getHelpers();
+	for (TypeHelperList::iterator I = thl->begin(); I != thl->end(); ++I)
+	    for (int i=0; i<(*I)->getNumFuncs(); i++)
+		(*I)->getFunction(i)->accept(this);
+    } else {
+	if (topLevelStream)
+	    topLevelStream->accept(this);
+	FEPrintVisitor::visitProgram(prog);
+    }
 
     if (topLevelStream) {
 	Constant* c = mod->getOrInsertFunction("main", lType::getVoidTy(CTX), NULL);
@@ -1013,13 +1159,21 @@ void *FEIRToSKIR::visitProgram(Program *prog) {
 	    builder.CreateCall(global_init, nul);
 	}
 
-	string top = topLevelStream->getName();
-	Value *init = syms.getValue("streamit::"+top+"::init", true);
-	Value *work = syms.getValue("streamit::"+top+"::work", true);
-
-	Value *k = builder.CreateKernel(mod, init, work, NULL);
-	builder.CreateKernelCall(mod, k, NULL, NULL);
-	builder.CreateWait(mod, k);
+	if (flat) {
+	    createFlatGraph(graph, builder);
+	    debug("emitted flat stream graph");
+	}
+	else {
+	    // the hierarchy depends on values only known at run time,
+	    // let the top level kernel build it
+	    string top = topLevelStream->getName();
+	    Value *init = syms.getValue("streamit::"+top+"::init", true);
+	    Value *work = syms.getValue("streamit::"+top+"::work", true);
+
+	    Value *k = builder.CreateKernel(mod, init, work, NULL);
+	    builder.CreateKernelCall(mod, k, NULL, NULL);
+	    builder.CreateWait(mod, k);
+	}
 	builder.CreateRetVoid();
     }
 
@@ -1028,6 +1182,215 @@ void *FEIRToSKIR::visitProgram(Program *prog) {
     return NULL;
 }
 
+// false if some leaf of the flat graph has a parameter with no
+// constant form
+bool
+FEIRToSKIR::checkFlatGraph(StreamGraphVisitor &graph)
+{
+    vector<GraphNode>::iterator I, E = graph.nodes.end();
+    for (I = graph.nodes.begin(); I != E; ++I) {
+	if (I->spec->getType() != StreamSpec::STREAM_FILTER)
+	    return false;
+	ParameterList *pl = I->spec->getParams();
+	for (size_t i=0; i<pl->size(); i++) {
+	    const lType *ty = tConvert.convert((*pl)[i]->getType());
+	    bool nchildren = (I->args[i].kind == ConstVal::CONST_NCHILDREN);
+	    if (!ty || (nchildren ? !isa<PointerType>(ty) : 
+			!(ty->isIntegerTy() || ty->isFloatingPointTy())))
+		return false;
+	}
+    }
+    return true;
+}
+
+// create and call every leaf of the flat graph from main(): kernels get
+// their constant parameters from internal globals and are connected by
+// streams allocated here.
+void
+FEIRToSKIR::createFlatGraph(StreamGraphVisitor &graph, SKIRBuilder &builder)
+{
+    vector<GraphNode> &nodes = graph.nodes;
+    vector<GraphNode>::iterator I, E = nodes.end();
+
+    for (I = nodes.begin(); I != E; ++I)
+	specialize(*I);
+
+    const lType *int32Ty = lType::getInt32Ty(CTX);
+    lFunction *F = builder.GetInsertBlock()->getParent();
+
+    // streams, elements are sizeof(int) like the runtime's pipelines
+    vector<Value *> streams;
+    for (int s=0; s<graph.numStreams; s++) {
+	Value *st = builder.CreateStream(mod, ConstantInt::get(int32Ty, sizeof(int)));
+	streams.push_back(builder.CreateBitCast(st, GetVoidPtrType(CTX)));
+    }
+
+    vector<Value *> kernels;
+    for (I = nodes.begin(); I != E; ++I) {
+	GraphNode &n = *I;
+	Value *init = syms.getValue("streamit::"+n.name+"::init", true);
+	Value *work = syms.getValue("streamit::"+n.name+"::work", true);
+
+	Value *params = NULL;
+	ParameterList *pl = n.spec->getParams();
+	if (pl->size()) {
+	    vector<Constant *> fields;
+	    for (size_t i=0; i<pl->size(); i++) {
+		const lType *ty = tConvert.convert((*pl)[i]->getType());
+		ConstVal &v = n.args[i];
+		if (v.kind == ConstVal::CONST_NCHILDREN)
+		    fields.push_back(new GlobalVariable(*mod, int32Ty, true,
+							GlobalValue::InternalLinkage,
+							ConstantInt::get(int32Ty, v.i),
+							"__num_children"));
+		else if (ty->isIntegerTy())
+		    fields.push_back(ConstantInt::get(ty, v.asInt()));
+		else
+		    fields.push_back(ConstantFP::get(ty, v.asFloat()));
+	    }
+	    Constant *s = ConstantStruct::get(CTX, fields, false);
+	    GlobalVariable *gv = new GlobalVariable(*mod, s->getType(), true,
+						    GlobalValue::InternalLinkage, s,
+						    "__streamit_"+n.name+"_params");
+	    params = ConstantExpr::getBitCast(gv, GetVoidPtrType(CTX));
+	}
+	kernels.push_back(builder.CreateKernel(mod, init, work, params));
+    }
+
+    // call in the order the hierarchy would have, upstream first
+    for (size_t k=0; k<nodes.size(); k++) {
+	Value *io[2] = { NULL, NULL };
+	vector<int> *lists[2] = { &nodes[k].ins, &nodes[k].outs };
+	for (int l=0; l<2; l++) {
+	    vector<int> &ids = *lists[l];
+	    if (ids.empty())
+		continue;
+	    // null terminated stream array
+	    const lType *arrTy = ArrayType::get(GetVoidPtrType(CTX), ids.size()+1);
+	    Value *arr = new AllocaInst(arrTy, "", getAllocaPoint(F));
+	    for (size_t i=0; i<=ids.size(); i++) {
+		Value *v = (i < ids.size()) ? streams[ids[i]] :
+		    ConstantPointerNull::get(cast<PointerType>(GetVoidPtrType(CTX)));
+		builder.CreateStore(v, builder.CreateConstGEP2_32(arr, 0, i));
+	    }
+	    io[l] = builder.CreateConstGEP2_32(arr, 0, 0);
+	}
+	builder.CreateKernelCall(mod, kernels[k], io[0], io[1]);
+    }
+
+    for (size_t k=0; k<kernels.size(); k++)
+	builder.CreateWait(mod, kernels[k]);
+}
+
+// constants for spec's code: the parameters it is specialized on and
+// fields with constant initializers, as long as nothing assigns them
+void
+FEIRToSKIR::bindConsts(StreamSpec *spec)
+{
+    AssignedVarsVisitor av;
+    spec->accept(&av);
+    assigned.swap(av.names);
+
+    consts = ConstEvalVisitor();
+    ParameterList *pl = spec->getParams();
+    for (ParameterList::iterator I = pl->begin(); I != pl->end(); ++I) {
+	ConstEnv::iterator P = specParams.find((*I)->getName());
+	if (P != specParams.end() && !assigned.count(P->first))
+	    consts.define(P->first, P->second);
+    }
+    specParams.clear();
+
+    if (spec->getType() != StreamSpec::STREAM_FILTER)
+	return;
+    FieldDeclList *fdl = spec->getFields();
+    for (FieldDeclList::iterator I = fdl->begin(); I != fdl->end(); ++I) {
+	FieldDecl *fd = *I;
+	if (localFields.count(fd))
+	    continue;
+	for (int i=0; i<fd->getNumFields(); i++) {
+	    Expression *init = fd->getInit(i);
+	    ConstVal v;
+	    if (init && !init->isArrayInit() && !assigned.count(fd->getName(i)) &&
+		consts.eval(init, v) && ConstEvalVisitor::convert(fd->getType(i), v))
+		consts.define(fd->getName(i), v);
+	}
+    }
+}
+
+// generate code for ss as a root of the stream graph
+void
+FEIRToSKIR::emitSpec(StreamSpec *ss)
+{
+    string scope = syms.getScope();
+    syms.setScope("streamit");
+    ss->accept(this);
+    syms.setScope(scope);
+}
+
+// generate a renamed copy of filter n.spec whose code sees its
+// parameters as the constants n.args, and point n at it.  instances with
+// equal arguments share a copy.
+StreamSpec *
+FEIRToSKIR::specialize(GraphNode &n)
+{
+    StreamSpec *ss = n.spec;
+    ParameterList *pl = ss->getParams();
+    if (!ss->getFuncs())
+	return ss;  // builtin
+    if (pl->empty()) {
+	emitSpec(ss);
+	return ss;
+    }
+
+    stringstream key;
+    key << n.name << setprecision(17);
+    for (size_t i=0; i<n.args.size(); i++) {
+	if (n.args[i].isFloat())
+	    key << "," << n.args[i].f;
+	else
+	    key << "," << n.args[i].i;
+    }
+
+    StreamSpec *&sp = specialized[key.str()];
+    if (!sp) {
+	stringstream name;
+	name << n.name << "__" << specialized.size();
+
+	// the fields without the locals generating code added
+	FieldDeclList *fields = new FieldDeclList;
+	FieldDeclList *fdl = ss->getFields();
+	for (FieldDeclList::iterator I = fdl->begin(); I != fdl->end(); ++I)
+	    if (!localFields.count(*I))
+		fields->push_back(*I);
+
+	sp = new StreamSpec(ss->getContext(), ss->getType(), ss->getStreamType(),
+			    name.str(), pl, fields, ss->getFuncs());
+	sp->setParent(ss->getParent());
+
+	string scope = syms.getScope();
+	syms.setScope("streamit");
+	SymbolTableVisitor stv(&syms);
+	sp->accept(&stv);
+
+	syms.setScope(scope);
+
+	for (size_t i=0; i<pl->size(); i++)
+	    specParams[(*pl)[i]->getName()] = n.args[i];
+	emitSpec(sp);
+    }
+
+    n.name = sp->getName();
+    n.spec = sp;
+    return sp;
+}
+
+StreamCreator *
+FEIRToSKIR::createSplitJoin(SplitterJoiner *sj, bool isSplit)
+{
+    splitjoin = isSplit;
+    return (StreamCreator *)sj->accept(this);
+}
+
 //void *FEIRToSKIR::visitSCAnon(SCAnon *creator) { return NULL; }
 //void *FEIRToSKIR::visitSCSimple(SCSimple *creator) { return NULL; }
 
@@ -1083,13 +1446,11 @@ void *FEIRToSKIR::visitSJWeightedRR(SJWeightedRR *sj)
 	for (; I!=E; ++I) {
 	    args->push_back( *I );
 	} 
-	if (weights->size() == 2) 
-	    args->push_back( new ExprConstInt(0) );
 	
 	if (splitjoin == split) {
-	    name = "_splitrrW";
+	    name = addWeightedRR("_splitrrW", weights->size());
 	} else {
-	    name = "_joinrrW";
+	    name = addWeightedRR("_joinrrW", weights->size());
 	}
     }
     else {
@@ -1108,6 +1469,103 @@ void *FEIRToSKIR::visitSJWeightedRR(SJWeightedRR *sj)
     return sc;
 }
 
+// the weighted round robin builtins take the weight count followed by
+// that many weights, so each width gets its own spec.  all of them share
+// one init and work function.
+string
+FEIRToSKIR::addWeightedRR(const string &base, size_t n)
+{
+    stringstream name;
+    name << base << n;
+    if (syms.getNode("streamit::"+name.str(), true))
+	return name.str();
+
+    Constant *c;
+    c = getOrInsertFunction("__streamit_"+base+"_init", GetInitFunctionType(CTX));
+    syms.addEntry("streamit::"+name.str()+"::init", NULL, c, true);
+    c = getOrInsertFunction("__streamit_"+base+"_work", GetWorkFunctionType(CTX));
+    syms.addEntry("streamit::"+name.str()+"::work", NULL, c, true);
+    ParameterList *pl = new ParameterList;
+    pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "num") );
+    for (size_t i=0; i<n; i++) {
+	stringstream arg;
+	arg << "arg" << i;
+	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), arg.str()) );
+    }
+    StreamSpec *ss = new StreamSpec(NULL, StreamSpec::STREAM_FILTER,
+				    NULL, name.str(), pl, NULL, NULL);
+    syms.addEntry("streamit::"+name.str(), ss, NULL, true);
+    return name.str();
+}
+
+// collects the locals an init function declares, in order
+class InitLocalsVisitor : public FEPrintVisitor
+{
+public:
+    ParameterList locals;
+    set<string> seen;
+
+    void print(std::string s) {}
+
+    // not the children's locals
+    void *visitStmtAdd(StmtAdd *stmt) { return NULL; }
+
+    void *visitStmtVarDecl(StmtVarDecl *stmt) {
+	for (int i=0; i<stmt->getNumVars(); i++)
+	    if (seen.insert(stmt->getName(i)).second)
+		locals.push_back(new Parameter(stmt->getType(i), stmt->getName(i)));
+	return FEPrintVisitor::visitStmtVarDecl(stmt);
+    }
+};
+
+// the copy of an anonymous stream that takes its parent's parameters,
+// fields and init locals as parameters of the same name
+// (i.e. extend part of the parent's scope into child)
+StreamSpec *
+FEIRToSKIR::anonSpec(SCAnon *sca, StreamSpec *parent)
+{
+    StreamSpec *&ss = anonSpecs[sca->getSpec()];
+    if (ss)
+	return ss;
+
+    ParameterList *pl = new ParameterList;
+    set<string> seen;
+    ParameterList *ppl = parent->getParams();
+    for (ParameterList::iterator I = ppl->begin(); I != ppl->end(); ++I)
+	if (seen.insert((*I)->getName()).second)
+	    pl->push_back(*I);
+
+    FieldDeclList *fdl = parent->getFields();
+    for (FieldDeclList::iterator I = fdl->begin(); I != fdl->end(); ++I) {
+	FieldDecl *fd = *I;
+	if (localFields.count(fd))
+	    continue;
+	for (int i=0; i<fd->getNumFields(); i++)
+	    if (seen.insert(fd->getName(i)).second)
+		pl->push_back( new Parameter(fd->getType(i), fd->getName(i)) );
+    }
+
+    if (Function *init = parent->getInitFunc()) {
+	InitLocalsVisitor lv;
+	init->getBody()->accept(&lv);
+	for (ParameterList::iterator I = lv.locals.begin(); I != lv.locals.end(); ++I)
+	    if (seen.insert((*I)->getName()).second)
+		pl->push_back(*I);
+    }
+
+    StreamSpec *orig = sca->getSpec();
+    ss = new StreamSpec(orig->getContext(), orig->getType(), orig->getStreamType(),
+			orig->getName(), pl, orig->getFields(), orig->getFuncs());
+    ss->setParent(parent);
+
+    string name = "streamit::"+ss->getName();
+    for (ParameterList::iterator I = pl->begin(); I != pl->end(); ++I)
+	syms.addEntry(name+"::"+(*I)->getName(),
+		      new ExprVar(sca->getContext(), (*I)->getName()), NULL, true);
+    syms.addEntry(name, (FENode*)ss, NULL, true);
+    return ss;
+}
+
 void *FEIRToSKIR::visitStmtAdd(StmtAdd *stmt)
 {
     debug("in visitStmtAdd");
@@ -1124,46 +1582,22 @@ void *FEIRToSKIR::visitStmtAdd(StmtAdd *stmt)
 	StreamSpec *savedStreamSpec = currentStreamSpec;
 	string savedScope = syms.getScope();
 
-	syms.setScope("streamit");
-	
-	StreamSpec *ss = sca->getSpec();
-	ExpressionList *args = new ExpressionList;
-	
-	{
-	    // copy parent parameters to anonymous child
-	    // (i.e. extend part of the parent's scope into child)
-	    // also pass parent fielddecls to child as read-only in this way
-	    ParameterList *pl = new ParameterList;
-	    pl->insert(pl->end(),
-		       currentStreamSpec->getParams()->begin(),
-		       currentStreamSpec->getParams()->end());
-	   
-	    FieldDeclList *fdl = currentStreamSpec->getFields();
-	    FieldDeclList::iterator diter;
-	    for (diter = fdl->begin(); diter != fdl->end(); diter++) {
-		FieldDecl *fd = *diter;
-		for (int i=0; i<fd->getNumFields(); i++) {
-		    pl->push_back( new Parameter(fd->getType(i), fd->getName(i)) );
-		}
-	    }
-
-	    ss = new StreamSpec(ss->getContext(), ss->getType(), ss->getStreamType(),
-				ss->getName(), pl, ss->getFields(), ss->getFuncs());
-
-	    ParameterList::iterator iter;
-	    for (iter=pl->begin(); iter!=pl->end(); iter++) {
-		Parameter *p = *iter;
-		ExprVar *ev = new ExprVar(sca->getContext(), p->getName());
-		args->push_back( ev );
-		syms.addEntry(ss->getName()+"::"+p->getName(), ev, NULL);
-	    }
+	StreamSpec *ss = anonSpec(sca, currentStreamSpec);
 
+	// pass the parent's values, zero for locals not declared yet
+	ExpressionList *args = new ExpressionList;
+	ParameterList *pl = ss->getParams();
+	for (ParameterList::iterator iter=pl->begin(); iter!=pl->end(); iter++) {
+	    Parameter *p = *iter;
+	    if (syms.getValue(p->getName()))
+		args->push_back( new ExprVar(sca->getContext(), p->getName()) );
+	    else
+		args->push_back( new ExprConstInt(0) );
 	}
 	sc = new SCSimple(sca->getContext(), ss->getName(), NULL, args, NULL);
-	syms.addEntry(ss->getName(), (FENode*)ss, NULL);
 
 	// jump to the needed streamspec
-	ss->setParent(currentStreamSpec);
+	syms.setScope("streamit");
 	ss->accept(this);
 	
 	// restore state
@@ -1290,6 +1724,9 @@ void *FEIRToSKIR::visitStmtAssign(StmtAssign *stmt)
 	return stmt->accept(this);
 
     } else {
+	if (inWork)
+	    recordStateWrite(stmt->getLHS());
+
 	inLHS = true;
 	Value *lhs = (Value*)(stmt->getLHS()->accept(this));
 	inLHS = false;
@@ -1555,8 +1992,18 @@ void *FEIRToSKIR::visitStmtVarDecl(StmtVarDecl *stmt)
 	Expression *init = stmt->getInit(i);
 
 	// for struct streams
-	currentStreamSpec->getFields()->push_back(new FieldDecl(stmt->getContext(),
-								stype, name, init));
+	FieldDecl *local = new FieldDecl(stmt->getContext(), stype, name, init);
+	currentStreamSpec->getFields()->push_back(local);
+	localFields.insert(local);
+
+	// locals with constant initializers that nothing assigns are
+	// constants, the rest hide any outer constant of the same name
+	ConstVal cv;
+	if (init && !init->isArrayInit() && !assigned.count(name) &&
+	    consts.eval(init, cv) && ConstEvalVisitor::convert(stype, cv))
+	    consts.define(name, cv);
+	else
+	    consts.forget(name);
 
 	Value *ptr = new AllocaInst(ltype, name.c_str(), getAllocaPoint(currentBB->getParent()));
 
@@ -1637,6 +2084,11 @@ void *FEIRToSKIR::visitStreamSpec(StreamSpec *spec) {
     currentStreamSpec = spec;
     syms.pushScope(spec->getName());
 
+    // children are visited from inside their parent's init
+    ConstEvalVisitor savedConsts = consts;
+    set<string> savedAssigned = assigned;
+    bindConsts(spec);
+
     Function *init = spec->getInitFunc();
     switch (spec->getType()) {
     case StreamSpec::STREAM_PIPELINE:
@@ -1657,6 +2109,9 @@ void *FEIRToSKIR::visitStreamSpec(StreamSpec *spec) {
 	if (f != init) f->accept(this);
     }
 
+    consts = savedConsts;
+    assigned = savedAssigned;
+
     syms.popScope();
     currentStatePtr = NULL;
     currentStreamSpec = NULL;
@@ -1960,22 +2415,6 @@ void FEIRToSKIR::addBuiltins(void)
 					NULL, "_splitrrN", pl, NULL, NULL);
 	syms.addEntry("streamit::_splitrrN", ss, NULL, true);
     }
-    // weighted rr split (2-3 parameter)
-    {
-	Constant *c;
-	c = getOrInsertFunction("__streamit__splitrrW_init", GetInitFunctionType(CTX));
-	syms.addEntry("streamit::_splitrrW::init", NULL, c, true);
-	c = getOrInsertFunction("__streamit__splitrrW_work", GetWorkFunctionType(CTX));
-	syms.addEntry("streamit::_splitrrW::work", NULL, c, true);
-	ParameterList *pl = new ParameterList;
-	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "num") );
-	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "arg0") );
-	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "arg1") );
-	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "arg2") );
-	StreamSpec *ss = new StreamSpec(NULL, StreamSpec::STREAM_FILTER,
-					NULL, "_splitrrN", pl, NULL, NULL);
-	syms.addEntry("streamit::_splitrrW", ss, NULL, true);
-    }
 
     // weighted rr split (1 parameter)
     {
@@ -2020,22 +2459,6 @@ void FEIRToSKIR::addBuiltins(void)
 					NULL, "_joinrrN", pl, NULL, NULL);
 	syms.addEntry("streamit::_joinrrN", ss, NULL, true);
     }
-    // weighted rr join (2-3 parameter)
-    {
-	Constant *c;
-	c = getOrInsertFunction("__streamit__joinrrW_init", GetInitFunctionType(CTX));
-	syms.addEntry("streamit::_joinrrW::init", NULL, c, true);
-	c = getOrInsertFunction("__streamit__joinrrW_work", GetWorkFunctionType(CTX));
-	syms.addEntry("streamit::_joinrrW::work", NULL, c, true);
-	ParameterList *pl = new ParameterList;
-	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "num") );
-	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "arg0") );
-	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "arg1") );
-	pl->push_back( new Parameter(new TypePrimitive(TypePrimitive::TYPE_INT), "arg2") );
-	StreamSpec *ss = new StreamSpec(NULL, StreamSpec::STREAM_FILTER,
-					NULL, "_joinrrW", pl, NULL, NULL);
-	syms.addEntry("streamit::_joinrrW", ss, NULL, true);
-    }
 
     // Identity
     {
@@ -28,8 +28,14 @@
 #include "SymbolTable.hpp"
 #include "SymbolTableVisitor.hpp"
 #include "TypeConvert.hpp"
+#include "StreamGraphVisitor.hpp"
 #include <llvm/LLVMContext.h>
 #include <llvm/Module.h>
+#include <SKIR/SKIRBuilder.h>
+
+#include <map>
+#include <set>
+#include <string>
 
 namespace streamit {
 
@@ -43,7 +49,10 @@ public:
 	currentBB = 0;
 	currentStreamSpec = 0;
 	currentStatePtr = 0;
+	inWork = false;
 	verbose = false;
+	flatten = true;
+	tConvert.setConsts(&consts);
 	addBuiltins();
     }
 
@@ -107,6 +116,14 @@ public:
     
     void setVerbose(bool b) { syms.verbose = verbose = b; }
 
+    // emit main() as a flat graph when the hierarchy is constant
+    void setFlatten(bool b) { flatten = b; }
+
+    // the builtin stream implementing a splitter or joiner
+    StreamCreator *createSplitJoin(SplitterJoiner *sj, bool isSplit);
+    // an anonymous child with its parent's scope as parameters
+    StreamSpec *anonSpec(SCAnon *sca, StreamSpec *parent);
+
 private:
 
     void debug(std::string s) { 
@@ -134,9 +151,21 @@ private:
     void doArrayInit(llvm::Value *v, ExprArrayInit *init);
 
     void createPipeline(Function *init, string worker);
+    bool checkFlatGraph(StreamGraphVisitor &graph);
+    void createFlatGraph(StreamGraphVisitor &graph, llvm::SKIRBuilder &builder);
+    void emitSpec(StreamSpec *ss);
+
+    // per instance copies of filters with constant parameters
+    StreamSpec *specialize(GraphNode &n);
+    void bindConsts(StreamSpec *spec);
+
+    // SKIR_WORK_INFO for a filter's work function
+    void recordStateWrite(Expression *lhs);
+    void addWorkInfo(FuncWork *work, llvm::Function *f);
 
      // add built-in functions to symbol table
     void addBuiltins(void);
+    std::string addWeightedRR(const std::string &base, size_t n);
 
     llvm::Constant *getOrInsertFunction(llvm::StringRef name, const llvm::FunctionType *ty);
 
@@ -158,12 +187,34 @@ private:
     // are we in the left hand side of an assignment?
     bool inLHS;
 
+    // while generating a work function: the state it writes, and
+    // whether that's all of it (no helper calls)
+    bool inWork;
+    bool workStateKnown;
+    std::set<std::string> workWrites;
+
+    // names with a known constant value in the code being generated:
+    // the parameters of a specialized filter, fields and locals with
+    // constant initializers that are never assigned
+    ConstEvalVisitor consts;
+    // parameter values for the next specialized filter visited
+    ConstEnv specParams;
+    // names assigned anywhere in the current stream
+    std::set<std::string> assigned;
+    // locals visitStmtVarDecl added to a stream's fields
+    std::set<FieldDecl *> localFields;
+    // specialized filters by original name and arguments
+    std::map<std::string, StreamSpec *> specialized;
+    // anonymous streams and their copies with parameters
+    std::map<StreamSpec *, StreamSpec *> anonSpecs;
+
     // streamit types -> llvm types
     TypeConvert tConvert;
 
     StreamSpec *topLevelStream;
     
     bool verbose;
+    bool flatten;
 
     bool splitjoin;
 };
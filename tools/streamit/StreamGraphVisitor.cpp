@@ -0,0 +1,357 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#include "StreamGraphVisitor.hpp"
+#include "FEIRToSKIR.hpp"
+
+using namespace streamit;
+using namespace std;
+
+// bound on loop trips while elaborating, so a bad init can't hang us
+#define MAX_TRIPS (1<<20)
+
+#define OK ((void *)1)
+
+bool
+StreamGraphVisitor::elaborate(StreamSpec *top)
+{
+    nodes.clear();
+    numStreams = 0;
+
+    GraphNode n;
+    n.name = top->getName();
+    n.spec = top;
+    return expand(n, -1, -1);
+}
+
+// add the leaves of n to the graph, reading stream in and writing out
+// (-1 for none)
+bool
+StreamGraphVisitor::expand(GraphNode &n, int in, int out)
+{
+    switch (n.spec->getType()) {
+    case StreamSpec::STREAM_FILTER:
+	if (in >= 0) n.ins.push_back(in);
+	if (out >= 0) n.outs.push_back(out);
+	nodes.push_back(n);
+	return true;
+    case StreamSpec::STREAM_PIPELINE:
+    case StreamSpec::STREAM_SPLITJOIN:
+	return expandComposite(n, in, out);
+    }
+    return false;
+}
+
+bool
+StreamGraphVisitor::expandComposite(GraphNode &n, int in, int out)
+{
+    StreamSpec *ss = n.spec;
+    bool isSJ = (ss->getType() == StreamSpec::STREAM_SPLITJOIN);
+
+    // run init in a fresh environment holding the parameters and fields
+    vector<ConstEnv> savedScopes;
+    savedScopes.swap(scopes);
+    vector<GraphNode> *savedChildren = children;
+    GraphNode *savedSplitter = splitter, *savedJoiner = joiner;
+    StreamSpec *savedParent = parent;
+
+    vector<GraphNode> kids;
+    GraphNode sp, jn;
+    children = &kids;
+    splitter = isSJ ? &sp : 0;
+    joiner = isSJ ? &jn : 0;
+    parent = ss;
+    pushScope();
+
+    ParameterList *pl = ss->getParams();
+    for (size_t i=0; i<pl->size(); i++)
+	define((*pl)[i]->getName(), n.args[i]);
+
+    bool ok = true;
+    FieldDeclList *fdl = ss->getFields();
+    for (FieldDeclList::iterator I = fdl->begin(); ok && fdl && I != fdl->end(); ++I) {
+	FieldDecl *fd = *I;
+	for (int i=0; ok && i<fd->getNumFields(); i++) {
+	    ConstVal v;
+	    int kind;
+	    if (fd->getInit(i))
+		ok = eval(fd->getInit(i), v) && convert(fd->getType(i), v);
+	    else if (kindOf(fd->getType(i), kind))
+		v = ConstVal(kind, 0, 0);
+	    else {
+		forget(fd->getName(i));
+		continue;
+	    }
+	    define(fd->getName(i), v);
+	}
+    }
+
+    Function *init = ss->getInitFunc();
+    if (ok && init)
+	ok = init->getBody()->accept(this) != NULL;
+
+    scopes.swap(savedScopes);
+    children = savedChildren;
+    splitter = savedSplitter;
+    joiner = savedJoiner;
+    parent = savedParent;
+
+    if (!ok || kids.empty())
+	return false;
+
+    if (!isSJ) {
+	// chain the children, each writing the stream the next one reads
+	int prev = in;
+	for (size_t i=0; i<kids.size(); i++) {
+	    int next = (i+1 == kids.size()) ? out : numStreams++;
+	    if (!expand(kids[i], prev, next))
+		return false;
+	    prev = next;
+	}
+	return true;
+    }
+
+    if (sp.name.empty() || jn.name.empty())
+	return false;
+
+    // the builtin splitters and joiners read the child count, which
+    // includes themselves, through a pointer
+    int nchildren = kids.size() + 2;
+    for (size_t i=0; i<sp.args.size(); i++)
+	if (sp.args[i].kind == ConstVal::CONST_NCHILDREN) sp.args[i].i = nchildren;
+    for (size_t i=0; i<jn.args.size(); i++)
+	if (jn.args[i].kind == ConstVal::CONST_NCHILDREN) jn.args[i].i = nchildren;
+
+    if (in >= 0) sp.ins.push_back(in);
+    vector<int> joinIns;
+    for (size_t i=0; i<kids.size(); i++) {
+	sp.outs.push_back(numStreams++);
+	joinIns.push_back(numStreams++);
+    }
+    nodes.push_back(sp);
+
+    for (size_t i=0; i<kids.size(); i++)
+	if (!expand(kids[i], sp.outs[i], joinIns[i]))
+	    return false;
+
+    jn.ins = joinIns;
+    if (out >= 0) jn.outs.push_back(out);
+    nodes.push_back(jn);
+    return true;
+}
+
+// fill in the name, spec and constant arguments of the child sc creates
+bool
+StreamGraphVisitor::makeChild(StreamCreator *sc, GraphNode &n)
+{
+    if (sc->isAnon()) {
+	// anonymous streams take their parent's parameters, fields and
+	// init locals as parameters of the same name
+	n.spec = fe->anonSpec((SCAnon *)sc, parent);
+	n.name = n.spec->getName();
+	ParameterList *pl = n.spec->getParams();
+	for (ParameterList::iterator I = pl->begin(); I != pl->end(); ++I) {
+	    ConstVal v;
+	    int kind;
+	    if (lookup((*I)->getName(), v)) {
+		if (!convert((*I)->getType(), v))
+		    return false;
+	    }
+	    else if (kindOf((*I)->getType(), kind))
+		v = ConstVal(kind, 0, 0);  // not declared yet
+	    else
+		return false;
+	    n.args.push_back(v);
+	}
+	return true;
+    }
+
+    SCSimple *scs = (SCSimple *)sc;
+    n.name = scs->getName();
+    n.spec = (StreamSpec *)syms->getNode("streamit::"+n.name, true);
+    if (!n.spec)
+	return false;
+    ParameterList *pl = n.spec->getParams();
+    ExpressionList *al = scs->getParams();
+    if (pl->size() != al->size())
+	return false;
+    for (size_t i=0; i<pl->size(); i++) {
+	ConstVal v;
+	if (!eval((*al)[i], v))
+	    return false;
+	if (v.kind != ConstVal::CONST_NCHILDREN && !convert((*pl)[i]->getType(), v))
+	    return false;
+	n.args.push_back(v);
+    }
+    return true;
+}
+
+bool
+StreamGraphVisitor::loop(Expression *cond, Statement *body, Statement *incr)
+{
+    for (int trips = 0; trips < MAX_TRIPS; trips++) {
+	ConstVal c;
+	if (cond && !eval(cond, c))
+	    return false;
+	if (cond && !c.asInt())
+	    return true;
+	if (body && !body->accept(this))
+	    return false;
+	if (incr && !incr->accept(this))
+	    return false;
+    }
+    return false;
+}
+
+void *
+StreamGraphVisitor::visitExprVar(ExprVar *exp)
+{
+    if (exp->getName() == "__num_children_ptr") {
+	val = ConstVal(ConstVal::CONST_NCHILDREN, 0, 0);
+	return OK;
+    }
+    return ConstEvalVisitor::visitExprVar(exp);
+}
+
+void *
+StreamGraphVisitor::visitStmtAdd(StmtAdd *stmt)
+{
+    GraphNode n;
+    if (!children || !makeChild(stmt->getCreator(), n))
+	return NULL;
+    children->push_back(n);
+    return OK;
+}
+
+void *
+StreamGraphVisitor::visitStmtAssign(StmtAssign *stmt)
+{
+    VarVisitor vv;
+    ExprVar *var = (ExprVar *)stmt->getLHS()->accept(&vv);
+    ConstVal v;
+    if (!var || !eval(stmt->getRHS(), v))
+	return NULL;
+    if (stmt->getOp()) {
+	ConstVal cur;
+	if (!lookup(var->getName(), cur) || !binop(stmt->getOp(), cur, v))
+	    return NULL;
+	v = val;
+    }
+    return assign(var->getName(), v) ? OK : NULL;
+}
+
+void *
+StreamGraphVisitor::visitStmtBlock(StmtBlock *stmt)
+{
+    pushScope();
+    StatementList *sl = stmt->getStmts();
+    for (StatementList::iterator I = sl->begin(); I != sl->end(); ++I) {
+	if (!(*I)->accept(this)) {
+	    popScope();
+	    return NULL;
+	}
+    }
+    popScope();
+    return OK;
+}
+
+void *
+StreamGraphVisitor::visitStmtEmpty(StmtEmpty *stmt)
+{
+    return OK;
+}
+
+void *
+StreamGraphVisitor::visitStmtExpr(StmtExpr *stmt)
+{
+    ConstVal v;
+    return eval(stmt->getExpression(), v) ? OK : NULL;
+}
+
+void *
+StreamGraphVisitor::visitStmtFor(StmtFor *stmt)
+{
+    pushScope();
+    bool ok = (!stmt->getInit() || stmt->getInit()->accept(this)) &&
+	loop(stmt->getCond(), stmt->getBody(), stmt->getIncr());
+    popScope();
+    return ok ? OK : NULL;
+}
+
+void *
+StreamGraphVisitor::visitStmtIfThen(StmtIfThen *stmt)
+{
+    ConstVal c;
+    if (!eval(stmt->getCond(), c))
+	return NULL;
+    Statement *s = c.asInt() ? stmt->getCons() : stmt->getAlt();
+    return s ? s->accept(this) : OK;
+}
+
+void *
+StreamGraphVisitor::visitStmtJoin(StmtJoin *stmt)
+{
+    if (!joiner || !joiner->name.empty())
+	return NULL;
+    StreamCreator *sc = fe->createSplitJoin(stmt->getJoiner(), false);
+    bool ok = sc && makeChild(sc, *joiner);
+    delete sc;
+    return ok ? OK : NULL;
+}
+
+void *
+StreamGraphVisitor::visitStmtSplit(StmtSplit *stmt)
+{
+    if (!splitter || !splitter->name.empty())
+	return NULL;
+    StreamCreator *sc = fe->createSplitJoin(stmt->getSplitter(), true);
+    bool ok = sc && makeChild(sc, *splitter);
+    delete sc;
+    return ok ? OK : NULL;
+}
+
+void *
+StreamGraphVisitor::visitStmtVarDecl(StmtVarDecl *stmt)
+{
+    for (int i=0; i<stmt->getNumVars(); i++) {
+	ConstVal v;
+	int kind;
+	if (stmt->getInit(i)) {
+	    if (!eval(stmt->getInit(i), v) || !convert(stmt->getType(i), v))
+		return NULL;
+	}
+	else if (kindOf(stmt->getType(i), kind))
+	    v = ConstVal(kind, 0, 0);
+	else {
+	    forget(stmt->getName(i));
+	    continue;
+	}
+	define(stmt->getName(i), v);
+    }
+    return OK;
+}
+
+void *
+StreamGraphVisitor::visitStmtWhile(StmtWhile *stmt)
+{
+    return loop(stmt->getCond(), stmt->getBody(), NULL) ? OK : NULL;
+}
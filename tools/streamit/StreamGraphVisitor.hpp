@@ -0,0 +1,102 @@
+//===----------------------------------------------------------------------===//
+// Copyright (c) 2011 Regents of the University of Colorado 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to 
+// deal in the Software without restriction, including without limitation the 
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions: 
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software. 
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR 
+// OTHER DEALINGS IN THE SOFTWARE. 
+//===----------------------------------------------------------------------===//
+
+#ifndef _STREAMGRAPHVISITOR_HPP_
+#define _STREAMGRAPHVISITOR_HPP_
+
+#include "ConstEvalVisitor.hpp"
+#include "SymbolTable.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+  elaborates the stream hierarchy at compile time: runs the init
+  functions of pipelines and splitjoins over constant parameters and
+  records the filters, splitters and joiners they add as a flat graph.
+*/
+
+namespace streamit {
+
+class FEIRToSKIR;
+
+// one leaf of the flat stream graph
+struct GraphNode
+{
+    // name of the leaf stream, i.e. streamit::<name>::init/work
+    std::string name;
+    StreamSpec *spec;
+    // actual parameters, one per parameter of spec
+    std::vector<ConstVal> args;
+    // stream numbers
+    std::vector<int> ins;
+    std::vector<int> outs;
+};
+
+class StreamGraphVisitor : public ConstEvalVisitor
+{
+public:
+    StreamGraphVisitor(FEIRToSKIR *fe, SymbolTable *syms) : fe(fe), syms(syms) {
+	numStreams = 0;
+	children = 0;
+	splitter = joiner = 0;
+	parent = 0;
+    }
+
+    // elaborate top; false if some part of the hierarchy can't be
+    // evaluated at compile time
+    bool elaborate(StreamSpec *top);
+
+    // leaves in the order the hierarchy would have called them
+    std::vector<GraphNode> nodes;
+    int numStreams;
+
+    void *visitExprVar(ExprVar *exp);
+    void *visitStmtAdd(StmtAdd *stmt);
+    void *visitStmtAssign(StmtAssign *stmt);
+    void *visitStmtBlock(StmtBlock *stmt);
+    void *visitStmtEmpty(StmtEmpty *stmt);
+    void *visitStmtExpr(StmtExpr *stmt);
+    void *visitStmtFor(StmtFor *stmt);
+    void *visitStmtIfThen(StmtIfThen *stmt);
+    void *visitStmtJoin(StmtJoin *stmt);
+    void *visitStmtSplit(StmtSplit *stmt);
+    void *visitStmtVarDecl(StmtVarDecl *stmt);
+    void *visitStmtWhile(StmtWhile *stmt);
+
+private:
+    FEIRToSKIR *fe;
+    SymbolTable *syms;
+
+    // the children added by the composite being elaborated
+    std::vector<GraphNode> *children;
+    GraphNode *splitter, *joiner;
+    StreamSpec *parent;
+
+    bool expand(GraphNode &n, int in, int out);
+    bool expandComposite(GraphNode &n, int in, int out);
+    bool makeChild(StreamCreator *sc, GraphNode &n);
+    bool loop(Expression *cond, Statement *body, Statement *incr);
+};
+
+}
+#endif
@@ -40,9 +40,13 @@ class TypeConvert : public TypeVisitor
 {
 private:
     llvm::LLVMContext &CTX;
+    // constants array lengths may refer to
+    const ConstEvalVisitor *consts;
     
 public:
-    TypeConvert(llvm::LLVMContext &C) : CTX(C) {}
+    TypeConvert(llvm::LLVMContext &C) : CTX(C), consts(0) {}
+
+    void setConsts(const ConstEvalVisitor *c) { consts = c; }
     
     lType *convert(sType *t) {
 	return (lType*)t->accept(this);
@@ -56,9 +60,9 @@ public:
     void *visitType(Type *t) { return NULL; }
 
     void *visitTypeArray(TypeArray *t) {
-	ExprEvalVisitor ev;
+	ExprEvalVisitor ev(consts);
 	lType *baseType = (lType*)t->getBase()->accept(this);
-	size_t length = (size_t)t->getLength()->accept(&ev);
+	size_t length = ev.evaluate(t->getLength());
 	return llvm::ArrayType::get(baseType, length);
     }
 
@@ -69,6 +69,7 @@ main(int argc, char *argv[])
 {
     string ofilename("-"), ifilename("-");
     bool verbose = false;
+    bool flatten = true;
 
     for (int i=1; i<argc; i++) {
 	if (!strncmp("-i", argv[i], 2))
@@ -77,6 +78,9 @@ main(int argc, char *argv[])
 	    ofilename = argv[++i];
 	if (!strncmp("-v", argv[i], 2))
 	    verbose = true;
+	// keep pipelines and splitjoins as hierarchical kernels
+	if (!strncmp("-hier", argv[i], 5))
+	    flatten = false;
     }
     
     LLVMContext &CTX = getGlobalContext();
@@ -126,6 +130,7 @@ main(int argc, char *argv[])
 
     FEIRToSKIR v(mod);
     v.setVerbose(verbose);
+    v.setFlatten(flatten);
 
     Program *p;
     if (ifilename == "-") {
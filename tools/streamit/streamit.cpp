@@ -151,65 +151,69 @@ typedef struct {
 
 typedef struct {
     int num;
-    int weights[3];
+    int weights[0];
 } sjw_state_t;
 
-} // extern "C"
-
 //
-// split duplicate
+// splitters and joiners
+//
+// the runtime generates their work functions from a skir_splitjoin_t
+// (see SKIR/SKIRStream.h).  __SKIR_splitjoin_work is the per element
+// version it runs when it doesn't.
 //
 
-struct split_dup_t {
-split_dup_t(int n) : nout(n) {}
-    int nout;
-};
-
-template< int NOUT > 
-static int split_dup_work_N_ (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+int
+__SKIR_splitjoin_work(void *s, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
 {
-    split_dup_t *s = (split_dup_t*)state;
-
+    skir_splitjoin_t *sj = (skir_splitjoin_t*)s;
     int e;
-    __SKIR_pop(0, &e);
-    for (int i=0; i<NOUT; i++)
-	__SKIR_push(i,&e);
+
+    switch (sj->kind) {
+    case SKIR_SPLIT_DUP:
+	__SKIR_pop(0, &e);
+	for (int i=0; i<sj->n; i++)
+	    __SKIR_push(i, &e);
+	break;
+    case SKIR_SPLIT_RR:
+	for (int i=0; i<sj->n; i++) {
+	    for (int j=0; j<sj->weights[i]; j++) {
+		__SKIR_pop(0, &e);
+		__SKIR_push(i, &e);
+	    }
+	}
+	break;
+    case SKIR_JOIN_RR:
+	for (int i=0; i<sj->n; i++) {
+	    for (int j=0; j<sj->weights[i]; j++) {
+		__SKIR_pop(i, &e);
+		__SKIR_push(0, &e);
+	    }
+	}
+	break;
+    }
     return 0;
 }
 
-template<>
-static int split_dup_work_N_< 0 > (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
+// start the splitter or joiner of kind with n outputs (inputs), each
+// with weights[i] or, without weights, with weight
+static void
+splitjoin_call(int kind, int n, const int *weights, int weight, 
+	       void *ins[], void *outs[])
 {
-    split_dup_t *s = (split_dup_t*)state;
-
-    int e;
-    __SKIR_pop(0, &e);
-    for (int i=0; i<s->nout; i++)
-	__SKIR_push(i,&e);
-    return 0;
+    skir_splitjoin_t *sj = 
+	(skir_splitjoin_t*)malloc(sizeof(skir_splitjoin_t) + n*sizeof(int));
+    sj->kind = kind;
+    sj->n = n;
+    sj->elem_size = sizeof(int);
+    for (int i=0; i<n; i++)
+	sj->weights[i] = weights ? weights[i] : weight;
+    void *k = __SKIR_kernel( (void *)__SKIR_splitjoin_work, sj );
+    __SKIR_call(k, ins, outs);
 }
 
-#define SPLIT_DUP(DNUM) \
-    static int (* split_dup_work_##DNUM )(void*,skir_stream_ptr_t*,skir_stream_ptr_t*) = \
-	 &split_dup_work_N_< DNUM >;
-
-SPLIT_DUP(16)
-SPLIT_DUP(8)
-SPLIT_DUP(6)
-SPLIT_DUP(4)
-SPLIT_DUP(2)
-SPLIT_DUP(0)
-
-#undef SPLIT_DUP
-
-#define SPLIT_DUP(DNUM) \
-    if ( (num-2) == DNUM ) {			\
-	void *k = __SKIR_kernel( (void *)( split_dup_work_##DNUM ), 0 ); \
-	__SKIR_call(k, (void **)ins, (void **)outs);			\
-	return 1;						\
-    }	
-
-extern "C" {
+//
+// split duplicate
+//
 
 /*static*/ void *
 __streamit__splitdupN_init(void *a)
@@ -225,33 +229,10 @@ __streamit__splitdupN_work (void *s, skir_stream_ptr_t ins[], skir_stream_ptr_t
     sj_state_t *state = (sj_state_t*)s;
     int num = *state->num_children_ptr;
 
-    SPLIT_DUP(16);
-    SPLIT_DUP(8);
-    SPLIT_DUP(6);
-    SPLIT_DUP(4);
-    SPLIT_DUP(2);
-
-    //fprintf(stderr, "WARNING: Unoptimized split dup (%d)\n", num-2);
-    void *k = __SKIR_kernel( (void *)(split_dup_work_0),
-                             new split_dup_t(num-2) );
-    __SKIR_call(k, (void **)ins, (void **)outs);
-
+    splitjoin_call(SKIR_SPLIT_DUP, num-2, 0, 0, (void **)ins, (void **)outs);
     return 1;
 }
 
-
-/*static*/ int
-split_dup_work (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    split_dup_t *s = (split_dup_t*)state;
-
-    int e;
-    __SKIR_pop(0, &e);
-    for (int i=0; i<s->nout; i++)
-	__SKIR_push(i,&e);
-    return 0;
-}
-
 /*static*/ void *
 __streamit__splitdup_init(void *a)
 {
@@ -273,110 +254,9 @@ __streamit__splitdup_work(void *s, skir_stream_t* ins[], skir_stream_t* outs[])
     return 0;
 }
 
-} // extern "C"
-
 //
 // split round-robin
 //
-struct split_rr_t {
-    split_rr_t(int n, int a) : nout(n), arg(a) {}
-    int nout;
-    int arg;
-};
-
-/*static*/ int split_rr_work (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    split_rr_t *s = (split_rr_t*)state;
-    for (int i=0; i<s->nout; i++) {
-	for (int j=0; j<s->arg; j++) {
-	    int e;
-	    __SKIR_pop(0, &e);
-	    __SKIR_push(i, &e);
-	}
-    }
-    return 0;
-}
-
-
-template< int NOUT, int ARG >
-static int split_rr_work_N_A_ (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    for (int i=0; i<NOUT; i++) {
-	for (int j=0; j<ARG; j++) {
-	    int e;
-	    __SKIR_pop(0, &e);
-	    __SKIR_push(i, &e);
-	}
-    }
-    return 0;
-}
-
-template<>
-static int split_rr_work_N_A_< 0, 0 > (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    split_rr_t *s = (split_rr_t*)state;
-    for (int i=0; i<s->nout; i++) {
-	for (int j=0; j<s->arg; j++) {
-	    int e;
-	    __SKIR_pop(0, &e);
-	    __SKIR_push(i, &e);
-	}
-    }
-    return 0;
-}
-
-#define SPLIT_RR(DNUM,DARG) \
-    static int (* split_rr_work_##DNUM##_##DARG )(void*,skir_stream_ptr_t*,skir_stream_ptr_t*) = \
-	 &split_rr_work_N_A_< DNUM, DARG >;
-
-template< int ARGA, int ARGB, int ARGC >
-static int split_rr_work_A_B_C_ (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    for (int j=0; j<ARGA; j++) {
-	int e;
-	__SKIR_pop(0, &e);
-	__SKIR_push(0, &e);
-    }
-    for (int j=0; j<ARGB; j++) {
-	int e;
-	__SKIR_pop(0, &e);
-	__SKIR_push(1, &e);
-    }
-    for (int j=0; j<ARGC; j++) {
-	int e;
-	__SKIR_pop(0, &e);
-	__SKIR_push(2, &e);
-    }
-    return 0;
-}
-
-template<>
-static int split_rr_work_A_B_C_< 0, 0, 0 > (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    return 0;
-}
-
-SPLIT_RR(16,16)
-SPLIT_RR(16,1)
-SPLIT_RR(48,1)
-SPLIT_RR(64,1)
-SPLIT_RR(4,2)
-SPLIT_RR(2,4)
-SPLIT_RR(1,8)
-SPLIT_RR(2,1)
-SPLIT_RR(4,1)
-SPLIT_RR(8,1)
-SPLIT_RR(8,8)
-
-#undef SPLIT_RR
-extern "C" {
-
-#define SPLIT_RR(DNUM,DARG) \
-    if ( ((num-2) == DNUM ) && (arg == DARG ) ) {			\
-	void *k = __SKIR_kernel( (void *)( split_rr_work_##DNUM##_##DARG ), 0 ); \
-	__SKIR_call(k, (void **)ins, (void **)outs);			\
-	return 1;						\
-    }	
 
 void *
 __streamit__splitrrN_init(void *a)
@@ -391,50 +271,17 @@ __streamit__splitrrN_work(void *s, skir_stream_t* ins[], skir_stream_t* outs[])
 {
     sj_state_t *state = (sj_state_t*)s;
     int num = *state->num_children_ptr;
-    int arg = state->weight;
-
-    SPLIT_RR(16,16);
-    SPLIT_RR(16,1);
-    SPLIT_RR(48,1);
-    SPLIT_RR(64,1);
-    SPLIT_RR(4,2);
-    SPLIT_RR(2,4);
-    SPLIT_RR(1,8);
-    SPLIT_RR(2,1);
-    SPLIT_RR(4,1);
-    SPLIT_RR(8,1);
-    SPLIT_RR(8,8);
-
-    printf("ERROR UNSUPPORTED split round robin (%d, %d)\n", num-2, arg);
+
+    splitjoin_call(SKIR_SPLIT_RR, num-2, 0, state->weight, (void **)ins, (void **)outs);
     return 1;
 }
 
-#undef SPLIT_RR
-
-#define SPLIT_RR(ARGA, ARGB, ARGC)				\
-    static int (* split_rr_work_##ARGA##_##ARGB##_##ARGC )(void*,		\
-							   skir_stream_ptr_t*, \
-							   skir_stream_ptr_t*) = \
-	 &split_rr_work_A_B_C_< ARGA, ARGB, ARGC >;
-
-SPLIT_RR(1, 63, 0)
-SPLIT_RR(384, 16, 3)
-SPLIT_RR(32,32,0)
-
-#undef SPLIT_RR
-#define SPLIT_RR(A, B, C)					\
-    if ( (arg0 == A ) && (arg1 == B) && (arg2 == C) ) {			\
-	void *k = __SKIR_kernel( (void *)( split_rr_work_##A##_##B##_##C ), 0 ); \
-	__SKIR_call(k, (void **)ins, (void **)outs);			\
-	return 1;						\
-    }	
-
-
 void *
 __streamit__splitrrW_init(void *a)
 {
-    sj_state_t *state = (sj_state_t*)malloc(sizeof(sj_state_t));
-    memcpy(state, a, sizeof(sj_state_t));
+    int num = ((sjw_state_t*)a)->num;
+    sjw_state_t *state = (sjw_state_t*)malloc(sizeof(sjw_state_t) + num*sizeof(int));
+    memcpy(state, a, sizeof(sjw_state_t) + num*sizeof(int));
     return state;
 }
 
@@ -442,19 +289,8 @@ int
 __streamit__splitrrW_work(void *s, skir_stream_t* ins[], skir_stream_t* outs[])
 {
     sjw_state_t *state = (sjw_state_t*)s;
-    int num = state->num;
-    int arg0 = state->weights[0];
-    int arg1 = state->weights[1];
-    int arg2 = state->weights[2];
-
-    //if (num == 3) {
 
-	SPLIT_RR(1, 63, 0)
-        SPLIT_RR(384, 16, 3)
-	SPLIT_RR(32,32,0)
-	    //}
-
-    printf("ERROR UNSUPPORTED split round robin (%d, %d %d %d)\n", num, arg0, arg1, arg2);
+    splitjoin_call(SKIR_SPLIT_RR, state->num, state->weights, 0, (void **)ins, (void **)outs);
     return 1;
 }
 
@@ -493,119 +329,9 @@ __streamit__splitrr0_work(void *s, skir_stream_t* ins[], skir_stream_t* outs[])
     return 1;
 }
 
-} // extern "C"
-
 //
 // join round-robin
 //
-struct join_rr_t {
-    join_rr_t(int n, int a) : nin(n), arg(a) {}
-    int nin;
-    int arg;
-};
-/*static*/ int join_rr_work (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-     join_rr_t *s = (join_rr_t*)state;
-    
-     for (int i=0; i<s->nin; i++) {
-	 for (int j=0; j<s->arg; j++) {
-	     int e;
-	     __SKIR_pop(i, &e);
-	     __SKIR_push(0, &e);
-	 }
-     }
-    return 0;
-}
-
-template< int NIN, int ARG >
-static int join_rr_work_N_A_ (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    for (int i=0; i<NIN; i++) {
-	 for (int j=0; j<ARG; j++) {
-	     int e;
-	     __SKIR_pop(i, &e);
-	     __SKIR_push(0, &e);
-	 }
-     }
-    return 0;
-}
-
-template<>
-static int join_rr_work_N_A_< 0, 0> (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    join_rr_t *s = (join_rr_t*)state;
-    
-    for (int i=0; i<s->nin; i++) {
-	for (int j=0; j<s->arg; j++) {
-	    int e;
-	    __SKIR_pop(i, &e);
-	    __SKIR_push(0, &e);
-	}
-    }
-    return 0;
-}
-
-#define JOIN_RR(DNUM, DARG) \
-    static int (* join_rr_work_##DNUM##_##DARG )(void *,skir_stream_ptr_t*,skir_stream_ptr_t*) = \
-	&join_rr_work_N_A_<DNUM,DARG>;
-
-template< int ARGA, int ARGB, int ARGC >
-static int join_rr_work_A_B_C_ (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    for (int j=0; j<ARGA; j++) {
-	int e;
-	__SKIR_pop(0, &e);
-	__SKIR_push(0, &e);
-    }
-    for (int j=0; j<ARGB; j++) {
-	int e;
-	__SKIR_pop(1, &e);
-	__SKIR_push(0, &e);
-    }
-    for (int j=0; j<ARGC; j++) {
-	int e;
-	__SKIR_pop(2, &e);
-	__SKIR_push(0, &e);
-    }
-    return 0;
-}
-
-template<>
-static int join_rr_work_A_B_C_< 0, 0, 0 > (void *state, skir_stream_ptr_t ins[], skir_stream_ptr_t outs[])
-{
-    return 0;
-}
-
-JOIN_RR(16,1)
-JOIN_RR(16,16)
-JOIN_RR(32,32)
-JOIN_RR(6,1)
-JOIN_RR(8,1)
-JOIN_RR(12,2)
-JOIN_RR(4,1)
-JOIN_RR(2,1)
-JOIN_RR(1,8)
-JOIN_RR(2,4)
-JOIN_RR(4,2)
-JOIN_RR(48,1)
-JOIN_RR(64,1)
-JOIN_RR(10,8)
-JOIN_RR(6,8)
-JOIN_RR(8,8)
-JOIN_RR(6,3)
-JOIN_RR(2,32)
-JOIN_RR(0,0)
-
-#undef JOIN_RR
-
-extern "C" {
-
-#define JOIN_RR(DNUM,DARG) \
-    if ( ((num-2) == DNUM ) && (arg == DARG ) ) {			\
-	void *k = __SKIR_kernel( (void *)( join_rr_work_##DNUM##_##DARG ), 0 ); \
-	__SKIR_call(k, (void **)ins, (void **)outs);			\
-	return 1;						\
-    }	
 
 /*static*/ void *
 __streamit__joinrrN_init(void *a)
@@ -620,63 +346,17 @@ __streamit__joinrrN_work(void *s, skir_stream_t* ins[], skir_stream_t* outs[])
 {
     sj_state_t *state = (sj_state_t*)s;
     int num = *state->num_children_ptr;
-    int arg = state->weight;
-    
-    JOIN_RR(16,1)
-    JOIN_RR(16,16)
-    JOIN_RR(32,32)
-    JOIN_RR(6,1)
-    JOIN_RR(8,1)
-    JOIN_RR(12,2)
-    JOIN_RR(4,1)
-    JOIN_RR(2,1)
-    JOIN_RR(1,8)
-    JOIN_RR(2,4)
-    JOIN_RR(4,2)
-    JOIN_RR(48,1)
-    JOIN_RR(64,1)
-    JOIN_RR(10,8)
-    JOIN_RR(8,8)
-    JOIN_RR(6,8)
-    JOIN_RR(6,3)
-    JOIN_RR(2,32)
-
-    //fprintf(stderr, "WARNING: Unoptimized join round robin (%d, %d)\n", num-2, arg);
-
-    void *k = __SKIR_kernel( (void *)(join_rr_work_0_0),
-                             new join_rr_t(num-2, arg));
-    __SKIR_call(k, (void **)ins, (void **)outs);
 
+    splitjoin_call(SKIR_JOIN_RR, num-2, 0, state->weight, (void **)ins, (void **)outs);
     return 1;
 }
 
-#undef JOIN_RR
-
-#define JOIN_RR(ARGA, ARGB, ARGC)				\
-    static int (* join_rr_work_##ARGA##_##ARGB##_##ARGC )(void*,		\
-							  skir_stream_ptr_t*, \
-							  skir_stream_ptr_t*) = \
-	 &join_rr_work_A_B_C_< ARGA, ARGB, ARGC >;
-
-JOIN_RR(1,63,0)
-JOIN_RR(64,64,0)
-JOIN_RR(64,8,3)
-JOIN_RR(32,32,0)
-JOIN_RR(1,16,0)
-
-#undef JOIN_RR
-#define JOIN_RR(A, B, C)					\
-    if ( (arg0 == A ) && (arg1 == B) && (arg2 == C) ) {			\
-	void *k = __SKIR_kernel( (void *)( join_rr_work_##A##_##B##_##C ), 0 ); \
-	__SKIR_call(k, (void **)ins, (void **)outs);			\
-	return 1;						\
-    }
-
 /*static*/ void *
 __streamit__joinrrW_init(void *a)
 {
-    sj_state_t *state = (sj_state_t*)malloc(sizeof(sj_state_t));
-    memcpy(state, a, sizeof(sj_state_t));
+    int num = ((sjw_state_t*)a)->num;
+    sjw_state_t *state = (sjw_state_t*)malloc(sizeof(sjw_state_t) + num*sizeof(int));
+    memcpy(state, a, sizeof(sjw_state_t) + num*sizeof(int));
     return state;
 }
 
@@ -684,18 +364,8 @@ __streamit__joinrrW_init(void *a)
 __streamit__joinrrW_work(void *s, skir_stream_t* ins[], skir_stream_t* outs[])
 {
     sjw_state_t *state = (sjw_state_t*)s;
-    int num = state->num;
-    int arg0 = state->weights[0];
-    int arg1 = state->weights[1];
-    int arg2 = state->weights[2];
-
-    JOIN_RR(1,63,0);
-    JOIN_RR(64,64,0);
-    JOIN_RR(64,8,3);
-    JOIN_RR(32,32,0);
-    JOIN_RR(1,16,0)
-
-    printf("ERROR UNSUPPORTED join round robin (%d, %d %d %d)\n", num, arg0, arg1, arg2);
+
+    splitjoin_call(SKIR_JOIN_RR, state->num, state->weights, 0, (void **)ins, (void **)outs);
     return 1;
 }
 